@@ -0,0 +1,542 @@
+#ifndef BULKIMPORT_H_INCLUDED
+#define BULKIMPORT_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <queue>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <limits>
+#include <stdint.h>
+#include <math.h>
+#include "CityGraph.h"
+#include "Messages.h"
+#include "Metrics.h"
+using namespace std;
+
+// a line of an import which could not be used, described like the errors a CityMap reports
+struct ImportProblem {
+    string source; // "cities" or "roads"
+    size_t line;
+    string subjectType;
+    string subject;
+    string reason;
+};
+
+const size_t MAX_IMPORT_PROBLEMS = 1000;
+
+// outcome of a bulk import
+struct ImportReport {
+    ImportReport() : cities(0), roads(0), duplicateRoads(0), problemCount(0), overBudget(false) {}
+    size_t cities; // cities added
+    size_t roads; // roads added
+    size_t duplicateRoads; // roads given more than once, or already in the map
+    size_t problemCount; // lines which could not be used, including those not kept in problems
+    bool overBudget; // whether temporary files could not be written, so road keys were held in memory past the budget
+    vector<ImportProblem> problems; // the first MAX_IMPORT_PROBLEMS of them
+};
+
+// splits an input stream into lines, reading it a large chunk at a time;
+// a line is a range of the reader's buffer ending with a zero, valid until the next line is read, so it can be cut up in place
+class ChunkedLineReader
+{
+    public:
+        explicit ChunkedLineReader(istream &input) : input(input), first(0), last(0), lineNumber(0) {}
+        bool Next(char *&lineFirst, char *&lineLast); // the next line without its line break, or false at the end
+        size_t LineNumber() const { return lineNumber; }
+    private:
+        static const size_t CHUNK = 1 << 20;
+        istream &input;
+        vector<char> buffer;
+        size_t first; // start of the part of buffer not returned yet
+        size_t last; // end of the data in buffer
+        size_t lineNumber;
+};
+
+inline bool ChunkedLineReader::Next(char *&lineFirst, char *&lineLast)
+{
+    while (true) {
+        char *data = buffer.empty() ? 0 : &buffer[0];
+        char *lineBreak = first == last ? 0 : (char *)memchr(data + first, '\n', last - first);
+        // at the end of the input the rest of the buffer is the last line; the buffer always has a byte to spare after it
+        if (lineBreak || (!input && first < last)) {
+            lineFirst = data + first;
+            lineLast = lineBreak ? lineBreak : data + last;
+            first = lineBreak ? size_t(lineBreak - data) + 1 : last;
+            if (lineLast != lineFirst && lineLast[-1] == '\r') {
+                lineLast--;
+            }
+            *lineLast = '\0';
+            lineNumber++;
+            return true;
+        }
+        if (!input) {
+            return false;
+        }
+        // the unfinished line moves to the front, and a chunk is read after it
+        if (first > 0) {
+            memmove(data, data + first, last - first);
+            last -= first;
+            first = 0;
+        }
+        if (buffer.size() < last + CHUNK + 1) {
+            buffer.resize(last + CHUNK + 1);
+        }
+        input.read(&buffer[last], CHUNK);
+        last += size_t(input.gcount());
+    }
+}
+
+// takes a line ending with a zero and cuts it in place into fields separated by commas or tabs, trimming the spaces around them;
+// gets the number of fields, or maxFields + 1 if there are more
+inline size_t SplitFields(char *lineFirst, char *lineLast, char **fields, size_t maxFields)
+{
+    size_t count = 0;
+    char *fieldFirst = lineFirst;
+    while (true) {
+        char *fieldLast = fieldFirst;
+        while (fieldLast != lineLast && *fieldLast != ',' && *fieldLast != '\t') {
+            fieldLast++;
+        }
+        if (count == maxFields) {
+            return maxFields + 1;
+        }
+        bool lineEnds = fieldLast == lineLast;
+        char *trimmedFirst = fieldFirst;
+        char *trimmedLast = fieldLast;
+        while (trimmedFirst != trimmedLast && *trimmedFirst == ' ') {
+            trimmedFirst++;
+        }
+        while (trimmedLast != trimmedFirst && trimmedLast[-1] == ' ') {
+            trimmedLast--;
+        }
+        *trimmedLast = '\0';
+        fields[count++] = trimmedFirst;
+        if (lineEnds) {
+            return count;
+        }
+        fieldFirst = fieldLast + 1;
+    }
+}
+
+// takes a field ending with a zero and parses all of it as a number with the C library rather than a stream
+template <typename T>
+bool ParseNumber(const char *field, T &value)
+{
+    if (*field == '\0') {
+        return false;
+    }
+    char *end;
+    if (numeric_limits<T>::is_integer) {
+        value = T(strtoll(field, &end, 10));
+    }
+    else {
+        value = T(strtod(field, &end));
+    }
+    return *end == '\0';
+}
+
+// builds a snapshot from large lists of cities and roads in one go, without going through the maps of a CityMap;
+// cities are gathered into one block of names, sorted and given their ids once all are read,
+// then every road is packed into a 64-bit key of its two ids, smaller first, so sorting the keys puts duplicates next to each other
+// and orders the roads the way the snapshot stores them;
+// the keys are kept within the memory budget by sorting them into runs written to temporary files, merged when the snapshot is built;
+// if a run cannot be written its keys stay in memory, which the report tells, and are merged with the runs as one more;
+// the cities themselves and the finished snapshot are not counted in the budget;
+// roads are as long as Metric makes them, and are stored as Weight, so the snapshot is one a map with these policies publishes
+template <typename T, typename Metric = EuclideanMetric<T>, typename Weight = T>
+class BulkImporter
+{
+    public:
+        explicit BulkImporter(size_t memoryBudget);
+        ~BulkImporter();
+        void Seed(const CityGraph<T, Weight> &graph); // start from the cities and roads of a snapshot; before anything is read
+        void ReadCities(istream &input); // lines of a name, x and y
+        void ReadRoads(istream &input); // lines of two city names; after the cities are read
+        shared_ptr<const CityGraph<T, Weight> > Build();
+        const ImportReport &Report() const { return report; }
+    private:
+        void Problem(const string &source, size_t line, const string &subjectType, const string &subject, const string &reason);
+        void SortCities(); // give the cities their ids, dropping the names given twice
+        CityId FindCity(const char *name) const; // id of a city once the cities are sorted, or NO_CITY
+        int CompareName(size_t city, const char *name, size_t length) const;
+        void AddRoadKey(CityId first, CityId second);
+        bool SpillRun(); // sort the buffered keys and write them out as a run, if there is a temporary file to write them to
+        template <typename Visit>
+        void ForEachRoad(Visit visit); // calls visit(key) for each different road, in order
+        size_t keyBudget; // keys buffered before a run is written
+        size_t sortAt; // keys buffered when the buffer is next deduplicated, past the budget once runs cannot be written
+        vector<char> names; // names of the cities in the order they were read
+        vector<size_t> nameOffsets; // name of city i is [nameOffsets[i], nameOffsets[i+1]) in names
+        vector<T> xs;
+        vector<T> ys;
+        vector<size_t> lines; // line each city was read from, 0 for seeded cities
+        vector<CityId> order; // cities by name once sorted; position in order is the id
+        bool citiesSorted;
+        const CityGraph<T, Weight> *seed;
+        CityId seedCities;
+        size_t seedRoads;
+        size_t roadsRead; // road lines used, duplicates included
+        vector<uint64_t> keys;
+        vector<FILE *> runs;
+        ImportReport report;
+};
+
+template <typename T, typename Metric, typename Weight>
+BulkImporter<T, Metric, Weight>::BulkImporter(size_t memoryBudget)
+    : keyBudget(max(memoryBudget / sizeof(uint64_t), size_t(1024))), sortAt(keyBudget), citiesSorted(false), seed(0), seedCities(0), seedRoads(0), roadsRead(0)
+{
+    nameOffsets.push_back(0);
+}
+
+template <typename T, typename Metric, typename Weight>
+BulkImporter<T, Metric, Weight>::~BulkImporter()
+{
+    for(vector<FILE *>::iterator it = runs.begin(); it != runs.end(); it++) {
+        fclose(*it);
+    }
+}
+
+template <typename T, typename Metric, typename Weight>
+void BulkImporter<T, Metric, Weight>::Problem(const string &source, size_t line, const string &subjectType, const string &subject, const string &reason)
+{
+    report.problemCount++;
+    if (report.problems.size() < MAX_IMPORT_PROBLEMS) {
+        ImportProblem problem = { source, line, subjectType, subject, reason };
+        report.problems.push_back(problem);
+    }
+}
+
+// takes a snapshot and adds its cities, which come before any city read, so they win over cities read with the same name;
+// its roads are added once the cities are sorted
+template <typename T, typename Metric, typename Weight>
+void BulkImporter<T, Metric, Weight>::Seed(const CityGraph<T, Weight> &graph)
+{
+    seed = &graph;
+    seedCities = graph.Size();
+    for(CityId city = 0; city < graph.Size(); city++) {
+        string name = graph.Name(city);
+        names.insert(names.end(), name.begin(), name.end());
+        nameOffsets.push_back(names.size());
+        xs.push_back(graph.X(city));
+        ys.push_back(graph.Y(city));
+        lines.push_back(0);
+    }
+}
+
+// takes a stream of lines of a city name and its coordinates, separated by commas or tabs, and gathers the cities;
+// a first line whose coordinates are not numbers is taken as a header
+template <typename T, typename Metric, typename Weight>
+void BulkImporter<T, Metric, Weight>::ReadCities(istream &input)
+{
+    ChunkedLineReader reader(input);
+    char *lineFirst;
+    char *lineLast;
+    char *fields[3];
+    while (reader.Next(lineFirst, lineLast)) {
+        if (lineFirst == lineLast) {
+            continue;
+        }
+        size_t count = SplitFields(lineFirst, lineLast, fields, 3);
+        T x, y;
+        if (count != 3 || *fields[0] == '\0' || !ParseNumber(fields[1], x) || !ParseNumber(fields[2], y)) {
+            if (reader.LineNumber() != 1 || count != 3) {
+                Problem("cities", reader.LineNumber(), LINE, fields[0], IS_MALFORMED);
+            }
+            continue;
+        }
+        names.insert(names.end(), fields[0], fields[0] + strlen(fields[0]));
+        nameOffsets.push_back(names.size());
+        xs.push_back(x);
+        ys.push_back(y);
+        lines.push_back(reader.LineNumber());
+    }
+}
+
+template <typename T, typename Metric, typename Weight>
+int BulkImporter<T, Metric, Weight>::CompareName(size_t city, const char *name, size_t length) const
+{
+    size_t cityLength = nameOffsets[city + 1] - nameOffsets[city];
+    size_t common = min(cityLength, length);
+    int order = common == 0 ? 0 : memcmp(&names[nameOffsets[city]], name, common);
+    if (order != 0) {
+        return order;
+    }
+    return cityLength < length ? -1 : (cityLength > length ? 1 : 0);
+}
+
+// sorts the cities by name, keeping the first of the cities with the same name, and adds the roads of the seed
+template <typename T, typename Metric, typename Weight>
+void BulkImporter<T, Metric, Weight>::SortCities()
+{
+    order.resize(xs.size());
+    for(size_t city = 0; city < order.size(); city++) {
+        order[city] = CityId(city);
+    }
+    stable_sort(order.begin(), order.end(), [this](CityId a, CityId b) {
+        return CompareName(a, &names[0] + nameOffsets[b], nameOffsets[b + 1] - nameOffsets[b]) < 0;
+    });
+    size_t kept = 0;
+    for(size_t i = 0; i < order.size(); i++) {
+        CityId city = order[i];
+        if (kept > 0 && CompareName(order[kept - 1], &names[0] + nameOffsets[city], nameOffsets[city + 1] - nameOffsets[city]) == 0) {
+            Problem("cities", lines[city], CITY, string(&names[0] + nameOffsets[city], nameOffsets[city + 1] - nameOffsets[city]), ALREADY_EXISTS);
+            continue;
+        }
+        order[kept++] = city;
+    }
+    order.resize(kept);
+    citiesSorted = true;
+    report.cities = order.size() - seedCities;
+
+    if (seed) {
+        vector<CityId> ids(seed->Size());
+        for(CityId city = 0; city < seed->Size(); city++) {
+            ids[city] = FindCity(seed->Name(city).c_str());
+        }
+        for(CityId city = 0; city < seed->Size(); city++) {
+            for(RoadId road = seed->FirstRoad(city); road != seed->LastRoad(city); road++) {
+                if (city < seed->Target(road)) {
+                    AddRoadKey(ids[city], ids[seed->Target(road)]);
+                    seedRoads++;
+                }
+            }
+        }
+    }
+}
+
+template <typename T, typename Metric, typename Weight>
+CityId BulkImporter<T, Metric, Weight>::FindCity(const char *name) const
+{
+    size_t length = strlen(name);
+    size_t low = 0;
+    size_t high = order.size();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int compared = CompareName(order[middle], name, length);
+        if (compared < 0) {
+            low = middle + 1;
+        }
+        else if (compared > 0) {
+            high = middle;
+        }
+        else {
+            return CityId(middle);
+        }
+    }
+    return NO_CITY;
+}
+
+// takes a stream of lines of two city names, separated by a comma or a tab, and gathers the roads between them;
+// a first line naming two cities which do not exist is taken as a header
+template <typename T, typename Metric, typename Weight>
+void BulkImporter<T, Metric, Weight>::ReadRoads(istream &input)
+{
+    if (!citiesSorted) {
+        SortCities();
+    }
+    ChunkedLineReader reader(input);
+    char *lineFirst;
+    char *lineLast;
+    char *fields[2];
+    while (reader.Next(lineFirst, lineLast)) {
+        if (lineFirst == lineLast) {
+            continue;
+        }
+        if (SplitFields(lineFirst, lineLast, fields, 2) != 2) {
+            Problem("roads", reader.LineNumber(), LINE, fields[0], IS_MALFORMED);
+            continue;
+        }
+        CityId first = FindCity(fields[0]);
+        CityId second = FindCity(fields[1]);
+        if (first == NO_CITY || second == NO_CITY) {
+            if (reader.LineNumber() != 1 || first != second) {
+                Problem("roads", reader.LineNumber(), CITY, first == NO_CITY ? fields[0] : fields[1], DOESNT_EXIST);
+            }
+            continue;
+        }
+        if (first == second) {
+            Problem("roads", reader.LineNumber(), ROAD, string(fields[0]) + " - " + fields[1], MUST_BE_DIFFERENT);
+            continue;
+        }
+        AddRoadKey(first, second);
+        roadsRead++;
+    }
+}
+
+// takes a road and buffers its key; a full buffer is deduplicated, and written out as a run if that does not free half of it;
+// a buffer which cannot be written out is let grow to twice its size before it is deduplicated again, so it is not sorted on every key
+template <typename T, typename Metric, typename Weight>
+void BulkImporter<T, Metric, Weight>::AddRoadKey(CityId first, CityId second)
+{
+    if (second < first) {
+        swap(first, second);
+    }
+    keys.push_back(uint64_t(first) << 32 | second);
+    if (keys.size() >= sortAt) {
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+        if (keys.size() > keyBudget / 2 && !SpillRun()) {
+            sortAt = max(keyBudget, 2 * keys.size());
+        }
+    }
+}
+
+// writes the buffered keys, sorted and without duplicates, to a temporary file and gets whether it could;
+// if it could not, they stay in memory and the report says the budget was passed
+template <typename T, typename Metric, typename Weight>
+bool BulkImporter<T, Metric, Weight>::SpillRun()
+{
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    FILE *run = tmpfile();
+    // the file is buffered, so a failed write may only show when it is flushed
+    if (!run || (!keys.empty() && fwrite(&keys[0], sizeof(uint64_t), keys.size(), run) != keys.size()) || fflush(run) != 0) {
+        if (run) {
+            fclose(run);
+        }
+        report.overBudget = true;
+        return false;
+    }
+    runs.push_back(run);
+    keys.clear();
+    return true;
+}
+
+// calls visit(key) for every different road key in increasing order, from the buffer or by merging the runs and the buffer,
+// each run read through a buffer of an equal share of the budget
+// precondition: the buffer is sorted without duplicates
+template <typename T, typename Metric, typename Weight>
+template <typename Visit>
+void BulkImporter<T, Metric, Weight>::ForEachRoad(Visit visit)
+{
+    if (runs.empty()) {
+        for(vector<uint64_t>::iterator it = keys.begin(); it != keys.end(); it++) {
+            visit(*it);
+        }
+        return;
+    }
+    size_t share = max(keyBudget / runs.size(), size_t(1024));
+    // the buffer is merged as a run of its own, numbered after the runs in files, which is read in place
+    vector<vector<uint64_t> > buffers(runs.size());
+    vector<size_t> positions(runs.size() + 1, 0);
+    typedef pair<uint64_t, size_t> Head; // smallest unmerged key of a run, and the run
+    priority_queue<Head, vector<Head>, greater<Head> > heads;
+    auto refill = [&](size_t run) {
+        buffers[run].resize(share);
+        buffers[run].resize(fread(&buffers[run][0], sizeof(uint64_t), share, runs[run]));
+        positions[run] = 0;
+        return !buffers[run].empty();
+    };
+    for(size_t run = 0; run < runs.size(); run++) {
+        rewind(runs[run]);
+        if (refill(run)) {
+            heads.push(Head(buffers[run][0], run));
+        }
+    }
+    if (!keys.empty()) {
+        heads.push(Head(keys[0], runs.size()));
+    }
+    bool visited = false;
+    uint64_t previous = 0;
+    while (!heads.empty()) {
+        Head head = heads.top();
+        heads.pop();
+        if (!visited || head.first != previous) {
+            visit(head.first);
+            previous = head.first;
+            visited = true;
+        }
+        size_t run = head.second;
+        if (run == runs.size()) {
+            if (++positions[run] < keys.size()) {
+                heads.push(Head(keys[positions[run]], run));
+            }
+        }
+        else if (++positions[run] < buffers[run].size() || refill(run)) {
+            heads.push(Head(buffers[run][positions[run]], run));
+        }
+    }
+}
+
+// lays the cities out in name order and the roads out by city, in two passes over the road keys: one counting the roads of
+// each city and one placing them; a road is placed at both its cities, and since keys are ordered by their smaller id,
+// every city gets its neighbours in increasing order; the lengths of the roads of each city are then computed as one batch,
+// and the snapshot renumbers the cities along its Hilbert curve
+template <typename T, typename Metric, typename Weight>
+shared_ptr<const CityGraph<T, Weight> > BulkImporter<T, Metric, Weight>::Build()
+{
+    if (!citiesSorted) {
+        SortCities();
+    }
+    if (!runs.empty() && !keys.empty() && SpillRun()) {
+        vector<uint64_t>().swap(keys);
+    }
+    else {
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    }
+
+    CityId cityCount = CityId(order.size());
+    vector<char> nameChars;
+    vector<unsigned int> offsets;
+    vector<T> cityXs;
+    vector<T> cityYs;
+    nameChars.reserve(names.size());
+    offsets.reserve(cityCount + 1);
+    cityXs.reserve(cityCount);
+    cityYs.reserve(cityCount);
+    offsets.push_back(0);
+    for(CityId city = 0; city < cityCount; city++) {
+        size_t index = order[city];
+        nameChars.insert(nameChars.end(), names.begin() + nameOffsets[index], names.begin() + nameOffsets[index + 1]);
+        offsets.push_back((unsigned int)nameChars.size());
+        cityXs.push_back(xs[index]);
+        cityYs.push_back(ys[index]);
+    }
+    vector<char>().swap(names);
+    vector<size_t>().swap(nameOffsets);
+
+    vector<RoadId> firstRoad(size_t(cityCount) + 1, 0);
+    size_t distinct = 0;
+    ForEachRoad([&](uint64_t key) {
+        firstRoad[size_t(key >> 32) + 1]++;
+        firstRoad[size_t(key & 0xffffffffu) + 1]++;
+        distinct++;
+    });
+    for(CityId city = 0; city < cityCount; city++) {
+        firstRoad[city + 1] += firstRoad[city];
+    }
+    vector<CityId> targets(firstRoad[cityCount]);
+    vector<Weight> lengths(firstRoad[cityCount]);
+    vector<T> cityLengths; // lengths of the roads of one city, before they are stored as Weight
+    vector<RoadId> placed(firstRoad.begin(), firstRoad.end() - 1);
+    ForEachRoad([&](uint64_t key) {
+        CityId first = CityId(key >> 32);
+        CityId second = CityId(key & 0xffffffffu);
+        targets[placed[first]++] = second;
+        targets[placed[second]++] = first;
+    });
+    for(CityId city = 0; city < cityCount; city++) {
+        RoadId first = firstRoad[city];
+        size_t count = firstRoad[city + 1] - first;
+        if (count == 0) {
+            continue;
+        }
+        cityLengths.resize(count);
+        Metric::Lengths(&cityXs[0], &cityYs[0], &targets[first], count, cityXs[city], cityYs[city], &cityLengths[0]);
+        for(size_t i = 0; i < count; i++) {
+            lengths[first + i] = RoadWeight<T, Weight>::Store(cityLengths[i]);
+        }
+    }
+    report.roads = distinct - seedRoads;
+    report.duplicateRoads = roadsRead - report.roads;
+    return make_shared<const CityGraph<T, Weight> >(nameChars, offsets, cityXs, cityYs, firstRoad, targets, lengths);
+}
+
+#endif // BULKIMPORT_H_INCLUDED
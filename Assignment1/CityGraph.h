@@ -0,0 +1,843 @@
+#ifndef CITYGRAPH_H_INCLUDED
+#define CITYGRAPH_H_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <fstream>
+#include <stdint.h>
+#include <math.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+using namespace std;
+
+// dense integer identifier of a city inside a CityGraph snapshot
+typedef unsigned int CityId;
+// index of a directed road inside a CityGraph snapshot
+typedef unsigned int RoadId;
+
+const CityId NO_CITY = CityId(-1);
+
+// distance standing for "no path"
+template <typename T>
+T Unreachable()
+{
+    return numeric_limits<T>::has_infinity ? numeric_limits<T>::infinity() : numeric_limits<T>::max();
+}
+
+// a change made to the maps of a CityMap since its snapshot was frozen;
+// lets structures derived from the previous snapshot be refreshed instead of rebuilt
+struct GraphChange {
+    enum Kind { CityAdded, CityRemoved, RoadAdded, RoadRemoved };
+    GraphChange(Kind kind, const string &first, const string &second = string()) : kind(kind), first(first), second(second) {}
+    Kind kind;
+    string first; // the city, or the first city of the road
+    string second; // the second city of the road
+};
+
+// road length stored as a 32-bit count of 1/SCALE units
+template <unsigned int SCALE>
+struct FixedPoint {
+    uint32_t units;
+};
+
+// conversion of road lengths to and from the type a snapshot stores them as, which can be smaller than T;
+// lengths are rounded up when they are stored, so a stored road is never shorter than it was,
+// and lower bounds of the road distance, such as the straight-line distance, stay lower bounds
+template <typename T, typename Weight>
+struct RoadWeight {
+    static const uint32_t SCALE = numeric_limits<Weight>::is_integer ? 1 : 0; // kept in map files: 0 for floating point, else units per length
+    static Weight Store(T length);
+    static T Load(Weight weight) { return T(weight); }
+};
+
+template <typename T, typename Weight>
+const uint32_t RoadWeight<T, Weight>::SCALE;
+
+template <typename T, typename Weight>
+Weight RoadWeight<T, Weight>::Store(T length)
+{
+    Weight weight = Weight(length);
+    if (T(weight) < length) {
+        weight = numeric_limits<Weight>::is_integer ? Weight(weight + 1) : Weight(nextafter(weight, numeric_limits<Weight>::max()));
+    }
+    return weight;
+}
+
+template <typename T, unsigned int FIXED_SCALE>
+struct RoadWeight<T, FixedPoint<FIXED_SCALE> > {
+    static const uint32_t SCALE = FIXED_SCALE;
+    static FixedPoint<FIXED_SCALE> Store(T length)
+    {
+        FixedPoint<FIXED_SCALE> weight = { uint32_t(ceil(double(length) * FIXED_SCALE)) };
+        // the product can round down to a whole number below the exact one
+        while (Load(weight) < length && weight.units != numeric_limits<uint32_t>::max()) {
+            weight.units++;
+        }
+        return weight;
+    }
+    static T Load(FixedPoint<FIXED_SCALE> weight) { return T(double(weight.units) / FIXED_SCALE); }
+};
+
+template <typename T, unsigned int FIXED_SCALE>
+const uint32_t RoadWeight<T, FixedPoint<FIXED_SCALE> >::SCALE;
+
+template <typename T>
+
+// represents the coordinates of a city
+struct Pos {
+    Pos() {};
+    Pos(T x, T y) : x(x), y(y){}
+    T x;
+    T y;
+};
+
+// outcome of opening a map file
+enum class MapFileStatus {
+    Ok,
+    Unreadable, // the file could not be opened or mapped
+    WrongFormat, // not a map file, or one of another format version, distance type or road length type
+    Corrupt // a checksum or the structure of the file does not hold
+};
+
+// fixed-size start of a map file; the sections follow it, each at an offset which is a multiple of 8,
+// in the same layout as the arrays of a CityGraph, so a mapped file is used in place;
+// every section has a checksum of its own, so opening a file can check the header alone and leave the sections unread
+struct MapFileHeader {
+    char magic[8]; // "CITYMAP" and a zero
+    uint32_t formatVersion;
+    uint32_t byteOrder; // BYTE_ORDER_MARK as written by the machine that saved the file
+    uint32_t distanceSize; // sizeof(T)
+    uint32_t distanceIsInteger;
+    uint32_t weightSize; // sizeof(Weight), the type road lengths are stored as
+    uint32_t weightScale; // RoadWeight<T, Weight>::SCALE
+    uint64_t cityCount;
+    uint64_t roadCount;
+    uint64_t nameLength; // bytes of all names together
+    uint64_t sections[8]; // offsets of nameOffsets, nameChars, xs, ys, firstRoad, targets, lengths and byName
+    uint64_t fileSize;
+    uint64_t sectionChecksums[8]; // FNV-1a of the bytes of each section, padding left out
+    uint64_t headerChecksum; // FNV-1a of the header before it
+};
+
+const uint32_t MAP_FILE_FORMAT_VERSION = 4;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+// takes a point of a 2^16 by 2^16 grid and gets its position along the Hilbert curve through the grid;
+// points close on the curve are close on the grid
+inline uint64_t HilbertIndex(uint32_t x, uint32_t y)
+{
+    uint64_t index = 0;
+    for(uint32_t side = 1u << 15; side > 0; side >>= 1) {
+        uint32_t right = (x & side) ? 1 : 0;
+        uint32_t up = (y & side) ? 1 : 0;
+        index += uint64_t(side) * side * ((3 * right) ^ up);
+        // the quadrant is turned so the curve inside it starts and ends where the curve around it needs
+        if (up == 0) {
+            if (right == 1) {
+                x = 0xffff - x;
+                y = 0xffff - y;
+            }
+            swap(x, y);
+        }
+    }
+    return index;
+}
+
+// immutable, compact snapshot of a city map;
+// city names are interned to dense ids in the order of the cities along a Hilbert curve over their coordinates,
+// so the cities a search settles one after another are mostly close in memory too, and a name is found by binary search
+// over the ids in name order; defining CITYGRAPH_NAME_ORDER numbers the cities in name order instead;
+// either way ids only depend on the cities and their coordinates, so they only move when cities come or go;
+// coordinates are kept as separate x and y arrays, and roads as a compressed sparse row adjacency:
+// the roads leaving city v are [FirstRoad(v), LastRoad(v)), with their targets and lengths in contiguous arrays;
+// the arrays are views of storage which is either built in memory or a map file mapped read-only,
+// and which is shared by copies of the snapshot; in memory the cities and the roads are stored apart, so a snapshot which only
+// changes some roads (see WithRows) shares the cities of the one it comes from;
+// road lengths are stored as Weight, which can be a smaller type than T, such as float or FixedPoint, to make the roads more compact,
+// and are turned back into T as they are read
+template <typename T, typename Weight = T>
+class CityGraph
+{
+    public:
+        typedef Weight LengthType; // type road lengths are stored as
+        CityGraph();
+        CityGraph(const map<string, Pos<T> > &cities, const map<string, map<string, T> > &adjacentRoads);
+        CityGraph(vector<char> &nameChars, vector<unsigned int> &nameOffsets, vector<T> &xs, vector<T> &ys,
+                  vector<RoadId> &firstRoad, vector<CityId> &targets, vector<Weight> &lengths); // takes name ordered arrays over, leaving them empty
+        CityId Size() const { return cityCount; } // number of cities
+        RoadId RoadCount() const { return roadCount; } // number of directed roads
+        CityId Find(string_view cityName) const; // id of a city, or NO_CITY
+        string Name(CityId city) const;
+        string_view NameView(CityId city) const; // name of a city without copying it, valid as long as the snapshot
+        CityId ByName(CityId position) const { return byName[position]; } // city at a position of the name order
+        T X(CityId city) const { return xs[city]; }
+        T Y(CityId city) const { return ys[city]; }
+        const T *Xs() const { return xs; } // x coordinates of all cities by id, for batch kernels
+        const T *Ys() const { return ys; }
+        const CityId *Targets() const { return targets; } // targets of all roads by id; the roads of a city are a block of it
+        RoadId FirstRoad(CityId city) const { return firstRoad[city]; }
+        RoadId LastRoad(CityId city) const { return firstRoad[city + 1]; }
+        CityId Target(RoadId road) const { return targets[road]; }
+        T Length(RoadId road) const { return RoadWeight<T, Weight>::Load(lengths[road]); }
+        RoadId FindRoad(CityId from, CityId to) const; // id of the road between two cities, or LastRoad(from)
+        template <typename Visit>
+        void ForEachRoad(CityId city, Visit visit) const; // calls visit(target, length) for every road of a city, in order of target
+        void Swap(CityGraph &other);
+        CityGraph Cities() const; // the cities alone, with no roads, in storage of their own
+        template <typename Roads>
+        CityGraph WithRoads(const Roads &roads) const; // the cities with the roads roads.ForEachRoad gives each of them
+        CityGraph WithRows(const map<CityId, vector<pair<CityId, T> > > &rows) const; // the same cities and roads but for the roads of some cities
+        bool Save(const string &path) const; // write the snapshot as a map file
+        MapFileStatus OpenMapped(const string &path, bool verify = false); // become a snapshot mapped from a map file, if it is valid
+        bool Mapped() const { return mapped; }
+    private:
+        // arrays of a snapshot built in memory
+        struct Arrays {
+            vector<char> nameChars;
+            vector<unsigned int> nameOffsets;
+            vector<T> xs;
+            vector<T> ys;
+            vector<RoadId> firstRoad;
+            vector<CityId> targets;
+            vector<Weight> lengths;
+            vector<CityId> byName;
+        };
+        // a file mapped into memory, unmapped when the last snapshot viewing it is gone
+        struct MappedFile {
+            MappedFile() : address(0), length(0) {}
+            ~MappedFile();
+            bool Map(const string &path);
+            const char *address;
+            size_t length;
+        };
+        static void Arrange(Arrays &arrays); // renumber cities laid out in name order along the Hilbert curve
+        void CopyCities(Arrays &arrays) const; // copy the names, coordinates and name order into arrays
+        void View(const Arrays &cityArrays, const Arrays &roadArrays); // point the views at the cities of one and the roads of the other
+        void ViewRoads(const Arrays &roadArrays); // point the views of the roads at the roads of arrays
+        void Keep(const shared_ptr<Arrays> &arrays); // move the roads of arrays built in memory apart from the cities, view and keep both
+        MapFileStatus View(const MappedFile &file, bool verify); // check a map file and point the views into it
+        bool Sound(const MapFileHeader &header) const; // whether the sections viewed match their checksums and describe a snapshot
+        static uint64_t Checksum(const char *first, const char *last);
+        int CompareName(CityId city, string_view cityName) const; // orders a city's name against a string like string::compare
+        CityId cityCount;
+        RoadId roadCount;
+        const char *nameChars; // all city names back to back
+        const unsigned int *nameOffsets; // name of city v is [nameOffsets[v], nameOffsets[v+1]) in nameChars
+        const T *xs; // x coordinate of each city
+        const T *ys; // y coordinate of each city
+        const RoadId *firstRoad; // first road of each city, with one extra entry marking the end of the last city
+        const CityId *targets; // city each road leads to; sorted within a city
+        const Weight *lengths; // length of each road
+        const CityId *byName; // ids of the cities in name order
+        shared_ptr<const void> storage; // the Arrays or MappedFile the views of the roads point into
+        shared_ptr<const void> cityStorage; // the Arrays or MappedFile the views of the cities point into
+        bool mapped;
+};
+
+template <typename T, typename Weight>
+CityGraph<T, Weight>::CityGraph()
+{
+    shared_ptr<Arrays> arrays = make_shared<Arrays>();
+    arrays->nameOffsets.push_back(0);
+    arrays->firstRoad.push_back(0);
+    Keep(arrays);
+}
+
+// takes arrays laid out in name order and lays them out again in the order of the cities along the Hilbert curve through
+// the smallest box holding them, filling byName; ties, such as cities at one point, keep their name order
+template <typename T, typename Weight>
+void CityGraph<T, Weight>::Arrange(Arrays &arrays)
+{
+    CityId count = CityId(arrays.xs.size());
+    arrays.byName.resize(count);
+    for(CityId city = 0; city < count; city++) {
+        arrays.byName[city] = city;
+    }
+#ifndef CITYGRAPH_NAME_ORDER
+    if (count < 2) {
+        return;
+    }
+    double minX = double(arrays.xs[0]), maxX = minX, minY = double(arrays.ys[0]), maxY = minY;
+    for(CityId city = 1; city < count; city++) {
+        minX = min(minX, double(arrays.xs[city]));
+        maxX = max(maxX, double(arrays.xs[city]));
+        minY = min(minY, double(arrays.ys[city]));
+        maxY = max(maxY, double(arrays.ys[city]));
+    }
+    double scaleX = maxX > minX ? 0xffff / (maxX - minX) : 0;
+    double scaleY = maxY > minY ? 0xffff / (maxY - minY) : 0;
+    vector<pair<uint64_t, CityId> > curve(count); // position on the curve and place in name order, sorted into the new order
+    for(CityId city = 0; city < count; city++) {
+        uint32_t x = uint32_t((double(arrays.xs[city]) - minX) * scaleX);
+        uint32_t y = uint32_t((double(arrays.ys[city]) - minY) * scaleY);
+        curve[city] = make_pair(HilbertIndex(min(x, 0xffffu), min(y, 0xffffu)), city);
+    }
+    sort(curve.begin(), curve.end());
+
+    Arrays arranged;
+    arranged.nameChars.reserve(arrays.nameChars.size());
+    arranged.nameOffsets.reserve(count + 1);
+    arranged.xs.reserve(count);
+    arranged.ys.reserve(count);
+    arranged.firstRoad.reserve(count + 1);
+    arranged.targets.reserve(arrays.targets.size());
+    arranged.lengths.reserve(arrays.lengths.size());
+    arranged.byName.resize(count);
+    for(CityId city = 0; city < count; city++) {
+        arranged.byName[curve[city].second] = city;
+    }
+    arranged.nameOffsets.push_back(0);
+    arranged.firstRoad.push_back(0);
+    vector<pair<CityId, Weight> > roads;
+    for(CityId city = 0; city < count; city++) {
+        CityId old = curve[city].second;
+        arranged.nameChars.insert(arranged.nameChars.end(), arrays.nameChars.begin() + arrays.nameOffsets[old], arrays.nameChars.begin() + arrays.nameOffsets[old + 1]);
+        arranged.nameOffsets.push_back((unsigned int)arranged.nameChars.size());
+        arranged.xs.push_back(arrays.xs[old]);
+        arranged.ys.push_back(arrays.ys[old]);
+        // targets are renumbered, so they are sorted again
+        roads.clear();
+        for(RoadId road = arrays.firstRoad[old]; road != arrays.firstRoad[old + 1]; road++) {
+            roads.push_back(make_pair(arranged.byName[arrays.targets[road]], arrays.lengths[road]));
+        }
+        sort(roads.begin(), roads.end(), [](const pair<CityId, Weight> &a, const pair<CityId, Weight> &b) { return a.first < b.first; });
+        for(typename vector<pair<CityId, Weight> >::iterator it = roads.begin(); it != roads.end(); it++) {
+            arranged.targets.push_back(it->first);
+            arranged.lengths.push_back(it->second);
+        }
+        arranged.firstRoad.push_back(RoadId(arranged.targets.size()));
+    }
+    swap(arrays, arranged);
+#endif
+}
+
+// takes the cities map and the adjacent roads map of a CityMap and builds the snapshot;
+// roads to cities which are not in the cities map are skipped
+template <typename T, typename Weight>
+CityGraph<T, Weight>::CityGraph(const map<string, Pos<T> > &cities, const map<string, map<string, T> > &adjacentRoads)
+{
+    size_t nameLength = 0;
+    for(typename map<string, Pos<T> >::const_iterator cityIt = cities.begin(); cityIt != cities.end(); cityIt++) {
+        nameLength += cityIt->first.size();
+    }
+    size_t roadCount = 0;
+    for(typename map<string, map<string, T> >::const_iterator roadsIt = adjacentRoads.begin(); roadsIt != adjacentRoads.end(); roadsIt++) {
+        roadCount += roadsIt->second.size();
+    }
+
+    shared_ptr<Arrays> arrays = make_shared<Arrays>();
+    Arrays &built = *arrays;
+    built.nameChars.reserve(nameLength);
+    built.nameOffsets.reserve(cities.size() + 1);
+    built.xs.reserve(cities.size());
+    built.ys.reserve(cities.size());
+    built.nameOffsets.push_back(0);
+    for(typename map<string, Pos<T> >::const_iterator cityIt = cities.begin(); cityIt != cities.end(); cityIt++) {
+        built.nameChars.insert(built.nameChars.end(), cityIt->first.begin(), cityIt->first.end());
+        built.nameOffsets.push_back((unsigned int)built.nameChars.size());
+        built.xs.push_back(cityIt->second.x);
+        built.ys.push_back(cityIt->second.y);
+    }
+    // names are needed by Find below, which searches them in id order until the cities are arranged
+    built.byName.resize(cities.size());
+    for(CityId city = 0; city < CityId(cities.size()); city++) {
+        built.byName[city] = city;
+    }
+    View(built, built);
+
+    // neighbour maps are sorted by name and ids follow name order until the cities are arranged, so targets come out sorted
+    built.firstRoad.reserve(cities.size() + 1);
+    built.targets.reserve(roadCount);
+    built.lengths.reserve(roadCount);
+    built.firstRoad.push_back(0);
+    for(typename map<string, Pos<T> >::const_iterator cityIt = cities.begin(); cityIt != cities.end(); cityIt++) {
+        typename map<string, map<string, T> >::const_iterator roadsIt = adjacentRoads.find(cityIt->first);
+        if (roadsIt != adjacentRoads.end()) {
+            for(typename map<string, T>::const_iterator neighbourIt = roadsIt->second.begin(); neighbourIt != roadsIt->second.end(); neighbourIt++) {
+                CityId neighbour = Find(neighbourIt->first);
+                if (neighbour != NO_CITY) {
+                    built.targets.push_back(neighbour);
+                    built.lengths.push_back(RoadWeight<T, Weight>::Store(neighbourIt->second));
+                }
+            }
+        }
+        built.firstRoad.push_back(RoadId(built.targets.size()));
+    }
+    Arrange(built);
+    Keep(arrays);
+}
+
+// takes arrays laid out as a snapshot with ids in name order, names in order and targets sorted, moves them into the snapshot
+// and arranges them
+template <typename T, typename Weight>
+CityGraph<T, Weight>::CityGraph(vector<char> &nameChars, vector<unsigned int> &nameOffsets, vector<T> &xs, vector<T> &ys,
+                        vector<RoadId> &firstRoad, vector<CityId> &targets, vector<Weight> &lengths)
+{
+    shared_ptr<Arrays> arrays = make_shared<Arrays>();
+    arrays->nameChars.swap(nameChars);
+    arrays->nameOffsets.swap(nameOffsets);
+    arrays->xs.swap(xs);
+    arrays->ys.swap(ys);
+    arrays->firstRoad.swap(firstRoad);
+    arrays->targets.swap(targets);
+    arrays->lengths.swap(lengths);
+    Arrange(*arrays);
+    Keep(arrays);
+}
+
+template <typename T, typename Weight>
+void CityGraph<T, Weight>::View(const Arrays &cityArrays, const Arrays &roadArrays)
+{
+    cityCount = CityId(cityArrays.xs.size());
+    nameChars = cityArrays.nameChars.empty() ? 0 : &cityArrays.nameChars[0];
+    nameOffsets = &cityArrays.nameOffsets[0];
+    xs = cityArrays.xs.empty() ? 0 : &cityArrays.xs[0];
+    ys = cityArrays.ys.empty() ? 0 : &cityArrays.ys[0];
+    byName = cityArrays.byName.empty() ? 0 : &cityArrays.byName[0];
+    ViewRoads(roadArrays);
+}
+
+template <typename T, typename Weight>
+void CityGraph<T, Weight>::ViewRoads(const Arrays &roadArrays)
+{
+    roadCount = RoadId(roadArrays.targets.size());
+    firstRoad = roadArrays.firstRoad.empty() ? 0 : &roadArrays.firstRoad[0];
+    targets = roadArrays.targets.empty() ? 0 : &roadArrays.targets[0];
+    lengths = roadArrays.lengths.empty() ? 0 : &roadArrays.lengths[0];
+    mapped = false;
+}
+
+// takes arrays built in memory, moves their roads into arrays of their own, and views and keeps the two
+template <typename T, typename Weight>
+void CityGraph<T, Weight>::Keep(const shared_ptr<Arrays> &arrays)
+{
+    shared_ptr<Arrays> roadArrays = make_shared<Arrays>();
+    roadArrays->firstRoad.swap(arrays->firstRoad);
+    roadArrays->targets.swap(arrays->targets);
+    roadArrays->lengths.swap(arrays->lengths);
+    View(*arrays, *roadArrays);
+    cityStorage = arrays;
+    storage = roadArrays;
+}
+
+// takes a city and a name and orders the city's name against the name
+template <typename T, typename Weight>
+int CityGraph<T, Weight>::CompareName(CityId city, string_view cityName) const
+{
+    size_t length = nameOffsets[city + 1] - nameOffsets[city];
+    size_t common = length < cityName.size() ? length : cityName.size();
+    int order = common == 0 ? 0 : memcmp(nameChars + nameOffsets[city], cityName.data(), common);
+    if (order != 0) {
+        return order;
+    }
+    return length < cityName.size() ? -1 : (length > cityName.size() ? 1 : 0);
+}
+
+// takes a city name and finds its id by binary search over the cities in name order
+template <typename T, typename Weight>
+CityId CityGraph<T, Weight>::Find(string_view cityName) const
+{
+    CityId low = 0;
+    CityId high = Size();
+    while (low < high) {
+        CityId middle = low + (high - low) / 2;
+        int order = CompareName(byName[middle], cityName);
+        if (order < 0) {
+            low = middle + 1;
+        }
+        else if (order > 0) {
+            high = middle;
+        }
+        else {
+            return byName[middle];
+        }
+    }
+    return NO_CITY;
+}
+
+// takes a city id and gets its name
+// precondition: the id is smaller than Size()
+template <typename T, typename Weight>
+string CityGraph<T, Weight>::Name(CityId city) const
+{
+    unsigned int first = nameOffsets[city];
+    unsigned int last = nameOffsets[city + 1];
+    return first == last ? string() : string(nameChars + first, last - first);
+}
+
+// takes a city id and gets a view of its name in the snapshot
+// precondition: the id is smaller than Size()
+template <typename T, typename Weight>
+string_view CityGraph<T, Weight>::NameView(CityId city) const
+{
+    unsigned int first = nameOffsets[city];
+    unsigned int last = nameOffsets[city + 1];
+    return first == last ? string_view() : string_view(nameChars + first, last - first);
+}
+
+// takes two cities and finds the road between them by binary search over the sorted targets
+// precondition: both ids are smaller than Size()
+template <typename T, typename Weight>
+RoadId CityGraph<T, Weight>::FindRoad(CityId from, CityId to) const
+{
+    const CityId *road = lower_bound(targets + FirstRoad(from), targets + LastRoad(from), to);
+    if (road != targets + LastRoad(from) && *road == to) {
+        return RoadId(road - targets);
+    }
+    return LastRoad(from);
+}
+
+// takes a city and calls visit(target, length) for each of its roads, the way searches which also run over
+// other kinds of roads, such as CompressedRoads, walk them
+template <typename T, typename Weight>
+template <typename Visit>
+void CityGraph<T, Weight>::ForEachRoad(CityId city, Visit visit) const
+{
+    for(RoadId road = FirstRoad(city); road != LastRoad(city); road++) {
+        visit(targets[road], Length(road));
+    }
+}
+
+template <typename T, typename Weight>
+void CityGraph<T, Weight>::CopyCities(Arrays &arrays) const
+{
+    arrays.nameChars.assign(nameChars, nameChars + nameOffsets[cityCount]);
+    arrays.nameOffsets.assign(nameOffsets, nameOffsets + cityCount + 1);
+    arrays.xs.assign(xs, xs + cityCount);
+    arrays.ys.assign(ys, ys + cityCount);
+    arrays.byName.assign(byName, byName + cityCount);
+}
+
+// gets a snapshot of the cities of this one, with the same ids, and no roads; it shares nothing with this one, so it is all
+// that stays in memory of a snapshot whose roads are kept some other way, such as compressed
+template <typename T, typename Weight>
+CityGraph<T, Weight> CityGraph<T, Weight>::Cities() const
+{
+    shared_ptr<Arrays> arrays = make_shared<Arrays>();
+    CopyCities(*arrays);
+    arrays->firstRoad.assign(size_t(cityCount) + 1, 0);
+    CityGraph cities;
+    cities.Keep(arrays);
+    return cities;
+}
+
+// takes roads of the cities of this snapshot, such as compressed ones, and gets a snapshot of the same cities, with the same ids,
+// and those roads; roads must give targets in order, as CompressedRoads and CityGraph do
+template <typename T, typename Weight>
+template <typename Roads>
+CityGraph<T, Weight> CityGraph<T, Weight>::WithRoads(const Roads &roads) const
+{
+    shared_ptr<Arrays> arrays = make_shared<Arrays>();
+    CopyCities(*arrays);
+    arrays->firstRoad.reserve(size_t(cityCount) + 1);
+    arrays->firstRoad.push_back(0);
+    for(CityId city = 0; city < cityCount; city++) {
+        roads.ForEachRoad(city, [&](CityId target, T length) {
+            arrays->targets.push_back(target);
+            arrays->lengths.push_back(RoadWeight<T, Weight>::Store(length));
+        });
+        arrays->firstRoad.push_back(RoadId(arrays->targets.size()));
+    }
+    CityGraph graph;
+    graph.Keep(arrays);
+    return graph;
+}
+
+// takes new roads for some cities, each city's sorted by target, and gets a snapshot of the same cities, with the same ids,
+// and with the roads of this one for every other city; the cities are shared with this snapshot rather than copied, and the roads
+// of the other cities are copied a run of cities at a time, so the cost is a copy of the rows of roads, at the speed of memcpy,
+// and the new roads, with no names looked up and no cities laid out again
+// precondition: the cities given are cities of this snapshot, and the targets too
+template <typename T, typename Weight>
+CityGraph<T, Weight> CityGraph<T, Weight>::WithRows(const map<CityId, vector<pair<CityId, T> > > &rows) const
+{
+    size_t newRoadCount = roadCount;
+    for(typename map<CityId, vector<pair<CityId, T> > >::const_iterator it = rows.begin(); it != rows.end(); it++) {
+        newRoadCount += it->second.size() - (LastRoad(it->first) - FirstRoad(it->first));
+    }
+    shared_ptr<Arrays> roadArrays = make_shared<Arrays>();
+    vector<RoadId> &newFirstRoad = roadArrays->firstRoad;
+    vector<CityId> &newTargets = roadArrays->targets;
+    vector<Weight> &newLengths = roadArrays->lengths;
+    newFirstRoad.resize(size_t(cityCount) + 1);
+    newTargets.reserve(newRoadCount);
+    newLengths.reserve(newRoadCount);
+    newFirstRoad[0] = 0;
+    CityId city = 0; // first city of the run of unchanged cities
+    typename map<CityId, vector<pair<CityId, T> > >::const_iterator row = rows.begin();
+    while (true) {
+        CityId runEnd = row == rows.end() ? cityCount : row->first;
+        RoadId shift = RoadId(newTargets.size()) - firstRoad[city]; // unsigned, so it wraps around when the run moves down, which adding it undoes
+        newTargets.insert(newTargets.end(), targets + firstRoad[city], targets + firstRoad[runEnd]);
+        newLengths.insert(newLengths.end(), lengths + firstRoad[city], lengths + firstRoad[runEnd]);
+        for(CityId next = city + 1; next <= runEnd; next++) {
+            newFirstRoad[next] = firstRoad[next] + shift;
+        }
+        if (row == rows.end()) {
+            break;
+        }
+        for(typename vector<pair<CityId, T> >::const_iterator road = row->second.begin(); road != row->second.end(); road++) {
+            newTargets.push_back(road->first);
+            newLengths.push_back(RoadWeight<T, Weight>::Store(road->second));
+        }
+        newFirstRoad[runEnd + 1] = RoadId(newTargets.size());
+        city = runEnd + 1;
+        row++;
+    }
+    CityGraph graph(*this);
+    graph.ViewRoads(*roadArrays);
+    graph.storage = roadArrays;
+    return graph;
+}
+
+template <typename T, typename Weight>
+void CityGraph<T, Weight>::Swap(CityGraph &other)
+{
+    swap(cityCount, other.cityCount);
+    swap(roadCount, other.roadCount);
+    swap(nameChars, other.nameChars);
+    swap(nameOffsets, other.nameOffsets);
+    swap(xs, other.xs);
+    swap(ys, other.ys);
+    swap(firstRoad, other.firstRoad);
+    swap(targets, other.targets);
+    swap(lengths, other.lengths);
+    swap(byName, other.byName);
+    storage.swap(other.storage);
+    cityStorage.swap(other.cityStorage);
+    swap(mapped, other.mapped);
+}
+
+// takes a range of bytes and gets their 64-bit FNV-1a hash
+template <typename T, typename Weight>
+uint64_t CityGraph<T, Weight>::Checksum(const char *first, const char *last)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(const char *byte = first; byte != last; byte++) {
+        hash ^= (unsigned char)*byte;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// takes a path and writes the snapshot there as a map file: the header, then the arrays as they are in memory;
+// the checksums are taken from the arrays themselves, which are then written straight to the file, so nothing is copied;
+// gets whether the whole file was written
+template <typename T, typename Weight>
+bool CityGraph<T, Weight>::Save(const string &path) const
+{
+    const char *data[8] = { (const char *)nameOffsets, nameChars, (const char *)xs, (const char *)ys, (const char *)firstRoad, (const char *)targets, (const char *)lengths,
+                            (const char *)byName };
+    size_t sizes[8] = { (size_t(cityCount) + 1) * sizeof(unsigned int), size_t(nameOffsets[cityCount]), size_t(cityCount) * sizeof(T), size_t(cityCount) * sizeof(T),
+                        (size_t(cityCount) + 1) * sizeof(RoadId), size_t(roadCount) * sizeof(CityId), size_t(roadCount) * sizeof(Weight), size_t(cityCount) * sizeof(CityId) };
+
+    MapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CITYMAP", 8);
+    header.formatVersion = MAP_FILE_FORMAT_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.distanceSize = sizeof(T);
+    header.distanceIsInteger = numeric_limits<T>::is_integer;
+    header.weightSize = sizeof(Weight);
+    header.weightScale = RoadWeight<T, Weight>::SCALE;
+    header.cityCount = cityCount;
+    header.roadCount = roadCount;
+    header.nameLength = nameOffsets[cityCount];
+    uint64_t offset = sizeof(MapFileHeader);
+    for(int section = 0; section < 8; section++) {
+        header.sections[section] = offset;
+        offset = (offset + sizes[section] + 7) / 8 * 8;
+    }
+    header.fileSize = offset;
+    for(int section = 0; section < 8; section++) {
+        header.sectionChecksums[section] = Checksum(data[section], data[section] + sizes[section]);
+    }
+    header.headerChecksum = Checksum((const char *)&header, (const char *)&header.headerChecksum);
+
+    ofstream file(path.c_str(), ios::binary | ios::trunc);
+    file.write((const char *)&header, sizeof(header));
+    const char padding[8] = { 0 };
+    for(int section = 0; section < 8; section++) {
+        file.write(data[section], sizes[section]);
+        uint64_t end = section + 1 < 8 ? header.sections[section + 1] : header.fileSize;
+        file.write(padding, streamsize(end - header.sections[section] - sizes[section]));
+    }
+    file.close();
+    return !file.fail();
+}
+
+// takes a path and, if it is a valid map file, maps it and views the snapshot in it; otherwise the snapshot is left as it was;
+// only the header is checked unless verify is set, so opening reads a few pages whatever the size of the file, and a file damaged
+// after it was written is only found to be corrupt with verify, which reads every section once
+template <typename T, typename Weight>
+MapFileStatus CityGraph<T, Weight>::OpenMapped(const string &path, bool verify)
+{
+    shared_ptr<MappedFile> file = make_shared<MappedFile>();
+    if (!file->Map(path)) {
+        return MapFileStatus::Unreadable;
+    }
+    CityGraph opened;
+    MapFileStatus status = opened.View(*file, verify);
+    if (status == MapFileStatus::Ok) {
+        opened.storage = file;
+        opened.cityStorage = file;
+        Swap(opened);
+    }
+    return status;
+}
+
+// takes a mapped file and checks its header, then points the views into it, and, if verify is set, checks its sections;
+// the header is checked whole, along with what can be checked of the arrays without reading more than their first and last entries
+template <typename T, typename Weight>
+MapFileStatus CityGraph<T, Weight>::View(const MappedFile &file, bool verify)
+{
+    static_assert(sizeof(CityId) == 4 && sizeof(RoadId) == 4 && sizeof(unsigned int) == 4, "map files store 32-bit ids");
+    MapFileHeader header;
+    if (file.length < sizeof(header)) {
+        return MapFileStatus::WrongFormat;
+    }
+    memcpy(&header, file.address, sizeof(header));
+    if (memcmp(header.magic, "CITYMAP", 8) != 0 || header.formatVersion != MAP_FILE_FORMAT_VERSION || header.byteOrder != BYTE_ORDER_MARK
+        || header.distanceSize != sizeof(T) || header.distanceIsInteger != uint32_t(numeric_limits<T>::is_integer)
+        || header.weightSize != sizeof(Weight) || header.weightScale != RoadWeight<T, Weight>::SCALE) {
+        return MapFileStatus::WrongFormat;
+    }
+    if (Checksum((const char *)&header, (const char *)&header.headerChecksum) != header.headerChecksum
+        || header.fileSize != file.length || header.cityCount >= NO_CITY || header.roadCount >= RoadId(-1)) {
+        return MapFileStatus::Corrupt;
+    }
+    uint64_t sizes[8] = { (header.cityCount + 1) * sizeof(unsigned int), header.nameLength, header.cityCount * sizeof(T), header.cityCount * sizeof(T),
+                          (header.cityCount + 1) * sizeof(RoadId), header.roadCount * sizeof(CityId), header.roadCount * sizeof(Weight), header.cityCount * sizeof(CityId) };
+    for(int section = 0; section < 8; section++) {
+        if (header.sections[section] % 8 != 0 || header.sections[section] < sizeof(header) || header.sections[section] > file.length
+            || sizes[section] > file.length - header.sections[section]) {
+            return MapFileStatus::Corrupt;
+        }
+    }
+
+    cityCount = CityId(header.cityCount);
+    roadCount = RoadId(header.roadCount);
+    nameOffsets = (const unsigned int *)(file.address + header.sections[0]);
+    nameChars = file.address + header.sections[1];
+    xs = (const T *)(file.address + header.sections[2]);
+    ys = (const T *)(file.address + header.sections[3]);
+    firstRoad = (const RoadId *)(file.address + header.sections[4]);
+    targets = (const CityId *)(file.address + header.sections[5]);
+    lengths = (const Weight *)(file.address + header.sections[6]);
+    byName = (const CityId *)(file.address + header.sections[7]);
+    mapped = true;
+
+    if (nameOffsets[0] != 0 || nameOffsets[cityCount] != header.nameLength || firstRoad[0] != 0 || firstRoad[cityCount] != roadCount) {
+        return MapFileStatus::Corrupt;
+    }
+    if (verify && !Sound(header)) {
+        return MapFileStatus::Corrupt;
+    }
+    return MapFileStatus::Ok;
+}
+
+// takes the header of the map file viewed and gets whether every section matches its checksum and the arrays describe a snapshot;
+// a file with good checksums can still have been written wrongly, so the arrays are checked before anything indexes with them
+template <typename T, typename Weight>
+bool CityGraph<T, Weight>::Sound(const MapFileHeader &header) const
+{
+    const char *data[8] = { (const char *)nameOffsets, nameChars, (const char *)xs, (const char *)ys, (const char *)firstRoad, (const char *)targets, (const char *)lengths,
+                            (const char *)byName };
+    size_t sizes[8] = { (size_t(cityCount) + 1) * sizeof(unsigned int), size_t(header.nameLength), size_t(cityCount) * sizeof(T), size_t(cityCount) * sizeof(T),
+                        (size_t(cityCount) + 1) * sizeof(RoadId), size_t(roadCount) * sizeof(CityId), size_t(roadCount) * sizeof(Weight), size_t(cityCount) * sizeof(CityId) };
+    for(int section = 0; section < 8; section++) {
+        if (Checksum(data[section], data[section] + sizes[section]) != header.sectionChecksums[section]) {
+            return false;
+        }
+    }
+    for(CityId city = 0; city < cityCount; city++) {
+        if (nameOffsets[city + 1] < nameOffsets[city] || firstRoad[city + 1] < firstRoad[city]) {
+            return false;
+        }
+        for(RoadId road = firstRoad[city]; road != firstRoad[city + 1]; road++) {
+            if (targets[road] >= cityCount || (road > firstRoad[city] && targets[road] <= targets[road - 1])) {
+                return false;
+            }
+        }
+    }
+    // Find relies on byName holding every city once, with the names in order; names in strict order cannot repeat a city
+    for(CityId position = 0; position < cityCount; position++) {
+        if (byName[position] >= cityCount) {
+            return false;
+        }
+        if (position > 0) {
+            CityId previous = byName[position - 1];
+            CityId city = byName[position];
+            size_t previousLength = nameOffsets[previous + 1] - nameOffsets[previous];
+            size_t length = nameOffsets[city + 1] - nameOffsets[city];
+            size_t common = min(previousLength, length);
+            int order = common == 0 ? 0 : memcmp(nameChars + nameOffsets[previous], nameChars + nameOffsets[city], common);
+            if (order > 0 || (order == 0 && previousLength >= length)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// takes a path and maps the whole file read-only, or reads it into memory where there is no mmap
+template <typename T, typename Weight>
+bool CityGraph<T, Weight>::MappedFile::Map(const string &path)
+{
+#ifdef _WIN32
+    ifstream file(path.c_str(), ios::binary | ios::ate);
+    if (!file) {
+        return false;
+    }
+    length = size_t(file.tellg());
+    char *buffer = new char[length > 0 ? length : 1];
+    file.seekg(0);
+    file.read(buffer, length);
+    address = buffer;
+    return !file.fail();
+#else
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        close(descriptor);
+        return false;
+    }
+    void *mapping = mmap(0, size_t(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+    // the mapping keeps the file open by itself
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    address = (const char *)mapping;
+    length = size_t(status.st_size);
+    return true;
+#endif
+}
+
+template <typename T, typename Weight>
+CityGraph<T, Weight>::MappedFile::~MappedFile()
+{
+    if (!address) {
+        return;
+    }
+#ifdef _WIN32
+    delete[] address;
+#else
+    munmap((void *)address, length);
+#endif
+}
+
+#endif // CITYGRAPH_H_INCLUDED
@@ -10,182 +10,597 @@
 #include <queue>
 #include <math.h>
 #include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "CityGraph.h"
+#include "SearchWorkspace.h"
+#include "ContractionHierarchy.h"
+#include "PartitionOverlay.h"
+#include "HubLabels.h"
+#include "CompressedRoads.h"
+#include "Heuristics.h"
+#include "Parallel.h"
+#include "RouteCache.h"
+#include "Messages.h"
+#include "BulkImport.h"
+#include "Journal.h"
+#include "SpatialIndex.h"
+#include "ShortestPathTree.h"
+#include "DynamicPathTree.h"
+#include "Stats.h"
 using namespace std;
 
+// engine used to answer distance and path queries
+enum class SearchMode {
+    AStar, // A* over the snapshot with the heuristic policy of the map
+    ContractionHierarchy, // bidirectional upward search over a contraction hierarchy built from the snapshot
+    Bidirectional, // A* from both ends at once, with potentials averaged from the heuristic policy of the map
+    PartitionOverlay, // bidirectional search over a multi-level partition overlay, customized again only where roads changed
+    HubLabels, // distances merged from hub labels built over a contraction hierarchy, paths from the hierarchy itself
+    Compressed // A* over a compressed copy of the roads of the snapshot, decoded as they are followed; the snapshot then keeps only its cities
+};
+
+// limits of a bounded-suboptimal or anytime route query (see CityMap::BoundedPath)
+struct RouteLimits {
+    RouteLimits() : epsilon(0), anytime(false), settleBudget(0), deadline(chrono::steady_clock::time_point::max()) {}
+    double epsilon; // estimates are weighted by 1 + epsilon, so the first path found is at most 1 + epsilon times as long as the shortest
+    bool anytime; // after the first path, keep searching for shorter ones until the shortest is proven or a limit is reached
+    size_t settleBudget; // cities the search may settle, 0 for no limit
+    chrono::steady_clock::time_point deadline; // when the search has to stop
+};
+
+// outcome of a bounded-suboptimal or anytime route query
 template <typename T>
+struct BoundedRoute {
+    BoundedRoute() : distance(Unreachable<T>()), bound(numeric_limits<double>::infinity()), settled(0), finished(false) {}
+    T distance; // length of the best path found, Unreachable if none was
+    vector<string> path; // cities on it, empty if none was found
+    double bound; // distance is proven to be at most bound times the shortest distance: 1 once it is the shortest, infinite without a path
+    size_t settled; // cities the search settled
+    bool finished; // whether the search ended by itself rather than at a limit
+};
 
-// represents the coordinates of a city
-struct Pos {
-    Pos() {};
-    Pos(T x, T y) : x(x), y(y){}
-    T x;
-    T y;
+// one published version of a CityMap: a frozen snapshot of its maps and everything derived from it;
+// a version never changes once it is published, so any number of threads can query it while the map is being edited
+template <typename T, typename Heuristic>
+struct CityMapVersion {
+    unsigned long number; // versions published by a map are numbered in order from 0
+    shared_ptr<const typename Heuristic::Graph> graph;
+    shared_ptr<const Heuristic> heuristic; // refreshed for graph
+    shared_ptr<const ContractionHierarchy<T> > hierarchy; // built from graph if it was published in the contraction hierarchy or hub label mode, otherwise null
+    shared_ptr<const PartitionOverlay<T> > overlay; // customized for graph if it was published in the partition overlay mode, otherwise null
+    shared_ptr<const HubLabels<T> > labels; // built from hierarchy if it was published in the hub label mode, otherwise null
+    shared_ptr<const CompressedRoads<T, typename Heuristic::DistanceMetric, typename Heuristic::Graph::LengthType> > compressed; // roads of the version if it was published in the compressed mode, whose graph then holds only the cities, otherwise null
+    shared_ptr<const SpatialIndex<T, typename Heuristic::DistanceMetric> > spatialIndex; // of graph once the map has had a position query, otherwise null
 };
 
 // represents a collection of cities and roads between them;
 // provides an interface of calculating the shortest distance between any two cities, and construct a path of cities along the shortest path;
 // for each city, the roads connecting to it are stored along with the road length,
-// the road length is assumed to be the distance between two cities on a cartesian plane
-template <typename T>
+// the road length is assumed to be the distance between two cities on a cartesian plane;
+// the maps are the editing front end, queries run against a CityGraph snapshot which is rebuilt when the maps have changed;
+// edits are made under a writer lock and published as a new immutable version, which queries pick up with an atomic load and no lock;
+// edits between BeginBatch and EndBatch are published together when the batch ends, other edits on the first query after them;
+// edits can also be recorded in a journal (see Journal.h), which the map is restored from after a restart;
+// Heuristic is the policy A* gets its lower bounds from (see Heuristics.h), and fixes the metric road lengths are measured in
+// and the type they are stored as, so the search loops are compiled for them with nothing left to choose at run time
+template <typename T, typename Heuristic = EuclideanHeuristic<T> >
 class CityMap
 {
     public:
         CityMap();
         CityMap(ostream &out, ostream &err);
+        CityMap(const CityMap &other); // shares the published version and copies the maps
         ~CityMap();
         void AddCity(string cityName, T x, T y);
-        void AddRoad(string firstCity, string secondCity); // connect cities
+        void AddRoad(string firstCity, string secondCity); // connect cities with a road as long as the metric makes it
+        void AddRoad(string firstCity, string secondCity, T length); // connect cities with a road of a given length; only with a metric of explicit lengths
         void RemoveCity(string cityName);
         void RemoveRoad(string firstCity, string secondCity); // disconnect cities
-        T FindDistance(string firstCity, string secondCity); // find shortest distance between two cities
-        vector<string> ShortestPath(string firstCity, string secondCity); // cities on the path
-        void PrintPath(string firstCity, string secondCity); // display cities on the path and distances
+        typedef CityMapVersion<T, Heuristic> Version;
+        typedef typename Heuristic::Graph Graph; // snapshots, storing road lengths as Graph::LengthType
+        typedef typename Heuristic::DistanceMetric Metric;
+        typedef PathTree<T, typename Graph::LengthType> Tree;
+        T FindDistance(string_view firstCity, string_view secondCity); // find shortest distance between two cities
+        vector<string> ShortestPath(string_view firstCity, string_view secondCity); // cities on the path
+        BoundedRoute<T> BoundedPath(string_view firstCity, string_view secondCity, const RouteLimits &limits,
+                                    const function<void(const BoundedRoute<T> &)> &improved = function<void(const BoundedRoute<T> &)>()); // a path within a bound of the shortest
+        void PrintPath(string_view firstCity, string_view secondCity); // display cities on the path and distances
+        T FindDistance(const Version &version, CityId firstCity, CityId secondCity); // the same for cities resolved in a version
+        T ShortestPath(const Version &version, CityId firstCity, CityId secondCity, vector<CityId> &path); // distance, and the path as ids into the version
+        void DistanceMatrix(const vector<string> &sources, const vector<string> &targets, T *distances); // fill a sources by targets table of shortest distances
+        Tree ShortestPathTree(string source, TreeAlgorithm algorithm = TreeAlgorithm::DeltaStepping); // distances and paths from a city to every city
+        void KeepTree(string source); // keep the shortest path tree from a city up to date, repairing it as the map changes
+        void DropTree(string source);
+        Tree KeptTree(string source); // the kept tree from a city for the current version
+        size_t KeptTreeRepairs(string source); // cities the last repair of a kept tree searched for again
+        void BeginBatch(); // hold edits back from queries until the matching EndBatch
+        void EndBatch(); // publish the edits of the batch as one version
+        void Freeze(); // publish a version rebuilt from the maps
+        void Save(string path); // write the current version's snapshot as a map file
+        void OpenMapped(string path, bool verify = false); // replace all cities and roads with the snapshot of a map file, used in place
+        ImportReport Import(istream &cityInput, istream &roadInput, size_t memoryBudget = size_t(256) << 20); // add cities and roads from large delimited files as one version
+        void OpenJournal(string path, const JournalOptions &options = JournalOptions()); // restore the map from a journal and record later edits in it
+        void SyncJournal(); // make the edits recorded so far durable
+        void CloseJournal(); // sync the journal and stop recording edits
+        JournalStats GetJournalStats() const; // what the open journal has done, if there is one
+        shared_ptr<const CityMapVersion<T, Heuristic> > CurrentVersion(); // latest version, publishing pending edits first
+        string NearestCity(T x, T y); // city closest to a point by the distance of the metric, empty if there are no cities
+        vector<string> KNearest(T x, T y, size_t k); // k cities closest to a point, closest first
+        vector<string> CitiesWithin(T x, T y, T radius); // cities no farther from a point than the radius, closest first
+        const Graph &Snapshot() { return *CurrentVersion()->graph; } // valid until a later version is published; only the cities in the compressed mode
+        const Heuristic &GetHeuristic() { return *CurrentVersion()->heuristic; } // valid until a later version is published
+        void SetSearchMode(SearchMode mode); // choose the engine of later queries, preprocessing for it now
+        SearchMode GetSearchMode() const { return searchMode; }
+        void SetRouteCacheCapacity(size_t routes) { routeCache.SetCapacity(routes); } // cache up to that many routes, none by default
+        RouteCacheStats GetRouteCacheStats() const { return routeCache.Stats(); }
+        CityMapStats Stats() const; // route queries of the whole process, if the map is built with CITYMAP_STATS defined
+        HubLabelReport GetHubLabelReport(); // memory and query time of the hub labels of the current version, if it has them
     private:
         void Error(string subjectType, string subject, string reason); // template for displaying error message
-        T CartesianDistance(Pos<T> pos1, Pos<T> pos2); // get distance between points on a cartesian plane
+        T CartesianDistance(Pos<T> pos1, Pos<T> pos2); // get distance between points in the metric
         T CartesianDistance(string firstCity, string secondCity); // get distance between two cities
-        vector<string> ReconstructPath(map<string, string> paths, string current); // get the cities visited on the shortest path
-        pair<vector<string>, T> ShortestPathCore(string firstCity, string secondCity); // A* algorithm
+        void InsertRoad(const string &firstCity, const string &secondCity, const T *length); // add a road, as long as the metric makes it if length is null
+        void RecordChange(const GraphChange &change); // remember a change for refreshing the heuristic
+        bool FindCities(const Graph &graph, string_view firstCity, string_view secondCity, CityId &first, CityId &second); // resolve names in the snapshot
+        void FindCities(const Graph &graph, const vector<string> &cityNames, vector<CityId> &ids); // resolve names, NO_CITY for missing ones
+        void DistancesFrom(const Graph &graph, CityId source, const vector<CityId> &targets, const vector<bool> &isTarget, size_t targetCount, T *row) const; // one-to-many Dijkstra
+        template <typename Roads>
+        T ShortestPathCore(const Graph &graph, const Heuristic &heuristic, const Roads &roads, CityId firstCity, CityId secondCity, vector<CityId> *path); // A* algorithm
+        template <typename Roads>
+        void BoundedCore(const Graph &graph, const Heuristic &heuristic, const Roads &roads, CityId firstCity, CityId secondCity, const RouteLimits &limits,
+                         BoundedRoute<T> &route, const function<void(const BoundedRoute<T> &)> &improved); // anytime weighted A* algorithm
+        T BidirectionalCore(const Graph &graph, const Heuristic &heuristic, CityId firstCity, CityId secondCity, vector<CityId> *path); // bidirectional A* algorithm
+        T Route(const Version &version, CityId firstCity, CityId secondCity, vector<CityId> *path); // shortest path, recorded in the statistics
+        T EngineRoute(const Version &version, CityId firstCity, CityId secondCity, vector<CityId> *path); // shortest path with the engine of the search mode
+        bool ValidCities(const Version &version, CityId firstCity, CityId secondCity, vector<CityId> *path); // whether the ids are in the snapshot
+        T CachedRoute(const Version &version, string_view firstCity, string_view secondCity, CityId first, CityId second, vector<string> *path); // route through the route cache
+        void Publish(); // replace the current version with one built from the maps; the writer lock must be held
+        void PublishGraph(const shared_ptr<const Graph> &graph, const vector<GraphChange> *graphChanges); // make a version of a snapshot current
+        bool Preprocess(Version &next, const Version &previous, const vector<GraphChange> *graphChanges); // add what the search mode needs to a version
+        static shared_ptr<const Graph> RoadGraph(const Version &version); // the snapshot of a version with its roads, decoded if they are compressed
+        static T RoadLength(const Version &version, CityId from, CityId to); // length of a road of the snapshot of a version
+        shared_ptr<const Version> IndexedVersion(); // latest version, with a spatial index
+        vector<string> Names(const Graph &graph, const vector<CityId> &ids); // names of the cities
+        void Hydrate(); // fill the maps from a mapped or compressed snapshot before they are edited; the writer lock must be held
+        void Fill(const Graph &graph); // replace the contents of the maps with the cities and roads of a snapshot
+        void Replay(const vector<JournalEntry<T> > &entries); // apply edits read from a journal to the maps
+        void Journaled(bool recorded); // report an edit the journal could not record, and compact it when due; the writer lock must be held
+        void CompactJournal(bool replaced); // save the current version as the snapshot of a new journal generation; the writer lock must be held
         map<string, Pos<T> > cities; // map of city name and its coordinates
         map<string, map<string, T> > adjacentRoads; // map of cities and a map containing their neighbors and distances to their neighbors
+        shared_ptr<const Version> current; // version queries run against, only read and replaced atomically
+        bool mapsHydrated; // false while the maps are empty because the current version was opened from a map file or compressed
+        bool graphStale; // whether the maps have changed since the current version was published
+        atomic<bool> publishDue; // whether the next query should publish the edits, which it should unless a batch is open
+        int openBatches; // BeginBatch calls not matched by EndBatch yet
+        vector<GraphChange> changes; // changes to the maps since the current version was published
+        bool changesTracked; // false once more changes were made than are worth replaying
+        atomic<SearchMode> searchMode;
+        atomic<bool> spatiallyIndexed; // whether versions are published with a spatial index
+        RouteCache<T, Metric> routeCache; // routes found by earlier queries
+        typedef DynamicPathTree<T, typename Graph::LengthType> KeptPathTree;
+        map<string, KeptPathTree> keptTrees; // shortest path trees repaired whenever a version is published
+        unique_ptr<MapJournal<T> > journal; // where edits are recorded, null unless a journal is open; copies of the map have none
+        mutable mutex writer; // held while the maps are edited or a version is published; guards everything above but current and the atomics
+        mutex streamLock; // held while writing to out or err
         ostream &out;
         ostream &err;
 
 
 };
-//Constants
-const string ALREADY_EXISTS = "already exists";
-const string DOESNT_EXIST = "doesn't exist";
-const string MUST_BE_DIFFERENT = "must be different";
-const string CITY = "City";
-const string ROAD = "Road";
-const string PATH = "Path";
 
 //Private
 // template for displaying error message
-template <typename T>
-void CityMap<T>::Error(string subjectType, string subject, string reason) {
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::Error(string subjectType, string subject, string reason) {
+    lock_guard<mutex> lock(streamLock);
     err << "Error: " << reason << endl;
     err << subjectType << ": " << subject << endl;
 }
 
 // takes two cities and get distance between them
 // precondition: the cities are in the cities map
-template <typename T>
-T CityMap<T>::CartesianDistance(string firstCity, string secondCity)
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::CartesianDistance(string firstCity, string secondCity)
 {
-    return CartesianDistance(cities[firstCity], cities[secondCity]);
+    return CartesianDistance(cities.find(firstCity)->second, cities.find(secondCity)->second);
 }
 
-// takes two points and gets distance between points on a cartesian plane
+// takes two points and gets the distance between them in the metric of the map
 // precondition: two exsiting points of struct Pos
-template <typename T>
-T CityMap<T>::CartesianDistance(Pos<T> pos1, Pos<T> pos2)
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::CartesianDistance(Pos<T> pos1, Pos<T> pos2)
 {
-    T deltaX = pos2.x - pos1.x;
-    T deltaY = pos2.y - pos1.y;
-    return sqrt(deltaX * deltaX + deltaY*deltaY);
+    return Metric::Length(pos1.x, pos1.y, pos2.x, pos2.y);
 }
 
-// comparer for priority queue
-template <typename T>
-struct Lesser {
-    bool operator()(const pair<string, T >& a, const pair<string, T >& b) const{
-        return a.second >  b.second;
+// takes a snapshot and two city names and gets their ids; reports an error if a city is not in the snapshot
+template <typename T, typename Heuristic>
+bool CityMap<T, Heuristic>::FindCities(const Graph &graph, string_view firstCity, string_view secondCity, CityId &first, CityId &second) {
+    first = graph.Find(firstCity);
+    second = graph.Find(secondCity);
+    if (first == NO_CITY) {
+        Error(CITY, string(firstCity), DOESNT_EXIST);
+        return false;
     }
-};
-
-// takes a map which contains a city and its previous city on the path, and a city; gets all the cities visited on the shortest path
-// precondition: the map exists and the city is included in the map as a key
-template <typename T>
-vector<string> CityMap<T>::ReconstructPath(map<string, string> paths, string current) {
-    vector<string> path;
-	path.push_back(current);
-	while (paths.find(current) != paths.end()) {
-		current = paths[current];
-		path.push_back(current);
-	}
+    if (second == NO_CITY) {
+        Error(CITY, string(secondCity), DOESNT_EXIST);
+        return false;
+    }
+    return true;
+}
 
-	return vector<string>(path.rbegin(), path.rend());
+// takes a snapshot and a list of city names and gets their ids, reporting the names which are not in the snapshot
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::FindCities(const Graph &graph, const vector<string> &cityNames, vector<CityId> &ids) {
+    ids.clear();
+    ids.reserve(cityNames.size());
+    for(vector<string>::const_iterator it = cityNames.begin(); it != cityNames.end(); it++) {
+        ids.push_back(graph.Find(*it));
+        if (ids.back() == NO_CITY) {
+            Error(CITY, *it, DOESNT_EXIST);
+        }
+    }
 }
 
-// takes two cities and gets a pair which contains the cities on the shortest path and the shortest distance between the two cities
-// precondition: the cities are in the cities map
-template <typename T>
-pair<vector<string>, T> CityMap<T>::ShortestPathCore(string firstCity, string secondCity) {
-    priority_queue <pair<string, T>, vector<pair<string, T> >, Lesser<T> > fQueue; // priority queue of f scores (g score + h score)with the lowest f score on the top
-    set<string> open; // the set of nodes to be evaluated, initially containing the start node
-    set<string> closed; // the set of nodes already evaluated
-    map<string, T> gScores; // map of a node and its distance from the start along the best known path
-    map<string,string> paths; // map of a node and its previous node
-    T g = 0;
-    T h = CartesianDistance(firstCity, secondCity); // distance between a node and the destination node
-    gScores[firstCity] = g;
-    pair<string, T> current = pair<string, T>(firstCity, g+h);
-    fQueue.push(current);
-    open.insert(firstCity);
-
-    while(!open.empty()) {
-        current = fQueue.top();
-        fQueue.pop();
-        string currentCityName = current.first;
-        open.erase(currentCityName);
-        closed.insert(currentCityName);
+// takes a snapshot and two cities and gets the shortest distance between the two cities, and the cities on the shortest path if path is given;
+// the search state comes from the thread's workspace, so no memory is allocated once the workspace has grown to the graph
+// precondition: the cities are in the snapshot
+template <typename T, typename Heuristic>
+template <typename Roads>
+T CityMap<T, Heuristic>::ShortestPathCore(const Graph &graph, const Heuristic &heuristic, const Roads &roads, CityId firstCity, CityId secondCity, vector<CityId> *path) {
+    SearchWorkspace<T> &workspace = SearchWorkspace<T>::ForThisThread();
+    SearchSpace<T> &search = workspace.forward; // g scores, previous nodes and the open heap ordered by f score (g score + h score)
+    search.Start(graph.Size());
+    T h = heuristic.Estimate(graph, firstCity, secondCity); // lower bound of the distance between a node and the destination node
+    search.Reach(firstCity, 0, NO_CITY);
+    if (h != Unreachable<T>()) {
+        search.heap.Push(firstCity, h);
+    }
+
+    while(!search.heap.Empty()) {
+        CityId currentCity = search.heap.PopMin();
+        search.Settle(currentCity);
 
         // if destination is reached, constructs shortest path and gets shortest distance
-        bool goalReached = currentCityName == secondCity;
+        bool goalReached = currentCity == secondCity;
         if (goalReached) {
-            vector<string> shortestPath = ReconstructPath(paths, currentCityName);
-            T shortestDist = gScores[currentCityName];
-            return pair<vector<string>, T>(shortestPath, shortestDist);
+            if (path) {
+                search.Path(currentCity, *path);
+            }
+            return search.Distance(currentCity);
         }
 
-        else {
-            // iterates all the neighbors of current city and their distances from current city
-            map<string, T> neighbours = adjacentRoads[currentCityName];
-            for(typename map<string, T> :: iterator neighbourIt = neighbours.begin(); neighbourIt != neighbours.end(); neighbourIt++) {
-                pair<string, T> neighbour = (*neighbourIt);
-                string neighbourName = neighbour.first;
-                T distanceToNeighbour = neighbour.second;
-
-                // if neighbour has not been evaluated,
-                bool neighbourNotClosed = closed.count(neighbourName) == 0;
-                if (neighbourNotClosed) {
-                    // if neighbour has not been added to the to-be-evaluated set,
-                    // adds it to the to-be-evaluated set and calculates f score of the neighbour and adds to the f queue
-                    bool neighbourNotOpen = open.count(neighbourName) == 0;
-                    if (neighbourNotOpen) {
-                         paths[neighbourName] = currentCityName;
-                         T neighbourG = gScores[currentCityName] + distanceToNeighbour;
-                         gScores[neighbourName] = neighbourG;
-
-                        pair<string, T> neighbourF = pair<string, T>(neighbourName, neighbourG+CartesianDistance(neighbourName, secondCity));
-                        fQueue.push(neighbourF);
-                        open.insert(neighbourName);
-                    }
+        // iterates all the neighbors of current city and their distances from current city,
+        // gathering those seen for the first time or reached by a shorter way, so their heuristic estimates come in one batch
+        T currentG = search.Distance(currentCity);
+        workspace.batch.clear();
+        workspace.batchDistances.clear();
+        size_t relaxed = 0;
+        roads.ForEachRoad(currentCity, [&](CityId neighbour, T length) {
+            relaxed++;
+            // the heuristic is consistent, so an evaluated neighbour already has its shortest distance
+            if (search.Settled(neighbour)) {
+                return;
+            }
+            T neighbourG = currentG + length;
+            if (!search.Reached(neighbour) || neighbourG < search.Distance(neighbour)) {
+                workspace.batch.push_back(neighbour);
+                workspace.batchDistances.push_back(neighbourG);
+            }
+        });
+        search.CountRelaxed(relaxed);
+        if (workspace.batch.empty()) {
+            continue;
+        }
+        workspace.batchEstimates.resize(workspace.batch.size());
+        heuristic.EstimateBatch(graph, &workspace.batch[0], workspace.batch.size(), secondCity, &workspace.batchEstimates[0]);
+
+        // adds a neighbour seen for the first time to the open heap, and moves an open neighbour up when a shorter way to it is found
+        for(size_t i = 0; i < workspace.batch.size(); i++) {
+            CityId neighbour = workspace.batch[i];
+            T neighbourG = workspace.batchDistances[i];
+            T neighbourH = workspace.batchEstimates[i];
+            // the heuristic may know the destination cannot be reached from the neighbour
+            if (neighbourH == Unreachable<T>()) {
+                continue;
+            }
+            bool neighbourNotOpen = !search.Reached(neighbour);
+            search.Reach(neighbour, neighbourG, currentCity);
+            if (neighbourNotOpen) {
+                search.heap.Push(neighbour, neighbourG + neighbourH);
+            }
+            else {
+                search.heap.DecreaseKey(neighbour, neighbourG + neighbourH);
+            }
+        }
+    }
+    Error(PATH, graph.Name(firstCity) + " - " + graph.Name(secondCity), DOESNT_EXIST);
+    if (path) {
+        path->clear();
+    }
+    return T();
+}
+
+// takes a snapshot, two cities and limits and fills route with a path between them found by weighted A*, whose open heap is ordered by
+// g + (1 + epsilon) * h: the first path found is at most 1 + epsilon times as long as the shortest, as long as cities are opened again
+// when a shorter way to them turns up, which also keeps a city on a shortest path open with its shortest distance until the end;
+// the smallest g + h of the open cities is then a lower bound of the shortest distance, which proves the bound route reports;
+// in the anytime mode the search goes on after a path is found, dropping cities which cannot lead to a shorter one and reporting
+// every shorter path to improved, until nothing is left open and the path is the shortest, or a limit stops it
+// precondition: the cities are in the snapshot
+template <typename T, typename Heuristic>
+template <typename Roads>
+void CityMap<T, Heuristic>::BoundedCore(const Graph &graph, const Heuristic &heuristic, const Roads &roads, CityId firstCity, CityId secondCity, const RouteLimits &limits,
+                                        BoundedRoute<T> &route, const function<void(const BoundedRoute<T> &)> &improved)
+{
+    const unsigned int DEADLINE_INTERVAL = 16; // cities taken off the heap between looks at the clock
+    SearchWorkspace<T> &workspace = SearchWorkspace<T>::ForThisThread();
+    SearchSpace<T> &search = workspace.forward;
+    search.Start(graph.Size());
+    double weight = 1 + limits.epsilon;
+    vector<CityId> best;
+    bool found = false;
+
+    // takes the best path found and works out how close to the shortest it is proven to be
+    auto prove = [&]() {
+        T lower = route.distance;
+        for(size_t i = 0; i < search.heap.Size(); i++) {
+            CityId city = search.heap.At(i);
+            T h = heuristic.Estimate(graph, city, secondCity);
+            if (h != Unreachable<T>() && search.Distance(city) + h < lower) {
+                lower = search.Distance(city) + h;
+            }
+        }
+        double ratio = T() < lower ? double(route.distance) / double(lower) : (route.distance == T() ? 1 : weight);
+        route.bound = max(1.0, min(weight, ratio));
+        route.settled = search.SettledCount();
+        route.path = Names(graph, best);
+    };
+
+    T h = heuristic.Estimate(graph, firstCity, secondCity);
+    search.Reach(firstCity, 0, NO_CITY);
+    if (h != Unreachable<T>()) {
+        search.heap.Push(firstCity, T(double(h) * weight));
+    }
+    bool limited = false;
+    for(unsigned int popped = 0; !search.heap.Empty(); popped++) {
+        if ((limits.settleBudget > 0 && search.SettledCount() >= limits.settleBudget)
+            || (popped % DEADLINE_INTERVAL == 0 && chrono::steady_clock::now() >= limits.deadline)) {
+            limited = true;
+            break;
+        }
+        CityId currentCity = search.heap.PopMin();
+        T currentG = search.Distance(currentCity);
+        if (found && !(currentG + heuristic.Estimate(graph, currentCity, secondCity) < route.distance)) {
+            continue;
+        }
+        search.Settle(currentCity);
+        if (currentCity == secondCity) {
+            route.distance = currentG;
+            search.Path(currentCity, best);
+            found = true;
+            if (!limits.anytime) {
+                break;
+            }
+            if (improved) {
+                prove();
+                improved(route);
+            }
+            continue;
+        }
+
+        // gathers the neighbours reached for the first time or by a shorter way, settled ones included, which are opened again
+        workspace.batch.clear();
+        workspace.batchDistances.clear();
+        size_t relaxed = 0;
+        roads.ForEachRoad(currentCity, [&](CityId neighbour, T length) {
+            relaxed++;
+            T neighbourG = currentG + length;
+            if ((found && !(neighbourG < route.distance)) || (search.Reached(neighbour) && !(neighbourG < search.Distance(neighbour)))) {
+                return;
+            }
+            workspace.batch.push_back(neighbour);
+            workspace.batchDistances.push_back(neighbourG);
+        });
+        search.CountRelaxed(relaxed);
+        if (workspace.batch.empty()) {
+            continue;
+        }
+        workspace.batchEstimates.resize(workspace.batch.size());
+        heuristic.EstimateBatch(graph, &workspace.batch[0], workspace.batch.size(), secondCity, &workspace.batchEstimates[0]);
+        for(size_t i = 0; i < workspace.batch.size(); i++) {
+            CityId neighbour = workspace.batch[i];
+            T neighbourG = workspace.batchDistances[i];
+            T neighbourH = workspace.batchEstimates[i];
+            if (neighbourH == Unreachable<T>() || (found && !(neighbourG + neighbourH < route.distance))) {
+                continue;
+            }
+            bool queued = search.heap.Contains(neighbour);
+            search.Reach(neighbour, neighbourG, currentCity);
+            T key = neighbourG + T(double(neighbourH) * weight);
+            if (queued) {
+                search.heap.DecreaseKey(neighbour, key);
+            }
+            else {
+                search.heap.Push(neighbour, key);
+            }
+        }
+    }
+
+    route.finished = !limited;
+    route.settled = search.SettledCount();
+    if (found) {
+        prove();
+    }
+    else if (!limited) {
+        Error(PATH, graph.Name(firstCity) + " - " + graph.Name(secondCity), DOESNT_EXIST);
+    }
+}
+
+// takes a snapshot and two cities and gets the shortest distance between the two cities, and the cities on the shortest path if path is given,
+// searching forward from the first city and backward from the second until the searches meet;
+// each city gets the potential p(v) = (h(v, second) - h(first, v)) / 2, which is consistent in both directions,
+// so the forward search is ordered by g + p and the backward search by g - p, both kept doubled so no division is needed;
+// no shorter path can be found once the smallest keys of the two heaps add up to the best meeting found so far;
+// the distance is summed along the path from the first city, the same way the forward search sums it
+// precondition: the cities are in the snapshot
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::BidirectionalCore(const Graph &graph, const Heuristic &heuristic, CityId firstCity, CityId secondCity, vector<CityId> *path)
+{
+    SearchWorkspace<T> &workspace = SearchWorkspace<T>::ForThisThread();
+    SearchSpace<T> &forward = workspace.forward;
+    SearchSpace<T> &backward = workspace.backward;
+    forward.Start(graph.Size());
+    backward.Start(graph.Size());
+    T h = heuristic.Estimate(graph, firstCity, secondCity);
+    forward.Reach(firstCity, 0, NO_CITY);
+    backward.Reach(secondCity, 0, NO_CITY);
+    if (h != Unreachable<T>()) {
+        forward.heap.Push(firstCity, h);
+        backward.heap.Push(secondCity, h);
+    }
+
+    // the best path found so far runs through the road from meetingForward, reached forward, to meetingBackward, reached backward
+    CityId meetingForward = NO_CITY;
+    CityId meetingBackward = NO_CITY;
+    T best = T();
+    if (firstCity == secondCity && h != Unreachable<T>()) {
+        meetingForward = meetingBackward = firstCity;
+    }
+    while (!forward.heap.Empty() && !backward.heap.Empty()) {
+        if (meetingForward != NO_CITY && !(forward.heap.MinKey() + backward.heap.MinKey() < best + best)) {
+            break;
+        }
+        bool forwardTurn = !(backward.heap.MinKey() < forward.heap.MinKey());
+        SearchSpace<T> &search = forwardTurn ? forward : backward;
+        SearchSpace<T> &other = forwardTurn ? backward : forward;
+        CityId currentCity = search.heap.PopMin();
+        search.Settle(currentCity);
+        search.CountRelaxed(graph.LastRoad(currentCity) - graph.FirstRoad(currentCity));
+
+        T currentG = search.Distance(currentCity);
+        for(RoadId road = graph.FirstRoad(currentCity); road != graph.LastRoad(currentCity); road++) {
+            CityId neighbour = graph.Target(road);
+            if (search.Settled(neighbour)) {
+                continue;
+            }
+            T neighbourG = currentG + graph.Length(road);
+            bool neighbourNotOpen = !search.Reached(neighbour);
+            if (neighbourNotOpen || neighbourG < search.Distance(neighbour)) {
+                T toSecond = heuristic.Estimate(graph, neighbour, secondCity);
+                T fromFirst = heuristic.Estimate(graph, firstCity, neighbour);
+                // the heuristic may know the neighbour is cut off from one of the ends
+                if (toSecond == Unreachable<T>() || fromFirst == Unreachable<T>()) {
+                    continue;
+                }
+                search.Reach(neighbour, neighbourG, currentCity);
+                T key = neighbourG + neighbourG + (forwardTurn ? toSecond - fromFirst : fromFirst - toSecond);
+                if (neighbourNotOpen) {
+                    search.heap.Push(neighbour, key);
+                }
+                else {
+                    search.heap.ChangeKey(neighbour, key);
+                }
+                if (other.Reached(neighbour) && (meetingForward == NO_CITY || neighbourG + other.Distance(neighbour) < best)) {
+                    best = neighbourG + other.Distance(neighbour);
+                    meetingForward = forwardTurn ? currentCity : neighbour;
+                    meetingBackward = forwardTurn ? neighbour : currentCity;
                 }
             }
         }
     }
-    Error(PATH, firstCity + " - " + secondCity, DOESNT_EXIST);
-    return pair<vector<string>, T>();
+
+    if (meetingForward == NO_CITY) {
+        Error(PATH, graph.Name(firstCity) + " - " + graph.Name(secondCity), DOESNT_EXIST);
+        if (path) {
+            path->clear();
+        }
+        return T();
+    }
+    if (path) {
+        forward.Path(meetingForward, *path);
+    }
+    T distance = forward.Distance(meetingForward);
+    CityId previousCity = meetingForward;
+    for(CityId currentCity = meetingBackward; currentCity != NO_CITY; currentCity = backward.Parent(currentCity)) {
+        if (currentCity != previousCity) {
+            distance += graph.Length(graph.FindRoad(previousCity, currentCity));
+            if (path) {
+                path->push_back(currentCity);
+            }
+        }
+        previousCity = currentCity;
+    }
+    return distance;
 }
 
 
 
+// takes a change just made to the maps and remembers it until the next freeze;
+// once there are more changes than the snapshot has cities and roads, rebuilding is cheaper than replaying them
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::RecordChange(const GraphChange &change)
+{
+    graphStale = true;
+    publishDue = openBatches == 0;
+    if (!changesTracked) {
+        return;
+    }
+    if (changes.size() > size_t(current->graph->Size()) + (current->compressed ? current->compressed->RoadCount() : current->graph->RoadCount())) {
+        changes.clear();
+        changesTracked = false;
+        return;
+    }
+    changes.push_back(change);
+}
+
 //Public
-template <typename T>
-CityMap<T>::CityMap() : out(cout), err(cerr) {}
+template <typename T, typename Heuristic>
+CityMap<T, Heuristic>::CityMap() : CityMap(cout, cerr) {}
 
-template <typename T>
-CityMap<T>::CityMap(ostream &out, ostream &err) : out(out), err(err) {}
+// the first version has no cities
+template <typename T, typename Heuristic>
+CityMap<T, Heuristic>::CityMap(ostream &out, ostream &err) : mapsHydrated(true), graphStale(false), publishDue(false), openBatches(0), changesTracked(true), searchMode(SearchMode::AStar), spatiallyIndexed(false), out(out), err(err)
+{
+    shared_ptr<Version> first = make_shared<Version>();
+    first->number = 0;
+    first->graph = make_shared<const Graph>();
+    first->heuristic = make_shared<const Heuristic>();
+    current = first;
+}
 
-template <typename T>
-CityMap<T>::~CityMap() {}
+// versions are immutable, so the copy shares the current one; a batch open on other is not open on the copy
+template <typename T, typename Heuristic>
+CityMap<T, Heuristic>::CityMap(const CityMap &other) : openBatches(0), out(other.out), err(other.err)
+{
+    lock_guard<mutex> lock(other.writer);
+    cities = other.cities;
+    adjacentRoads = other.adjacentRoads;
+    current = atomic_load(&other.current);
+    mapsHydrated = other.mapsHydrated;
+    graphStale = other.graphStale;
+    publishDue = other.graphStale;
+    changes = other.changes;
+    keptTrees = other.keptTrees;
+    changesTracked = other.changesTracked;
+    searchMode = other.searchMode.load();
+    spatiallyIndexed = other.spatiallyIndexed.load();
+    routeCache.SetCapacity(other.routeCache.Capacity());
+}
+
+template <typename T, typename Heuristic>
+CityMap<T, Heuristic>::~CityMap() {}
 
 // add city and its coordinate to the cities map
-template <typename T>
-void CityMap<T>::AddCity(string cityName, T x, T y) {
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::AddCity(string cityName, T x, T y) {
+    lock_guard<mutex> lock(writer);
+    Hydrate();
     bool cityAdded = cities.insert(pair<string, Pos<T> >(cityName, Pos<T>(x,y))).second;
     if (!cityAdded) {
         Error(CITY, cityName, ALREADY_EXISTS);
@@ -193,14 +608,40 @@ void CityMap<T>::AddCity(string cityName, T x, T y) {
     else {
 
         adjacentRoads.insert(pair<string, map<string, T> >(cityName, map<string,T>() ));
+        RecordChange(GraphChange(GraphChange::CityAdded, cityName));
+        if (journal) {
+            Journaled(journal->AddCity(cityName, x, y));
+        }
+        lock_guard<mutex> streamGuard(streamLock);
         out << "Added "+ CITY+ ": "+cityName << endl;
     }
 };
 
 // add road to the adjacentRoads map with firstCity as key and with secondCity and distance between them as value
-template <typename T>
-void CityMap<T>::AddRoad(string firstCity, string secondCity)
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::AddRoad(string firstCity, string secondCity)
+{
+    InsertRoad(firstCity, secondCity, 0);
+}
+
+// takes two cities and the length of the road between them, which the metric must leave to the roads, and adds the road
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::AddRoad(string firstCity, string secondCity, T length)
 {
+    static_assert(Metric::EXPLICIT_LENGTHS, "roads are given lengths only with a metric of explicit lengths");
+    if (length < T()) {
+        Error(ROAD, firstCity + " - " + secondCity, CANT_BE_NEGATIVE);
+        return;
+    }
+    InsertRoad(firstCity, secondCity, &length);
+}
+
+// takes two cities and the length of the road between them, or null for the length the metric gives, and adds the road
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::InsertRoad(const string &firstCity, const string &secondCity, const T *length)
+{
+    lock_guard<mutex> lock(writer);
+    Hydrate();
    if (firstCity == secondCity) {
         Error(ROAD, firstCity + " - " + secondCity, MUST_BE_DIFFERENT);
     }
@@ -214,13 +655,18 @@ void CityMap<T>::AddRoad(string firstCity, string secondCity)
             Error(CITY, secondCity, DOESNT_EXIST);
         }
         else {
-            T roadLength = CartesianDistance(firstCity, secondCity);
+            T roadLength = length ? *length : CartesianDistance(firstCity, secondCity);
             bool roadAlreadyExisted = !(firstAdjacencies->second).insert(pair<string, T>(secondCity, roadLength )).second
                 || !(secondAdjacencies->second).insert(pair<string, T>(firstCity, roadLength )).second;
             if(roadAlreadyExisted) {
                 Error(ROAD, firstCity + " - "+secondCity, ALREADY_EXISTS);
             }
             else {
+                RecordChange(GraphChange(GraphChange::RoadAdded, firstCity, secondCity));
+                if (journal) {
+                    Journaled(journal->AddRoad(firstCity, secondCity, roadLength));
+                }
+                lock_guard<mutex> streamGuard(streamLock);
                 out << "Added "+ROAD+ ": "+firstCity+"-"+secondCity << endl;
             }
         }
@@ -228,34 +674,42 @@ void CityMap<T>::AddRoad(string firstCity, string secondCity)
 }
 
 // remove city from the cites map and all the roads connecting the city to other cities
-template <typename T>
-void CityMap<T>::RemoveCity(string cityName)
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::RemoveCity(string cityName)
 {
+    lock_guard<mutex> lock(writer);
+    Hydrate();
     typename map<string, Pos<T> >::iterator cityIt = cities.find(cityName);
     if (cityIt == cities.end()) {
         Error(CITY, cityName, DOESNT_EXIST);
     }
     else {
         typename map<string, map<string, T> >::iterator adjacentRoadsIt = adjacentRoads.find(cityName);
-        map<string, T> roadsToRemove = adjacentRoadsIt->second;
+        map<string, T> &roadsToRemove = adjacentRoadsIt->second;
 
         for(typename map<string, T>::iterator roadsToRemoveIt = roadsToRemove.begin(); roadsToRemoveIt != roadsToRemove.end(); roadsToRemoveIt++) {
             string neighbour = roadsToRemoveIt->first;
-            map<string, T> neighbourRoads = adjacentRoads.find(neighbour)->second;
+            map<string, T> &neighbourRoads = adjacentRoads.find(neighbour)->second;
 
             neighbourRoads.erase(cityName);
+            RecordChange(GraphChange(GraphChange::RoadRemoved, cityName, neighbour));
+        }
+        adjacentRoads.erase(adjacentRoadsIt);
+        cities.erase(cityIt);
+        RecordChange(GraphChange(GraphChange::CityRemoved, cityName));
+        if (journal) {
+            Journaled(journal->RemoveCity(cityName));
         }
-        roadsToRemove.clear();
-        adjacentRoads.erase(cityName);
-        cities.erase(cityName);
     }
 }
 
 
 // remove road between two cities
-template <typename T>
-void CityMap<T>::RemoveRoad(string firstCity, string secondCity)
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::RemoveRoad(string firstCity, string secondCity)
 {
+    lock_guard<mutex> lock(writer);
+    Hydrate();
     typename map<string, map<string, T> >::iterator firstAdjacentRoadsIt = adjacentRoads.find(firstCity);
     typename map<string, map<string, T> >::iterator secondAdjacentRoadsIt = adjacentRoads.find(secondCity);
 
@@ -266,8 +720,8 @@ void CityMap<T>::RemoveRoad(string firstCity, string secondCity)
         Error(CITY, secondCity, DOESNT_EXIST);
     }
     else {
-        map<string, T> firstAdjacentRoads = (firstAdjacentRoadsIt->second);
-        map<string, T> secondAdjacentRoads = (secondAdjacentRoadsIt->second);
+        map<string, T> &firstAdjacentRoads = (firstAdjacentRoadsIt->second);
+        map<string, T> &secondAdjacentRoads = (secondAdjacentRoadsIt->second);
         bool secondToFirstExists = secondAdjacentRoads.find(firstCity) != secondAdjacentRoads.end();
         bool firstToSecondExists =  firstAdjacentRoads.find(secondCity) != firstAdjacentRoads.end();
         if (!(secondToFirstExists && firstToSecondExists)) {
@@ -276,47 +730,906 @@ void CityMap<T>::RemoveRoad(string firstCity, string secondCity)
         else {
             firstAdjacentRoads.erase(secondCity);
             secondAdjacentRoads.erase(firstCity);
+            RecordChange(GraphChange(GraphChange::RoadRemoved, firstCity, secondCity));
+            if (journal) {
+                Journaled(journal->RemoveRoad(firstCity, secondCity));
+            }
+        }
+    }
+}
+
+// publishes a version rebuilt from the cities and adjacentRoads maps, even while a batch is open
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::Freeze()
+{
+    lock_guard<mutex> lock(writer);
+    Publish();
+}
+
+// builds a version from the maps, refreshing a copy of the heuristic of the current one, and makes it current;
+// queries still running on the old version keep it alive until they are done;
+// when only roads have changed since the current version, the cities and their ids are the same, so rather than build the snapshot
+// from the maps again, the current one is patched: the rows of the cities at the ends of the changed roads are read from the maps,
+// the other rows are copied (see CityGraph::WithRows) and the cities are shared;
+// this does not make publishing independent of the size of the map: copying the road arrays is still linear in the roads,
+// if only at the speed of memcpy, and in the overlay mode the cells a change reaches are customized again, up to a whole cell
+// of the highest level, a quarter of the map, when its clique changes; adding or removing a city, or publishing in the compressed
+// mode, still builds the snapshot anew
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::Publish()
+{
+    Hydrate();
+    const Graph &graph = *current->graph;
+    bool citiesChanged = !changesTracked || current->compressed;
+    for(vector<GraphChange>::iterator it = changes.begin(); it != changes.end() && !citiesChanged; it++) {
+        citiesChanged = it->kind == GraphChange::CityAdded || it->kind == GraphChange::CityRemoved;
+    }
+    map<CityId, vector<pair<CityId, T> > > rows;
+    for(vector<GraphChange>::iterator it = changes.begin(); it != changes.end() && !citiesChanged; it++) {
+        string ends[] = { it->first, it->second };
+        for(int end = 0; end < 2; end++) {
+            CityId city = graph.Find(ends[end]);
+            if (rows.find(city) != rows.end()) {
+                continue;
+            }
+            vector<pair<CityId, T> > &row = rows[city];
+            const map<string, T> &roads = adjacentRoads.find(ends[end])->second;
+            for(typename map<string, T>::const_iterator road = roads.begin(); road != roads.end(); road++) {
+                row.push_back(pair<CityId, T>(graph.Find(road->first), road->second));
+            }
+            sort(row.begin(), row.end(), [](const pair<CityId, T> &a, const pair<CityId, T> &b) { return a.first < b.first; });
+        }
+    }
+    if (citiesChanged) {
+        PublishGraph(make_shared<const Graph>(cities, adjacentRoads), changesTracked ? &changes : 0);
+    }
+    else {
+        PublishGraph(rows.empty() ? current->graph : make_shared<const Graph>(graph.WithRows(rows)), &changes);
+    }
+}
+
+// takes a snapshot and the changes from the current version to it, or null when they are unknown,
+// and makes a version of it, with a refreshed copy of the heuristic and whatever the mode needs, current
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::PublishGraph(const shared_ptr<const Graph> &graph, const vector<GraphChange> *graphChanges)
+{
+    // from here the maps hold what the snapshot does, which Preprocess relies on
+    graphStale = false;
+    shared_ptr<const Version> previous = current;
+    shared_ptr<Version> next = make_shared<Version>();
+    next->number = previous->number + 1;
+    shared_ptr<Heuristic> heuristic = make_shared<Heuristic>(*previous->heuristic);
+    heuristic->Refresh(*previous->graph, *graph, graphChanges);
+    next->graph = graph;
+    next->heuristic = heuristic;
+    Preprocess(*next, *previous, graphChanges);
+    if (spatiallyIndexed && previous->spatialIndex && graphChanges) {
+        next->spatialIndex = make_shared<const SpatialIndex<T, Metric> >(*previous->spatialIndex, *graph, *graphChanges);
+    }
+    else if (spatiallyIndexed) {
+        next->spatialIndex = make_shared<const SpatialIndex<T, Metric> >(*graph);
+    }
+    routeCache.Published(next->number, *graph, graphChanges);
+    for(typename map<string, KeptPathTree>::iterator it = keptTrees.begin(); it != keptTrees.end(); it++) {
+        it->second.Update(*previous->graph, graph, graphChanges);
+    }
+    atomic_store(&current, shared_ptr<const Version>(next));
+    publishDue = false;
+    changes.clear();
+    changesTracked = true;
+}
+
+// takes a version being made, the version before it and the changes between their snapshots, or null when they are unknown,
+// and adds the hierarchy, overlay, labels or compressed roads the search mode needs which the version does not have yet; gets whether it added any
+template <typename T, typename Heuristic>
+bool CityMap<T, Heuristic>::Preprocess(Version &next, const Version &previous, const vector<GraphChange> *graphChanges)
+{
+    SearchMode mode = searchMode;
+    bool added = false;
+    if ((mode == SearchMode::ContractionHierarchy || mode == SearchMode::HubLabels) && !next.hierarchy) {
+        next.hierarchy = make_shared<const ContractionHierarchy<T> >(*next.graph);
+        added = true;
+    }
+    if (mode == SearchMode::PartitionOverlay && !next.overlay) {
+        // only the cells holding changed roads are customized again, the rest are shared with the previous overlay
+        next.overlay = make_shared<const PartitionOverlay<T> >(*next.graph, previous.overlay.get(), graphChanges);
+        added = true;
+    }
+    if (mode == SearchMode::HubLabels && !next.labels) {
+        next.labels = make_shared<const HubLabels<T> >(*next.hierarchy);
+        added = true;
+    }
+    if (mode == SearchMode::Compressed && !next.compressed) {
+        // the version keeps only the cities and the compressed roads, and the maps are emptied too, to be filled from them when next edited;
+        // maps holding edits not published yet, as in an open batch, are all there is of those edits, so they are kept until they are
+        next.compressed = make_shared<const CompressedRoads<T, Metric, typename Graph::LengthType> >(*next.graph);
+        next.graph = make_shared<const Graph>(next.compressed->Cities());
+        if (!graphStale) {
+            cities.clear();
+            adjacentRoads.clear();
+            mapsHydrated = false;
+        }
+        added = true;
+    }
+    return added;
+}
+
+// takes a version and gets its snapshot with its roads: the snapshot itself, or, in the compressed mode, one of the same cities
+// with the roads decoded, which is only kept for as long as the caller needs the roads in that form
+template <typename T, typename Heuristic>
+shared_ptr<const typename CityMap<T, Heuristic>::Graph> CityMap<T, Heuristic>::RoadGraph(const Version &version)
+{
+    if (!version.compressed) {
+        return version.graph;
+    }
+    return make_shared<const Graph>(version.graph->WithRoads(*version.compressed));
+}
+
+// takes a version and two cities with a road between them and gets its length, from the snapshot or the compressed roads
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::RoadLength(const Version &version, CityId from, CityId to)
+{
+    if (!version.compressed) {
+        return version.graph->Length(version.graph->FindRoad(from, to));
+    }
+    T length = T();
+    version.compressed->ForEachRoad(from, [&](CityId target, T roadLength) {
+        if (target == to) {
+            length = roadLength;
+        }
+    });
+    return length;
+}
+
+// fills the empty maps with the cities and roads of the current version, which was opened from a map file or has its roads compressed
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::Hydrate()
+{
+    if (mapsHydrated) {
+        return;
+    }
+    Fill(*RoadGraph(*current));
+    mapsHydrated = true;
+}
+
+// takes a snapshot and makes the maps hold its cities and roads; cities are taken in name order, so every city goes
+// at the end of the maps, while the roads of a city are in order of target id and go wherever their names belong
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::Fill(const Graph &graph)
+{
+    cities.clear();
+    adjacentRoads.clear();
+    for(CityId position = 0; position < graph.Size(); position++) {
+        CityId city = graph.ByName(position);
+        string cityName = graph.Name(city);
+        cities.insert(cities.end(), pair<string, Pos<T> >(cityName, Pos<T>(graph.X(city), graph.Y(city))));
+        map<string, T> &roads = adjacentRoads.insert(adjacentRoads.end(), pair<string, map<string, T> >(cityName, map<string, T>()))->second;
+        for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+            roads.insert(pair<string, T>(graph.Name(graph.Target(road)), graph.Length(road)));
         }
     }
 }
 
+// takes edits read from a journal, which were all made to the maps successfully when they were recorded, and makes them again,
+// quietly and under the one lock the caller holds; the changes are not tracked, as the current version is not what they were made to
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::Replay(const vector<JournalEntry<T> > &entries)
+{
+    changes.clear();
+    changesTracked = false;
+    for(typename vector<JournalEntry<T> >::const_iterator it = entries.begin(); it != entries.end(); it++) {
+        typename map<string, map<string, T> >::iterator firstRoads = adjacentRoads.find(it->first);
+        typename map<string, map<string, T> >::iterator secondRoads = adjacentRoads.find(it->second);
+        switch (it->kind) {
+            case JournalEntryKind::CityAdded:
+                if (cities.insert(pair<string, Pos<T> >(it->first, Pos<T>(it->x, it->y))).second) {
+                    adjacentRoads.insert(pair<string, map<string, T> >(it->first, map<string, T>()));
+                }
+                break;
+            case JournalEntryKind::RoadAdded:
+                if (firstRoads != adjacentRoads.end() && secondRoads != adjacentRoads.end() && firstRoads != secondRoads) {
+                    firstRoads->second.insert(pair<string, T>(it->second, it->length));
+                    secondRoads->second.insert(pair<string, T>(it->first, it->length));
+                }
+                break;
+            case JournalEntryKind::CityRemoved:
+                if (firstRoads != adjacentRoads.end()) {
+                    for(typename map<string, T>::iterator road = firstRoads->second.begin(); road != firstRoads->second.end(); road++) {
+                        adjacentRoads.find(road->first)->second.erase(it->first);
+                    }
+                    adjacentRoads.erase(firstRoads);
+                    cities.erase(it->first);
+                }
+                break;
+            case JournalEntryKind::RoadRemoved:
+                if (firstRoads != adjacentRoads.end() && secondRoads != adjacentRoads.end()) {
+                    firstRoads->second.erase(it->second);
+                    secondRoads->second.erase(it->first);
+                }
+                break;
+        }
+    }
+    graphStale = true;
+}
+
+// takes a path and writes the snapshot of the current version there as a map file
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::Save(string path)
+{
+    if (!RoadGraph(*CurrentVersion())->Save(path)) {
+        Error(SNAPSHOT_FILE, path, CANT_BE_WRITTEN);
+    }
+}
+
+// takes the path of a map file and makes its snapshot, mapped read-only, the current version, with no parsing;
+// the maps are only filled from it when the cities or roads are first edited; a file which is not valid leaves the map as it was;
+// only the header of the file is checked unless verify is set, which reads the whole file (see CityGraph::OpenMapped)
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::OpenMapped(string path, bool verify)
+{
+    lock_guard<mutex> lock(writer);
+    shared_ptr<Graph> graph = make_shared<Graph>();
+    MapFileStatus status = graph->OpenMapped(path, verify);
+    if (status != MapFileStatus::Ok) {
+        Error(SNAPSHOT_FILE, path, status == MapFileStatus::Unreadable ? CANT_BE_READ : (status == MapFileStatus::WrongFormat ? WRONG_FORMAT : IS_CORRUPT));
+        return;
+    }
+    cities.clear();
+    adjacentRoads.clear();
+    mapsHydrated = false;
+    PublishGraph(graph, 0);
+    if (journal) {
+        CompactJournal(true);
+    }
+}
+
+// takes streams of city lines (name, x, y) and road lines (two names), separated by commas or tabs, and adds them all as one version,
+// building its snapshot directly rather than going through the maps, which are only filled from it when next edited;
+// the memory budget bounds the roads held at once, the rest waiting in temporary files;
+// lines which cannot be used are skipped and described in the report rather than displayed, as there may be very many
+template <typename T, typename Heuristic>
+ImportReport CityMap<T, Heuristic>::Import(istream &cityInput, istream &roadInput, size_t memoryBudget)
+{
+    lock_guard<mutex> lock(writer);
+    if (graphStale) {
+        Publish();
+    }
+    static_assert(!Metric::EXPLICIT_LENGTHS, "imported roads have no lengths of their own");
+    BulkImporter<T, Metric, typename Graph::LengthType> importer(memoryBudget);
+    importer.Seed(*current->graph);
+    importer.ReadCities(cityInput);
+    importer.ReadRoads(roadInput);
+    shared_ptr<const Graph> graph = importer.Build();
+    cities.clear();
+    adjacentRoads.clear();
+    mapsHydrated = false;
+    PublishGraph(graph, 0);
+    if (journal) {
+        CompactJournal(true);
+    }
+    return importer.Report();
+}
+
+// takes the path files of a journal are named after (see MapJournal) and makes the map what was recorded there: the latest snapshot
+// which can be opened, with the edits the journals since recorded made again in one go, all published as one version;
+// without any edits to make the snapshot is used mapped, as with OpenMapped; with nothing recorded there yet, the map is
+// kept as it is and saved as the first snapshot; later edits are recorded in the journal until it is closed;
+// when the snapshot a journal has to follow is missing, the map is left as it was and nothing is recorded
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::OpenJournal(string path, const JournalOptions &options)
+{
+    lock_guard<mutex> lock(writer);
+    journal.reset();
+    unique_ptr<MapJournal<T> > opened(new MapJournal<T>(path, options));
+    vector<uint64_t> snapshots = opened->Snapshots();
+    vector<uint64_t> journals = opened->Journals();
+    if (snapshots.empty() && journals.empty()) {
+        journal = move(opened);
+        if (graphStale) {
+            Publish();
+        }
+        CompactJournal(true);
+        return;
+    }
+
+    // a snapshot which cannot be opened is passed over for an older one, whose journals lead to the same map;
+    // recovery is when damage would otherwise go unnoticed, so the snapshots are verified whole
+    shared_ptr<Graph> graph;
+    uint64_t firstGeneration = journals.empty() ? 0 : journals.front();
+    for(vector<uint64_t>::iterator it = snapshots.begin(); it != snapshots.end() && !graph; it++) {
+        shared_ptr<Graph> snapshot = make_shared<Graph>();
+        MapFileStatus status = snapshot->OpenMapped(opened->SnapshotPath(*it), true);
+        if (status == MapFileStatus::Ok) {
+            graph = snapshot;
+            firstGeneration = *it;
+        }
+        else {
+            Error(SNAPSHOT_FILE, opened->SnapshotPath(*it), status == MapFileStatus::Unreadable ? CANT_BE_READ : (status == MapFileStatus::WrongFormat ? WRONG_FORMAT : IS_CORRUPT));
+        }
+    }
+    bool snapshotLoaded = graph != 0;
+    if (!graph) {
+        graph = make_shared<Graph>();
+    }
+    vector<JournalEntry<T> > entries;
+    JournalRecovery recovery = opened->Recover(firstGeneration, snapshotLoaded, entries);
+    if (recovery == JournalRecovery::SnapshotMissing) {
+        // the edits after the missing snapshot were made to a map nothing else here holds, so the map is left as it was
+        Error(SNAPSHOT_FILE, opened->SnapshotPath(opened->Generation()), DOESNT_EXIST);
+        return;
+    }
+    if (recovery == JournalRecovery::Unwritable) {
+        Error(JOURNAL_FILE, opened->Path(), CANT_BE_WRITTEN);
+    }
+    if (entries.empty()) {
+        cities.clear();
+        adjacentRoads.clear();
+        mapsHydrated = false;
+        PublishGraph(graph, 0);
+    }
+    else {
+        Fill(*graph);
+        mapsHydrated = true;
+        Replay(entries);
+        Publish();
+    }
+    journal = move(opened);
+}
+
+// writes and syncs the edits the journal holds, so they survive a crash
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::SyncJournal()
+{
+    lock_guard<mutex> lock(writer);
+    if (journal) {
+        Journaled(journal->Sync());
+    }
+}
+
+// syncs the journal and stops recording edits in it, once a snapshot it is saving is on disk
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::CloseJournal()
+{
+    lock_guard<mutex> lock(writer);
+    if (journal && !journal->Sync()) {
+        Error(JOURNAL_FILE, journal->Path(), CANT_BE_WRITTEN);
+    }
+    journal.reset();
+}
+
+template <typename T, typename Heuristic>
+JournalStats CityMap<T, Heuristic>::GetJournalStats() const
+{
+    lock_guard<mutex> lock(writer);
+    return journal ? journal->Stats() : JournalStats();
+}
+
+// takes whether the journal recorded an edit, or synced, and reports it if it did not; outside a batch, a journal which has
+// grown large enough is compacted, so the journal replayed after a restart stays short
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::Journaled(bool recorded)
+{
+    if (!recorded) {
+        Error(JOURNAL_FILE, journal->Path(), CANT_BE_WRITTEN);
+    }
+    else if (openBatches == 0 && journal->CompactionDue()) {
+        if (graphStale) {
+            Publish();
+        }
+        CompactJournal(false);
+    }
+}
+
+// takes whether the map was just replaced as a whole and makes the current version the snapshot of a new journal generation,
+// which the journal saves while edits go on, or right away after a replacement; a replacement whose snapshot cannot be
+// saved cannot be recorded at all, so the journal is closed rather than go on recording edits to a map it does not lead to
+// precondition: a journal is open and the current version holds every edit it has recorded
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::CompactJournal(bool replaced)
+{
+    if (journal->Compact(RoadGraph(*current), replaced)) {
+        return;
+    }
+    if (replaced) {
+        Error(SNAPSHOT_FILE, journal->SnapshotPath(journal->Generation() + 1), CANT_BE_WRITTEN);
+        journal.reset();
+    }
+    else {
+        Error(JOURNAL_FILE, journal->Path(), CANT_BE_WRITTEN);
+    }
+}
+
+// gets the version queries run against, publishing the edits made outside a batch first;
+// unless there are such edits, no lock is taken
+template <typename T, typename Heuristic>
+shared_ptr<const CityMapVersion<T, Heuristic> > CityMap<T, Heuristic>::CurrentVersion()
+{
+    if (publishDue) {
+        lock_guard<mutex> lock(writer);
+        if (publishDue) {
+            Publish();
+        }
+    }
+    return atomic_load(&current);
+}
+
+// gets the latest version with a spatial index; the first position query of a map publishes the current snapshot again with one,
+// and from then on every version is published with its own, brought up to date from the index before with the cities added and
+// removed, so AddCity and RemoveCity are reflected once they are published without building the index again
+template <typename T, typename Heuristic>
+shared_ptr<const CityMapVersion<T, Heuristic> > CityMap<T, Heuristic>::IndexedVersion()
+{
+    shared_ptr<const Version> version = CurrentVersion();
+    if (version->spatialIndex) {
+        return version;
+    }
+    lock_guard<mutex> lock(writer);
+    spatiallyIndexed = true;
+    if (!current->spatialIndex) {
+        shared_ptr<Version> next = make_shared<Version>(*current);
+        next->number = current->number + 1;
+        next->spatialIndex = make_shared<const SpatialIndex<T, Metric> >(*current->graph);
+        atomic_store(&current, shared_ptr<const Version>(next));
+    }
+    return current;
+}
+
+template <typename T, typename Heuristic>
+vector<string> CityMap<T, Heuristic>::Names(const Graph &graph, const vector<CityId> &ids)
+{
+    vector<string> cityNames;
+    cityNames.reserve(ids.size());
+    for(vector<CityId>::const_iterator it = ids.begin(); it != ids.end(); it++) {
+        cityNames.push_back(graph.Name(*it));
+    }
+    return cityNames;
+}
+
+// takes a point and gets the name of the city closest to it, for snapping positions to cities
+template <typename T, typename Heuristic>
+string CityMap<T, Heuristic>::NearestCity(T x, T y)
+{
+    shared_ptr<const Version> version = IndexedVersion();
+    return version->spatialIndex->Nearest(x, y);
+}
+
+// takes a point and a number and gets the names of that many cities closest to the point, or of all cities if there are fewer
+template <typename T, typename Heuristic>
+vector<string> CityMap<T, Heuristic>::KNearest(T x, T y, size_t k)
+{
+    shared_ptr<const Version> version = IndexedVersion();
+    return version->spatialIndex->KNearest(x, y, k);
+}
+
+// takes a point and a radius and gets the names of the cities within the radius of the point
+template <typename T, typename Heuristic>
+vector<string> CityMap<T, Heuristic>::CitiesWithin(T x, T y, T radius)
+{
+    shared_ptr<const Version> version = IndexedVersion();
+    return version->spatialIndex->Within(x, y, radius);
+}
+
+// starts a batch of edits, which queries do not see until the batch ends; batches may be nested
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::BeginBatch()
+{
+    lock_guard<mutex> lock(writer);
+    openBatches++;
+    publishDue = false;
+}
+
+// ends a batch of edits, and when it is the outermost one, publishes them all at once
+// precondition: a batch is open
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::EndBatch()
+{
+    lock_guard<mutex> lock(writer);
+    openBatches--;
+    if (openBatches == 0 && graphStale) {
+        Publish();
+    }
+    if (openBatches == 0 && journal) {
+        Journaled(journal->Sync());
+    }
+}
+
+// takes a search mode and uses it for later queries;
+// the preprocessing the mode needs is done now, and again for every version published while the mode is in use;
+// leaving the compressed mode decodes the roads of the current version back into its snapshot, which the other modes search
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::SetSearchMode(SearchMode mode)
+{
+    lock_guard<mutex> lock(writer);
+    searchMode = mode;
+    bool decompress = mode != SearchMode::Compressed && current->compressed && !publishDue;
+    if ((mode == SearchMode::AStar || mode == SearchMode::Bidirectional) && !decompress) {
+        return;
+    }
+    if (publishDue) {
+        Publish();
+        return;
+    }
+    // the same snapshot again, with what the mode needs, unless the current version has it all already
+    shared_ptr<Version> next = make_shared<Version>(*current);
+    if (decompress) {
+        next->graph = RoadGraph(*current);
+        next->compressed.reset();
+    }
+    if (Preprocess(*next, *current, 0) || decompress) {
+        next->number = current->number + 1;
+        atomic_store(&current, shared_ptr<const Version>(next));
+    }
+}
+
+// gets the report of the hub labels of the current version, all zero if it was not published in the hub label mode
+template <typename T, typename Heuristic>
+HubLabelReport CityMap<T, Heuristic>::GetHubLabelReport()
+{
+    shared_ptr<const Version> version = CurrentVersion();
+    return version->labels ? version->labels->Report() : HubLabelReport();
+}
+
+// gets the statistics of the route queries of every map of the process, searched for rather than found in a route cache;
+// without CITYMAP_STATS nothing is counted, and the snapshot is all zero with enabled false
+template <typename T, typename Heuristic>
+CityMapStats CityMap<T, Heuristic>::Stats() const
+{
+#ifdef CITYMAP_STATS
+    return QueryStatistics::Process().Snapshot();
+#else
+    return CityMapStats();
+#endif
+}
+
+// takes a version and two cities and gets the shortest distance between them, and the cities on the shortest path if path is given,
+// with the engine of the current search mode; a version published before the mode was chosen has no hierarchy, overlay, labels
+// or compressed roads, so A* over the snapshot stands in for it; hub labels only hold distances, so paths in the hub label mode come from the hierarchy under them
+// precondition: the cities are in the snapshot of the version
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::EngineRoute(const Version &version, CityId firstCity, CityId secondCity, vector<CityId> *path)
+{
+    SearchMode mode = searchMode;
+    bool labelled = mode == SearchMode::HubLabels && version.labels && !path;
+    bool hierarchical = (mode == SearchMode::ContractionHierarchy || mode == SearchMode::HubLabels) && version.hierarchy;
+    bool overlaid = mode == SearchMode::PartitionOverlay && version.overlay;
+    if (labelled || hierarchical || overlaid) {
+        T distance = T();
+        const Graph &graph = *version.graph;
+        const Heuristic &heuristic = *version.heuristic;
+        bool found;
+        if (labelled) {
+            distance = version.labels->Distance(firstCity, secondCity);
+            found = distance != Unreachable<T>();
+        }
+        else if (hierarchical) {
+            found = version.hierarchy->Query(firstCity, secondCity, distance, path);
+        }
+        else {
+            found = version.overlay->Query(graph, firstCity, secondCity, [&](CityId city, CityId target) { return heuristic.Estimate(graph, city, target); }, distance, path);
+        }
+        if (!found) {
+            Error(PATH, version.graph->Name(firstCity) + " - " + version.graph->Name(secondCity), DOESNT_EXIST);
+            if (path) {
+                path->clear();
+            }
+            return T();
+        }
+        return distance;
+    }
+    // a version with compressed roads has no others, whatever the mode has been changed to since it was published
+    if (version.compressed) {
+        return ShortestPathCore(*version.graph, *version.heuristic, *version.compressed, firstCity, secondCity, path);
+    }
+    if (mode == SearchMode::Bidirectional) {
+        return BidirectionalCore(*version.graph, *version.heuristic, firstCity, secondCity, path);
+    }
+    return ShortestPathCore(*version.graph, *version.heuristic, *version.graph, firstCity, secondCity, path);
+}
+
+// the same, timing the search and adding its work to the statistics when they are kept
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::Route(const Version &version, CityId firstCity, CityId secondCity, vector<CityId> *path)
+{
+#ifdef CITYMAP_STATS
+    QueryProbe<T> probe;
+    T distance = EngineRoute(version, firstCity, secondCity, path);
+    probe.Finish(path ? path->size() : 0, distance);
+    return distance;
+#else
+    return EngineRoute(version, firstCity, secondCity, path);
+#endif
+}
+
+// takes a version, two cities by name and by id and gets the shortest distance between them, and the cities on the path if path is given;
+// a fresh route from the route cache is used if there is one, otherwise the route is searched for and cached;
+// the cache is keyed by name, so the names are only copied when it is on
+// precondition: the cities are in the snapshot of the version
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::CachedRoute(const Version &version, string_view firstName, string_view secondName, CityId first, CityId second, vector<string> *path)
+{
+    bool caching = routeCache.Enabled();
+    if (!caching && !path) {
+        return Route(version, first, second, 0);
+    }
+    string firstCity = caching ? string(firstName) : string();
+    string secondCity = caching ? string(secondName) : string();
+    T distance;
+    if (caching && routeCache.Find(firstCity, secondCity, version.number, distance, path)) {
+        return distance;
+    }
+    vector<CityId> roads;
+    distance = Route(version, first, second, &roads);
+    vector<string> cityPath;
+    cityPath.reserve(roads.size());
+    for(vector<CityId>::iterator it = roads.begin(); it != roads.end(); it++) {
+        cityPath.push_back(version.graph->Name(*it));
+    }
+    if (caching && !roads.empty()) {
+        routeCache.Insert(firstCity, secondCity, version.number, *version.graph, distance, cityPath);
+    }
+    if (path) {
+        path->swap(cityPath);
+    }
+    return distance;
+}
+
 // takes two cities and find the shortest distance between them
 // precondition: the cities are added in the cities map
-template <typename T>
-T CityMap<T>::FindDistance(string firstCity, string secondCity)
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::FindDistance(string_view firstCity, string_view secondCity)
 {
-    pair<vector<string>, T> res = ShortestPathCore(firstCity, secondCity);
-    return res.second;
+    shared_ptr<const Version> version = CurrentVersion();
+    const Graph &graph = *version->graph;
+    CityId first, second;
+    if (!FindCities(graph, firstCity, secondCity, first, second)) {
+        return T();
+    }
+    return CachedRoute(*version, firstCity, secondCity, first, second, 0);
 }
 
 // takes two cities and gets all the cities visited on the shortest path
 // precondition: the cities are added in the cities map
-template <typename T>
-vector<string> CityMap<T>::ShortestPath(string firstCity, string secondCity)
+template <typename T, typename Heuristic>
+vector<string> CityMap<T, Heuristic>::ShortestPath(string_view firstCity, string_view secondCity)
 {
     vector<string> cityPath;
-    vector<string> roads = ShortestPathCore(firstCity, secondCity).first;
-    for(vector<string>::iterator it = roads.begin(); it != roads.end(); it++) {
-        cityPath.push_back(*it);
+    shared_ptr<const Version> version = CurrentVersion();
+    const Graph &graph = *version->graph;
+    CityId first, second;
+    if (!FindCities(graph, firstCity, secondCity, first, second)) {
+        return cityPath;
     }
+    CachedRoute(*version, firstCity, secondCity, first, second, &cityPath);
     return cityPath;
 }
 
+// takes two cities and limits and gets a path between them which may be longer than the shortest, with a proven bound of how much,
+// found by weighted A* over the current snapshot; in the anytime mode improved is called with every shorter path found after the first,
+// while the search goes on; the engine of the search mode and the route cache are not used, but the query is counted in the statistics
+// precondition: the cities are added in the cities map
+template <typename T, typename Heuristic>
+BoundedRoute<T> CityMap<T, Heuristic>::BoundedPath(string_view firstCity, string_view secondCity, const RouteLimits &limits,
+                                                   const function<void(const BoundedRoute<T> &)> &improved)
+{
+    BoundedRoute<T> route;
+    shared_ptr<const Version> version = CurrentVersion();
+    CityId first, second;
+    if (!FindCities(*version->graph, firstCity, secondCity, first, second)) {
+        return route;
+    }
+#ifdef CITYMAP_STATS
+    QueryProbe<T> probe;
+#endif
+    if (version->compressed) {
+        BoundedCore(*version->graph, *version->heuristic, *version->compressed, first, second, limits, route, improved);
+    }
+    else {
+        BoundedCore(*version->graph, *version->heuristic, *version->graph, first, second, limits, route, improved);
+    }
+#ifdef CITYMAP_STATS
+    probe.Finish(route.path.size(), route.distance);
+#endif
+    return route;
+}
+
+// takes a version and two cities of its snapshot, as found with version.graph->Find, and gets the shortest distance between them;
+// the names are neither looked up nor copied, and the route cache, which is keyed by name, is not used
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::FindDistance(const Version &version, CityId firstCity, CityId secondCity)
+{
+    vector<CityId> *noPath = 0;
+    if (!ValidCities(version, firstCity, secondCity, noPath)) {
+        return T();
+    }
+    return Route(version, firstCity, secondCity, noPath);
+}
+
+// takes a version and two cities of its snapshot and gets the shortest distance between them, filling path with the ids of the cities
+// on the shortest path, which the snapshot of the version names; a path vector kept by the caller across queries is refilled in place,
+// so once it has grown to the longest path, queries do not allocate
+template <typename T, typename Heuristic>
+T CityMap<T, Heuristic>::ShortestPath(const Version &version, CityId firstCity, CityId secondCity, vector<CityId> &path)
+{
+    if (!ValidCities(version, firstCity, secondCity, &path)) {
+        return T();
+    }
+    return Route(version, firstCity, secondCity, &path);
+}
+
+// takes a version and two city ids and checks they are cities of its snapshot, reporting the first which is not and clearing path if given
+template <typename T, typename Heuristic>
+bool CityMap<T, Heuristic>::ValidCities(const Version &version, CityId firstCity, CityId secondCity, vector<CityId> *path)
+{
+    CityId bad = firstCity >= version.graph->Size() ? firstCity : (secondCity >= version.graph->Size() ? secondCity : NO_CITY);
+    if (bad == NO_CITY && firstCity != NO_CITY && secondCity != NO_CITY) {
+        return true;
+    }
+    Error(CITY, bad == NO_CITY ? string("NO_CITY") : to_string(bad), DOESNT_EXIST);
+    if (path) {
+        path->clear();
+    }
+    return false;
+}
+
 // takes two cities as start and destination and prints all the cities visited on the shortest path and the distances between each
 // precondition: the cities are in the cities map
-template <typename T>
-void CityMap<T>::PrintPath(string firstCity, string secondCity)
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::PrintPath(string_view firstCity, string_view secondCity)
 {
-    vector<string> roads = ShortestPath(firstCity, secondCity);
-    string previousCity;
-    for(vector<string>::iterator it = roads.begin(); it != roads.end(); it++) {
-        string currentCity = (*it);
-        if (previousCity != "") {
-            out << CartesianDistance(previousCity, currentCity) << endl;
+    shared_ptr<const Version> version = CurrentVersion();
+    const Graph &graph = *version->graph;
+    CityId first, second;
+    if (!FindCities(graph, firstCity, secondCity, first, second)) {
+        return;
+    }
+    vector<string> cityPath;
+    CachedRoute(*version, firstCity, secondCity, first, second, &cityPath);
+    lock_guard<mutex> lock(streamLock);
+    CityId previousCity = NO_CITY;
+    for(vector<string>::iterator it = cityPath.begin(); it != cityPath.end(); it++) {
+        CityId currentCity = graph.Find(*it);
+        if (previousCity != NO_CITY) {
+            out << RoadLength(*version, previousCity, currentCity) << endl;
         }
-        out << currentCity << endl;
+        out << graph.Name(currentCity) << endl;
         previousCity = currentCity;
     }
 }
 
+// takes a list of sources and a list of targets and fills distances, which must have room for sources.size() * targets.size() values,
+// with the shortest distance from each source to each target, row by row; pairs without a path, or with a city which does not exist, get Unreachable<T>();
+// in the hub label mode every entry is a merge of two labels, in the contraction hierarchy mode the table comes from
+// bucket-based many-to-many searches over the hierarchy, otherwise from one Dijkstra search per source which stops once
+// it has settled every target; either way the rows are spread over all cores
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::DistanceMatrix(const vector<string> &sources, const vector<string> &targets, T *distances)
+{
+    shared_ptr<const Version> version = CurrentVersion();
+    shared_ptr<const Graph> roadGraph = RoadGraph(*version); // the searches below follow the compressed sparse rows
+    const Graph &graph = *roadGraph;
+    vector<CityId> sourceIds;
+    vector<CityId> targetIds;
+    FindCities(graph, sources, sourceIds);
+    FindCities(graph, targets, targetIds);
+    if (searchMode == SearchMode::HubLabels && version->labels) {
+        const HubLabels<T> &labels = *version->labels;
+        ParallelFor(sourceIds.size(), [&](size_t source) {
+            T *row = distances + source * targets.size();
+            for(size_t target = 0; target < targetIds.size(); target++) {
+                bool known = sourceIds[source] != NO_CITY && targetIds[target] != NO_CITY;
+                row[target] = known ? labels.Distance(sourceIds[source], targetIds[target]) : Unreachable<T>();
+            }
+        });
+        return;
+    }
+    if (searchMode == SearchMode::ContractionHierarchy && version->hierarchy) {
+        version->hierarchy->Distances(sourceIds, targetIds, distances);
+        return;
+    }
+
+    vector<bool> isTarget(graph.Size(), false);
+    size_t targetCount = 0; // different cities among the targets
+    for(vector<CityId>::iterator it = targetIds.begin(); it != targetIds.end(); it++) {
+        if (*it != NO_CITY && !isTarget[*it]) {
+            isTarget[*it] = true;
+            targetCount++;
+        }
+    }
+    ParallelFor(sourceIds.size(), [&](size_t source) {
+        DistancesFrom(graph, sourceIds[source], targetIds, isTarget, targetCount, distances + source * targets.size());
+    });
+}
+
+// takes a city and gets the distance from it to every city of the current snapshot and the parent of every city on a shortest path,
+// as arrays by city id; both algorithms give the same tree, delta-stepping spreading the work over all cores
+template <typename T, typename Heuristic>
+typename CityMap<T, Heuristic>::Tree CityMap<T, Heuristic>::ShortestPathTree(string source, TreeAlgorithm algorithm)
+{
+    shared_ptr<const Version> version = CurrentVersion();
+    CityId sourceId = version->graph->Find(source);
+    if (sourceId == NO_CITY) {
+        Error(CITY, source, DOESNT_EXIST);
+    }
+    return GrowPathTree(RoadGraph(*version), sourceId, algorithm);
+}
+
+// takes a city and grows a shortest path tree from it in the current version, which every later version repairs for the changes it brings
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::KeepTree(string source)
+{
+    lock_guard<mutex> lock(writer);
+    if (keptTrees.find(source) == keptTrees.end()) {
+        keptTrees.insert(make_pair(source, KeptPathTree(source, RoadGraph(*current))));
+    }
+}
+
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::DropTree(string source)
+{
+    lock_guard<mutex> lock(writer);
+    keptTrees.erase(source);
+}
+
+// takes a city and gets a copy of the tree kept from it, repaired up to the current version; a tree which is not kept is grown
+template <typename T, typename Heuristic>
+typename CityMap<T, Heuristic>::Tree CityMap<T, Heuristic>::KeptTree(string source)
+{
+    CurrentVersion();
+    {
+        lock_guard<mutex> lock(writer);
+        typename map<string, KeptPathTree>::iterator it = keptTrees.find(source);
+        if (it != keptTrees.end()) {
+            return it->second.Tree();
+        }
+    }
+    return ShortestPathTree(source);
+}
+
+template <typename T, typename Heuristic>
+size_t CityMap<T, Heuristic>::KeptTreeRepairs(string source)
+{
+    CurrentVersion();
+    lock_guard<mutex> lock(writer);
+    typename map<string, KeptPathTree>::iterator it = keptTrees.find(source);
+    return it == keptTrees.end() ? 0 : it->second.Repaired();
+}
+
+// takes a snapshot, a source and the targets, and fills row with the distances from the source to the targets;
+// the search is Dijkstra's algorithm on the thread's workspace, and ends as soon as all targetCount marked cities are settled
+template <typename T, typename Heuristic>
+void CityMap<T, Heuristic>::DistancesFrom(const Graph &graph, CityId source, const vector<CityId> &targets, const vector<bool> &isTarget, size_t targetCount, T *row) const
+{
+    SearchSpace<T> &search = SearchWorkspace<T>::ForThisThread().forward;
+    search.Start(graph.Size());
+    if (source != NO_CITY) {
+        search.Reach(source, 0, NO_CITY);
+        search.heap.Push(source, 0);
+    }
+    size_t targetsLeft = targetCount;
+    while (!search.heap.Empty() && targetsLeft > 0) {
+        CityId currentCity = search.heap.PopMin();
+        search.Settle(currentCity);
+        if (isTarget[currentCity]) {
+            targetsLeft--;
+        }
+        T currentG = search.Distance(currentCity);
+        for(RoadId road = graph.FirstRoad(currentCity); road != graph.LastRoad(currentCity); road++) {
+            CityId neighbour = graph.Target(road);
+            T neighbourG = currentG + graph.Length(road);
+            if (!search.Reached(neighbour)) {
+                search.Reach(neighbour, neighbourG, currentCity);
+                search.heap.Push(neighbour, neighbourG);
+            }
+            else if (!search.Settled(neighbour) && neighbourG < search.Distance(neighbour)) {
+                search.Reach(neighbour, neighbourG, currentCity);
+                search.heap.DecreaseKey(neighbour, neighbourG);
+            }
+        }
+    }
+    for(size_t target = 0; target < targets.size(); target++) {
+        CityId city = targets[target];
+        row[target] = city != NO_CITY && search.Settled(city) ? search.Distance(city) : Unreachable<T>();
+    }
+}
+
 #endif // CITYMAP_H_INCLUDED
@@ -0,0 +1,196 @@
+#ifndef COMPRESSEDROADS_H_INCLUDED
+#define COMPRESSEDROADS_H_INCLUDED
+
+#include <vector>
+#include <limits>
+#include <stdint.h>
+#include <math.h>
+#include "CityGraph.h"
+#include "Parallel.h"
+using namespace std;
+
+// read-only copy of the roads of a CityGraph snapshot in a few bytes a road, for searches over graphs too large for the
+// compressed sparse rows; the roads of a city are a run of bytes holding, in order of target, the target as a varint of its
+// difference from the target before, the first from the city itself, so with cities numbered along the Hilbert curve most
+// targets take a byte or two; with a metric which makes road lengths (see Metrics.h) lengths are not stored at all but
+// computed again from the coordinates of the cities, which are kept in a snapshot of the cities alone (see CityGraph::Cities),
+// so nothing of the snapshot the roads came from, nor of its compressed sparse rows, stays in memory for them; a version
+// published in the compressed mode uses that snapshot of the cities as its own; with explicit lengths every road also has
+// a varint of how many quanta it is longer than the straight line, rounded up, so a road is never shorter than in the snapshot
+// and less than a quantum longer; runs are found through a 64-bit offset for every CITY_BLOCK cities and a 32-bit one for
+// every city within its block
+template <typename T, typename Metric, typename Weight = T>
+class CompressedRoads
+{
+    public:
+        explicit CompressedRoads(const CityGraph<T, Weight> &graph, T quantum = DefaultQuantum());
+        CityId Size() const { return cities.Size(); }
+        const CityGraph<T, Weight> &Cities() const { return cities; } // the cities of the roads, without roads of their own
+        RoadId RoadCount() const { return roadCount; }
+        template <typename Visit>
+        void ForEachRoad(CityId city, Visit visit) const; // calls visit(target, length) for every road of a city, in order of target
+        size_t Bytes() const; // memory the roads take, offsets included
+        double BytesPerRoad() const { return roadCount == 0 ? 0 : double(Bytes()) / roadCount; }
+        static T DefaultQuantum() { return numeric_limits<T>::is_integer ? T(1) : T(1) / 1000; }
+    private:
+        static const CityId CITY_BLOCK = 64;
+        static size_t VarintSize(uint64_t value);
+        static void AppendVarint(unsigned char *&out, uint64_t value);
+        static uint64_t ReadVarint(const unsigned char *&in);
+        static uint64_t Zigzag(int64_t value) { return (uint64_t(value) << 1) ^ uint64_t(value >> 63); }
+        static int64_t Unzigzag(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+        T Straight(CityId from, CityId to) const { return Metric::Length(cities.X(from), cities.Y(from), cities.X(to), cities.Y(to)); }
+        int64_t Excess(CityId from, CityId to, T length) const; // quanta a road is longer than the straight line, rounded up
+        size_t Begin(CityId city) const { return blockFirst[city / CITY_BLOCK] + cityOffset[city]; }
+        size_t EncodedSize(const CityGraph<T, Weight> &graph, CityId city) const;
+        CityGraph<T, Weight> cities; // the cities of the snapshot, whose coordinates lengths are computed from
+        T quantum;
+        RoadId roadCount;
+        vector<uint64_t> blockFirst; // first byte of every block of CITY_BLOCK cities
+        vector<uint32_t> cityOffset; // first byte of every city, from the first of its block
+        vector<unsigned char> bytes;
+};
+
+template <typename T, typename Metric, typename Weight>
+const CityId CompressedRoads<T, Metric, Weight>::CITY_BLOCK;
+
+// takes a snapshot and a quantum of explicit lengths and encodes its roads: sizes first, so every city can be encoded
+// in parallel straight into its place
+template <typename T, typename Metric, typename Weight>
+CompressedRoads<T, Metric, Weight>::CompressedRoads(const CityGraph<T, Weight> &graph, T quantum)
+    : cities(graph.Cities()), quantum(quantum), roadCount(graph.RoadCount())
+{
+    CityId cityCount = graph.Size();
+    vector<size_t> sizes(cityCount);
+    ParallelFor(cityCount, [&](size_t city) {
+        sizes[city] = EncodedSize(graph, CityId(city));
+    });
+    blockFirst.assign(cityCount / CITY_BLOCK + 1, 0);
+    cityOffset.assign(cityCount + 1, 0);
+    uint64_t first = 0;
+    for(CityId city = 0; city <= cityCount; city++) {
+        if (city % CITY_BLOCK == 0) {
+            blockFirst[city / CITY_BLOCK] = first;
+        }
+        cityOffset[city] = uint32_t(first - blockFirst[city / CITY_BLOCK]);
+        if (city < cityCount) {
+            first += sizes[city];
+        }
+    }
+    bytes.resize(size_t(first));
+    ParallelFor(cityCount, [&](size_t city) {
+        unsigned char *out = bytes.data() + Begin(CityId(city));
+        for(RoadId road = graph.FirstRoad(CityId(city)); road != graph.LastRoad(CityId(city)); road++) {
+            CityId target = graph.Target(road);
+            bool firstRoad = road == graph.FirstRoad(CityId(city));
+            AppendVarint(out, firstRoad ? Zigzag(int64_t(target) - int64_t(city)) : uint64_t(target - graph.Target(road - 1) - 1));
+            if (Metric::EXPLICIT_LENGTHS) {
+                AppendVarint(out, Zigzag(Excess(CityId(city), target, graph.Length(road))));
+            }
+        }
+    });
+}
+
+// takes the snapshot being encoded and a city and gets the bytes its roads take
+template <typename T, typename Metric, typename Weight>
+size_t CompressedRoads<T, Metric, Weight>::EncodedSize(const CityGraph<T, Weight> &graph, CityId city) const
+{
+    size_t size = 0;
+    for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+        CityId target = graph.Target(road);
+        bool firstRoad = road == graph.FirstRoad(city);
+        size += VarintSize(firstRoad ? Zigzag(int64_t(target) - int64_t(city)) : uint64_t(target - graph.Target(road - 1) - 1));
+        if (Metric::EXPLICIT_LENGTHS) {
+            size += VarintSize(Zigzag(Excess(city, target, graph.Length(road))));
+        }
+    }
+    return size;
+}
+
+// takes a road and gets how many quanta longer than the straight line it has to be stored as not to come out shorter;
+// decoding adds the quanta to the straight line in the same way, so the check below sees exactly what decoding will give
+template <typename T, typename Metric, typename Weight>
+int64_t CompressedRoads<T, Metric, Weight>::Excess(CityId from, CityId to, T length) const
+{
+    T straight = Straight(from, to);
+    int64_t excess = int64_t(ceil((double(length) - double(straight)) / double(quantum)));
+    while (straight + T(excess) * quantum < length) {
+        excess++;
+    }
+    return excess;
+}
+
+// takes a city and calls visit(target, length) for each of its roads, decoding them as it goes
+template <typename T, typename Metric, typename Weight>
+template <typename Visit>
+void CompressedRoads<T, Metric, Weight>::ForEachRoad(CityId city, Visit visit) const
+{
+    const unsigned char *in = bytes.data() + Begin(city);
+    const unsigned char *end = bytes.data() + Begin(city + 1);
+    if (in == end) {
+        return;
+    }
+    CityId target = CityId(int64_t(city) + Unzigzag(ReadVarint(in)));
+    while (true) {
+        T length = Straight(city, target);
+        if (Metric::EXPLICIT_LENGTHS) {
+            length = length + T(Unzigzag(ReadVarint(in))) * quantum;
+        }
+        visit(target, length);
+        if (in == end) {
+            return;
+        }
+        target += CityId(ReadVarint(in)) + 1;
+    }
+}
+
+template <typename T, typename Metric, typename Weight>
+size_t CompressedRoads<T, Metric, Weight>::Bytes() const
+{
+    return bytes.size() + blockFirst.size() * sizeof(uint64_t) + cityOffset.size() * sizeof(uint32_t);
+}
+
+// takes a value and gets how many bytes it takes as a varint
+template <typename T, typename Metric, typename Weight>
+size_t CompressedRoads<T, Metric, Weight>::VarintSize(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// takes a value and writes it at out, seven bits a byte from the lowest, the high bit set on every byte but the last
+template <typename T, typename Metric, typename Weight>
+void CompressedRoads<T, Metric, Weight>::AppendVarint(unsigned char *&out, uint64_t value)
+{
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+}
+
+// takes a position in the bytes, decodes the varint there and moves past it; most take one byte, which is the first test
+template <typename T, typename Metric, typename Weight>
+uint64_t CompressedRoads<T, Metric, Weight>::ReadVarint(const unsigned char *&in)
+{
+    uint64_t value = *in++;
+    if (value < 0x80) {
+        return value;
+    }
+    value &= 0x7f;
+    unsigned int shift = 7;
+    while (true) {
+        uint64_t byte = *in++;
+        value |= (byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+        shift += 7;
+    }
+}
+
+#endif // COMPRESSEDROADS_H_INCLUDED
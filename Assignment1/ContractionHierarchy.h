@@ -0,0 +1,426 @@
+#ifndef CONTRACTIONHIERARCHY_H_INCLUDED
+#define CONTRACTIONHIERARCHY_H_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include "CityGraph.h"
+#include "SearchWorkspace.h"
+#include "Parallel.h"
+using namespace std;
+
+// contraction hierarchy over a CityGraph snapshot;
+// cities are contracted one by one in order of importance, adding shortcut roads between their remaining neighbours
+// where no witness path is as short; a query then only searches upwards in importance from both cities,
+// and shortcuts are unpacked into the original roads through the city they bypass
+template <typename T>
+class ContractionHierarchy
+{
+    public:
+        template <typename Weight>
+        explicit ContractionHierarchy(const CityGraph<T, Weight> &graph);
+        bool Query(CityId firstCity, CityId secondCity, T &distance, vector<CityId> *path) const; // false if there is no path
+        void Distances(const vector<CityId> &sources, const vector<CityId> &targets, T *distances) const; // many-to-many distance table
+        CityId Rank(CityId city) const { return rank[city]; } // position of a city in the contraction order
+        CityId Size() const { return CityId(rank.size()); }
+        RoadId FirstUpward(CityId city) const { return firstUpward[city]; } // upward roads of a city are [FirstUpward, LastUpward)
+        RoadId LastUpward(CityId city) const { return firstUpward[city + 1]; }
+        CityId UpwardTarget(RoadId road) const { return upward[road].target; }
+        T UpwardLength(RoadId road) const { return upward[road].length; }
+        RoadId ShortcutCount() const { return shortcutCount; }
+    private:
+        static const unsigned int WITNESS_SETTLE_LIMIT = 500; // a witness search gives up, adding the shortcut, after this many cities
+        static const unsigned int SIMULATION_SETTLE_LIMIT = 50; // the same limit when only estimating the shortcuts of a city
+        struct Road {
+            CityId target;
+            T length;
+            CityId middle; // city a shortcut bypasses, or NO_CITY for an original road
+        };
+        typedef vector<vector<Road> > WorkingGraph;
+        int Contract(WorkingGraph &working, CityId city, SearchSpace<T> &witness, bool simulate); // contracts a city, or only counts its shortcuts
+        int Priority(WorkingGraph &working, CityId city, SearchSpace<T> &witness, const vector<int> &contractedNeighbours, const vector<int> &level);
+        void AddRoad(WorkingGraph &working, CityId from, const Road &road); // adds a road or shortens an existing one
+        void Unpack(CityId from, CityId to, vector<CityId> &path) const; // appends the original cities of an upward road after from
+        const Road *UpwardRoad(CityId lower, CityId higher) const;
+        template <typename Visit>
+        void UpwardSearch(CityId city, SearchSpace<T> &search, Visit visit) const; // calls visit(city, distance) for the cities settled upwards
+        vector<CityId> rank;
+        vector<RoadId> firstUpward; // upward roads of city v are [firstUpward[v], firstUpward[v+1]), sorted by target
+        vector<Road> upward; // roads from each city to more important cities, including shortcuts
+        RoadId shortcutCount;
+};
+
+template <typename T>
+const unsigned int ContractionHierarchy<T>::WITNESS_SETTLE_LIMIT;
+
+template <typename T>
+const unsigned int ContractionHierarchy<T>::SIMULATION_SETTLE_LIMIT;
+
+// takes a snapshot, orders its cities by priority with lazy updates and contracts them in that order
+template <typename T>
+template <typename Weight>
+ContractionHierarchy<T>::ContractionHierarchy(const CityGraph<T, Weight> &graph) : shortcutCount(0)
+{
+    CityId cityCount = graph.Size();
+    WorkingGraph working(cityCount);
+    for(CityId city = 0; city < cityCount; city++) {
+        for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+            Road original = { graph.Target(road), graph.Length(road), NO_CITY };
+            working[city].push_back(original);
+        }
+    }
+
+    SearchSpace<T> witness;
+    IndexedHeap<int> order; // cities not contracted yet, by priority
+    order.Resize(cityCount);
+    vector<int> contractedNeighbours(cityCount, 0);
+    vector<int> level(cityCount, 0);
+    for(CityId city = 0; city < cityCount; city++) {
+        order.Push(city, Priority(working, city, witness, contractedNeighbours, level));
+    }
+
+    rank.assign(cityCount, 0);
+    vector<vector<Road> > upwardRoads(cityCount);
+    CityId nextRank = 0;
+    while (!order.Empty()) {
+        // priorities go stale as neighbours are contracted, so the top city is re-evaluated before it is taken
+        CityId city = order.Min();
+        int priority = Priority(working, city, witness, contractedNeighbours, level);
+        if (priority > order.MinKey()) {
+            order.ChangeKey(city, priority);
+            continue;
+        }
+        order.PopMin();
+        rank[city] = nextRank++;
+        upwardRoads[city] = working[city];
+        Contract(working, city, witness, false);
+
+        // the neighbours lost a road and may have gained shortcuts, so their priorities are brought up to date
+        for(typename vector<Road>::iterator it = upwardRoads[city].begin(); it != upwardRoads[city].end(); it++) {
+            contractedNeighbours[it->target]++;
+            level[it->target] = max(level[it->target], level[city] + 1);
+            order.ChangeKey(it->target, Priority(working, it->target, witness, contractedNeighbours, level));
+        }
+    }
+
+    firstUpward.reserve(cityCount + 1);
+    firstUpward.push_back(0);
+    for(CityId city = 0; city < cityCount; city++) {
+        vector<Road> &roads = upwardRoads[city];
+        sort(roads.begin(), roads.end(), [](const Road &a, const Road &b) { return a.target < b.target; });
+        upward.insert(upward.end(), roads.begin(), roads.end());
+        firstUpward.push_back(RoadId(upward.size()));
+        vector<Road>().swap(roads);
+    }
+}
+
+// takes a city which is still in the working graph and gets how late it should be contracted:
+// cities adding few shortcuts go first, spread evenly by counting contracted neighbours and the depth of the hierarchy below them
+template <typename T>
+int ContractionHierarchy<T>::Priority(WorkingGraph &working, CityId city, SearchSpace<T> &witness, const vector<int> &contractedNeighbours, const vector<int> &level)
+{
+    return 2 * Contract(working, city, witness, true) + contractedNeighbours[city] + level[city];
+}
+
+// takes a road and adds it to the working graph, or shortens the road already there between the same cities
+template <typename T>
+void ContractionHierarchy<T>::AddRoad(WorkingGraph &working, CityId from, const Road &road)
+{
+    vector<Road> &roads = working[from];
+    for(typename vector<Road>::iterator it = roads.begin(); it != roads.end(); it++) {
+        if (it->target == road.target) {
+            if (road.length < it->length) {
+                *it = road;
+            }
+            return;
+        }
+    }
+    roads.push_back(road);
+}
+
+// takes a city which is still in the working graph and gets its edge difference (shortcuts added minus roads removed);
+// unless simulating, the shortcuts are added and the city is taken out of the working graph
+template <typename T>
+int ContractionHierarchy<T>::Contract(WorkingGraph &working, CityId city, SearchSpace<T> &witness, bool simulate)
+{
+    vector<Road> &roads = working[city];
+    int shortcuts = 0;
+    // estimating priorities is done far more often than contracting, so it settles for shorter witness searches
+    unsigned int settleLimit = simulate ? SIMULATION_SETTLE_LIMIT : WITNESS_SETTLE_LIMIT;
+
+    for(size_t i = 0; i + 1 < roads.size(); i++) {
+        CityId source = roads[i].target;
+        T longest = T();
+        for(size_t j = i + 1; j < roads.size(); j++) {
+            if (longest < roads[j].length) {
+                longest = roads[j].length;
+            }
+        }
+        T limit = roads[i].length + longest;
+        size_t targetsLeft = roads.size() - i - 1;
+
+        // searches from one neighbour for paths to the later ones that avoid the city, until all of them are settled
+        witness.Start(CityId(working.size()));
+        witness.Reach(source, 0, NO_CITY);
+        witness.heap.Push(source, 0);
+        unsigned int settled = 0;
+        while (!witness.heap.Empty() && witness.heap.MinKey() <= limit && settled < settleLimit && targetsLeft > 0) {
+            CityId current = witness.heap.PopMin();
+            witness.Settle(current);
+            settled++;
+            for(size_t j = i + 1; j < roads.size(); j++) {
+                if (roads[j].target == current) {
+                    targetsLeft--;
+                }
+            }
+            for(typename vector<Road>::iterator it = working[current].begin(); it != working[current].end(); it++) {
+                if (it->target == city || witness.Settled(it->target)) {
+                    continue;
+                }
+                T distance = witness.Distance(current) + it->length;
+                if (!witness.Reached(it->target)) {
+                    witness.Reach(it->target, distance, current);
+                    witness.heap.Push(it->target, distance);
+                }
+                else if (distance < witness.Distance(it->target)) {
+                    witness.Reach(it->target, distance, current);
+                    witness.heap.DecreaseKey(it->target, distance);
+                }
+            }
+        }
+
+        for(size_t j = i + 1; j < roads.size(); j++) {
+            CityId target = roads[j].target;
+            T viaCity = roads[i].length + roads[j].length;
+            if (witness.Reached(target) && !(viaCity < witness.Distance(target))) {
+                continue;
+            }
+            shortcuts++;
+            if (!simulate) {
+                Road forward = { target, viaCity, city };
+                Road backward = { source, viaCity, city };
+                AddRoad(working, source, forward);
+                AddRoad(working, target, backward);
+                shortcutCount++;
+            }
+        }
+    }
+
+    int removed = int(roads.size());
+    if (!simulate) {
+        for(typename vector<Road>::iterator it = roads.begin(); it != roads.end(); it++) {
+            vector<Road> &neighbourRoads = working[it->target];
+            for(size_t k = 0; k < neighbourRoads.size(); k++) {
+                if (neighbourRoads[k].target == city) {
+                    neighbourRoads[k] = neighbourRoads.back();
+                    neighbourRoads.pop_back();
+                    break;
+                }
+            }
+        }
+        vector<Road>().swap(roads);
+    }
+    return shortcuts - removed;
+}
+
+// takes two cities, the first less important, and finds the upward road between them
+template <typename T>
+const typename ContractionHierarchy<T>::Road *ContractionHierarchy<T>::UpwardRoad(CityId lower, CityId higher) const
+{
+    const Road *first = &upward[0] + firstUpward[lower];
+    const Road *last = &upward[0] + firstUpward[lower + 1];
+    const Road *road = lower_bound(first, last, higher, [](const Road &a, CityId target) { return a.target < target; });
+    return road != last && road->target == higher ? road : 0;
+}
+
+// takes two cities joined by an upward road and appends the cities of the original roads it stands for, ending with to
+template <typename T>
+void ContractionHierarchy<T>::Unpack(CityId from, CityId to, vector<CityId> &path) const
+{
+    const Road *road = rank[from] < rank[to] ? UpwardRoad(from, to) : UpwardRoad(to, from);
+    if (road->middle == NO_CITY) {
+        path.push_back(to);
+    }
+    else {
+        Unpack(from, road->middle, path);
+        Unpack(road->middle, to, path);
+    }
+}
+
+// takes two cities and gets the shortest distance between them, and the cities on the shortest path if path is given;
+// both searches only follow upward roads and meet at the most important city on the path
+template <typename T>
+bool ContractionHierarchy<T>::Query(CityId firstCity, CityId secondCity, T &distance, vector<CityId> *path) const
+{
+    SearchWorkspace<T> &workspace = SearchWorkspace<T>::ForThisThread();
+    SearchSpace<T> *searches[2] = { &workspace.forward, &workspace.backward };
+    CityId cityCount = CityId(rank.size());
+    searches[0]->Start(cityCount);
+    searches[1]->Start(cityCount);
+    searches[0]->Reach(firstCity, 0, NO_CITY);
+    searches[0]->heap.Push(firstCity, 0);
+    searches[1]->Reach(secondCity, 0, NO_CITY);
+    searches[1]->heap.Push(secondCity, 0);
+
+    bool found = false;
+    CityId meeting = NO_CITY;
+    while (true) {
+        // continues the side with the smaller key until neither side can improve the best distance found
+        bool forwardDone = searches[0]->heap.Empty() || (found && !(searches[0]->heap.MinKey() < distance));
+        bool backwardDone = searches[1]->heap.Empty() || (found && !(searches[1]->heap.MinKey() < distance));
+        if (forwardDone && backwardDone) {
+            break;
+        }
+        int side = forwardDone ? 1 : (backwardDone ? 0 : (searches[1]->heap.MinKey() < searches[0]->heap.MinKey() ? 1 : 0));
+        SearchSpace<T> &search = *searches[side];
+        const SearchSpace<T> &other = *searches[1 - side];
+
+        CityId current = search.heap.PopMin();
+        search.Settle(current);
+        T currentDistance = search.Distance(current);
+        if (other.Reached(current) && (!found || currentDistance + other.Distance(current) < distance)) {
+            distance = currentDistance + other.Distance(current);
+            meeting = current;
+            found = true;
+        }
+        // a city reached more cheaply down from a more important city is not on a shortest path, so its roads are not followed
+        bool stalled = false;
+        for(RoadId road = firstUpward[current]; road != firstUpward[current + 1] && !stalled; road++) {
+            CityId target = upward[road].target;
+            stalled = search.Reached(target) && search.Distance(target) + upward[road].length < currentDistance;
+        }
+        if (stalled) {
+            continue;
+        }
+        search.CountRelaxed(firstUpward[current + 1] - firstUpward[current]);
+        for(RoadId road = firstUpward[current]; road != firstUpward[current + 1]; road++) {
+            CityId target = upward[road].target;
+            T targetDistance = currentDistance + upward[road].length;
+            if (!search.Reached(target)) {
+                search.Reach(target, targetDistance, current);
+                search.heap.Push(target, targetDistance);
+            }
+            else if (!search.Settled(target) && targetDistance < search.Distance(target)) {
+                search.Reach(target, targetDistance, current);
+                search.heap.DecreaseKey(target, targetDistance);
+            }
+        }
+    }
+
+    if (found && path) {
+        vector<CityId> &result = *path;
+        searches[0]->Path(meeting, result);
+        vector<CityId> upwardPath;
+        upwardPath.swap(result);
+        result.push_back(upwardPath[0]);
+        for(size_t i = 1; i < upwardPath.size(); i++) {
+            Unpack(upwardPath[i - 1], upwardPath[i], result);
+        }
+        for(CityId current = meeting; current != secondCity; current = searches[1]->Parent(current)) {
+            Unpack(current, searches[1]->Parent(current), result);
+        }
+    }
+    return found;
+}
+
+// takes a city and searches all the way up from it, calling visit(reached, distance) for every city it settles;
+// stalled cities are reached more cheaply from above, so they are not visited
+template <typename T>
+template <typename Visit>
+void ContractionHierarchy<T>::UpwardSearch(CityId city, SearchSpace<T> &search, Visit visit) const
+{
+    search.Start(CityId(rank.size()));
+    search.Reach(city, 0, NO_CITY);
+    search.heap.Push(city, 0);
+    while (!search.heap.Empty()) {
+        CityId current = search.heap.PopMin();
+        search.Settle(current);
+        T currentDistance = search.Distance(current);
+        bool stalled = false;
+        for(RoadId road = firstUpward[current]; road != firstUpward[current + 1] && !stalled; road++) {
+            CityId target = upward[road].target;
+            stalled = search.Reached(target) && search.Distance(target) + upward[road].length < currentDistance;
+        }
+        if (stalled) {
+            continue;
+        }
+        search.CountRelaxed(firstUpward[current + 1] - firstUpward[current]);
+        visit(current, currentDistance);
+        for(RoadId road = firstUpward[current]; road != firstUpward[current + 1]; road++) {
+            CityId target = upward[road].target;
+            T targetDistance = currentDistance + upward[road].length;
+            if (!search.Reached(target)) {
+                search.Reach(target, targetDistance, current);
+                search.heap.Push(target, targetDistance);
+            }
+            else if (!search.Settled(target) && targetDistance < search.Distance(target)) {
+                search.Reach(target, targetDistance, current);
+                search.heap.DecreaseKey(target, targetDistance);
+            }
+        }
+    }
+}
+
+// takes lists of sources and targets and fills the sources by targets table, row by row, with the distances between them,
+// Unreachable where there is no path or the city is NO_CITY;
+// every target leaves its distance in a bucket at each city its upward search settles, then the upward search of every source
+// scans the buckets of the cities it settles, so each pair meets at the most important city of its shortest path;
+// both rounds of searches are spread over all cores
+template <typename T>
+void ContractionHierarchy<T>::Distances(const vector<CityId> &sources, const vector<CityId> &targets, T *distances) const
+{
+    struct BucketEntry {
+        size_t target; // position in targets
+        T distance;
+    };
+    CityId cityCount = CityId(rank.size());
+    vector<vector<BucketEntry> > spaces(targets.size()); // what each target leaves in the buckets, by city
+    vector<vector<CityId> > spaceCities(targets.size());
+    ParallelFor(targets.size(), [&](size_t target) {
+        if (targets[target] == NO_CITY) {
+            return;
+        }
+        UpwardSearch(targets[target], SearchWorkspace<T>::ForThisThread().backward, [&](CityId city, T distance) {
+            BucketEntry entry = { target, distance };
+            spaces[target].push_back(entry);
+            spaceCities[target].push_back(city);
+        });
+    });
+
+    // the buckets are laid out one after another, city by city
+    vector<size_t> firstEntry(cityCount + 1, 0);
+    for(size_t target = 0; target < targets.size(); target++) {
+        for(vector<CityId>::const_iterator it = spaceCities[target].begin(); it != spaceCities[target].end(); it++) {
+            firstEntry[*it + 1]++;
+        }
+    }
+    for(CityId city = 0; city < cityCount; city++) {
+        firstEntry[city + 1] += firstEntry[city];
+    }
+    vector<BucketEntry> buckets(firstEntry[cityCount]);
+    vector<size_t> filled(firstEntry.begin(), firstEntry.end() - 1);
+    for(size_t target = 0; target < targets.size(); target++) {
+        for(size_t i = 0; i < spaces[target].size(); i++) {
+            buckets[filled[spaceCities[target][i]]++] = spaces[target][i];
+        }
+        vector<BucketEntry>().swap(spaces[target]);
+        vector<CityId>().swap(spaceCities[target]);
+    }
+
+    ParallelFor(sources.size(), [&](size_t source) {
+        T *row = distances + source * targets.size();
+        fill(row, row + targets.size(), Unreachable<T>());
+        if (sources[source] == NO_CITY) {
+            return;
+        }
+        UpwardSearch(sources[source], SearchWorkspace<T>::ForThisThread().forward, [&](CityId city, T distance) {
+            for(size_t entry = firstEntry[city]; entry != firstEntry[city + 1]; entry++) {
+                T viaCity = distance + buckets[entry].distance;
+                if (viaCity < row[buckets[entry].target]) {
+                    row[buckets[entry].target] = viaCity;
+                }
+            }
+        });
+    });
+}
+
+#endif // CONTRACTIONHIERARCHY_H_INCLUDED
@@ -0,0 +1,146 @@
+#ifndef DISTANCEKERNEL_H_INCLUDED
+#define DISTANCEKERNEL_H_INCLUDED
+
+#include <stddef.h>
+#include <math.h>
+#include "CityGraph.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CITYMAP_X86_KERNELS
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// straight-line distances from one point to a batch of cities, with the coordinates read from structure-of-arrays x and y arrays;
+// for float and double coordinates the batch is computed 4 or 8 at a time with AVX2 or SSE2 when the processor has them, chosen at run time,
+// so the rest of the code is compiled for any x86 processor; other coordinate types, and other processors, use the scalar loop;
+// every kernel does the same operations in the same order without fused multiply-adds, so they all give exactly the scalar results
+enum class DistanceKernel {
+    Scalar,
+    SSE2, // 2 doubles or 4 floats at a time
+    AVX2 // 4 doubles or 8 floats at a time, gathering the coordinates of the batch
+};
+
+// best kernel the processor supports, checked once
+inline DistanceKernel BestDistanceKernel()
+{
+#ifdef CITYMAP_X86_KERNELS
+    static const DistanceKernel best = __builtin_cpu_supports("avx2") ? DistanceKernel::AVX2
+        : (__builtin_cpu_supports("sse2") ? DistanceKernel::SSE2 : DistanceKernel::Scalar);
+    return best;
+#else
+    return DistanceKernel::Scalar;
+#endif
+}
+
+// takes the coordinate arrays, count city ids, and a point, and fills distances with the distance from the point to each city
+template <typename T>
+void ScalarStraightDistances(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *distances)
+{
+    for(size_t i = 0; i < count; i++) {
+        T deltaX = xs[cities[i]] - x;
+        T deltaY = ys[cities[i]] - y;
+        distances[i] = sqrt(deltaX * deltaX + deltaY * deltaY);
+    }
+}
+
+// the same with the kernel given, or the best one; a kernel the processor does not support is replaced by the best one it does
+template <typename T>
+void StraightDistances(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *distances, DistanceKernel = BestDistanceKernel())
+{
+    ScalarStraightDistances(xs, ys, cities, count, x, y, distances);
+}
+
+#ifdef CITYMAP_X86_KERNELS
+
+__attribute__((target("sse2")))
+inline void Sse2StraightDistances(const double *xs, const double *ys, const CityId *cities, size_t count, double x, double y, double *distances)
+{
+    __m128d pointX = _mm_set1_pd(x);
+    __m128d pointY = _mm_set1_pd(y);
+    size_t i = 0;
+    for(; i + 2 <= count; i += 2) {
+        __m128d deltaX = _mm_sub_pd(_mm_set_pd(xs[cities[i + 1]], xs[cities[i]]), pointX);
+        __m128d deltaY = _mm_sub_pd(_mm_set_pd(ys[cities[i + 1]], ys[cities[i]]), pointY);
+        _mm_storeu_pd(distances + i, _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(deltaX, deltaX), _mm_mul_pd(deltaY, deltaY))));
+    }
+    ScalarStraightDistances(xs, ys, cities + i, count - i, x, y, distances + i);
+}
+
+__attribute__((target("sse2")))
+inline void Sse2StraightDistances(const float *xs, const float *ys, const CityId *cities, size_t count, float x, float y, float *distances)
+{
+    __m128 pointX = _mm_set1_ps(x);
+    __m128 pointY = _mm_set1_ps(y);
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128 deltaX = _mm_sub_ps(_mm_set_ps(xs[cities[i + 3]], xs[cities[i + 2]], xs[cities[i + 1]], xs[cities[i]]), pointX);
+        __m128 deltaY = _mm_sub_ps(_mm_set_ps(ys[cities[i + 3]], ys[cities[i + 2]], ys[cities[i + 1]], ys[cities[i]]), pointY);
+        _mm_storeu_ps(distances + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(deltaX, deltaX), _mm_mul_ps(deltaY, deltaY))));
+    }
+    ScalarStraightDistances(xs, ys, cities + i, count - i, x, y, distances + i);
+}
+
+// city ids are gathered as signed 32-bit indexes, which covers every map the snapshot format can hold in memory;
+// the gathers are the masked ones with every lane on, as the plain ones leave their source register uninitialised
+__attribute__((target("avx2")))
+inline void Avx2StraightDistances(const double *xs, const double *ys, const CityId *cities, size_t count, double x, double y, double *distances)
+{
+    __m256d pointX = _mm256_set1_pd(x);
+    __m256d pointY = _mm256_set1_pd(y);
+    __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i indexes = _mm_loadu_si128((const __m128i *)(cities + i));
+        __m256d deltaX = _mm256_sub_pd(_mm256_mask_i32gather_pd(_mm256_setzero_pd(), xs, indexes, all, 8), pointX);
+        __m256d deltaY = _mm256_sub_pd(_mm256_mask_i32gather_pd(_mm256_setzero_pd(), ys, indexes, all, 8), pointY);
+        _mm256_storeu_pd(distances + i, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(deltaX, deltaX), _mm256_mul_pd(deltaY, deltaY))));
+    }
+    ScalarStraightDistances(xs, ys, cities + i, count - i, x, y, distances + i);
+}
+
+__attribute__((target("avx2")))
+inline void Avx2StraightDistances(const float *xs, const float *ys, const CityId *cities, size_t count, float x, float y, float *distances)
+{
+    __m256 pointX = _mm256_set1_ps(x);
+    __m256 pointY = _mm256_set1_ps(y);
+    __m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i indexes = _mm256_loadu_si256((const __m256i *)(cities + i));
+        __m256 deltaX = _mm256_sub_ps(_mm256_mask_i32gather_ps(_mm256_setzero_ps(), xs, indexes, all, 4), pointX);
+        __m256 deltaY = _mm256_sub_ps(_mm256_mask_i32gather_ps(_mm256_setzero_ps(), ys, indexes, all, 4), pointY);
+        _mm256_storeu_ps(distances + i, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(deltaX, deltaX), _mm256_mul_ps(deltaY, deltaY))));
+    }
+    ScalarStraightDistances(xs, ys, cities + i, count - i, x, y, distances + i);
+}
+
+inline void StraightDistances(const double *xs, const double *ys, const CityId *cities, size_t count, double x, double y, double *distances, DistanceKernel kernel = BestDistanceKernel())
+{
+    DistanceKernel best = BestDistanceKernel();
+    switch (kernel < best ? kernel : best) {
+        case DistanceKernel::AVX2: Avx2StraightDistances(xs, ys, cities, count, x, y, distances); break;
+        case DistanceKernel::SSE2: Sse2StraightDistances(xs, ys, cities, count, x, y, distances); break;
+        default: ScalarStraightDistances(xs, ys, cities, count, x, y, distances);
+    }
+}
+
+inline void StraightDistances(const float *xs, const float *ys, const CityId *cities, size_t count, float x, float y, float *distances, DistanceKernel kernel = BestDistanceKernel())
+{
+    DistanceKernel best = BestDistanceKernel();
+    switch (kernel < best ? kernel : best) {
+        case DistanceKernel::AVX2: Avx2StraightDistances(xs, ys, cities, count, x, y, distances); break;
+        case DistanceKernel::SSE2: Sse2StraightDistances(xs, ys, cities, count, x, y, distances); break;
+        default: ScalarStraightDistances(xs, ys, cities, count, x, y, distances);
+    }
+}
+
+#endif // CITYMAP_X86_KERNELS
+
+// takes a snapshot, a batch of cities and another city, and fills distances with the straight-line distance from each city of the batch to it
+template <typename T, typename Weight>
+void StraightDistances(const CityGraph<T, Weight> &graph, const CityId *cities, size_t count, CityId target, T *distances)
+{
+    StraightDistances(graph.Xs(), graph.Ys(), cities, count, graph.X(target), graph.Y(target), distances);
+}
+
+#endif // DISTANCEKERNEL_H_INCLUDED
@@ -0,0 +1,270 @@
+#ifndef DYNAMICPATHTREE_H_INCLUDED
+#define DYNAMICPATHTREE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <algorithm>
+#include "CityGraph.h"
+#include "SearchWorkspace.h"
+#include "ShortestPathTree.h"
+using namespace std;
+
+// shortest path tree from a city which is kept up to date as the map changes, repairing the part of it the changes reach
+// in the way of Ramalingam and Reps rather than growing it again:
+// removed roads and cities can only lengthen the paths of the cities below them in the tree, so those subtrees are cut off,
+// and their distances found again by a search seeded from the cities around them that kept theirs, leaving out added roads;
+// added roads can then only shorten paths, so a search is seeded from the ends of the added roads they shorten,
+// and goes on only through cities whose distance drops;
+// both searches only visit cities whose distance changes and their neighbours, so the work follows the size of the change;
+// ids move when cities come or go, so then the arrays are carried over to the new ids first, the one step which goes over every city
+template <typename T, typename Weight = T>
+class DynamicPathTree
+{
+    public:
+        DynamicPathTree(const string &source, const shared_ptr<const CityGraph<T, Weight> > &graph);
+        void Update(const CityGraph<T, Weight> &previous, const shared_ptr<const CityGraph<T, Weight> > &graph, const vector<GraphChange> *changes); // follow a newly published snapshot
+        const PathTree<T, Weight> &Tree() const { return tree; }
+        size_t Repaired() const { return repaired; } // cities whose distance the last update searched for again
+    private:
+        void Grow(const shared_ptr<const CityGraph<T, Weight> > &graph); // the whole tree, when the changes are not known
+        void CarryOver(const CityGraph<T, Weight> &previous, const CityGraph<T, Weight> &graph, const set<string> &renewed, vector<CityId> &cut); // move the arrays to the ids of graph
+        void Cut(const CityGraph<T, Weight> &graph, const vector<CityId> &cut, const set<pair<CityId, CityId> > &added); // repair removals
+        void Shorten(const CityGraph<T, Weight> &graph, const set<pair<CityId, CityId> > &added); // repair additions
+        bool Reachable(CityId city) const { return tree.distances[city] != Unreachable<T>(); }
+        string source;
+        PathTree<T, Weight> tree;
+        size_t repaired;
+};
+
+template <typename T, typename Weight>
+DynamicPathTree<T, Weight>::DynamicPathTree(const string &source, const shared_ptr<const CityGraph<T, Weight> > &graph) : source(source), repaired(0)
+{
+    Grow(graph);
+}
+
+template <typename T, typename Weight>
+void DynamicPathTree<T, Weight>::Grow(const shared_ptr<const CityGraph<T, Weight> > &graph)
+{
+    tree = GrowPathTree(graph, graph->Find(source), TreeAlgorithm::Dijkstra);
+    repaired = graph->Size();
+}
+
+// takes the previous snapshot, the new one and the changes between them, or null when they are unknown, and repairs the tree
+template <typename T, typename Weight>
+void DynamicPathTree<T, Weight>::Update(const CityGraph<T, Weight> &previous, const shared_ptr<const CityGraph<T, Weight> > &graph, const vector<GraphChange> *changes)
+{
+    CityId newSource = graph->Find(source);
+    if (!changes || tree.source == NO_CITY || newSource == NO_CITY) {
+        Grow(graph);
+        return;
+    }
+    set<string> renewed; // cities removed, and maybe added again somewhere else
+    bool citiesChanged = false;
+    for(vector<GraphChange>::const_iterator it = changes->begin(); it != changes->end(); it++) {
+        if (it->kind == GraphChange::CityRemoved) {
+            renewed.insert(it->first);
+        }
+        citiesChanged = citiesChanged || it->kind == GraphChange::CityAdded || it->kind == GraphChange::CityRemoved;
+    }
+    if (renewed.count(source)) {
+        Grow(graph);
+        return;
+    }
+
+    vector<CityId> cut; // cities whose road to their parent has gone
+    if (citiesChanged) {
+        CarryOver(previous, *graph, renewed, cut);
+    }
+    tree.graph = graph;
+    tree.source = newSource;
+    set<pair<CityId, CityId> > added; // roads added, smaller id first
+    for(vector<GraphChange>::const_iterator it = changes->begin(); it != changes->end(); it++) {
+        if (it->kind != GraphChange::RoadAdded && it->kind != GraphChange::RoadRemoved) {
+            continue;
+        }
+        CityId first = graph->Find(it->first);
+        CityId second = graph->Find(it->second);
+        if (first == NO_CITY || second == NO_CITY) {
+            continue;
+        }
+        // a road removed and added again may be longer than it was, so a removal cuts the tree whether the road is back or not,
+        // and the road, if back, is added again by Shorten
+        bool exists = graph->FindRoad(first, second) != graph->LastRoad(first);
+        if (it->kind == GraphChange::RoadAdded && exists) {
+            added.insert(make_pair(min(first, second), max(first, second)));
+        }
+        else if (it->kind == GraphChange::RoadRemoved) {
+            if (tree.parents[second] == first) {
+                cut.push_back(second);
+            }
+            if (tree.parents[first] == second) {
+                cut.push_back(first);
+            }
+        }
+    }
+    repaired = 0;
+    Cut(*graph, cut, added);
+    Shorten(*graph, added);
+}
+
+// takes both snapshots and walks their cities side by side in name order to give every city its old entries;
+// cities which are new, or were removed and added again, start unreachable, and their old children, like the children of removed cities, are cut
+template <typename T, typename Weight>
+void DynamicPathTree<T, Weight>::CarryOver(const CityGraph<T, Weight> &previous, const CityGraph<T, Weight> &graph, const set<string> &renewed, vector<CityId> &cut)
+{
+    vector<CityId> newIds(previous.Size(), NO_CITY);
+    CityId oldPosition = 0;
+    for(CityId position = 0; position < graph.Size(); position++) {
+        CityId city = graph.ByName(position);
+        string_view name = graph.NameView(city);
+        while (oldPosition < previous.Size() && previous.NameView(previous.ByName(oldPosition)) < name) {
+            oldPosition++;
+        }
+        if (oldPosition < previous.Size() && previous.NameView(previous.ByName(oldPosition)) == name && !renewed.count(string(name))) {
+            newIds[previous.ByName(oldPosition)] = city;
+        }
+    }
+    vector<T> distances(graph.Size(), Unreachable<T>());
+    vector<CityId> parents(graph.Size(), NO_CITY);
+    for(CityId old = 0; old < previous.Size(); old++) {
+        CityId city = newIds[old];
+        if (city == NO_CITY || tree.distances[old] == Unreachable<T>()) {
+            continue;
+        }
+        distances[city] = tree.distances[old];
+        CityId oldParent = tree.parents[old];
+        if (oldParent != NO_CITY && newIds[oldParent] == NO_CITY) {
+            cut.push_back(city);
+        }
+        else if (oldParent != NO_CITY) {
+            parents[city] = newIds[oldParent];
+        }
+    }
+    tree.distances.swap(distances);
+    tree.parents.swap(parents);
+}
+
+// takes the cities cut from their parents and finds the distances of everything below them again, without the added roads:
+// the subtrees are collected by following, from each city, the neighbours whose parent it is, and emptied,
+// then every city in them is seeded with its best road to a city outside, and the rest is Dijkstra's algorithm inside them
+template <typename T, typename Weight>
+void DynamicPathTree<T, Weight>::Cut(const CityGraph<T, Weight> &graph, const vector<CityId> &cut, const set<pair<CityId, CityId> > &added)
+{
+    if (cut.empty()) {
+        return;
+    }
+    SearchSpace<T> &search = SearchWorkspace<T>::ForThisThread().forward;
+    search.Start(graph.Size());
+    // cities in the subtrees are marked by being reached, with a settled flag of their own kept for the search below
+    vector<CityId> affected;
+    for(vector<CityId>::const_iterator it = cut.begin(); it != cut.end(); it++) {
+        if (!search.Reached(*it) && Reachable(*it)) {
+            search.Reach(*it, Unreachable<T>(), NO_CITY);
+            affected.push_back(*it);
+        }
+    }
+    for(size_t i = 0; i < affected.size(); i++) {
+        CityId city = affected[i];
+        for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+            CityId neighbour = graph.Target(road);
+            if (tree.parents[neighbour] == city && !search.Reached(neighbour)) {
+                search.Reach(neighbour, Unreachable<T>(), NO_CITY);
+                affected.push_back(neighbour);
+            }
+        }
+    }
+    for(vector<CityId>::iterator it = affected.begin(); it != affected.end(); it++) {
+        tree.distances[*it] = Unreachable<T>();
+        tree.parents[*it] = NO_CITY;
+    }
+    repaired += affected.size();
+
+    for(vector<CityId>::iterator it = affected.begin(); it != affected.end(); it++) {
+        CityId city = *it;
+        for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+            CityId neighbour = graph.Target(road);
+            if (search.Reached(neighbour) || !Reachable(neighbour) || added.count(make_pair(min(city, neighbour), max(city, neighbour)))) {
+                continue;
+            }
+            T distance = tree.distances[neighbour] + graph.Length(road);
+            if (distance < tree.distances[city]) {
+                tree.distances[city] = distance;
+                tree.parents[city] = neighbour;
+            }
+        }
+        if (Reachable(city)) {
+            search.heap.Push(city, tree.distances[city]);
+        }
+    }
+    while (!search.heap.Empty()) {
+        CityId city = search.heap.PopMin();
+        search.Settle(city);
+        for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+            CityId neighbour = graph.Target(road);
+            if (!search.Reached(neighbour) || search.Settled(neighbour) || added.count(make_pair(min(city, neighbour), max(city, neighbour)))) {
+                continue;
+            }
+            T distance = tree.distances[city] + graph.Length(road);
+            if (distance < tree.distances[neighbour]) {
+                tree.distances[neighbour] = distance;
+                tree.parents[neighbour] = city;
+                if (search.heap.Contains(neighbour)) {
+                    search.heap.DecreaseKey(neighbour, distance);
+                }
+                else {
+                    search.heap.Push(neighbour, distance);
+                }
+            }
+        }
+    }
+}
+
+// takes the added roads and lowers the distances they shorten, and the distances those lead to
+template <typename T, typename Weight>
+void DynamicPathTree<T, Weight>::Shorten(const CityGraph<T, Weight> &graph, const set<pair<CityId, CityId> > &added)
+{
+    if (added.empty()) {
+        return;
+    }
+    SearchSpace<T> &search = SearchWorkspace<T>::ForThisThread().forward;
+    search.Start(graph.Size());
+    // takes a city, a shorter distance to it and the city it comes from, and records it, queueing the city
+    auto lower = [&](CityId city, T distance, CityId parent) {
+        tree.distances[city] = distance;
+        tree.parents[city] = parent;
+        if (!search.Reached(city)) {
+            repaired++;
+        }
+        search.Reach(city, distance, parent);
+        if (search.heap.Contains(city)) {
+            search.heap.DecreaseKey(city, distance);
+        }
+        else {
+            search.heap.Push(city, distance);
+        }
+    };
+    for(typename set<pair<CityId, CityId> >::const_iterator it = added.begin(); it != added.end(); it++) {
+        T length = graph.Length(graph.FindRoad(it->first, it->second));
+        if (Reachable(it->first) && tree.distances[it->first] + length < tree.distances[it->second]) {
+            lower(it->second, tree.distances[it->first] + length, it->first);
+        }
+        else if (Reachable(it->second) && tree.distances[it->second] + length < tree.distances[it->first]) {
+            lower(it->first, tree.distances[it->second] + length, it->second);
+        }
+    }
+    while (!search.heap.Empty()) {
+        CityId city = search.heap.PopMin();
+        search.Settle(city);
+        for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+            CityId neighbour = graph.Target(road);
+            T distance = tree.distances[city] + graph.Length(road);
+            if (distance < tree.distances[neighbour]) {
+                lower(neighbour, distance, city);
+            }
+        }
+    }
+}
+
+#endif // DYNAMICPATHTREE_H_INCLUDED
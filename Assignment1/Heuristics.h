@@ -0,0 +1,270 @@
+#ifndef HEURISTICS_H_INCLUDED
+#define HEURISTICS_H_INCLUDED
+
+#include <vector>
+#include <math.h>
+#include "CityGraph.h"
+#include "SearchWorkspace.h"
+#include "Metrics.h"
+using namespace std;
+
+// heuristic policies of CityMap; a policy gets a lower bound of the road distance between two cities of a snapshot,
+// and is refreshed every time the snapshot is frozen:
+//     typedef ... DistanceMetric; the metric policy of the map (see Metrics.h)
+//     typedef CityGraph<T, Weight> Graph; the snapshots of the map, with their road lengths stored as Weight
+//     void Refresh(const Graph &previous, const Graph &graph, const vector<GraphChange> *changes);
+//     T Estimate(const Graph &graph, CityId city, CityId target) const;
+//     void EstimateBatch(const Graph &graph, const CityId *cities, size_t count, CityId target, T *estimates) const;
+// the map takes its metric and its snapshot type from its heuristic, so the two always agree and are fixed at compile time;
+// EstimateBatch gives the estimates of count cities at once, equal to those of Estimate, so A* can get a whole block of neighbours in one call;
+// changes lists what was done to the maps between previous and graph, or is null when that is not known;
+// estimates must be consistent (dropping by no more than the length of a road along it) for A* to stay exact
+
+// bound of the metric between two cities, a lower bound since every road is as long as the metric says
+template <typename T, typename Metric = EuclideanMetric<T>, typename Weight = T>
+class MetricHeuristic
+{
+    public:
+        typedef Metric DistanceMetric;
+        typedef CityGraph<T, Weight> Graph;
+        void Refresh(const Graph &, const Graph &, const vector<GraphChange> *) {}
+        T Estimate(const Graph &graph, CityId city, CityId target) const
+        {
+            return Metric::Bound(graph.X(city), graph.Y(city), graph.X(target), graph.Y(target));
+        }
+        void EstimateBatch(const Graph &graph, const CityId *cities, size_t count, CityId target, T *estimates) const
+        {
+            Metric::Bounds(graph.Xs(), graph.Ys(), cities, count, graph.X(target), graph.Y(target), estimates);
+        }
+};
+
+// straight-line distance between two cities, the default heuristic
+template <typename T, typename Weight = T>
+using EuclideanHeuristic = MetricHeuristic<T, EuclideanMetric<T>, Weight>;
+
+// landmark (ALT) heuristic: the road distances from a few well spread landmark cities to every city are precomputed,
+// and by the triangle inequality |d(L, target) - d(L, city)| <= d(city, target) for every landmark L;
+// the best of these bounds and the bound of the metric is the estimate;
+// roads are two-way, so distances from a landmark are also the distances to it;
+// the table is stored city by city, so the entries a query reads for one city are next to each other
+template <typename T, unsigned int LANDMARKS = 8, typename Metric = EuclideanMetric<T>, typename Weight = T>
+class LandmarkHeuristic
+{
+    public:
+        typedef Metric DistanceMetric;
+        typedef CityGraph<T, Weight> Graph;
+        LandmarkHeuristic() : removalsSinceBuild(0) {}
+        void Refresh(const Graph &previous, const Graph &graph, const vector<GraphChange> *changes);
+        T Estimate(const Graph &graph, CityId city, CityId target) const;
+        void EstimateBatch(const Graph &graph, const CityId *cities, size_t count, CityId target, T *estimates) const;
+        const vector<CityId> &Landmarks() const { return landmarks; } // ids in the last snapshot, NO_CITY for a removed landmark
+    private:
+        T Tighten(CityId city, CityId target, T bound) const; // raise a bound of the metric with the landmark bounds
+        void Build(const Graph &graph); // choose the landmarks and compute all their distances
+        void DistancesFrom(const Graph &graph, CityId landmark, unsigned int slot, SearchSpace<T> &search);
+        void Lower(const Graph &graph, CityId city, unsigned int slot, T distance, SearchSpace<T> &search);
+        T &Entry(CityId city, unsigned int slot) { return distances[size_t(city) * LANDMARKS + slot]; }
+        vector<CityId> landmarks;
+        vector<T> distances; // distance from landmark i to city v at v * LANDMARKS + i, Unreachable if there is none
+        size_t removalsSinceBuild; // roads removed since the landmarks were chosen
+        MetricHeuristic<T, Metric, Weight> metric;
+};
+
+// takes two cities and gets the largest of the landmark bounds and the bound of the metric
+template <typename T, unsigned int LANDMARKS, typename Metric, typename Weight>
+T LandmarkHeuristic<T, LANDMARKS, Metric, Weight>::Estimate(const Graph &graph, CityId city, CityId target) const
+{
+    return Tighten(city, target, metric.Estimate(graph, city, target));
+}
+
+// takes a batch of cities and gets the bounds of the metric of all of them in one batch before tightening each one
+template <typename T, unsigned int LANDMARKS, typename Metric, typename Weight>
+void LandmarkHeuristic<T, LANDMARKS, Metric, Weight>::EstimateBatch(const Graph &graph, const CityId *cities, size_t count, CityId target, T *estimates) const
+{
+    metric.EstimateBatch(graph, cities, count, target, estimates);
+    for(size_t i = 0; i < count; i++) {
+        estimates[i] = Tighten(cities[i], target, estimates[i]);
+    }
+}
+
+// takes two cities and the bound of the metric between them and gets the largest of it and the landmark bounds;
+// a city some landmark reaches while the other city is out of its reach is in another part of the map, so it is Unreachable
+template <typename T, unsigned int LANDMARKS, typename Metric, typename Weight>
+T LandmarkHeuristic<T, LANDMARKS, Metric, Weight>::Tighten(CityId city, CityId target, T bound) const
+{
+    T unreachable = Unreachable<T>();
+    const T *fromCity = &distances[size_t(city) * LANDMARKS];
+    const T *fromTarget = &distances[size_t(target) * LANDMARKS];
+    for(unsigned int slot = 0; slot < landmarks.size(); slot++) {
+        if (fromCity[slot] == unreachable || fromTarget[slot] == unreachable) {
+            if (fromCity[slot] != fromTarget[slot]) {
+                return unreachable;
+            }
+            continue;
+        }
+        T difference = fromTarget[slot] < fromCity[slot] ? fromCity[slot] - fromTarget[slot] : fromTarget[slot] - fromCity[slot];
+        if (bound < difference) {
+            bound = difference;
+        }
+    }
+    return bound;
+}
+
+// takes the previous and the new snapshot and what changed between them and brings the table up to date;
+// the table stays a valid bound after roads are removed, as removing roads never shortens a distance,
+// and after roads are added the entries they shorten are lowered from the ends of the new roads;
+// the landmarks are chosen again when the changes are unknown or many roads have gone since they were chosen
+template <typename T, unsigned int LANDMARKS, typename Metric, typename Weight>
+void LandmarkHeuristic<T, LANDMARKS, Metric, Weight>::Refresh(const Graph &previous, const Graph &graph, const vector<GraphChange> *changes)
+{
+    if (!changes || landmarks.size() < LANDMARKS) {
+        Build(graph);
+        return;
+    }
+    bool citiesChanged = false;
+    for(vector<GraphChange>::const_iterator it = changes->begin(); it != changes->end(); it++) {
+        citiesChanged = citiesChanged || it->kind == GraphChange::CityAdded || it->kind == GraphChange::CityRemoved;
+        if (it->kind == GraphChange::RoadRemoved) {
+            removalsSinceBuild++;
+        }
+    }
+    if (removalsSinceBuild * 16 > graph.RoadCount()) {
+        Build(graph);
+        return;
+    }
+
+    // ids only depend on the cities and their coordinates, so they only move when cities come or go
+    if (citiesChanged) {
+        vector<T> carried(size_t(graph.Size()) * LANDMARKS, Unreachable<T>());
+        for(CityId city = 0; city < graph.Size(); city++) {
+            CityId previousCity = previous.Find(graph.Name(city));
+            if (previousCity != NO_CITY) {
+                copy(&distances[size_t(previousCity) * LANDMARKS], &distances[size_t(previousCity) * LANDMARKS] + LANDMARKS, &carried[size_t(city) * LANDMARKS]);
+            }
+        }
+        distances.swap(carried);
+        for(vector<CityId>::iterator it = landmarks.begin(); it != landmarks.end(); it++) {
+            *it = *it == NO_CITY ? NO_CITY : graph.Find(previous.Name(*it));
+        }
+    }
+
+    SearchSpace<T> search;
+    for(vector<GraphChange>::const_iterator it = changes->begin(); it != changes->end(); it++) {
+        if (it->kind != GraphChange::RoadAdded) {
+            continue;
+        }
+        // the road may have been removed again before the snapshot was frozen
+        CityId first = graph.Find(it->first);
+        CityId second = graph.Find(it->second);
+        if (first == NO_CITY || second == NO_CITY || graph.FindRoad(first, second) == graph.LastRoad(first)) {
+            continue;
+        }
+        T length = graph.Length(graph.FindRoad(first, second));
+        for(unsigned int slot = 0; slot < landmarks.size(); slot++) {
+            if (Entry(first, slot) != Unreachable<T>()) {
+                Lower(graph, second, slot, Entry(first, slot) + length, search);
+            }
+            if (Entry(second, slot) != Unreachable<T>()) {
+                Lower(graph, first, slot, Entry(second, slot) + length, search);
+            }
+        }
+    }
+}
+
+// takes a snapshot and picks each landmark as the city farthest from the landmarks picked before it,
+// cities out of reach of all of them counting as farthest, then computes the whole table
+template <typename T, unsigned int LANDMARKS, typename Metric, typename Weight>
+void LandmarkHeuristic<T, LANDMARKS, Metric, Weight>::Build(const Graph &graph)
+{
+    landmarks.clear();
+    distances.assign(size_t(graph.Size()) * LANDMARKS, T());
+    removalsSinceBuild = 0;
+    if (graph.Size() == 0) {
+        return;
+    }
+
+    SearchSpace<T> search;
+    // the first landmark is the city farthest from an arbitrary one, which is measured in the first slot for now
+    DistancesFrom(graph, 0, 0, search);
+    vector<T> nearest(graph.Size()); // distance from each city to its closest landmark
+    for(CityId city = 0; city < graph.Size(); city++) {
+        nearest[city] = Entry(city, 0);
+    }
+    for(unsigned int slot = 0; slot < LANDMARKS; slot++) {
+        CityId farthest = CityId(max_element(nearest.begin(), nearest.end()) - nearest.begin());
+        if (!landmarks.empty() && !(T() < nearest[farthest])) {
+            break;
+        }
+        landmarks.push_back(farthest);
+        DistancesFrom(graph, farthest, slot, search);
+        for(CityId city = 0; city < graph.Size(); city++) {
+            if (Entry(city, slot) < nearest[city]) {
+                nearest[city] = Entry(city, slot);
+            }
+        }
+    }
+}
+
+// takes a landmark and fills its slot of the table with the distances from it to every city
+template <typename T, unsigned int LANDMARKS, typename Metric, typename Weight>
+void LandmarkHeuristic<T, LANDMARKS, Metric, Weight>::DistancesFrom(const Graph &graph, CityId landmark, unsigned int slot, SearchSpace<T> &search)
+{
+    search.Start(graph.Size());
+    search.Reach(landmark, 0, NO_CITY);
+    search.heap.Push(landmark, 0);
+    while (!search.heap.Empty()) {
+        CityId current = search.heap.PopMin();
+        search.Settle(current);
+        for(RoadId road = graph.FirstRoad(current); road != graph.LastRoad(current); road++) {
+            CityId target = graph.Target(road);
+            T distance = search.Distance(current) + graph.Length(road);
+            if (!search.Reached(target)) {
+                search.Reach(target, distance, current);
+                search.heap.Push(target, distance);
+            }
+            else if (!search.Settled(target) && distance < search.Distance(target)) {
+                search.Reach(target, distance, current);
+                search.heap.DecreaseKey(target, distance);
+            }
+        }
+    }
+    for(CityId city = 0; city < graph.Size(); city++) {
+        Entry(city, slot) = search.Reached(city) ? search.Distance(city) : Unreachable<T>();
+    }
+}
+
+// takes a city and a distance to it from the landmark in slot, and if it is shorter than the entry, lowers the entry
+// and every entry the shorter distance leads to
+template <typename T, unsigned int LANDMARKS, typename Metric, typename Weight>
+void LandmarkHeuristic<T, LANDMARKS, Metric, Weight>::Lower(const Graph &graph, CityId city, unsigned int slot, T distance, SearchSpace<T> &search)
+{
+    if (!(distance < Entry(city, slot))) {
+        return;
+    }
+    search.Start(graph.Size());
+    Entry(city, slot) = distance;
+    search.Reach(city, distance, NO_CITY);
+    search.heap.Push(city, distance);
+    while (!search.heap.Empty()) {
+        CityId current = search.heap.PopMin();
+        search.Settle(current);
+        for(RoadId road = graph.FirstRoad(current); road != graph.LastRoad(current); road++) {
+            CityId target = graph.Target(road);
+            T targetDistance = Entry(current, slot) + graph.Length(road);
+            if (!(targetDistance < Entry(target, slot)) || search.Settled(target)) {
+                continue;
+            }
+            Entry(target, slot) = targetDistance;
+            if (!search.Reached(target)) {
+                search.Reach(target, targetDistance, current);
+                search.heap.Push(target, targetDistance);
+            }
+            else {
+                search.Reach(target, targetDistance, current);
+                search.heap.DecreaseKey(target, targetDistance);
+            }
+        }
+    }
+}
+
+#endif // HEURISTICS_H_INCLUDED
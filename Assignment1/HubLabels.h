@@ -0,0 +1,294 @@
+#ifndef HUBLABELS_H_INCLUDED
+#define HUBLABELS_H_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include "CityGraph.h"
+#include "ContractionHierarchy.h"
+#include "Parallel.h"
+using namespace std;
+
+// size and speed of a set of hub labels, for deciding whether they are worth the memory
+struct HubLabelReport {
+    HubLabelReport() : cities(0), hubs(0), largestLabel(0), bytes(0), plainBytes(0), buildSeconds(0), queryMicroseconds(0) {}
+    size_t cities;
+    size_t hubs; // entries of all the labels
+    size_t largestLabel; // entries of the largest label
+    size_t bytes; // memory the labels take as stored, offsets included
+    size_t plainBytes; // memory the same labels would take as arrays of (hub, distance) pairs
+    double buildSeconds;
+    double queryMicroseconds; // mean time of a distance query, over random pairs timed after the build
+};
+
+// hub labels over a contraction hierarchy: every city has a label of (hub, distance) pairs such that any two cities
+// share a hub on a shortest path between them, so their distance is the smallest sum over the hubs of both labels,
+// found by merging the two labels, which are sorted by hub;
+// the label of a city is its upward search space in the hierarchy, less the hubs some other hub of the label reaches more cheaply;
+// hubs are numbered by rank, so the hubs of a label are mostly important cities with close numbers, and labels are stored
+// one after another in a single array, each hub as a varint of its difference from the one before, followed by its distance
+template <typename T>
+class HubLabels
+{
+    public:
+        explicit HubLabels(const ContractionHierarchy<T> &hierarchy);
+        T Distance(CityId firstCity, CityId secondCity) const; // Unreachable if there is no path
+        size_t LabelSize(CityId city) const; // hubs in the label of a city
+        const HubLabelReport &Report() const { return report; }
+    private:
+        static const size_t QUERY_SAMPLE = 10000; // random queries timed for the report
+        struct Entry {
+            CityId hub; // rank of the hub
+            T distance;
+        };
+        static T Merge(const vector<Entry> &first, const vector<Entry> &second); // shortest distance through a shared hub
+        static void AppendVarint(unsigned char *&out, CityId value);
+        static size_t VarintSize(CityId value);
+        static void ReadEntry(const unsigned char *&in, CityId &hub, T &distance); // adds the next difference to hub
+        vector<size_t> firstByte; // label of city v is bytes [firstByte[v], firstByte[v+1])
+        vector<unsigned char> bytes;
+        HubLabelReport report;
+};
+
+template <typename T>
+const size_t HubLabels<T>::QUERY_SAMPLE;
+
+// takes a contraction hierarchy and labels its cities from the most important down:
+// a label is the city itself joined with the labels of its upward neighbours, the distances lengthened by the road to them,
+// after which every hub that the label and the hub's own label show a shorter way to is pruned;
+// cities are labelled in rounds by height in the upward graph, so the upward neighbours of a round are all labelled
+// in earlier rounds and the cities of a round are labelled in parallel
+template <typename T>
+HubLabels<T>::HubLabels(const ContractionHierarchy<T> &hierarchy)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    CityId cityCount = hierarchy.Size();
+    vector<CityId> byRank(cityCount);
+    for(CityId city = 0; city < cityCount; city++) {
+        byRank[hierarchy.Rank(city)] = city;
+    }
+    vector<unsigned int> height(cityCount, 0);
+    vector<vector<CityId> > rounds;
+    for(CityId position = cityCount; position > 0; position--) {
+        CityId city = byRank[position - 1];
+        for(RoadId road = hierarchy.FirstUpward(city); road != hierarchy.LastUpward(city); road++) {
+            height[city] = max(height[city], height[hierarchy.UpwardTarget(road)] + 1);
+        }
+        if (rounds.size() <= height[city]) {
+            rounds.resize(height[city] + 1);
+        }
+        rounds[height[city]].push_back(city);
+    }
+
+    vector<vector<Entry> > labels(cityCount);
+    for(size_t round = 0; round < rounds.size(); round++) {
+        const vector<CityId> &cities = rounds[round];
+        ParallelFor(cities.size(), [&](size_t i) {
+            CityId city = cities[i];
+            vector<Entry> candidates;
+            Entry self = { hierarchy.Rank(city), T() };
+            candidates.push_back(self);
+            for(RoadId road = hierarchy.FirstUpward(city); road != hierarchy.LastUpward(city); road++) {
+                const vector<Entry> &above = labels[hierarchy.UpwardTarget(road)];
+                T length = hierarchy.UpwardLength(road);
+                for(typename vector<Entry>::const_iterator it = above.begin(); it != above.end(); it++) {
+                    Entry entry = { it->hub, length + it->distance };
+                    candidates.push_back(entry);
+                }
+            }
+            // the shortest distance to every hub comes first, and the rest of its entries are dropped
+            sort(candidates.begin(), candidates.end(), [](const Entry &a, const Entry &b) {
+                return a.hub < b.hub || (a.hub == b.hub && a.distance < b.distance);
+            });
+            candidates.erase(unique(candidates.begin(), candidates.end(), [](const Entry &a, const Entry &b) { return a.hub == b.hub; }), candidates.end());
+            vector<Entry> &label = labels[city];
+            for(typename vector<Entry>::iterator it = candidates.begin(); it != candidates.end(); it++) {
+                if (it->hub == self.hub || !(Merge(candidates, labels[byRank[it->hub]]) < it->distance)) {
+                    label.push_back(*it);
+                }
+            }
+        });
+    }
+
+    // sizes first, so every label can be encoded in parallel straight into its place
+    firstByte.assign(cityCount + 1, 0);
+    ParallelFor(cityCount, [&](size_t city) {
+        size_t size = 0;
+        CityId previous = 0;
+        for(typename vector<Entry>::iterator it = labels[city].begin(); it != labels[city].end(); it++) {
+            size += VarintSize(it->hub - previous) + sizeof(T);
+            previous = it->hub;
+        }
+        firstByte[city + 1] = size;
+    });
+    for(CityId city = 0; city < cityCount; city++) {
+        firstByte[city + 1] += firstByte[city];
+        report.hubs += labels[city].size();
+        report.largestLabel = max(report.largestLabel, labels[city].size());
+    }
+    bytes.resize(firstByte[cityCount]);
+    ParallelFor(cityCount, [&](size_t city) {
+        unsigned char *out = bytes.data() + firstByte[city];
+        CityId previous = 0;
+        for(typename vector<Entry>::iterator it = labels[city].begin(); it != labels[city].end(); it++) {
+            AppendVarint(out, it->hub - previous);
+            memcpy(out, &it->distance, sizeof(T));
+            out += sizeof(T);
+            previous = it->hub;
+        }
+        vector<Entry>().swap(labels[city]);
+    });
+
+    report.cities = cityCount;
+    report.bytes = bytes.size() + firstByte.size() * sizeof(size_t);
+    report.plainBytes = report.hubs * sizeof(Entry) + firstByte.size() * sizeof(size_t);
+    report.buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (cityCount > 0) {
+        // a fixed linear congruential sequence, so the sample is the same for the same hierarchy
+        unsigned long long state = 1;
+        T sum = T();
+        chrono::steady_clock::time_point timed = chrono::steady_clock::now();
+        for(size_t query = 0; query < QUERY_SAMPLE; query++) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            CityId first = CityId((state >> 33) % cityCount);
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            CityId second = CityId((state >> 33) % cityCount);
+            T distance = Distance(first, second);
+            if (distance != Unreachable<T>()) {
+                sum += distance;
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - timed).count();
+        volatile T kept = sum; // the queries are only timed, this keeps them from being optimized away
+        (void)kept;
+        report.queryMicroseconds = seconds * 1e6 / QUERY_SAMPLE;
+    }
+}
+
+// takes two labels sorted by hub and gets the shortest sum of distances over the hubs they share, Unreachable if they share none
+template <typename T>
+T HubLabels<T>::Merge(const vector<Entry> &first, const vector<Entry> &second)
+{
+    T best = Unreachable<T>();
+    typename vector<Entry>::const_iterator a = first.begin();
+    typename vector<Entry>::const_iterator b = second.begin();
+    while (a != first.end() && b != second.end()) {
+        if (a->hub < b->hub) {
+            a++;
+        }
+        else if (b->hub < a->hub) {
+            b++;
+        }
+        else {
+            if (a->distance + b->distance < best) {
+                best = a->distance + b->distance;
+            }
+            a++;
+            b++;
+        }
+    }
+    return best;
+}
+
+// takes a value and gets how many bytes it takes as a varint
+template <typename T>
+size_t HubLabels<T>::VarintSize(CityId value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// takes a value and writes it at out, seven bits a byte from the lowest, the high bit set on every byte but the last
+template <typename T>
+void HubLabels<T>::AppendVarint(unsigned char *&out, CityId value)
+{
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+}
+
+// takes a position in the labels, decodes the entry there into hub, which holds the hub before it, and distance, and moves past it
+template <typename T>
+void HubLabels<T>::ReadEntry(const unsigned char *&in, CityId &hub, T &distance)
+{
+    CityId difference = 0;
+    unsigned int shift = 0;
+    while (*in & 0x80) {
+        difference |= CityId(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    difference |= CityId(*in++) << shift;
+    hub += difference;
+    memcpy(&distance, in, sizeof(T));
+    in += sizeof(T);
+}
+
+// takes two cities and gets the shortest distance between them, merging their labels as they are decoded
+template <typename T>
+T HubLabels<T>::Distance(CityId firstCity, CityId secondCity) const
+{
+    T best = Unreachable<T>();
+    const unsigned char *a = bytes.data() + firstByte[firstCity];
+    const unsigned char *aEnd = bytes.data() + firstByte[firstCity + 1];
+    const unsigned char *b = bytes.data() + firstByte[secondCity];
+    const unsigned char *bEnd = bytes.data() + firstByte[secondCity + 1];
+    if (a == aEnd || b == bEnd) {
+        return best;
+    }
+    CityId hubA = 0, hubB = 0;
+    T distanceA, distanceB;
+    ReadEntry(a, hubA, distanceA);
+    ReadEntry(b, hubB, distanceB);
+    CITYMAP_COUNT(size_t scanned = 2); // label entries read
+    while (true) {
+        if (hubA < hubB) {
+            if (a == aEnd) {
+                break;
+            }
+            ReadEntry(a, hubA, distanceA);
+            CITYMAP_COUNT(scanned++);
+        }
+        else if (hubB < hubA) {
+            if (b == bEnd) {
+                break;
+            }
+            ReadEntry(b, hubB, distanceB);
+            CITYMAP_COUNT(scanned++);
+        }
+        else {
+            if (distanceA + distanceB < best) {
+                best = distanceA + distanceB;
+            }
+            if (a == aEnd || b == bEnd) {
+                break;
+            }
+            ReadEntry(a, hubA, distanceA);
+            ReadEntry(b, hubB, distanceB);
+            CITYMAP_COUNT(scanned += 2);
+        }
+    }
+    CITYMAP_COUNT(SearchWorkspace<T>::ForThisThread().scans.scanned += scanned);
+    return best;
+}
+
+// takes a city and gets the number of hubs in its label
+template <typename T>
+size_t HubLabels<T>::LabelSize(CityId city) const
+{
+    size_t size = 0;
+    CityId hub = 0;
+    T distance;
+    for(const unsigned char *in = bytes.data() + firstByte[city]; in != bytes.data() + firstByte[city + 1]; size++) {
+        ReadEntry(in, hub, distance);
+    }
+    return size;
+}
+
+#endif // HUBLABELS_H_INCLUDED
@@ -0,0 +1,717 @@
+#ifndef JOURNAL_H_INCLUDED
+#define JOURNAL_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#endif
+using namespace std;
+
+// kinds of edits a journal records
+enum class JournalEntryKind : unsigned char {
+    CityAdded = 1,
+    RoadAdded,
+    CityRemoved, // with all of its roads
+    RoadRemoved
+};
+
+// one edit of a map as recorded in a journal
+template <typename T>
+struct JournalEntry {
+    JournalEntryKind kind;
+    string first; // city added or removed, or one end of a road
+    string second; // other end of a road
+    T x; // coordinates of an added city
+    T y;
+    T length; // of an added road, as the map stored it
+};
+
+// when a journal is synced and compacted
+struct JournalOptions {
+    JournalOptions() : syncBytes(size_t(1) << 20), compactBytes(size_t(64) << 20) {}
+    size_t syncBytes; // edits are held in memory until there are this many bytes of them, then written and synced together
+    size_t compactBytes; // journal size at which the map is saved as a new snapshot and a new journal is started
+};
+
+// what a journal has done since it was opened, for choosing its options
+struct JournalStats {
+    JournalStats() : generation(0), replayed(0), discardedBytes(0), appended(0), syncs(0), compactions(0), failedCompactions(0), bytes(0) {}
+    uint64_t generation; // of the journal being written
+    size_t replayed; // edits replayed when the journal was opened
+    size_t discardedBytes; // bytes of torn records dropped when the journal was opened
+    size_t appended; // edits recorded
+    size_t syncs;
+    size_t compactions; // snapshots started
+    size_t failedCompactions; // snapshots which could not be saved, whose older journals are kept instead
+    size_t bytes; // of the journal being written, held edits included
+};
+
+// fixed-size start of a journal file, checked before its records are replayed
+struct JournalFileHeader {
+    char magic[8]; // "CITYLOG" and a zero
+    uint32_t formatVersion;
+    uint32_t byteOrder; // JOURNAL_BYTE_ORDER_MARK as written by the machine that wrote the file
+    uint32_t distanceSize; // sizeof(T)
+    uint32_t distanceIsInteger;
+    uint64_t generation; // the same as in the file name, so a renamed file is not replayed over the wrong snapshot
+    uint32_t replaced; // whether the map was replaced as a whole when the generation began, so the journal follows only its own snapshot
+    uint32_t reserved;
+};
+
+// outcome of recovering a map from its journals
+enum class JournalRecovery {
+    Ok,
+    Unwritable, // the journal to append to could not be opened
+    SnapshotMissing // a journal begins with the map replaced as a whole, and its own snapshot was not loaded
+};
+
+const uint32_t JOURNAL_FILE_FORMAT_VERSION = 1;
+const uint32_t JOURNAL_BYTE_ORDER_MARK = 0x01020304;
+
+// append-only journal of the edits of a map, kept next to snapshots of the map; files are numbered by generation,
+// path.<generation>.map being a snapshot and path.<generation>.journal the edits made after it, so the map is
+// the latest snapshot there is with the journals from its generation on replayed over it, in order;
+// a record is the size and checksum of an edit followed by the edit, so a record torn by a crash is found and dropped on replay;
+// edits are encoded into a buffer, which is written and synced once it holds syncBytes of them or when Sync is called,
+// so an edit costs little more than copying it, and a crash loses only the edits which were not synced yet;
+// compaction starts the journal of the next generation at once and saves its snapshot on a thread of its own, deleting
+// the files of older generations only once the snapshot is on disk, so edits go on while it is saved and a crash loses nothing synced;
+// a map replaced as a whole, by an import or a map file, cannot be reached from the journals before, so its snapshot is saved
+// before its journal is started, and a journal marked as starting with a replacement is never replayed over another snapshot
+template <typename T>
+class MapJournal
+{
+    public:
+        MapJournal(const string &path, const JournalOptions &options);
+        ~MapJournal(); // syncs the held edits and waits for a snapshot still being saved
+        vector<uint64_t> Snapshots() const; // generations with a snapshot, the latest first
+        vector<uint64_t> Journals() const; // generations with a journal, in order
+        JournalRecovery Recover(uint64_t generation, bool fromSnapshot, vector<JournalEntry<T> > &entries); // read the journals from a generation on, and append to the last
+        bool AddCity(const string &cityName, T x, T y);
+        bool AddRoad(const string &firstCity, const string &secondCity, T length);
+        bool RemoveCity(const string &cityName);
+        bool RemoveRoad(const string &firstCity, const string &secondCity);
+        bool Sync(); // write and sync the held edits
+        bool CompactionDue() const { return !saving && written + buffer.size() >= options.compactBytes; }
+        template <typename Graph>
+        bool Compact(const shared_ptr<const Graph> &graph, bool replaced); // start a new generation whose snapshot is graph
+        uint64_t Generation() const { return generation; } // of the journal being written, or of the one recovery stopped at
+        string SnapshotPath(uint64_t generation) const;
+        string JournalPath(uint64_t generation) const;
+        string Path() const { return JournalPath(generation); } // of the journal being written
+        JournalStats Stats() const;
+    private:
+        MapJournal(const MapJournal &other);
+        bool Open(uint64_t nextGeneration, size_t validBytes, bool replaced); // append to the journal of a generation, cutting it after validBytes
+        void Generations(const string &suffix, vector<uint64_t> &found) const; // generations of the files with a suffix, in order
+        size_t Read(uint64_t fileGeneration, vector<JournalEntry<T> > &entries, size_t &fileBytes, bool &replaced) const; // bytes of whole records
+        template <typename Graph>
+        bool SaveSnapshot(const Graph &graph, uint64_t snapshotGeneration) const; // write, sync and rename into place
+        void DropOlder(uint64_t firstKept) const; // delete the files of the generations before one
+        void Begin(JournalEntryKind kind);
+        void Put(const string &name);
+        void Put(T value);
+        bool End();
+        static bool Get(const char *&in, const char *last, string &name);
+        static bool Get(const char *&in, const char *last, T &value);
+        static uint32_t Checksum(const char *first, const char *last);
+        static int OpenFile(const string &filePath); // for writing, created if it is missing; -1 if it cannot be opened
+        static bool Truncate(int file, size_t length); // cut a file after length bytes and write on from there
+        static bool WriteFile(int file, const char *first, size_t length);
+        static bool SyncData(int file);
+        static void CloseFile(int file);
+        static bool SyncFile(const string &filePath, bool isDirectory);
+        string path;
+        string directory; // holding the files, for listing and syncing them
+        string prefix; // file name of path, which the names of the files start with
+        JournalOptions options;
+        uint64_t generation;
+        int descriptor; // of the journal being written, -1 before one is opened
+        size_t written; // bytes of the journal on disk
+        bool torn; // whether a write failed partway, so the journal may hold part of a record after written
+        vector<char> buffer; // edits not written yet, as records
+        size_t recordFirst; // where the record being encoded starts in buffer
+        JournalStats stats;
+        atomic<bool> saving; // whether a snapshot is being saved by compactor
+        atomic<size_t> failedCompactions;
+        thread compactor;
+};
+
+// takes the path files are named after and the options, and opens nothing yet
+template <typename T>
+MapJournal<T>::MapJournal(const string &path, const JournalOptions &options)
+    : path(path), options(options), generation(0), descriptor(-1), written(0), torn(false), recordFirst(0), saving(false), failedCompactions(0)
+{
+    size_t slash = path.rfind('/');
+    directory = slash == string::npos ? string(".") : (slash == 0 ? string("/") : path.substr(0, slash));
+    prefix = slash == string::npos ? path : path.substr(slash + 1);
+}
+
+template <typename T>
+MapJournal<T>::~MapJournal()
+{
+    Sync();
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+    if (descriptor >= 0) {
+        CloseFile(descriptor);
+    }
+}
+
+template <typename T>
+string MapJournal<T>::SnapshotPath(uint64_t fileGeneration) const
+{
+    return path + "." + to_string(fileGeneration) + ".map";
+}
+
+template <typename T>
+string MapJournal<T>::JournalPath(uint64_t fileGeneration) const
+{
+    return path + "." + to_string(fileGeneration) + ".journal";
+}
+
+// takes a suffix and fills found with the generations of the files named prefix.<generation><suffix> in the directory, in order
+template <typename T>
+void MapJournal<T>::Generations(const string &suffix, vector<uint64_t> &found) const
+{
+    found.clear();
+    vector<string> names;
+#ifdef _WIN32
+    _finddata_t file;
+    intptr_t listing = _findfirst((directory + "/" + prefix + ".*" + suffix).c_str(), &file);
+    if (listing == -1) {
+        return;
+    }
+    do {
+        names.push_back(file.name);
+    } while (_findnext(listing, &file) == 0);
+    _findclose(listing);
+#else
+    DIR *listing = opendir(directory.c_str());
+    if (!listing) {
+        return;
+    }
+    while (dirent *file = readdir(listing)) {
+        names.push_back(file->d_name);
+    }
+    closedir(listing);
+#endif
+    for(vector<string>::iterator it = names.begin(); it != names.end(); it++) {
+        const string &name = *it;
+        if (name.size() <= prefix.size() + 1 + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 || name[prefix.size()] != '.'
+            || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+        string digits = name.substr(prefix.size() + 1, name.size() - prefix.size() - 1 - suffix.size());
+        if (digits.find_first_not_of("0123456789") == string::npos) {
+            found.push_back(strtoull(digits.c_str(), 0, 10));
+        }
+    }
+    sort(found.begin(), found.end());
+}
+
+template <typename T>
+vector<uint64_t> MapJournal<T>::Snapshots() const
+{
+    vector<uint64_t> found;
+    Generations(".map", found);
+    reverse(found.begin(), found.end());
+    return found;
+}
+
+template <typename T>
+vector<uint64_t> MapJournal<T>::Journals() const
+{
+    vector<uint64_t> found;
+    Generations(".journal", found);
+    return found;
+}
+
+// takes the generation of the snapshot the map was loaded from, or of the first journal when there is none, and appends the edits
+// of the journals from that generation on to entries, in order, then goes on appending to the last of them;
+// a torn record ends the replay: its journal is cut short before it and the journals after it are deleted, as they came after
+// edits which are lost; a journal which starts with the map replaced, and whose snapshot was not the one loaded, ends the recovery
+// with nothing deleted and no journal opened, as its edits were made to a map the files before it cannot give
+template <typename T>
+JournalRecovery MapJournal<T>::Recover(uint64_t firstGeneration, bool fromSnapshot, vector<JournalEntry<T> > &entries)
+{
+    vector<uint64_t> journals = Journals();
+    size_t entriesBefore = entries.size();
+    uint64_t last = firstGeneration;
+    uint64_t expected = firstGeneration;
+    size_t validBytes = 0;
+    bool torn = false;
+    for(vector<uint64_t>::iterator it = journals.begin(); it != journals.end(); it++) {
+        if (*it < firstGeneration) {
+            continue;
+        }
+        if (torn || *it != expected) {
+            remove(JournalPath(*it).c_str());
+            torn = true;
+            continue;
+        }
+        size_t fileBytes = 0;
+        bool replaced = false;
+        vector<JournalEntry<T> > read;
+        size_t readBytes = Read(*it, read, fileBytes, replaced);
+        if (replaced && !(fromSnapshot && *it == firstGeneration)) {
+            generation = *it;
+            entries.resize(entriesBefore);
+            return JournalRecovery::SnapshotMissing;
+        }
+        entries.insert(entries.end(), read.begin(), read.end());
+        last = *it;
+        validBytes = readBytes;
+        if (validBytes < fileBytes) {
+            stats.discardedBytes += fileBytes - validBytes;
+            torn = true;
+        }
+        expected++;
+    }
+    stats.replayed = entries.size() - entriesBefore;
+    return Open(last, validBytes, false) ? JournalRecovery::Ok : JournalRecovery::Unwritable;
+}
+
+// takes a generation, reads the records of its journal into entries up to the first one which is torn or does not check out,
+// and gets the bytes of the journal up to there, 0 if it has another format; fileBytes is set to the bytes of the whole file,
+// and replaced to whether the generation began with the map replaced as a whole
+template <typename T>
+size_t MapJournal<T>::Read(uint64_t fileGeneration, vector<JournalEntry<T> > &entries, size_t &fileBytes, bool &replaced) const
+{
+    vector<char> bytes;
+    FILE *file = fopen(JournalPath(fileGeneration).c_str(), "rb");
+    if (file) {
+        char chunk[1 << 16];
+        size_t got;
+        while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            bytes.insert(bytes.end(), chunk, chunk + got);
+        }
+        fclose(file);
+    }
+    fileBytes = bytes.size();
+    JournalFileHeader header;
+    if (bytes.size() < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, &bytes[0], sizeof(header));
+    if (memcmp(header.magic, "CITYLOG", 8) != 0 || header.formatVersion != JOURNAL_FILE_FORMAT_VERSION || header.byteOrder != JOURNAL_BYTE_ORDER_MARK
+        || header.distanceSize != sizeof(T) || header.distanceIsInteger != uint32_t(numeric_limits<T>::is_integer) || header.generation != fileGeneration) {
+        return 0;
+    }
+    replaced = header.replaced != 0;
+
+    const char *first = &bytes[0];
+    const char *last = first + bytes.size();
+    const char *in = first + sizeof(header);
+    while (size_t(last - in) >= 2 * sizeof(uint32_t)) {
+        uint32_t size, checksum;
+        memcpy(&size, in, sizeof(size));
+        memcpy(&checksum, in + sizeof(size), sizeof(checksum));
+        const char *record = in + 2 * sizeof(uint32_t);
+        if (size == 0 || size_t(last - record) < size || Checksum(record, record + size) != checksum) {
+            break;
+        }
+        const char *recordLast = record + size;
+        JournalEntry<T> entry = JournalEntry<T>();
+        entry.kind = JournalEntryKind(*record++);
+        bool decoded = Get(record, recordLast, entry.first);
+        switch (entry.kind) {
+            case JournalEntryKind::CityAdded:
+                decoded = decoded && Get(record, recordLast, entry.x) && Get(record, recordLast, entry.y);
+                break;
+            case JournalEntryKind::RoadAdded:
+                decoded = decoded && Get(record, recordLast, entry.second) && Get(record, recordLast, entry.length);
+                break;
+            case JournalEntryKind::RoadRemoved:
+                decoded = decoded && Get(record, recordLast, entry.second);
+                break;
+            case JournalEntryKind::CityRemoved:
+                break;
+            default:
+                decoded = false;
+        }
+        if (!decoded || record != recordLast) {
+            break;
+        }
+        entries.push_back(entry);
+        in = recordLast;
+    }
+    return size_t(in - first);
+}
+
+// takes a generation and the bytes of its journal worth keeping, syncs and closes the journal being written and appends to that one,
+// cut short after validBytes; a journal with nothing worth keeping is started again with just its header, which records
+// whether the generation begins with the map replaced
+template <typename T>
+bool MapJournal<T>::Open(uint64_t nextGeneration, size_t validBytes, bool replaced)
+{
+    bool synced = Sync();
+    // edits which could not be written belong to the journal being closed; the snapshot the next generation starts from holds them
+    buffer.clear();
+    torn = false;
+    if (descriptor >= 0) {
+        CloseFile(descriptor);
+    }
+    generation = nextGeneration;
+    descriptor = OpenFile(JournalPath(generation));
+    if (descriptor < 0) {
+        written = 0;
+        return false;
+    }
+    bool started = validBytes < sizeof(JournalFileHeader);
+    written = started ? 0 : validBytes;
+    if (!Truncate(descriptor, written)) {
+        return false;
+    }
+    if (started) {
+        JournalFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "CITYLOG", 8);
+        header.formatVersion = JOURNAL_FILE_FORMAT_VERSION;
+        header.byteOrder = JOURNAL_BYTE_ORDER_MARK;
+        header.distanceSize = sizeof(T);
+        header.distanceIsInteger = numeric_limits<T>::is_integer;
+        header.generation = generation;
+        header.replaced = replaced;
+        buffer.insert(buffer.begin(), (const char *)&header, (const char *)&header + sizeof(header));
+        // the new file has to be in its directory before anything recorded in it counts as synced
+        return Sync() && SyncFile(directory, true) && synced;
+    }
+    return synced;
+}
+
+// starts encoding an edit: room for the size and checksum, which End fills in, then its kind
+template <typename T>
+void MapJournal<T>::Begin(JournalEntryKind kind)
+{
+    recordFirst = buffer.size();
+    buffer.resize(recordFirst + 2 * sizeof(uint32_t));
+    buffer.push_back(char(kind));
+}
+
+// takes a name and appends it as a varint of its length followed by its characters
+template <typename T>
+void MapJournal<T>::Put(const string &name)
+{
+    uint64_t length = name.size();
+    while (length >= 0x80) {
+        buffer.push_back(char(length | 0x80));
+        length >>= 7;
+    }
+    buffer.push_back(char(length));
+    buffer.insert(buffer.end(), name.begin(), name.end());
+}
+
+template <typename T>
+void MapJournal<T>::Put(T value)
+{
+    const char *bytes = (const char *)&value;
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// finishes encoding an edit, and writes and syncs the held edits once there are enough of them; gets whether that went well
+template <typename T>
+bool MapJournal<T>::End()
+{
+    const char *record = &buffer[recordFirst + 2 * sizeof(uint32_t)];
+    uint32_t size = uint32_t(&buffer[0] + buffer.size() - record);
+    uint32_t checksum = Checksum(record, record + size);
+    memcpy(&buffer[recordFirst], &size, sizeof(size));
+    memcpy(&buffer[recordFirst + sizeof(size)], &checksum, sizeof(checksum));
+    stats.appended++;
+    return buffer.size() < options.syncBytes || Sync();
+}
+
+// takes a position in a record and the end of the record, decodes the name there and moves past it; gets whether there was one
+template <typename T>
+bool MapJournal<T>::Get(const char *&in, const char *last, string &name)
+{
+    uint64_t length = 0;
+    for(unsigned int shift = 0; ; shift += 7) {
+        if (in == last || shift > 63) {
+            return false;
+        }
+        unsigned char byte = (unsigned char)*in++;
+        length |= uint64_t(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            break;
+        }
+    }
+    if (uint64_t(last - in) < length) {
+        return false;
+    }
+    name.assign(in, size_t(length));
+    in += length;
+    return true;
+}
+
+template <typename T>
+bool MapJournal<T>::Get(const char *&in, const char *last, T &value)
+{
+    if (size_t(last - in) < sizeof(T)) {
+        return false;
+    }
+    memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+    return true;
+}
+
+template <typename T>
+bool MapJournal<T>::AddCity(const string &cityName, T x, T y)
+{
+    Begin(JournalEntryKind::CityAdded);
+    Put(cityName);
+    Put(x);
+    Put(y);
+    return End();
+}
+
+template <typename T>
+bool MapJournal<T>::AddRoad(const string &firstCity, const string &secondCity, T length)
+{
+    Begin(JournalEntryKind::RoadAdded);
+    Put(firstCity);
+    Put(secondCity);
+    Put(length);
+    return End();
+}
+
+template <typename T>
+bool MapJournal<T>::RemoveCity(const string &cityName)
+{
+    Begin(JournalEntryKind::CityRemoved);
+    Put(cityName);
+    return End();
+}
+
+template <typename T>
+bool MapJournal<T>::RemoveRoad(const string &firstCity, const string &secondCity)
+{
+    Begin(JournalEntryKind::RoadRemoved);
+    Put(firstCity);
+    Put(secondCity);
+    return End();
+}
+
+// writes the held edits to the journal in one go and syncs it; edits which could not be written are kept, with the error,
+// and written again with the next ones: a write which failed partway may have left part of a record after written, which recovery
+// would stop at, losing every record synced after it, so the journal is cut back to written before anything more is written to it
+template <typename T>
+bool MapJournal<T>::Sync()
+{
+    if (buffer.empty()) {
+        return true;
+    }
+    if (descriptor < 0 || (torn && !Truncate(descriptor, written))) {
+        return false;
+    }
+    torn = false;
+    bool synced = WriteFile(descriptor, &buffer[0], buffer.size()) && SyncData(descriptor);
+    if (synced) {
+        written += buffer.size();
+        stats.syncs++;
+        buffer.clear();
+    }
+    else {
+        torn = !Truncate(descriptor, written);
+    }
+    return synced;
+}
+
+// takes a snapshot holding every edit recorded so far, and whether it replaced the map as a whole, and makes it the start
+// of the next generation; after edits, later edits go to a new journal at once, while a thread saves the snapshot, as the
+// journals before still lead to the same map if it is lost; after a replacement they do not, so the snapshot is saved before
+// the new journal is started, and a snapshot which cannot be saved leaves the journal as it was; a snapshot still being saved
+// is waited for first
+template <typename T>
+template <typename Graph>
+bool MapJournal<T>::Compact(const shared_ptr<const Graph> &graph, bool replaced)
+{
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+    uint64_t next = generation + 1;
+    stats.compactions++;
+    if (replaced) {
+        if (!Sync() || !SaveSnapshot(*graph, next)) {
+            failedCompactions++;
+            return false;
+        }
+        if (!Open(next, 0, true)) {
+            return false;
+        }
+        DropOlder(next);
+        return true;
+    }
+    if (!Open(next, 0, false)) {
+        return false;
+    }
+    saving = true;
+    compactor = thread([this, graph, next]() {
+        if (SaveSnapshot(*graph, next)) {
+            DropOlder(next);
+        }
+        else {
+            failedCompactions++;
+        }
+        saving = false;
+    });
+    return true;
+}
+
+// takes a snapshot and a generation and saves the snapshot as that generation's under a temporary name, syncs it and renames it
+// into place, so a snapshot is there whole or not at all; gets whether it is on disk
+template <typename T>
+template <typename Graph>
+bool MapJournal<T>::SaveSnapshot(const Graph &graph, uint64_t snapshotGeneration) const
+{
+    string snapshotPath = SnapshotPath(snapshotGeneration);
+    string temporaryPath = snapshotPath + ".tmp";
+    bool saved = graph.Save(temporaryPath) && SyncFile(temporaryPath, false)
+        && rename(temporaryPath.c_str(), snapshotPath.c_str()) == 0 && SyncFile(directory, true);
+    if (!saved) {
+        remove(temporaryPath.c_str());
+    }
+    return saved;
+}
+
+// takes the first generation to keep and deletes the snapshots and journals of the generations before it
+template <typename T>
+void MapJournal<T>::DropOlder(uint64_t firstKept) const
+{
+    vector<uint64_t> older;
+    Generations(".map", older);
+    for(vector<uint64_t>::iterator it = older.begin(); it != older.end() && *it < firstKept; it++) {
+        remove(SnapshotPath(*it).c_str());
+    }
+    Generations(".journal", older);
+    for(vector<uint64_t>::iterator it = older.begin(); it != older.end() && *it < firstKept; it++) {
+        remove(JournalPath(*it).c_str());
+    }
+}
+
+// the file calls below are POSIX, with the MSVCRT calls of the same meaning on Windows, where a directory cannot be synced
+// and is left to the file system
+
+template <typename T>
+int MapJournal<T>::OpenFile(const string &filePath)
+{
+#ifdef _WIN32
+    return _open(filePath.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(filePath.c_str(), O_WRONLY | O_CREAT, 0644);
+#endif
+}
+
+template <typename T>
+bool MapJournal<T>::Truncate(int file, size_t length)
+{
+#ifdef _WIN32
+    return _chsize_s(file, (__int64)length) == 0 && _lseeki64(file, (__int64)length, SEEK_SET) >= 0;
+#else
+    return ftruncate(file, off_t(length)) == 0 && lseek(file, off_t(length), SEEK_SET) >= 0;
+#endif
+}
+
+// takes a file and a range of bytes and writes them all at the end of it
+template <typename T>
+bool MapJournal<T>::WriteFile(int file, const char *first, size_t length)
+{
+    for(size_t done = 0; done < length; ) {
+#ifdef _WIN32
+        int wrote = _write(file, first + done, (unsigned int)min(length - done, size_t(1) << 30));
+#else
+        ssize_t wrote = write(file, first + done, length - done);
+#endif
+        if (wrote <= 0) {
+            return false;
+        }
+        done += size_t(wrote);
+    }
+    return true;
+}
+
+// takes a file and syncs what was written to it, leaving out times which are not needed to read it back
+template <typename T>
+bool MapJournal<T>::SyncData(int file)
+{
+#ifdef _WIN32
+    return _commit(file) == 0;
+#else
+    return fdatasync(file) == 0;
+#endif
+}
+
+template <typename T>
+void MapJournal<T>::CloseFile(int file)
+{
+#ifdef _WIN32
+    _close(file);
+#else
+    close(file);
+#endif
+}
+
+// takes the path of a file or a directory and syncs it, so what was written to it, or the names in it, survive a crash
+template <typename T>
+bool MapJournal<T>::SyncFile(const string &filePath, bool isDirectory)
+{
+#ifdef _WIN32
+    if (isDirectory) {
+        return true;
+    }
+    int file = _open(filePath.c_str(), _O_RDWR | _O_BINARY);
+#else
+    int file = open(filePath.c_str(), isDirectory ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+#endif
+    if (file < 0) {
+        return false;
+    }
+#ifdef _WIN32
+    bool synced = _commit(file) == 0;
+#else
+    bool synced = fsync(file) == 0;
+#endif
+    CloseFile(file);
+    return synced;
+}
+
+// takes a range of bytes and gets their 32-bit FNV-1a hash
+template <typename T>
+uint32_t MapJournal<T>::Checksum(const char *first, const char *last)
+{
+    uint32_t hash = 2166136261u;
+    for(const char *byte = first; byte != last; byte++) {
+        hash ^= (unsigned char)*byte;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+JournalStats MapJournal<T>::Stats() const
+{
+    JournalStats current = stats;
+    current.generation = generation;
+    current.failedCompactions = failedCompactions;
+    current.bytes = written + buffer.size();
+    return current;
+}
+
+#endif // JOURNAL_H_INCLUDED
@@ -0,0 +1,25 @@
+#ifndef MESSAGES_H_INCLUDED
+#define MESSAGES_H_INCLUDED
+
+#include <string>
+using namespace std;
+
+// subjects and reasons of the errors a CityMap and its loaders report
+//Constants
+const string ALREADY_EXISTS = "already exists";
+const string DOESNT_EXIST = "doesn't exist";
+const string MUST_BE_DIFFERENT = "must be different";
+const string CITY = "City";
+const string ROAD = "Road";
+const string PATH = "Path";
+const string SNAPSHOT_FILE = "Map file";
+const string JOURNAL_FILE = "Journal file";
+const string CANT_BE_READ = "can't be read";
+const string CANT_BE_WRITTEN = "can't be written";
+const string WRONG_FORMAT = "has a different format";
+const string IS_CORRUPT = "is corrupt";
+const string LINE = "Line";
+const string IS_MALFORMED = "is malformed";
+const string CANT_BE_NEGATIVE = "can't be negative";
+
+#endif // MESSAGES_H_INCLUDED
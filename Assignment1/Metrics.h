@@ -0,0 +1,153 @@
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <stddef.h>
+#include <math.h>
+#include "CityGraph.h"
+#include "DistanceKernel.h"
+using namespace std;
+
+// metric policies of CityMap, chosen at compile time through its heuristic policy (see Heuristics.h);
+// a metric gives the length of a road from the positions of its cities, and a lower bound of the road distance between two cities:
+//     static T Length(T x1, T y1, T x2, T y2);
+//     static void Lengths(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *lengths);
+//     static T Bound(T x1, T y1, T x2, T y2);
+//     static void Bounds(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *bounds);
+//     static T AxisBound(T x, T y, T split, bool alongX);
+//     static const bool EXPLICIT_LENGTHS;
+// the batch versions do what the single ones do for count cities at once; a road distance is made of roads as long as the metric says,
+// so any bound which satisfies the triangle inequality of the metric, the metric itself included, is a lower bound;
+// with EXPLICIT_LENGTHS, roads are added with a length of their own, which nothing relates to the positions, so the bound is 0;
+// AxisBound is a lower bound of Length from a position to any position whose x, or y if alongX is false, is on the other side
+// of split, for pruning searches over positions such as SpatialIndex
+
+// straight-line distance on a plane
+template <typename T>
+struct EuclideanMetric {
+    static const bool EXPLICIT_LENGTHS = false;
+    static T Length(T x1, T y1, T x2, T y2)
+    {
+        T deltaX = x2 - x1;
+        T deltaY = y2 - y1;
+        return sqrt(deltaX * deltaX + deltaY * deltaY);
+    }
+    static void Lengths(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *lengths)
+    {
+        StraightDistances(xs, ys, cities, count, x, y, lengths);
+    }
+    static T Bound(T x1, T y1, T x2, T y2) { return Length(x1, y1, x2, y2); }
+    static void Bounds(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *bounds)
+    {
+        Lengths(xs, ys, cities, count, x, y, bounds);
+    }
+    static T AxisBound(T x, T y, T split, bool alongX)
+    {
+        T coordinate = alongX ? x : y;
+        return split < coordinate ? coordinate - split : split - coordinate;
+    }
+};
+
+// distance along the axes, as on a street grid
+template <typename T>
+struct ManhattanMetric {
+    static const bool EXPLICIT_LENGTHS = false;
+    static T Length(T x1, T y1, T x2, T y2)
+    {
+        return (x2 < x1 ? x1 - x2 : x2 - x1) + (y2 < y1 ? y1 - y2 : y2 - y1);
+    }
+    static void Lengths(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *lengths)
+    {
+        for(size_t i = 0; i < count; i++) {
+            lengths[i] = Length(x, y, xs[cities[i]], ys[cities[i]]);
+        }
+    }
+    static T Bound(T x1, T y1, T x2, T y2) { return Length(x1, y1, x2, y2); }
+    static void Bounds(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *bounds)
+    {
+        Lengths(xs, ys, cities, count, x, y, bounds);
+    }
+    static T AxisBound(T x, T y, T split, bool alongX)
+    {
+        T coordinate = alongX ? x : y;
+        return split < coordinate ? coordinate - split : split - coordinate;
+    }
+};
+
+// great-circle distance in kilometres between positions given as longitude (x) and latitude (y) in degrees, by the haversine formula
+template <typename T>
+struct HaversineMetric {
+    static const bool EXPLICIT_LENGTHS = false;
+    static T Length(T x1, T y1, T x2, T y2)
+    {
+        const double EARTH_RADIUS = 6371.0088; // mean radius in kilometres
+        const double RADIANS = 3.14159265358979323846 / 180;
+        double latitude1 = double(y1) * RADIANS;
+        double latitude2 = double(y2) * RADIANS;
+        double sinLatitude = sin((latitude2 - latitude1) / 2);
+        double sinLongitude = sin((double(x2) - double(x1)) * RADIANS / 2);
+        double h = sinLatitude * sinLatitude + cos(latitude1) * cos(latitude2) * sinLongitude * sinLongitude;
+        return T(2 * EARTH_RADIUS * asin(sqrt(h < 1 ? h : 1)));
+    }
+    static void Lengths(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *lengths)
+    {
+        for(size_t i = 0; i < count; i++) {
+            lengths[i] = Length(x, y, xs[cities[i]], ys[cities[i]]);
+        }
+    }
+    static T Bound(T x1, T y1, T x2, T y2) { return Length(x1, y1, x2, y2); }
+    static void Bounds(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *bounds)
+    {
+        Lengths(xs, ys, cities, count, x, y, bounds);
+    }
+    // a latitude is at least its difference away, along the meridian; a longitude is at least as far as its meridian,
+    // reached the shorter way round, which the other side reaches from behind through 180 degrees; past a quarter turn the
+    // nearest position of a meridian is the pole; the bound is taken a hair lower, so rounding cannot make it pass Length
+    static T AxisBound(T x, T y, T split, bool alongX)
+    {
+        const double EARTH_RADIUS = 6371.0088;
+        const double RADIANS = 3.14159265358979323846 / 180;
+        const double MARGIN = 1 - 1e-9;
+        if (!alongX) {
+            return T(double(Length(x, y, x, split)) * MARGIN);
+        }
+        double angle = x < split ? min(double(split) - double(x), double(x) + 180) : min(double(x) - double(split), 180 - double(x));
+        if (!(angle > 0)) {
+            return T();
+        }
+        double sinDistance = cos(double(y) * RADIANS) * sin(min(angle, 90.0) * RADIANS);
+        return T(EARTH_RADIUS * asin(sinDistance < 1 ? sinDistance : 1) * MARGIN);
+    }
+};
+
+// lengths given with each road, such as travel times; a road added without one is as long as the straight line
+template <typename T>
+struct ExplicitLengths {
+    static const bool EXPLICIT_LENGTHS = true;
+    static T Length(T x1, T y1, T x2, T y2) { return EuclideanMetric<T>::Length(x1, y1, x2, y2); }
+    static void Lengths(const T *xs, const T *ys, const CityId *cities, size_t count, T x, T y, T *lengths)
+    {
+        EuclideanMetric<T>::Lengths(xs, ys, cities, count, x, y, lengths);
+    }
+    static T Bound(T, T, T, T) { return T(); }
+    static T AxisBound(T x, T y, T split, bool alongX) { return EuclideanMetric<T>::AxisBound(x, y, split, alongX); }
+    static void Bounds(const T *, const T *, const CityId *, size_t count, T, T, T *bounds)
+    {
+        for(size_t i = 0; i < count; i++) {
+            bounds[i] = T();
+        }
+    }
+};
+
+template <typename T>
+const bool EuclideanMetric<T>::EXPLICIT_LENGTHS;
+
+template <typename T>
+const bool ManhattanMetric<T>::EXPLICIT_LENGTHS;
+
+template <typename T>
+const bool HaversineMetric<T>::EXPLICIT_LENGTHS;
+
+template <typename T>
+const bool ExplicitLengths<T>::EXPLICIT_LENGTHS;
+
+#endif // METRICS_H_INCLUDED
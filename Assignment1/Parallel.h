@@ -0,0 +1,143 @@
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+// number of threads parallel work is spread over, one per core
+inline unsigned int WorkerCount()
+{
+    unsigned int cores = thread::hardware_concurrency();
+    return cores == 0 ? 1 : cores;
+}
+
+// takes a number of items and a function, and calls function(item) for every item in [0, count) on all cores;
+// threads take the next item as they finish one, so items of uneven cost are spread evenly;
+// the calling thread works too, and everything is done when this returns
+template <typename Function>
+void ParallelFor(size_t count, Function function)
+{
+    size_t threadCount = WorkerCount();
+    if (threadCount > count) {
+        threadCount = count;
+    }
+    atomic<size_t> next(0);
+    auto work = [&]() {
+        for(size_t item = next++; item < count; item = next++) {
+            function(item);
+        }
+    };
+    vector<thread> threads;
+    for(size_t i = 1; i < threadCount; i++) {
+        threads.push_back(thread(work));
+    }
+    work();
+    for(vector<thread>::iterator it = threads.begin(); it != threads.end(); it++) {
+        it->join();
+    }
+}
+
+// threads kept for a computation of many short parallel steps, such as the rounds of delta-stepping, which would spend more
+// starting and joining threads for each step than working; between steps the threads wait on a condition variable;
+// For runs a step like ParallelFor, with the thread that made the team working too, and returns when every item is done
+class WorkerTeam
+{
+    public:
+        explicit WorkerTeam(unsigned int threadCount = WorkerCount());
+        ~WorkerTeam(); // stops and joins the threads
+        template <typename Function>
+        void For(size_t items, Function &work); // calls work(item) for every item in [0, items) on the threads of the team
+        unsigned int Size() const { return (unsigned int)threads.size() + 1; } // threads working on a step, counting the caller
+    private:
+        void Work(); // loop of a thread of the team
+        void Take(); // calls the step for items until there are none left
+        vector<thread> threads;
+        mutex lock;
+        condition_variable started; // signalled when a step starts or the team stops
+        condition_variable finished; // signalled when the last thread of the team is done with a step
+        void (*call)(void *function, size_t item); // calls the function of the current step
+        void *function;
+        size_t count; // items of the current step
+        atomic<size_t> next; // next item of the current step to be taken
+        unsigned long step; // steps started, guarded by lock
+        unsigned int busy; // threads of the team not done with the current step yet, guarded by lock
+        bool stopping; // guarded by lock
+};
+
+inline WorkerTeam::WorkerTeam(unsigned int threadCount) : call(0), function(0), count(0), next(0), step(0), busy(0), stopping(false)
+{
+    for(unsigned int i = 1; i < threadCount; i++) {
+        threads.push_back(thread(&WorkerTeam::Work, this));
+    }
+}
+
+inline WorkerTeam::~WorkerTeam()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    started.notify_all();
+    for(vector<thread>::iterator it = threads.begin(); it != threads.end(); it++) {
+        it->join();
+    }
+}
+
+// takes a number of items and a function, and wakes the team to share them out; the function is only called through a pointer,
+// so a step costs no allocation; a team with no threads of its own, or a step of one item, just calls it in place
+template <typename Function>
+void WorkerTeam::For(size_t items, Function &work)
+{
+    if (threads.empty() || items < 2) {
+        for(size_t item = 0; item < items; item++) {
+            work(item);
+        }
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        call = [](void *stepFunction, size_t item) { (*static_cast<Function *>(stepFunction))(item); };
+        function = &work;
+        count = items;
+        next = 0;
+        busy = (unsigned int)threads.size();
+        step++;
+    }
+    started.notify_all();
+    Take();
+    unique_lock<mutex> guard(lock);
+    finished.wait(guard, [this]() { return busy == 0; });
+}
+
+inline void WorkerTeam::Take()
+{
+    for(size_t item = next++; item < count; item = next++) {
+        call(function, item);
+    }
+}
+
+// waits for each step, takes items of it until there are none left, and reports being done, until the team stops
+inline void WorkerTeam::Work()
+{
+    unsigned long done = 0;
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        started.wait(guard, [this, done]() { return stopping || step != done; });
+        if (stopping) {
+            return;
+        }
+        done = step;
+        guard.unlock();
+        Take();
+        guard.lock();
+        if (--busy == 0) {
+            finished.notify_one();
+        }
+    }
+}
+
+#endif // PARALLEL_H_INCLUDED
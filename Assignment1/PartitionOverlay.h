@@ -0,0 +1,497 @@
+#ifndef PARTITIONOVERLAY_H_INCLUDED
+#define PARTITIONOVERLAY_H_INCLUDED
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdint.h>
+#include "CityGraph.h"
+#include "SearchWorkspace.h"
+#include "Parallel.h"
+using namespace std;
+
+// multi-level partition overlay (customizable route planning) over a CityGraph snapshot;
+// the cities are split into cells by their positions alone, halving along the wider side until a cell has at most CELL_CITIES cities,
+// and every 2^LEVEL_BITS neighbouring cells of a level make one cell of the level above;
+// the boundary cities of a cell are those with a road leaving it, and customizing a cell finds the shortest distances within it
+// between its boundary cities, over the roads for the lowest level and over the cliques of its subcells above that;
+// a clique only keeps the arcs whose shortest path passes no other boundary city, as the others are made of those,
+// which leaves a few arcs per city on road networks where a full clique would have as many arcs as the cell has roads;
+// the partition does not depend on the road lengths, so after roads change only the cells whose customization reads them are customized
+// again, and the cells above those only when one of their subcells came out different, while every other cell is shared with
+// the overlay the new one was made from;
+// a query is an A* search over the roads of the lowest cells of its two cities and, elsewhere, the cliques of the highest cells
+// which hold neither; clique arcs are as long as paths of roads, so a heuristic consistent along roads stays consistent along them
+template <typename T>
+class PartitionOverlay
+{
+    public:
+        template <typename Weight>
+        PartitionOverlay(const CityGraph<T, Weight> &graph, const PartitionOverlay *previous = 0, const vector<GraphChange> *changes = 0);
+        template <typename Weight, typename Estimate>
+        bool Query(const CityGraph<T, Weight> &graph, CityId firstCity, CityId secondCity, Estimate estimate, T &distance, vector<CityId> *path) const; // false if there is no path
+        unsigned int Levels() const { return levels; }
+        size_t CellCount(unsigned int level) const { return cells[level].size(); }
+        size_t BoundaryCount(unsigned int level, size_t cell) const { return cells[level][cell]->boundary.size(); }
+        size_t ArcCount(unsigned int level, size_t cell) const { return cells[level][cell]->arcs.size(); }
+        size_t CustomizedCells() const { return customizedCells; } // cells customized to make this overlay, all of them unless it was made from another
+    private:
+        static const CityId CELL_CITIES = 64; // most cities in a cell of the lowest level
+        static const unsigned int LEVEL_BITS = 2; // a cell is made of 4 cells of the level below
+        struct Partition {
+            vector<uint32_t> leaf; // lowest cell of each city
+            vector<CityId> cities; // cities cell by cell, so every cell of every level is a range of them
+            vector<CityId> firstCity; // cities of lowest cell i are cities[firstCity[i]] to cities[firstCity[i + 1]]
+        };
+        struct Arc {
+            CityId target;
+            T length; // shortest distance within the cell
+        };
+        struct Cell {
+            vector<CityId> boundary; // sorted
+            vector<uint32_t> firstArc; // arcs of boundary city i are arcs[firstArc[i]] to arcs[firstArc[i + 1]]
+            vector<Arc> arcs; // to the boundary cities reached with no other boundary city on the way
+        };
+        template <typename Weight>
+        void Split(const CityGraph<T, Weight> &graph); // partition the cities
+        template <typename Weight>
+        shared_ptr<const Cell> Customize(const CityGraph<T, Weight> &graph, unsigned int level, uint32_t cell) const;
+        static bool Same(const Cell &first, const Cell &second); // same boundary and arcs
+        template <typename Visit>
+        void ScanClique(const Cell &cell, CityId city, Visit visit) const; // calls visit(target, length) for the arcs of a boundary city
+        template <typename Weight, typename Visit>
+        void ScanCell(const CityGraph<T, Weight> &graph, unsigned int level, uint32_t cell, CityId city, Visit visit) const; // calls visit(target, length) within a cell
+        template <typename Weight, typename Visit>
+        void ScanQuery(const CityGraph<T, Weight> &graph, const uint32_t *ends, CityId city, Visit visit) const; // the same for the search graph of a query
+        template <typename Weight, typename Estimate>
+        void Unpack(const CityGraph<T, Weight> &graph, unsigned int level, uint32_t cell, CityId from, CityId to, Estimate estimate, vector<CityId> &path) const;
+        template <typename Scan, typename Estimate>
+        bool AStar(SearchSpace<T> &search, CityId cityCount, CityId from, CityId to, Scan scan, Estimate estimate) const;
+        int QueryLevel(CityId city, const uint32_t *ends) const; // highest level whose cell of the city holds neither end, -1 if none
+        uint32_t CellOf(CityId city, unsigned int level) const { return partition->leaf[city] >> (LEVEL_BITS * level); }
+        shared_ptr<const Partition> partition; // shared by the overlays made from one another
+        unsigned int levels; // levels of cells with cliques, 0 when the graph fits in one cell
+        vector<vector<shared_ptr<const Cell> > > cells; // by level, then cell
+        size_t customizedCells;
+};
+
+template <typename T>
+const CityId PartitionOverlay<T>::CELL_CITIES;
+
+template <typename T>
+const unsigned int PartitionOverlay<T>::LEVEL_BITS;
+
+// takes a snapshot, and the overlay of the snapshot before it with the changes made since, or nulls, and customizes an overlay for it;
+// if only roads changed, the partition is shared with the previous overlay, and so is every cell but those reading a changed road:
+// the lowest cells of its cities, and above them the cells of its cities whose subcells part it, as they scan it or may lose or gain
+// a boundary city by it; a cell above the lowest level is customized again too when one of its subcells came out different,
+// so a change which leaves the cliques as they were stops there instead of reaching the highest level;
+// otherwise city ids have moved and everything is built anew; the cells of a level are customized in parallel
+template <typename T>
+template <typename Weight>
+PartitionOverlay<T>::PartitionOverlay(const CityGraph<T, Weight> &graph, const PartitionOverlay *previous, const vector<GraphChange> *changes)
+    : levels(0), customizedCells(0)
+{
+    bool reuse = previous && changes && previous->partition->leaf.size() == graph.Size();
+    for(size_t i = 0; reuse && i < changes->size(); i++) {
+        reuse = (*changes)[i].kind == GraphChange::RoadAdded || (*changes)[i].kind == GraphChange::RoadRemoved;
+    }
+    vector<vector<uint32_t> > stale; // cells to customize, by level
+    if (reuse) {
+        partition = previous->partition;
+        levels = previous->levels;
+        cells = previous->cells;
+        stale.resize(levels);
+        for(vector<GraphChange>::const_iterator it = changes->begin(); it != changes->end(); it++) {
+            CityId ends[2] = { graph.Find(it->first), graph.Find(it->second) };
+            for(unsigned int level = 0; level < levels; level++) {
+                if (level == 0 || CellOf(ends[0], level - 1) != CellOf(ends[1], level - 1)) {
+                    stale[level].push_back(CellOf(ends[0], level));
+                    stale[level].push_back(CellOf(ends[1], level));
+                }
+            }
+        }
+    }
+    else {
+        Split(graph);
+        cells.resize(levels);
+        stale.resize(levels);
+        for(unsigned int level = 0; level < levels; level++) {
+            cells[level].resize(size_t(partition->firstCity.size() - 1) >> (LEVEL_BITS * level));
+            for(uint32_t cell = 0; cell < cells[level].size(); cell++) {
+                stale[level].push_back(cell);
+            }
+        }
+    }
+
+    // a level is customized over the cliques of the level below, so the levels go bottom up
+    for(unsigned int level = 0; level < levels; level++) {
+        vector<uint32_t> &levelCells = stale[level];
+        sort(levelCells.begin(), levelCells.end());
+        levelCells.erase(unique(levelCells.begin(), levelCells.end()), levelCells.end());
+        ParallelFor(levelCells.size(), [&](size_t i) {
+            cells[level][levelCells[i]] = Customize(graph, level, levelCells[i]);
+        });
+        customizedCells += levelCells.size();
+        for(size_t i = 0; reuse && level + 1 < levels && i < levelCells.size(); i++) {
+            if (!Same(*cells[level][levelCells[i]], *previous->cells[level][levelCells[i]])) {
+                stale[level + 1].push_back(levelCells[i] >> LEVEL_BITS);
+            }
+        }
+    }
+}
+
+// takes two cells and gets whether they have the same boundary cities and the same arcs, in the same order
+template <typename T>
+bool PartitionOverlay<T>::Same(const Cell &first, const Cell &second)
+{
+    if (first.boundary != second.boundary || first.firstArc != second.firstArc) {
+        return false;
+    }
+    for(size_t arc = 0; arc < first.arcs.size(); arc++) {
+        if (first.arcs[arc].target != second.arcs[arc].target || first.arcs[arc].length != second.arcs[arc].length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// takes a snapshot and splits its cities into 2^depth lowest cells of equal size, where depth is the fewest halvings leaving
+// no more than CELL_CITIES cities in a cell; each halving sorts the cities of a cell by the coordinate it is wider in,
+// around its middle, and the first half becomes the cell numbered 2i and the second 2i + 1, so the cells of every level are ranges
+template <typename T>
+template <typename Weight>
+void PartitionOverlay<T>::Split(const CityGraph<T, Weight> &graph)
+{
+    shared_ptr<Partition> split = make_shared<Partition>();
+    CityId cityCount = graph.Size();
+    unsigned int depth = 0;
+    while ((size_t(cityCount) >> depth) > CELL_CITIES) {
+        depth++;
+    }
+    // start of cell i among 2^d cells
+    auto bound = [cityCount](unsigned int d, size_t i) { return CityId((uint64_t(cityCount) * i) >> d); };
+    split->cities.resize(cityCount);
+    for(CityId city = 0; city < cityCount; city++) {
+        split->cities[city] = city;
+    }
+    for(unsigned int d = 0; d < depth; d++) {
+        ParallelFor(size_t(1) << d, [&](size_t i) {
+            vector<CityId>::iterator first = split->cities.begin() + bound(d, i);
+            vector<CityId>::iterator middle = split->cities.begin() + bound(d + 1, 2 * i + 1);
+            vector<CityId>::iterator last = split->cities.begin() + bound(d, i + 1);
+            if (first == last) {
+                return;
+            }
+            T minX = graph.X(*first), maxX = minX, minY = graph.Y(*first), maxY = minY;
+            for(vector<CityId>::iterator it = first; it != last; it++) {
+                minX = min(minX, graph.X(*it));
+                maxX = max(maxX, graph.X(*it));
+                minY = min(minY, graph.Y(*it));
+                maxY = max(maxY, graph.Y(*it));
+            }
+            // cities at the same position are ordered by id, so the split does not depend on the library
+            if (maxY - minY < maxX - minX) {
+                nth_element(first, middle, last, [&](CityId a, CityId b) { return graph.X(a) < graph.X(b) || (graph.X(a) == graph.X(b) && a < b); });
+            }
+            else {
+                nth_element(first, middle, last, [&](CityId a, CityId b) { return graph.Y(a) < graph.Y(b) || (graph.Y(a) == graph.Y(b) && a < b); });
+            }
+        });
+    }
+    split->leaf.resize(cityCount);
+    for(size_t leaf = 0; leaf <= (size_t(1) << depth); leaf++) {
+        split->firstCity.push_back(bound(depth, leaf));
+    }
+    for(size_t leaf = 0; leaf < (size_t(1) << depth); leaf++) {
+        for(CityId i = split->firstCity[leaf]; i < split->firstCity[leaf + 1]; i++) {
+            split->leaf[split->cities[i]] = uint32_t(leaf);
+        }
+    }
+    // the highest level keeps at least two cells
+    levels = depth == 0 ? 0 : (depth - 1) / LEVEL_BITS + 1;
+    partition = split;
+}
+
+// takes a level and a cell of it and finds its boundary cities and the arcs of its clique, with one search from each boundary city
+// which never leaves the cell; a city is reached through another boundary city when the one it is reached from is a boundary city,
+// other than the source, or was itself reached through one, and so is every city settled after the heap holds only such cities,
+// which gives no arc, so the search stops there, having seen little more than the cities up to the nearest boundary cities;
+// the searches run over a copy of the part of the graph they can see, its cities numbered from 0, since the ids of the cities
+// of a cell are spread over the whole snapshot and the searches would otherwise miss the cache at nearly every step
+// precondition: the cells of the level below are customized
+template <typename T>
+template <typename Weight>
+shared_ptr<const typename PartitionOverlay<T>::Cell> PartitionOverlay<T>::Customize(const CityGraph<T, Weight> &graph, unsigned int level, uint32_t cell) const
+{
+    // the cities the searches see: all cities of the cell at the lowest level, the boundary cities of its subcells above it
+    static thread_local vector<CityId> nodes;
+    static thread_local vector<uint32_t> localIndex; // by city id, set for the nodes of the cell being customized
+    static thread_local vector<uint32_t> firstLocalArc;
+    static thread_local vector<Arc> localArcs;
+    static thread_local vector<char> throughBoundary;
+    nodes.clear();
+    if (level == 0) {
+        nodes.assign(partition->cities.begin() + partition->firstCity[cell], partition->cities.begin() + partition->firstCity[cell + 1]);
+    }
+    else {
+        for(uint32_t subcell = cell << LEVEL_BITS; subcell != (cell + 1) << LEVEL_BITS; subcell++) {
+            const vector<CityId> &subcellBoundary = cells[level - 1][subcell]->boundary;
+            nodes.insert(nodes.end(), subcellBoundary.begin(), subcellBoundary.end());
+        }
+    }
+    sort(nodes.begin(), nodes.end());
+    if (localIndex.size() < graph.Size()) {
+        localIndex.resize(graph.Size());
+    }
+    for(uint32_t node = 0; node < nodes.size(); node++) {
+        localIndex[nodes[node]] = node;
+    }
+    firstLocalArc.clear();
+    localArcs.clear();
+    shared_ptr<Cell> customized = make_shared<Cell>();
+    vector<CityId> &boundary = customized->boundary;
+    for(uint32_t node = 0; node < nodes.size(); node++) {
+        firstLocalArc.push_back(uint32_t(localArcs.size()));
+        ScanCell(graph, level, cell, nodes[node], [&](CityId target, T length) {
+            Arc arc = { localIndex[target], length };
+            localArcs.push_back(arc);
+        });
+        for(RoadId road = graph.FirstRoad(nodes[node]); road != graph.LastRoad(nodes[node]); road++) {
+            if (CellOf(graph.Target(road), level) != cell) {
+                boundary.push_back(nodes[node]);
+                break;
+            }
+        }
+    }
+    firstLocalArc.push_back(uint32_t(localArcs.size()));
+
+    // nodes are sorted by city id, and so are the boundary cities, which are among them
+    SearchSpace<T> &search = SearchWorkspace<T>::ForThisThread().local;
+    throughBoundary.resize(nodes.size());
+    customized->firstArc.push_back(0);
+    for(size_t source = 0; source < boundary.size(); source++) {
+        CityId sourceNode = localIndex[boundary[source]];
+        search.Start(CityId(nodes.size()));
+        search.Reach(sourceNode, 0, NO_CITY);
+        search.heap.Push(sourceNode, 0);
+        throughBoundary[sourceNode] = false;
+        size_t direct = 1; // nodes in the heap not reached through another boundary city
+        while (direct > 0) {
+            CityId current = search.heap.PopMin();
+            search.Settle(current);
+            direct -= !throughBoundary[current];
+            bool onBoundary = binary_search(boundary.begin(), boundary.end(), nodes[current]);
+            if (onBoundary) {
+                if (current != sourceNode && !throughBoundary[current]) {
+                    Arc arc = { nodes[current], search.Distance(current) };
+                    customized->arcs.push_back(arc);
+                }
+            }
+            bool passing = throughBoundary[current] || (onBoundary && current != sourceNode);
+            T currentDistance = search.Distance(current);
+            for(uint32_t arc = firstLocalArc[current]; arc != firstLocalArc[current + 1]; arc++) {
+                CityId target = localArcs[arc].target;
+                T targetDistance = currentDistance + localArcs[arc].length;
+                if (!search.Reached(target)) {
+                    search.Reach(target, targetDistance, current);
+                    search.heap.Push(target, targetDistance);
+                    throughBoundary[target] = passing;
+                    direct += !passing;
+                }
+                else if (!search.Settled(target) && targetDistance < search.Distance(target)) {
+                    search.Reach(target, targetDistance, current);
+                    search.heap.DecreaseKey(target, targetDistance);
+                    direct += size_t(!passing) - size_t(!throughBoundary[target]);
+                    throughBoundary[target] = passing;
+                }
+            }
+        }
+        customized->firstArc.push_back(uint32_t(customized->arcs.size()));
+    }
+    return customized;
+}
+
+// takes a cell and a city and calls visit(target, length) for the arcs of the city if it is a boundary city of the cell
+template <typename T>
+template <typename Visit>
+void PartitionOverlay<T>::ScanClique(const Cell &cell, CityId city, Visit visit) const
+{
+    vector<CityId>::const_iterator it = lower_bound(cell.boundary.begin(), cell.boundary.end(), city);
+    if (it == cell.boundary.end() || *it != city) {
+        return;
+    }
+    size_t row = it - cell.boundary.begin();
+    for(uint32_t arc = cell.firstArc[row]; arc != cell.firstArc[row + 1]; arc++) {
+        visit(cell.arcs[arc].target, cell.arcs[arc].length);
+    }
+}
+
+// takes a level, one of its cells and a city of the cell, a boundary city of its subcell above the lowest level,
+// and calls visit(target, length) for the roads of the city staying in the lowest cell, or, above it,
+// for the clique of its subcell and the roads from it to the other subcells
+template <typename T>
+template <typename Weight, typename Visit>
+void PartitionOverlay<T>::ScanCell(const CityGraph<T, Weight> &graph, unsigned int level, uint32_t cell, CityId city, Visit visit) const
+{
+    if (level == 0) {
+        for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+            if (partition->leaf[graph.Target(road)] == cell) {
+                visit(graph.Target(road), graph.Length(road));
+            }
+        }
+        return;
+    }
+    uint32_t subcell = CellOf(city, level - 1);
+    ScanClique(*cells[level - 1][subcell], city, visit);
+    for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+        CityId target = graph.Target(road);
+        if (CellOf(target, level) == cell && CellOf(target, level - 1) != subcell) {
+            visit(target, graph.Length(road));
+        }
+    }
+}
+
+// takes the lowest cells of the two ends of a query and a city and gets the highest level whose cell of the city holds neither end
+template <typename T>
+int PartitionOverlay<T>::QueryLevel(CityId city, const uint32_t *ends) const
+{
+    uint32_t leaf = partition->leaf[city];
+    for(int level = int(levels) - 1; level >= 0; level--) {
+        unsigned int shift = LEVEL_BITS * level;
+        if ((leaf >> shift) != (ends[0] >> shift) && (leaf >> shift) != (ends[1] >> shift)) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+// takes the lowest cells of the two ends of a query and a city and calls visit(target, length) for the roads of the search graph;
+// a city in the lowest cell of an end follows all its roads, any other one is a boundary city of its cell at its query level,
+// crosses the cell through the clique and leaves it along its roads
+template <typename T>
+template <typename Weight, typename Visit>
+void PartitionOverlay<T>::ScanQuery(const CityGraph<T, Weight> &graph, const uint32_t *ends, CityId city, Visit visit) const
+{
+    int level = QueryLevel(city, ends);
+    if (level < 0) {
+        for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+            visit(graph.Target(road), graph.Length(road));
+        }
+        return;
+    }
+    uint32_t cell = CellOf(city, level);
+    ScanClique(*cells[level][cell], city, visit);
+    for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+        if (CellOf(graph.Target(road), level) != cell) {
+            visit(graph.Target(road), graph.Length(road));
+        }
+    }
+}
+
+// takes two cities and an estimate(city, target) of the distance between two cities, consistent along roads,
+// and gets the shortest distance between the cities, and the cities on the shortest path if path is given;
+// the estimate may be Unreachable for cities known to be cut off from the target
+template <typename T>
+template <typename Weight, typename Estimate>
+bool PartitionOverlay<T>::Query(const CityGraph<T, Weight> &graph, CityId firstCity, CityId secondCity, Estimate estimate, T &distance, vector<CityId> *path) const
+{
+    SearchSpace<T> &search = SearchWorkspace<T>::ForThisThread().forward;
+    uint32_t ends[2] = { partition->leaf[firstCity], partition->leaf[secondCity] };
+    bool found = AStar(search, graph.Size(), firstCity, secondCity, [&](CityId city, auto visit) { ScanQuery(graph, ends, city, visit); }, estimate);
+    if (!found) {
+        if (path) {
+            path->clear();
+        }
+        return false;
+    }
+    distance = search.Distance(secondCity);
+    if (path) {
+        // the search space is reused by the unpacking, so the hops are taken out first
+        vector<CityId> hops;
+        search.Path(secondCity, hops);
+        path->clear();
+        path->push_back(firstCity);
+        for(size_t i = 1; i < hops.size(); i++) {
+            // two cities are joined by a clique when both are in the cell of the query level of the first
+            int level = QueryLevel(hops[i - 1], ends);
+            if (level >= 0 && CellOf(hops[i - 1], level) == CellOf(hops[i], level)) {
+                Unpack(graph, level, CellOf(hops[i], level), hops[i - 1], hops[i], estimate, *path);
+            }
+            else {
+                path->push_back(hops[i]);
+            }
+        }
+    }
+    return true;
+}
+
+// takes two boundary cities of a cell and appends the cities of the shortest path between them within the cell, ending with to;
+// the path is searched for again over the cliques of the subcells, whose hops are unpacked level by level down to the roads
+template <typename T>
+template <typename Weight, typename Estimate>
+void PartitionOverlay<T>::Unpack(const CityGraph<T, Weight> &graph, unsigned int level, uint32_t cell, CityId from, CityId to, Estimate estimate, vector<CityId> &path) const
+{
+    SearchSpace<T> &search = SearchWorkspace<T>::ForThisThread().local;
+    AStar(search, graph.Size(), from, to, [&](CityId city, auto visit) { ScanCell(graph, level, cell, city, visit); }, estimate);
+    // the search space is reused by the unpacking below, so the hops are taken out first
+    vector<CityId> hops;
+    search.Path(to, hops);
+    for(size_t i = 1; i < hops.size(); i++) {
+        if (level > 0 && CellOf(hops[i - 1], level - 1) == CellOf(hops[i], level - 1)) {
+            Unpack(graph, level - 1, CellOf(hops[i], level - 1), hops[i - 1], hops[i], estimate, path);
+        }
+        else {
+            path.push_back(hops[i]);
+        }
+    }
+}
+
+// takes a search space, two cities, scan(city, visit), which calls visit(target, length) for the roads or arcs of a city,
+// and the estimate, and runs A* from the first city until it settles the second; gets whether it did
+template <typename T>
+template <typename Scan, typename Estimate>
+bool PartitionOverlay<T>::AStar(SearchSpace<T> &search, CityId cityCount, CityId from, CityId to, Scan scan, Estimate estimate) const
+{
+    search.Start(cityCount);
+    search.Reach(from, 0, NO_CITY);
+    T h = estimate(from, to);
+    if (h != Unreachable<T>()) {
+        search.heap.Push(from, h);
+    }
+    while (!search.heap.Empty()) {
+        CityId current = search.heap.PopMin();
+        search.Settle(current);
+        if (current == to) {
+            return true;
+        }
+        T currentDistance = search.Distance(current);
+        size_t relaxed = 0;
+        scan(current, [&](CityId target, T length) {
+            relaxed++;
+            // the estimate is consistent, so a settled city already has its shortest distance
+            if (search.Settled(target)) {
+                return;
+            }
+            T targetDistance = currentDistance + length;
+            bool targetNotOpen = !search.Reached(target);
+            if (targetNotOpen || targetDistance < search.Distance(target)) {
+                T targetH = estimate(target, to);
+                if (targetH == Unreachable<T>()) {
+                    return;
+                }
+                search.Reach(target, targetDistance, current);
+                if (targetNotOpen) {
+                    search.heap.Push(target, targetDistance + targetH);
+                }
+                else {
+                    search.heap.DecreaseKey(target, targetDistance + targetH);
+                }
+            }
+        });
+        search.CountRelaxed(relaxed);
+    }
+    return false;
+}
+
+#endif // PARTITIONOVERLAY_H_INCLUDED
@@ -0,0 +1,251 @@
+#ifndef QUERYSERVICE_H_INCLUDED
+#define QUERYSERVICE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include "CityMap.h"
+#include "Parallel.h"
+using namespace std;
+
+const size_t QUERY_BATCH_CHUNK = 32; // queries of a batch answered by one task, so a batch costs few queue operations
+
+// asynchronous front end of a CityMap serving many concurrent callers: queries are submitted from any thread and answered,
+// as futures, by a pool of worker threads which live as long as the service, so each keeps its own search workspace warm;
+// every worker has a queue of its own, submissions are dealt round robin over the queues, and a worker takes the newest task
+// of its own queue first and steals the oldest task of another when it runs out, so work never waits behind a busy worker;
+// at most capacity queries wait at once: beyond that, submitting blocks until the workers catch up, or fails with TryFindDistance;
+// queries run against the version current when they start, and errors such as unknown cities go to the map's error stream
+template <typename T, typename Heuristic = EuclideanHeuristic<T> >
+class QueryService
+{
+    public:
+        QueryService(CityMap<T, Heuristic> &citymap, unsigned int workerCount = WorkerCount(), size_t capacity = 4096);
+        ~QueryService(); // answers every query already submitted, then stops the workers
+        future<T> FindDistance(const string &firstCity, const string &secondCity);
+        future<vector<string> > ShortestPath(const string &firstCity, const string &secondCity);
+        vector<future<T> > FindDistances(const vector<pair<string, string> > &pairs); // a batch, in order
+        bool TryFindDistance(const string &firstCity, const string &secondCity, future<T> &distance); // false rather than blocking when full
+        size_t Waiting() const { return waiting; } // queries submitted and not started yet
+        unsigned int Workers() const { return (unsigned int)workers.size(); }
+    private:
+        struct Task {
+            function<void()> run;
+            size_t queries;
+        };
+        struct Queue {
+            mutex lock;
+            deque<Task> tasks;
+        };
+        bool Submit(Task &task, bool block); // queue a task, waiting for room if block is set
+        bool Take(unsigned int worker, Task &task); // the next task for a worker, from its own queue or stolen
+        void Work(unsigned int worker);
+        CityMap<T, Heuristic> &citymap;
+        size_t capacity;
+        vector<unique_ptr<Queue> > queues; // one per worker
+        vector<thread> workers;
+        atomic<unsigned int> nextQueue; // queue the next submission is dealt to
+        atomic<size_t> waiting; // queries in the queues
+        atomic<unsigned int> sleeping; // workers waiting for work
+        atomic<unsigned int> blocked; // submitters waiting for room
+        mutex stateLock; // held to sleep and to wake sleepers, so no wake-up is lost
+        condition_variable work; // signalled when tasks are queued or the service stops
+        condition_variable room; // signalled when tasks are taken
+        bool stopping; // guarded by stateLock
+};
+
+template <typename T, typename Heuristic>
+QueryService<T, Heuristic>::QueryService(CityMap<T, Heuristic> &citymap, unsigned int workerCount, size_t capacity)
+    : citymap(citymap), capacity(capacity), nextQueue(0), waiting(0), sleeping(0), blocked(0), stopping(false)
+{
+    if (workerCount == 0) {
+        workerCount = 1;
+    }
+    for(unsigned int worker = 0; worker < workerCount; worker++) {
+        queues.push_back(unique_ptr<Queue>(new Queue()));
+    }
+    for(unsigned int worker = 0; worker < workerCount; worker++) {
+        workers.push_back(thread(&QueryService::Work, this, worker));
+    }
+}
+
+template <typename T, typename Heuristic>
+QueryService<T, Heuristic>::~QueryService()
+{
+    {
+        lock_guard<mutex> lock(stateLock);
+        stopping = true;
+    }
+    work.notify_all();
+    for(vector<thread>::iterator it = workers.begin(); it != workers.end(); it++) {
+        it->join();
+    }
+}
+
+// takes two cities and gets the future of the shortest distance between them
+template <typename T, typename Heuristic>
+future<T> QueryService<T, Heuristic>::FindDistance(const string &firstCity, const string &secondCity)
+{
+    shared_ptr<packaged_task<T()> > query = make_shared<packaged_task<T()> >([this, firstCity, secondCity]() {
+        return citymap.FindDistance(firstCity, secondCity);
+    });
+    future<T> distance = query->get_future();
+    Task task = { [query]() { (*query)(); }, 1 };
+    Submit(task, true);
+    return distance;
+}
+
+// takes two cities and gets the future of the cities on the shortest path between them
+template <typename T, typename Heuristic>
+future<vector<string> > QueryService<T, Heuristic>::ShortestPath(const string &firstCity, const string &secondCity)
+{
+    shared_ptr<packaged_task<vector<string>()> > query = make_shared<packaged_task<vector<string>()> >([this, firstCity, secondCity]() {
+        return citymap.ShortestPath(firstCity, secondCity);
+    });
+    future<vector<string> > path = query->get_future();
+    Task task = { [query]() { (*query)(); }, 1 };
+    Submit(task, true);
+    return path;
+}
+
+// takes a list of city pairs and gets the futures of their shortest distances, in the same order;
+// the pairs are queued in chunks of QUERY_BATCH_CHUNK, one task each, which different workers can answer at once
+template <typename T, typename Heuristic>
+vector<future<T> > QueryService<T, Heuristic>::FindDistances(const vector<pair<string, string> > &pairs)
+{
+    shared_ptr<const vector<pair<string, string> > > shared = make_shared<const vector<pair<string, string> > >(pairs);
+    shared_ptr<vector<promise<T> > > promises = make_shared<vector<promise<T> > >(pairs.size());
+    vector<future<T> > distances;
+    distances.reserve(pairs.size());
+    for(size_t i = 0; i < pairs.size(); i++) {
+        distances.push_back((*promises)[i].get_future());
+    }
+    for(size_t first = 0; first < pairs.size(); first += QUERY_BATCH_CHUNK) {
+        size_t last = min(pairs.size(), first + QUERY_BATCH_CHUNK);
+        Task task = { [this, shared, promises, first, last]() {
+            for(size_t i = first; i < last; i++) {
+                (*promises)[i].set_value(citymap.FindDistance((*shared)[i].first, (*shared)[i].second));
+            }
+        }, last - first };
+        Submit(task, true);
+    }
+    return distances;
+}
+
+// takes two cities and, if there is room, submits the query and sets distance to its future; gets whether it did
+template <typename T, typename Heuristic>
+bool QueryService<T, Heuristic>::TryFindDistance(const string &firstCity, const string &secondCity, future<T> &distance)
+{
+    shared_ptr<packaged_task<T()> > query = make_shared<packaged_task<T()> >([this, firstCity, secondCity]() {
+        return citymap.FindDistance(firstCity, secondCity);
+    });
+    Task task = { [query]() { (*query)(); }, 1 };
+    if (!Submit(task, false)) {
+        return false;
+    }
+    distance = query->get_future();
+    return true;
+}
+
+// takes a task and puts it on the next queue, first waiting while capacity queries are waiting if block is set,
+// or giving up then if not; a task larger than the capacity gets in once nothing waits, so it cannot wait forever;
+// room is reserved in waiting before the task is queued, so no worker can take it, and lower waiting, before it is counted,
+// and two submitters cannot both take the last room;
+// sleepers on either side are only woken through stateLock when there are any, so the common path takes one queue lock
+template <typename T, typename Heuristic>
+bool QueryService<T, Heuristic>::Submit(Task &task, bool block)
+{
+    size_t queries = task.queries;
+    auto reserve = [&]() {
+        size_t queued = waiting;
+        while (queued == 0 || queued + queries <= capacity) {
+            if (waiting.compare_exchange_weak(queued, queued + queries)) {
+                return true;
+            }
+        }
+        return false;
+    };
+    if (!reserve()) {
+        if (!block) {
+            return false;
+        }
+        unique_lock<mutex> lock(stateLock);
+        // counted before checking, so a worker taking a task after the check sees this submitter and wakes it
+        blocked++;
+        room.wait(lock, reserve);
+        blocked--;
+    }
+    Queue &queue = *queues[nextQueue++ % queues.size()];
+    {
+        lock_guard<mutex> lock(queue.lock);
+        queue.tasks.push_back(move(task));
+    }
+    if (sleeping > 0) {
+        lock_guard<mutex> lock(stateLock);
+        work.notify_one();
+    }
+    return true;
+}
+
+// takes a worker and gets the newest task of its own queue or else the oldest of the first other queue which has one;
+// gets whether there was a task
+template <typename T, typename Heuristic>
+bool QueryService<T, Heuristic>::Take(unsigned int worker, Task &task)
+{
+    bool taken = false;
+    for(unsigned int i = 0; i < queues.size() && !taken; i++) {
+        Queue &queue = *queues[(worker + i) % queues.size()];
+        lock_guard<mutex> lock(queue.lock);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        taken = true;
+    }
+    if (taken) {
+        waiting -= task.queries;
+        if (blocked > 0) {
+            lock_guard<mutex> lock(stateLock);
+            room.notify_all();
+        }
+    }
+    return taken;
+}
+
+// runs tasks until the service stops and every queue is empty, sleeping while there is nothing to do
+template <typename T, typename Heuristic>
+void QueryService<T, Heuristic>::Work(unsigned int worker)
+{
+    while (true) {
+        Task task;
+        if (Take(worker, task)) {
+            task.run();
+            continue;
+        }
+        unique_lock<mutex> lock(stateLock);
+        // counted before checking, so a submitter queueing a task after the check sees this worker and wakes it;
+        // waiting counts a task from just before it is queued, so a worker can find none for that moment and come round again
+        sleeping++;
+        work.wait(lock, [&]() { return waiting > 0 || stopping; });
+        sleeping--;
+        if (waiting == 0 && stopping) {
+            return;
+        }
+    }
+}
+
+#endif // QUERYSERVICE_H_INCLUDED
@@ -0,0 +1,255 @@
+#ifndef ROUTECACHE_H_INCLUDED
+#define ROUTECACHE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <math.h>
+#include "CityGraph.h"
+#include "Metrics.h"
+using namespace std;
+
+// counters of a RouteCache, for sizing it
+struct RouteCacheStats {
+    size_t hits;
+    size_t misses; // lookups of routes which were never cached, were evicted or had gone stale
+    size_t invalidations; // cached routes found stale after the map changed
+    size_t evictions; // cached routes dropped to make room
+    size_t size; // routes cached now
+    size_t capacity;
+};
+
+// bounded cache of shortest routes between pairs of cities, evicting with the CLOCK algorithm;
+// every route is stamped with the number of the version it was computed on, and is checked against the changes published
+// since then when it is looked up in a later version:
+// a removed city or road may lengthen any route, so every route older than the last removal is stale,
+// an added city changes no route, and an added road only makes a route stale if going through it could be shorter;
+// that is judged with the bound of the metric of the map, which no road is shorter than:
+// a path using the road from a to b is at least |s a| + length + |b t| long;
+// the cache is shared by all the threads querying a map, so it is guarded by a lock, all but its capacity, which is atomic,
+// so that queries on a map with the cache off, as it is by default, never take the lock
+template <typename T, typename Metric = EuclideanMetric<T> >
+class RouteCache
+{
+    public:
+        RouteCache() : capacity(0), hand(0), removalVersion(0), forgottenVersion(0), hits(0), misses(0), invalidations(0), evictions(0) {}
+        void SetCapacity(size_t routes); // empties the cache and bounds it to that many routes; 0 turns it off
+        size_t Capacity() const { return capacity.load(memory_order_relaxed); }
+        bool Enabled() const { return capacity.load(memory_order_relaxed) != 0; } // Find and Insert check again under the lock
+        bool Find(const string &firstCity, const string &secondCity, unsigned long version, T &distance, vector<string> *path);
+        template <typename Weight>
+        void Insert(const string &firstCity, const string &secondCity, unsigned long version, const CityGraph<T, Weight> &graph, T distance, const vector<string> &path);
+        template <typename Weight>
+        void Published(unsigned long version, const CityGraph<T, Weight> &graph, const vector<GraphChange> *changes); // record what a new version changes, before it is current
+        RouteCacheStats Stats() const;
+    private:
+        static const size_t ADDED_ROAD_LOG = 256; // added roads remembered; routes older than the log are stale
+        struct Route {
+            string firstCity;
+            string secondCity;
+            unsigned long version; // the route is known to be shortest in this version
+            T firstX, firstY, secondX, secondY;
+            T distance;
+            vector<string> path;
+            bool used; // whether the slot holds a route
+            bool referenced; // whether the route was used since the clock hand last passed it
+        };
+        struct AddedRoad {
+            unsigned long version; // version the road was added in
+            T firstX, firstY, secondX, secondY;
+            T length;
+        };
+        bool Fresh(const Route &route, unsigned long version) const; // whether the changes up to version leave the route shortest
+        void Drop(size_t slot);
+        atomic<size_t> capacity; // only changed under the lock
+        vector<Route> slots;
+        map<pair<string, string>, size_t> index; // slot of each cached pair
+        vector<size_t> freeSlots;
+        size_t hand; // next slot the clock looks at for eviction
+        unsigned long removalVersion; // last version which removed a city or road, or was rebuilt from unknown changes
+        deque<AddedRoad> addedRoads; // roads added by recent versions, oldest first
+        unsigned long forgottenVersion; // roads added in this version or before may be missing from the log
+        size_t hits;
+        size_t misses;
+        size_t invalidations;
+        size_t evictions;
+        mutable mutex guard;
+};
+
+template <typename T, typename Metric>
+const size_t RouteCache<T, Metric>::ADDED_ROAD_LOG;
+
+template <typename T, typename Metric>
+void RouteCache<T, Metric>::SetCapacity(size_t routes)
+{
+    lock_guard<mutex> lock(guard);
+    capacity = routes;
+    slots.clear();
+    index.clear();
+    freeSlots.clear();
+    hand = 0;
+}
+
+// takes a cached route and the version of a query, no older than the route's, and checks the changes published after the route was computed;
+// with integer distances road lengths are rounded down, so bounds of the metric are no bound and any added road makes the route stale;
+// a route whose detour bound is only just above its distance is also taken as stale, so rounding never hides a shorter route
+template <typename T, typename Metric>
+bool RouteCache<T, Metric>::Fresh(const Route &route, unsigned long version) const
+{
+    if (route.version < removalVersion || route.version < forgottenVersion) {
+        return false;
+    }
+    T margin = numeric_limits<T>::is_integer ? T() : route.distance * numeric_limits<T>::epsilon() * 64;
+    for(typename deque<AddedRoad>::const_reverse_iterator it = addedRoads.rbegin(); it != addedRoads.rend() && it->version > route.version; it++) {
+        if (it->version > version) {
+            continue;
+        }
+        if (numeric_limits<T>::is_integer) {
+            return false;
+        }
+        T forward = Metric::Bound(route.firstX, route.firstY, it->firstX, it->firstY) + it->length + Metric::Bound(it->secondX, it->secondY, route.secondX, route.secondY);
+        T backward = Metric::Bound(route.firstX, route.firstY, it->secondX, it->secondY) + it->length + Metric::Bound(it->firstX, it->firstY, route.secondX, route.secondY);
+        if (!(route.distance + margin < forward) || !(route.distance + margin < backward)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// takes a pair of cities and the version a query runs on, and gets the cached distance, and path if it is given;
+// a stale route is dropped and counted as a miss
+template <typename T, typename Metric>
+bool RouteCache<T, Metric>::Find(const string &firstCity, const string &secondCity, unsigned long version, T &distance, vector<string> *path)
+{
+    lock_guard<mutex> lock(guard);
+    if (capacity == 0) {
+        return false;
+    }
+    typename map<pair<string, string>, size_t>::iterator it = index.find(make_pair(firstCity, secondCity));
+    if (it == index.end()) {
+        misses++;
+        return false;
+    }
+    size_t slot = it->second;
+    Route &route = slots[slot];
+    // a query still running on an older version than the route's cannot use it
+    if (route.version > version) {
+        misses++;
+        return false;
+    }
+    if (!Fresh(route, version)) {
+        invalidations++;
+        misses++;
+        Drop(slot);
+        freeSlots.push_back(slot);
+        return false;
+    }
+    // later lookups need not look at the changes checked now
+    route.version = version;
+    route.referenced = true;
+    distance = route.distance;
+    if (path) {
+        *path = route.path;
+    }
+    hits++;
+    return true;
+}
+
+// takes a route found in version of graph and caches it, evicting the first route the clock finds unreferenced when full
+template <typename T, typename Metric>
+template <typename Weight>
+void RouteCache<T, Metric>::Insert(const string &firstCity, const string &secondCity, unsigned long version, const CityGraph<T, Weight> &graph, T distance, const vector<string> &path)
+{
+    lock_guard<mutex> lock(guard);
+    if (capacity == 0) {
+        return;
+    }
+    CityId first = graph.Find(firstCity);
+    CityId second = graph.Find(secondCity);
+    Route route = { firstCity, secondCity, version, graph.X(first), graph.Y(first), graph.X(second), graph.Y(second), distance, path, true, true };
+
+    size_t slot;
+    typename map<pair<string, string>, size_t>::iterator it = index.find(make_pair(firstCity, secondCity));
+    if (it != index.end()) {
+        slot = it->second;
+    }
+    else if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else if (slots.size() < capacity) {
+        slot = slots.size();
+        slots.push_back(route);
+    }
+    else {
+        // no slot is free here, so every slot holds a route
+        while (slots[hand].referenced) {
+            slots[hand].referenced = false;
+            hand = (hand + 1) % slots.size();
+        }
+        slot = hand;
+        hand = (hand + 1) % slots.size();
+        if (slots[slot].used) {
+            evictions++;
+            Drop(slot);
+        }
+    }
+    slots[slot] = route;
+    index[make_pair(firstCity, secondCity)] = slot;
+}
+
+template <typename T, typename Metric>
+void RouteCache<T, Metric>::Drop(size_t slot)
+{
+    Route &route = slots[slot];
+    index.erase(make_pair(route.firstCity, route.secondCity));
+    route.used = false;
+    route.referenced = false;
+    vector<string>().swap(route.path);
+}
+
+// takes the number of a version about to be published, its snapshot and the changes since the previous version, or null when unknown;
+// it must be called before any query can run on the version, or a query could vouch for a route the version makes stale
+template <typename T, typename Metric>
+template <typename Weight>
+void RouteCache<T, Metric>::Published(unsigned long version, const CityGraph<T, Weight> &graph, const vector<GraphChange> *changes)
+{
+    lock_guard<mutex> lock(guard);
+    if (!changes) {
+        removalVersion = version;
+        return;
+    }
+    for(vector<GraphChange>::const_iterator it = changes->begin(); it != changes->end(); it++) {
+        if (it->kind == GraphChange::CityRemoved || it->kind == GraphChange::RoadRemoved) {
+            removalVersion = version;
+        }
+        else if (it->kind == GraphChange::RoadAdded) {
+            // the road may have been removed again before the version was published
+            CityId first = graph.Find(it->first);
+            CityId second = graph.Find(it->second);
+            if (first == NO_CITY || second == NO_CITY || graph.FindRoad(first, second) == graph.LastRoad(first)) {
+                continue;
+            }
+            AddedRoad road = { version, graph.X(first), graph.Y(first), graph.X(second), graph.Y(second), graph.Length(graph.FindRoad(first, second)) };
+            addedRoads.push_back(road);
+            if (addedRoads.size() > ADDED_ROAD_LOG) {
+                forgottenVersion = addedRoads.front().version;
+                addedRoads.pop_front();
+            }
+        }
+    }
+}
+
+template <typename T, typename Metric>
+RouteCacheStats RouteCache<T, Metric>::Stats() const
+{
+    lock_guard<mutex> lock(guard);
+    RouteCacheStats stats = { hits, misses, invalidations, evictions, index.size(), capacity.load(memory_order_relaxed) };
+    return stats;
+}
+
+#endif // ROUTECACHE_H_INCLUDED
@@ -0,0 +1,307 @@
+#ifndef SEARCHWORKSPACE_H_INCLUDED
+#define SEARCHWORKSPACE_H_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include "CityGraph.h"
+using namespace std;
+
+// statements which count the work of searches are kept only when the map is built with CITYMAP_STATS defined,
+// so that by default the hot loops are exactly what they would be without them
+#ifdef CITYMAP_STATS
+#define CITYMAP_COUNT(statement) statement
+#else
+#define CITYMAP_COUNT(statement)
+#endif
+
+// work done by one search, or by many added up; all zero unless CITYMAP_STATS is defined
+struct SearchCounters {
+    SearchCounters() : pushed(0), popped(0), settled(0), decreased(0), relaxed(0), scanned(0) {}
+    SearchCounters &operator+=(const SearchCounters &other);
+    SearchCounters &operator-=(const SearchCounters &other);
+    size_t pushed; // cities queued
+    size_t popped; // cities taken off the heap, settled or passed over by searches which prune them
+    size_t settled; // cities settled, each time one is settled again by searches which reopen them
+    size_t decreased; // keys lowered in place; the heap is indexed, so it never holds stale entries
+    size_t relaxed; // roads, shortcuts or clique arcs followed out of the cities settled
+    size_t scanned; // hub label entries read
+};
+
+inline SearchCounters &SearchCounters::operator+=(const SearchCounters &other)
+{
+    pushed += other.pushed;
+    popped += other.popped;
+    settled += other.settled;
+    decreased += other.decreased;
+    relaxed += other.relaxed;
+    scanned += other.scanned;
+    return *this;
+}
+
+inline SearchCounters &SearchCounters::operator-=(const SearchCounters &other)
+{
+    pushed -= other.pushed;
+    popped -= other.popped;
+    settled -= other.settled;
+    decreased -= other.decreased;
+    relaxed -= other.relaxed;
+    scanned -= other.scanned;
+    return *this;
+}
+
+// 4-ary min-heap of cities ordered by a key;
+// the position of every city in the heap is kept, so the key of a queued city can be decreased in place
+template <typename T>
+class IndexedHeap
+{
+    public:
+        void Resize(CityId cityCount); // make room for city ids below cityCount
+        bool Empty() const { return entries.empty(); }
+        size_t Size() const { return entries.size(); }
+        bool Contains(CityId city) const { return positions[city] != NOT_QUEUED; }
+        T MinKey() const { return entries[0].key; }
+        CityId Min() const { return entries[0].city; }
+        CityId At(size_t position) const { return entries[position].city; } // queued city at a position, in heap order
+        void Clear(); // remove all cities, keeping the allocated memory
+        void Push(CityId city, T key);
+        void DecreaseKey(CityId city, T key);
+        void ChangeKey(CityId city, T key); // move a queued city up or down to a new key
+        CityId PopMin();
+        SearchCounters counters; // pushes, pops and decreases since the heap was made
+    private:
+        static const size_t ARITY = 4;
+        static const unsigned int NOT_QUEUED = (unsigned int)-1;
+        struct Entry {
+            T key;
+            CityId city;
+        };
+        void SiftUp(size_t position, Entry entry);
+        void SiftDown(size_t position, Entry entry);
+        vector<Entry> entries; // the heap itself
+        vector<unsigned int> positions; // position of each city in entries, or NOT_QUEUED
+};
+
+template <typename T>
+const size_t IndexedHeap<T>::ARITY;
+
+template <typename T>
+const unsigned int IndexedHeap<T>::NOT_QUEUED;
+
+template <typename T>
+void IndexedHeap<T>::Resize(CityId cityCount)
+{
+    if (positions.size() < cityCount) {
+        positions.resize(cityCount, NOT_QUEUED);
+    }
+}
+
+template <typename T>
+void IndexedHeap<T>::Clear()
+{
+    for(typename vector<Entry>::iterator it = entries.begin(); it != entries.end(); it++) {
+        positions[it->city] = NOT_QUEUED;
+    }
+    entries.clear();
+}
+
+// takes a city which is not in the heap and its key and queues it
+template <typename T>
+void IndexedHeap<T>::Push(CityId city, T key)
+{
+    CITYMAP_COUNT(counters.pushed++);
+    Entry entry = { key, city };
+    entries.push_back(entry);
+    SiftUp(entries.size() - 1, entry);
+}
+
+// takes a city which is in the heap and a key no larger than its current key and moves it up
+template <typename T>
+void IndexedHeap<T>::DecreaseKey(CityId city, T key)
+{
+    CITYMAP_COUNT(counters.decreased++);
+    Entry entry = { key, city };
+    SiftUp(positions[city], entry);
+}
+
+// takes a city which is in the heap and any key and moves it to where the key belongs
+template <typename T>
+void IndexedHeap<T>::ChangeKey(CityId city, T key)
+{
+    Entry entry = { key, city };
+    size_t position = positions[city];
+    if (key < entries[position].key) {
+        SiftUp(position, entry);
+    }
+    else {
+        SiftDown(position, entry);
+    }
+}
+
+// removes the city with the smallest key and gets it
+// precondition: the heap is not empty
+template <typename T>
+CityId IndexedHeap<T>::PopMin()
+{
+    CITYMAP_COUNT(counters.popped++);
+    CityId min = entries[0].city;
+    positions[min] = NOT_QUEUED;
+    Entry last = entries.back();
+    entries.pop_back();
+    if (!entries.empty()) {
+        SiftDown(0, last);
+    }
+    return min;
+}
+
+// moves the hole at position towards the root until entry fits in it
+template <typename T>
+void IndexedHeap<T>::SiftUp(size_t position, Entry entry)
+{
+    while (position > 0) {
+        size_t parent = (position - 1) / ARITY;
+        if (!(entry.key < entries[parent].key)) {
+            break;
+        }
+        entries[position] = entries[parent];
+        positions[entries[position].city] = (unsigned int)position;
+        position = parent;
+    }
+    entries[position] = entry;
+    positions[entry.city] = (unsigned int)position;
+}
+
+// moves the hole at position towards the leaves until entry fits in it
+template <typename T>
+void IndexedHeap<T>::SiftDown(size_t position, Entry entry)
+{
+    size_t size = entries.size();
+    while (true) {
+        size_t firstChild = position * ARITY + 1;
+        if (firstChild >= size) {
+            break;
+        }
+        size_t lastChild = firstChild + ARITY < size ? firstChild + ARITY : size;
+        size_t minChild = firstChild;
+        for(size_t child = firstChild + 1; child < lastChild; child++) {
+            if (entries[child].key < entries[minChild].key) {
+                minChild = child;
+            }
+        }
+        if (!(entries[minChild].key < entry.key)) {
+            break;
+        }
+        entries[position] = entries[minChild];
+        positions[entries[position].city] = (unsigned int)position;
+        position = minChild;
+    }
+    entries[position] = entry;
+    positions[entry.city] = (unsigned int)position;
+}
+
+// per-city labels and the open heap of one search;
+// labels carry the generation of the search that wrote them, so starting a new search does not touch them
+template <typename T>
+class SearchSpace
+{
+    public:
+        SearchSpace() : generation(0), settledCount(0) {}
+        void Start(CityId cityCount); // begin a new search over a graph with cityCount cities
+        bool Reached(CityId city) const { return labels[city].generation == generation; }
+        bool Settled(CityId city) const { return Reached(city) && labels[city].settled; }
+        T Distance(CityId city) const { return labels[city].distance; }
+        CityId Parent(CityId city) const { return labels[city].parent; }
+        void Reach(CityId city, T distance, CityId parent); // record a better distance to a city
+        void Settle(CityId city) { labels[city].settled = true; settledCount++; CITYMAP_COUNT(heap.counters.settled++); }
+        void Path(CityId city, vector<CityId> &path) const; // cities from the start to city, following parents
+        unsigned int Generation() const { return generation; } // changes with every search started
+        size_t SettledCount() const { return settledCount; } // cities settled by the current search
+        void CountRelaxed(size_t roads) { CITYMAP_COUNT(heap.counters.relaxed += roads); (void)roads; } // note roads followed
+        const SearchCounters &Counters() const { return heap.counters; } // work of every search run in the space so far
+        IndexedHeap<T> heap; // cities to be evaluated
+    private:
+        struct Label {
+            T distance;
+            CityId parent;
+            unsigned int generation;
+            bool settled;
+        };
+        vector<Label> labels;
+        unsigned int generation; // generation of the current search
+        size_t settledCount;
+};
+
+template <typename T>
+void SearchSpace<T>::Start(CityId cityCount)
+{
+    if (labels.size() < cityCount) {
+        Label unreached = { T(), NO_CITY, 0, false };
+        labels.resize(cityCount, unreached);
+    }
+    heap.Resize(cityCount);
+    heap.Clear();
+    settledCount = 0;
+    generation++;
+    // after wrapping around, old labels could look current again, so they are cleared once
+    if (generation == 0) {
+        for(typename vector<Label>::iterator it = labels.begin(); it != labels.end(); it++) {
+            it->generation = 0;
+        }
+        generation = 1;
+    }
+}
+
+template <typename T>
+void SearchSpace<T>::Reach(CityId city, T distance, CityId parent)
+{
+    Label &label = labels[city];
+    label.distance = distance;
+    label.parent = parent;
+    label.generation = generation;
+    label.settled = false;
+}
+
+// takes a reached city and fills path with the cities from the start of the search to it
+template <typename T>
+void SearchSpace<T>::Path(CityId city, vector<CityId> &path) const
+{
+    path.clear();
+    for(CityId current = city; current != NO_CITY; current = labels[current].parent) {
+        path.push_back(current);
+    }
+    reverse(path.begin(), path.end());
+}
+
+// search state reused by every query run on a thread, so steady-state queries do not allocate;
+// the counters of its spaces only grow, so the work of a query is the difference of Counters() from its start to its end,
+// whichever spaces it used and however many searches it ran in them
+template <typename T>
+struct SearchWorkspace {
+    static SearchWorkspace &ForThisThread();
+    SearchCounters Counters() const; // work of every search and label scan run on the thread so far
+    SearchSpace<T> forward;
+    SearchSpace<T> backward; // second search of two-sided queries
+    SearchSpace<T> local; // searches kept inside one cell of a partition overlay, which run while forward and backward still hold a query
+    vector<CityId> batch; // neighbours of a city whose heuristic estimates are wanted, in one batch
+    vector<T> batchDistances; // distance to each of them through the city
+    vector<T> batchEstimates;
+    SearchCounters scans; // work done outside the spaces, such as the label entries read by hub label queries
+};
+
+template <typename T>
+SearchWorkspace<T> &SearchWorkspace<T>::ForThisThread()
+{
+    static thread_local SearchWorkspace<T> workspace;
+    return workspace;
+}
+
+template <typename T>
+SearchCounters SearchWorkspace<T>::Counters() const
+{
+    SearchCounters counters = scans;
+    counters += forward.Counters();
+    counters += backward.Counters();
+    counters += local.Counters();
+    return counters;
+}
+
+#endif // SEARCHWORKSPACE_H_INCLUDED
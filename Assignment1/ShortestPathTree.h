@@ -0,0 +1,319 @@
+#ifndef SHORTESTPATHTREE_H_INCLUDED
+#define SHORTESTPATHTREE_H_INCLUDED
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include "CityGraph.h"
+#include "SearchWorkspace.h"
+#include "Parallel.h"
+using namespace std;
+
+const size_t PARALLEL_RELAX_MINIMUM = 1024; // cities relaxed in a round below which delta-stepping stays on one thread
+
+// algorithm a shortest path tree is grown with
+enum class TreeAlgorithm {
+    Dijkstra, // one thread, settling the cities in order of distance
+    DeltaStepping // all cores, settling the cities a band of distances at a time
+};
+
+// distances from one city to every city of a snapshot, and a shortest path to each of them, as dense arrays by city id
+template <typename T, typename Weight = T>
+struct PathTree {
+    shared_ptr<const CityGraph<T, Weight> > graph; // snapshot the ids belong to
+    CityId source; // NO_CITY if the source does not exist
+    vector<T> distances; // Unreachable<T>() for cities the source cannot reach
+    vector<CityId> parents; // city before each city on its path, NO_CITY for the source and cities it cannot reach
+};
+
+// takes a snapshot and a city and fills distances with the road distance from the city to every city, by Dijkstra's algorithm
+template <typename T, typename Weight>
+void DijkstraDistances(const CityGraph<T, Weight> &graph, CityId source, vector<T> &distances)
+{
+    distances.assign(graph.Size(), Unreachable<T>());
+    SearchSpace<T> &search = SearchWorkspace<T>::ForThisThread().forward;
+    search.Start(graph.Size());
+    search.Reach(source, 0, NO_CITY);
+    search.heap.Push(source, 0);
+    while (!search.heap.Empty()) {
+        CityId current = search.heap.PopMin();
+        search.Settle(current);
+        distances[current] = search.Distance(current);
+        for(RoadId road = graph.FirstRoad(current); road != graph.LastRoad(current); road++) {
+            CityId target = graph.Target(road);
+            T distance = distances[current] + graph.Length(road);
+            if (!search.Reached(target)) {
+                search.Reach(target, distance, current);
+                search.heap.Push(target, distance);
+            }
+            else if (!search.Settled(target) && distance < search.Distance(target)) {
+                search.Reach(target, distance, current);
+                search.heap.DecreaseKey(target, distance);
+            }
+        }
+    }
+}
+
+// takes the distance of a city, which other threads may be lowering too, and a candidate, and lowers the distance to the candidate
+// if it is shorter; gets whether it did; the lowering is a compare-and-swap retried until it holds or the candidate is beaten
+template <typename T>
+bool LowerDistance(atomic<T> &distance, T candidate)
+{
+    T known = distance.load(memory_order_relaxed);
+    while (candidate < known) {
+        if (distance.compare_exchange_weak(known, candidate, memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// takes a snapshot, a city and a bucket width, and fills distances with the road distance from the city to every city, by delta-stepping:
+// cities wait in buckets of distances delta wide, and the lowest bucket is emptied by relaxing the light roads (no longer than delta)
+// of all its cities at once, again and again as long as that drops cities back into it, then their heavy roads once;
+// each round is spread over a team of threads kept for the whole tree, in fixed slices of the bucket, each slice collecting the
+// cities it lowered; the slices are merged in parallel too: each files its own cities in buckets of its own, a city lowered by
+// several slices going to the one which stamps it first, and the slices' lists of the current bucket are copied into one at offsets
+// counted beforehand; rounds too small to be worth waking the team run on the calling thread; a delta of 0 takes the average road length
+template <typename T, typename Weight>
+void DeltaSteppingDistances(const CityGraph<T, Weight> &graph, CityId source, T delta, vector<T> &distances, unsigned int threadCount = WorkerCount())
+{
+    CityId cityCount = graph.Size();
+    if (!(T() < delta)) {
+        double total = 0;
+        for(RoadId road = 0; road < graph.RoadCount(); road++) {
+            total += double(graph.Length(road));
+        }
+        delta = T(graph.RoadCount() == 0 ? 1 : total / graph.RoadCount());
+        if (!(T() < delta)) {
+            delta = T(1);
+        }
+    }
+    vector<atomic<T> > tentative(cityCount);
+    vector<atomic<unsigned int> > stamps(cityCount); // round a city was last filed in, so it is filed once per round
+    for(CityId city = 0; city < cityCount; city++) {
+        tentative[city].store(Unreachable<T>(), memory_order_relaxed);
+        stamps[city].store(0, memory_order_relaxed);
+    }
+    tentative[source].store(T(), memory_order_relaxed);
+    auto bucketOf = [delta](T distance) { return size_t(distance / delta); };
+
+    WorkerTeam team(threadCount);
+    size_t sliceCount = size_t(team.Size()) * 4;
+    vector<vector<vector<CityId> > > buckets(sliceCount); // cities each slice filed, by bucket
+    buckets[0].assign(1, vector<CityId>(1, source));
+    size_t bucketCount = 1; // buckets of the slice with the most
+    vector<unsigned int> emptiedIn(cityCount, 0); // bucket a city was last taken out of, plus one
+    unsigned int round = 0;
+    size_t current = 0; // bucket being emptied
+    vector<vector<CityId> > lowered(sliceCount); // cities each slice lowered in the round
+    vector<vector<CityId> > sliceFrontiers(sliceCount); // cities each slice found still in the current bucket
+    vector<vector<CityId> > sliceEmptied(sliceCount); // cities each slice took out of the current bucket for the first time
+    vector<CityId> frontier;
+    vector<CityId> emptied; // cities taken out of the bucket, whose heavy roads are relaxed when it is empty
+
+    // runs a step over the slices, on the team unless it has too few cities to be worth waking it for
+    auto spread = [&](size_t cities, auto &step) {
+        if (cities < PARALLEL_RELAX_MINIMUM) {
+            for(size_t slice = 0; slice < sliceCount; slice++) {
+                step(slice);
+            }
+        }
+        else {
+            team.For(sliceCount, step);
+        }
+    };
+    // copies the lists of the slices after the end of one list, each slice its own, and empties them
+    auto gather = [&](vector<vector<CityId> > &parts, vector<CityId> &whole) {
+        vector<size_t> offsets(sliceCount + 1, whole.size());
+        for(size_t slice = 0; slice < sliceCount; slice++) {
+            offsets[slice + 1] = offsets[slice] + parts[slice].size();
+        }
+        whole.resize(offsets[sliceCount]);
+        auto copySlice = [&](size_t slice) {
+            copy(parts[slice].begin(), parts[slice].end(), whole.begin() + offsets[slice]);
+            parts[slice].clear();
+        };
+        spread(offsets[sliceCount] - offsets[0], copySlice);
+    };
+    // takes a city a slice found in the current bucket, which has its light roads relaxed next round and its heavy ones once
+    auto keep = [&](size_t slice, CityId city) {
+        sliceFrontiers[slice].push_back(city);
+        if (emptiedIn[city] != current + 1) {
+            emptiedIn[city] = (unsigned int)(current + 1);
+            sliceEmptied[slice].push_back(city);
+        }
+    };
+    // gathers the cities the slices kept into frontier and emptied, and counts the buckets after they have filed
+    auto gatherKept = [&]() {
+        frontier.clear();
+        gather(sliceFrontiers, frontier);
+        gather(sliceEmptied, emptied);
+        for(size_t slice = 0; slice < sliceCount; slice++) {
+            bucketCount = max(bucketCount, buckets[slice].size());
+        }
+    };
+    // relaxes the light or heavy roads of a list of cities, spread over the slices
+    auto relax = [&](const vector<CityId> &cities, bool light) {
+        size_t sliceSize = (cities.size() + sliceCount - 1) / sliceCount;
+        auto relaxSlice = [&](size_t slice) {
+            vector<CityId> &found = lowered[slice];
+            found.clear();
+            size_t last = min(cities.size(), (slice + 1) * sliceSize);
+            for(size_t i = slice * sliceSize; i < last; i++) {
+                CityId city = cities[i];
+                T distance = tentative[city].load(memory_order_relaxed);
+                for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+                    T length = graph.Length(road);
+                    if ((length <= delta) == light && LowerDistance(tentative[graph.Target(road)], distance + length)) {
+                        found.push_back(graph.Target(road));
+                    }
+                }
+            }
+        };
+        spread(cities.size(), relaxSlice);
+    };
+    // files the cities lowered by the slices under their buckets, and gathers the ones still in the current bucket in frontier
+    auto file = [&]() {
+        round++;
+        size_t loweredCount = 0;
+        for(size_t slice = 0; slice < sliceCount; slice++) {
+            loweredCount += lowered[slice].size();
+        }
+        auto fileSlice = [&](size_t slice) {
+            vector<vector<CityId> > &sliceBuckets = buckets[slice];
+            for(vector<CityId>::iterator it = lowered[slice].begin(); it != lowered[slice].end(); it++) {
+                if (stamps[*it].exchange(round, memory_order_relaxed) == round) {
+                    continue;
+                }
+                size_t bucket = bucketOf(tentative[*it].load(memory_order_relaxed));
+                if (bucket == current) {
+                    keep(slice, *it);
+                }
+                else {
+                    if (bucket >= sliceBuckets.size()) {
+                        sliceBuckets.resize(bucket + 1);
+                    }
+                    sliceBuckets[bucket].push_back(*it);
+                }
+            }
+        };
+        spread(loweredCount, fileSlice);
+        gatherKept();
+    };
+    // takes the cities of the current bucket out of the slices' lists; those whose distance has dropped to a lower bucket
+    // since they were filed here were handled there
+    auto take = [&]() {
+        round++;
+        size_t filedCount = 0;
+        for(size_t slice = 0; slice < sliceCount; slice++) {
+            filedCount += current < buckets[slice].size() ? buckets[slice][current].size() : 0;
+        }
+        auto takeSlice = [&](size_t slice) {
+            if (current >= buckets[slice].size()) {
+                return;
+            }
+            vector<CityId> &bucket = buckets[slice][current];
+            for(vector<CityId>::iterator it = bucket.begin(); it != bucket.end(); it++) {
+                if (bucketOf(tentative[*it].load(memory_order_relaxed)) == current && stamps[*it].exchange(round, memory_order_relaxed) != round) {
+                    keep(slice, *it);
+                }
+            }
+            vector<CityId>().swap(bucket);
+        };
+        spread(filedCount, takeSlice);
+        gatherKept();
+    };
+
+    for(current = 0; current < bucketCount; current++) {
+        emptied.clear();
+        take();
+        while (!frontier.empty()) {
+            relax(frontier, true);
+            file();
+            // a heavy road rounded down to the width of a bucket could still land in this one
+            if (frontier.empty()) {
+                relax(emptied, false);
+                emptied.clear();
+                file();
+            }
+        }
+    }
+
+    distances.resize(cityCount);
+    for(CityId city = 0; city < cityCount; city++) {
+        distances[city] = tentative[city].load(memory_order_relaxed);
+    }
+}
+
+// takes a snapshot, a city and the distances from it, and fills parents with a shortest path tree over them;
+// the tree depends only on the distances, so trees of the same distances are the same whatever found them:
+// the parent of a city is its lowest id neighbour which is closer to the source by exactly the road between them,
+// and cities with no such neighbour, only ones as far as they are over roads too short to count, are hung from those next
+template <typename T, typename Weight>
+void TreeParents(const CityGraph<T, Weight> &graph, CityId source, const vector<T> &distances, vector<CityId> &parents)
+{
+    CityId cityCount = graph.Size();
+    parents.assign(cityCount, NO_CITY);
+    vector<char> hung(cityCount, 0); // whether a city is in the tree
+    ParallelFor(cityCount, [&](size_t city) {
+        if (city == source) {
+            hung[city] = 1;
+            return;
+        }
+        if (distances[city] == Unreachable<T>()) {
+            return;
+        }
+        for(RoadId road = graph.FirstRoad(CityId(city)); road != graph.LastRoad(CityId(city)); road++) {
+            CityId neighbour = graph.Target(road);
+            if (distances[neighbour] < distances[city] && distances[neighbour] + graph.Length(road) == distances[city]) {
+                parents[city] = neighbour;
+                hung[city] = 1;
+                return;
+            }
+        }
+    });
+    bool hanging = true;
+    while (hanging) {
+        hanging = false;
+        for(CityId city = 0; city < cityCount; city++) {
+            if (hung[city] || distances[city] == Unreachable<T>()) {
+                continue;
+            }
+            for(RoadId road = graph.FirstRoad(city); road != graph.LastRoad(city); road++) {
+                CityId neighbour = graph.Target(road);
+                if (hung[neighbour] && distances[neighbour] == distances[city] && distances[neighbour] + graph.Length(road) == distances[city]) {
+                    parents[city] = neighbour;
+                    hung[city] = 1;
+                    hanging = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// takes a snapshot shared with the caller, a city and an algorithm, and gets the shortest path tree from the city
+template <typename T, typename Weight>
+PathTree<T, Weight> GrowPathTree(const shared_ptr<const CityGraph<T, Weight> > &graph, CityId source, TreeAlgorithm algorithm)
+{
+    PathTree<T, Weight> tree;
+    tree.graph = graph;
+    tree.source = source;
+    if (source == NO_CITY) {
+        tree.distances.assign(graph->Size(), Unreachable<T>());
+        tree.parents.assign(graph->Size(), NO_CITY);
+        return tree;
+    }
+    if (algorithm == TreeAlgorithm::Dijkstra) {
+        DijkstraDistances(*graph, source, tree.distances);
+    }
+    else {
+        DeltaSteppingDistances(*graph, source, T(), tree.distances);
+    }
+    TreeParents(*graph, source, tree.distances, tree.parents);
+    return tree;
+}
+
+#endif // SHORTESTPATHTREE_H_INCLUDED
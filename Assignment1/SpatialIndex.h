@@ -0,0 +1,310 @@
+#ifndef SPATIALINDEX_H_INCLUDED
+#define SPATIALINDEX_H_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <math.h>
+#include "CityGraph.h"
+using namespace std;
+
+// k-d tree over the positions of the cities of a snapshot, for finding the cities nearest to a point or within a radius of it
+// by the distance of the map's metric (see Metrics.h), whose AxisBound tells which sides of a split can be passed over;
+// the tree is implicit: the cities of a subtree are a range of points, with the city splitting them in the middle of the range,
+// ordered by x on even levels and by y on odd ones, so the tree takes no more than the points and is built with nth_element;
+// snapshots number their cities afresh, so cities are known by name: the tree keeps a copy of the names, in name order,
+// and the index of a later snapshot shares the tree, with the cities added since in a list searched along with it and
+// the cities removed since marked, until there are more of them than about 4 square roots of the cities, and the tree
+// is built again; cities as far from the point as each other come in order of their names, whichever way they are held
+template <typename T, typename Metric>
+class SpatialIndex
+{
+    public:
+        template <typename Weight>
+        explicit SpatialIndex(const CityGraph<T, Weight> &graph);
+        template <typename Weight>
+        SpatialIndex(const SpatialIndex &previous, const CityGraph<T, Weight> &graph, const vector<GraphChange> &changes); // previous brought up to graph
+        string Nearest(T x, T y) const; // empty if there are no cities
+        vector<string> KNearest(T x, T y, size_t k) const; // closest first
+        vector<string> Within(T x, T y, T radius) const; // closest first
+        size_t Pending() const { return added.size() + removed.size(); } // cities added or removed since the tree was built
+    private:
+        struct Point {
+            T x, y;
+            CityId entry; // position of the name in the names of the tree
+        };
+        // the tree, shared by the indexes of later snapshots until it is built again
+        struct Tree {
+            vector<Point> points; // in tree order
+            vector<size_t> nameOffsets; // the name of entry e is nameChars [nameOffsets[e], nameOffsets[e+1]); entries are in name order
+            vector<char> nameChars;
+            string_view Name(CityId entry) const { return string_view(&nameChars[0] + nameOffsets[entry], nameOffsets[entry + 1] - nameOffsets[entry]); }
+            CityId Find(string_view name) const; // NO_CITY if the name is not there
+        };
+        struct Added {
+            T x, y;
+            string name;
+        };
+        typedef pair<double, string_view> Candidate; // distance to the point, and the city
+        template <typename Weight>
+        void Build(const CityGraph<T, Weight> &graph);
+        static void Build(vector<Point> &points, size_t first, size_t last, unsigned int depth);
+        size_t RebuildThreshold() const { return size_t(4 * sqrt(double(tree->points.size()))) + 64; }
+        bool Removed(CityId entry) const { return binary_search(removed.begin(), removed.end(), entry); }
+        static double Measure(T x, T y, T pointX, T pointY) { return double(Metric::Length(x, y, pointX, pointY)); }
+        static double AxisBound(T x, T y, const Point &split, unsigned int depth) { return double(Metric::AxisBound(x, y, depth % 2 == 0 ? split.x : split.y, depth % 2 == 0)); }
+        static bool Lower(T x, T y, const Point &split, unsigned int depth) { return depth % 2 == 0 ? x < split.x : y < split.y; }
+        void Nearest(size_t first, size_t last, unsigned int depth, T x, T y, Candidate &best) const;
+        void KNearest(size_t first, size_t last, unsigned int depth, T x, T y, size_t k, priority_queue<Candidate> &best) const;
+        void Within(size_t first, size_t last, unsigned int depth, T x, T y, double radius, vector<Candidate> &found) const;
+        static void Offer(const Candidate &candidate, size_t k, priority_queue<Candidate> &best);
+        static vector<string> Names(vector<Candidate> &candidates);
+        shared_ptr<const Tree> tree;
+        vector<Added> added; // cities added since the tree was built, which are not in it
+        vector<CityId> removed; // sorted entries of the cities of the tree removed since it was built
+};
+
+template <typename T, typename Metric>
+template <typename Weight>
+SpatialIndex<T, Metric>::SpatialIndex(const CityGraph<T, Weight> &graph)
+{
+    Build(graph);
+}
+
+// takes the index of the snapshot before, the snapshot and the changes between them, and shares the tree of the index before,
+// adding the cities added to its list and marking the cities removed, unless that makes the list and marks too long;
+// a city added and removed again among the changes is found missing from the snapshot and left out
+template <typename T, typename Metric>
+template <typename Weight>
+SpatialIndex<T, Metric>::SpatialIndex(const SpatialIndex &previous, const CityGraph<T, Weight> &graph, const vector<GraphChange> &changes)
+    : tree(previous.tree), added(previous.added), removed(previous.removed)
+{
+    for(vector<GraphChange>::const_iterator it = changes.begin(); it != changes.end() && Pending() <= RebuildThreshold(); it++) {
+        if (it->kind == GraphChange::CityAdded) {
+            CityId city = graph.Find(it->first);
+            if (city != NO_CITY) {
+                Added addedCity = { graph.X(city), graph.Y(city), it->first };
+                added.push_back(addedCity);
+            }
+        }
+        else if (it->kind == GraphChange::CityRemoved) {
+            typename vector<Added>::iterator addedCity = added.begin();
+            while (addedCity != added.end() && addedCity->name != it->first) {
+                addedCity++;
+            }
+            if (addedCity != added.end()) {
+                added.erase(addedCity);
+                continue;
+            }
+            CityId entry = tree->Find(it->first);
+            typename vector<CityId>::iterator mark = lower_bound(removed.begin(), removed.end(), entry);
+            if (entry != NO_CITY && (mark == removed.end() || *mark != entry)) {
+                removed.insert(mark, entry);
+            }
+        }
+    }
+    if (Pending() > RebuildThreshold()) {
+        added.clear();
+        removed.clear();
+        Build(graph);
+    }
+}
+
+// takes a snapshot and builds a tree of its cities, with their names in name order
+template <typename T, typename Metric>
+template <typename Weight>
+void SpatialIndex<T, Metric>::Build(const CityGraph<T, Weight> &graph)
+{
+    shared_ptr<Tree> built = make_shared<Tree>();
+    built->points.reserve(graph.Size());
+    built->nameOffsets.reserve(size_t(graph.Size()) + 1);
+    built->nameOffsets.push_back(0);
+    for(CityId position = 0; position < graph.Size(); position++) {
+        CityId city = graph.ByName(position);
+        string name = graph.Name(city);
+        built->nameChars.insert(built->nameChars.end(), name.begin(), name.end());
+        built->nameOffsets.push_back(built->nameChars.size());
+        Point point = { graph.X(city), graph.Y(city), position };
+        built->points.push_back(point);
+    }
+    built->nameChars.push_back('\0');
+    Build(built->points, 0, built->points.size(), 0);
+    tree = built;
+}
+
+// takes a range of points and the level of their subtree, and puts the splitting city in the middle, smaller coordinates before it
+template <typename T, typename Metric>
+void SpatialIndex<T, Metric>::Build(vector<Point> &points, size_t first, size_t last, unsigned int depth)
+{
+    if (last - first < 2) {
+        return;
+    }
+    size_t middle = first + (last - first) / 2;
+    if (depth % 2 == 0) {
+        nth_element(points.begin() + first, points.begin() + middle, points.begin() + last, [](const Point &a, const Point &b) { return a.x < b.x; });
+    }
+    else {
+        nth_element(points.begin() + first, points.begin() + middle, points.begin() + last, [](const Point &a, const Point &b) { return a.y < b.y; });
+    }
+    Build(points, first, middle, depth + 1);
+    Build(points, middle + 1, last, depth + 1);
+}
+
+// takes a name and finds its entry by binary search over the names, which are in order
+template <typename T, typename Metric>
+CityId SpatialIndex<T, Metric>::Tree::Find(string_view name) const
+{
+    CityId low = 0;
+    CityId high = CityId(nameOffsets.size() - 1);
+    while (low < high) {
+        CityId middle = low + (high - low) / 2;
+        if (Name(middle) < name) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low < nameOffsets.size() - 1 && Name(low) == name ? low : NO_CITY;
+}
+
+// takes a point and gets the closest city to it, trying the added cities first so the tree search starts with a bound
+template <typename T, typename Metric>
+string SpatialIndex<T, Metric>::Nearest(T x, T y) const
+{
+    Candidate best(numeric_limits<double>::infinity(), string_view());
+    for(typename vector<Added>::const_iterator it = added.begin(); it != added.end(); it++) {
+        best = min(best, Candidate(Measure(x, y, it->x, it->y), string_view(it->name)));
+    }
+    Nearest(0, tree->points.size(), 0, x, y, best);
+    return string(best.second);
+}
+
+// takes a subtree and the closest city found so far, and looks for a closer one, on the side of the split the point is on first;
+// the other side is only searched if the metric's bound for it is no farther than the best city
+template <typename T, typename Metric>
+void SpatialIndex<T, Metric>::Nearest(size_t first, size_t last, unsigned int depth, T x, T y, Candidate &best) const
+{
+    if (first == last) {
+        return;
+    }
+    size_t middle = first + (last - first) / 2;
+    const Point &split = tree->points[middle];
+    if (!Removed(split.entry)) {
+        best = min(best, Candidate(Measure(x, y, split.x, split.y), tree->Name(split.entry)));
+    }
+    bool lowerFirst = Lower(x, y, split, depth);
+    Nearest(lowerFirst ? first : middle + 1, lowerFirst ? middle : last, depth + 1, x, y, best);
+    if (AxisBound(x, y, split, depth) <= best.first) {
+        Nearest(lowerFirst ? middle + 1 : first, lowerFirst ? last : middle, depth + 1, x, y, best);
+    }
+}
+
+// takes a candidate and keeps it among the k best, the farthest of which is on top
+template <typename T, typename Metric>
+void SpatialIndex<T, Metric>::Offer(const Candidate &candidate, size_t k, priority_queue<Candidate> &best)
+{
+    if (best.size() < k) {
+        best.push(candidate);
+    }
+    else if (candidate < best.top()) {
+        best.pop();
+        best.push(candidate);
+    }
+}
+
+// takes a point and a number of cities and gets that many cities closest to it, or all cities if there are fewer
+template <typename T, typename Metric>
+vector<string> SpatialIndex<T, Metric>::KNearest(T x, T y, size_t k) const
+{
+    priority_queue<Candidate> best; // the farthest of the closest k found so far on top
+    if (k > 0) {
+        for(typename vector<Added>::const_iterator it = added.begin(); it != added.end(); it++) {
+            Offer(Candidate(Measure(x, y, it->x, it->y), string_view(it->name)), k, best);
+        }
+        KNearest(0, tree->points.size(), 0, x, y, k, best);
+    }
+    vector<string> cities(best.size());
+    for(size_t i = cities.size(); i > 0; i--) {
+        cities[i - 1] = string(best.top().second);
+        best.pop();
+    }
+    return cities;
+}
+
+// like Nearest, with the farthest of the k best cities as the bound once k are found
+template <typename T, typename Metric>
+void SpatialIndex<T, Metric>::KNearest(size_t first, size_t last, unsigned int depth, T x, T y, size_t k, priority_queue<Candidate> &best) const
+{
+    if (first == last) {
+        return;
+    }
+    size_t middle = first + (last - first) / 2;
+    const Point &split = tree->points[middle];
+    if (!Removed(split.entry)) {
+        Offer(Candidate(Measure(x, y, split.x, split.y), tree->Name(split.entry)), k, best);
+    }
+    bool lowerFirst = Lower(x, y, split, depth);
+    KNearest(lowerFirst ? first : middle + 1, lowerFirst ? middle : last, depth + 1, x, y, k, best);
+    if (best.size() < k || AxisBound(x, y, split, depth) <= best.top().first) {
+        KNearest(lowerFirst ? middle + 1 : first, lowerFirst ? last : middle, depth + 1, x, y, k, best);
+    }
+}
+
+// takes a point and a radius and gets every city no farther from the point than the radius
+template <typename T, typename Metric>
+vector<string> SpatialIndex<T, Metric>::Within(T x, T y, T radius) const
+{
+    vector<Candidate> found;
+    if (!(radius < T())) {
+        for(typename vector<Added>::const_iterator it = added.begin(); it != added.end(); it++) {
+            double distance = Measure(x, y, it->x, it->y);
+            if (distance <= double(radius)) {
+                found.push_back(Candidate(distance, string_view(it->name)));
+            }
+        }
+        Within(0, tree->points.size(), 0, x, y, double(radius), found);
+    }
+    return Names(found);
+}
+
+// takes a subtree and collects its cities within the radius, skipping the side of a split which the metric puts beyond it
+template <typename T, typename Metric>
+void SpatialIndex<T, Metric>::Within(size_t first, size_t last, unsigned int depth, T x, T y, double radius, vector<Candidate> &found) const
+{
+    if (first == last) {
+        return;
+    }
+    size_t middle = first + (last - first) / 2;
+    const Point &split = tree->points[middle];
+    double distance = Measure(x, y, split.x, split.y);
+    if (distance <= radius && !Removed(split.entry)) {
+        found.push_back(Candidate(distance, tree->Name(split.entry)));
+    }
+    bool lowerFirst = Lower(x, y, split, depth);
+    bool farSide = AxisBound(x, y, split, depth) <= radius;
+    if (lowerFirst || farSide) {
+        Within(first, middle, depth + 1, x, y, radius, found);
+    }
+    if (!lowerFirst || farSide) {
+        Within(middle + 1, last, depth + 1, x, y, radius, found);
+    }
+}
+
+// takes candidates and gets their names, closest first
+template <typename T, typename Metric>
+vector<string> SpatialIndex<T, Metric>::Names(vector<Candidate> &candidates)
+{
+    sort(candidates.begin(), candidates.end());
+    vector<string> cities(candidates.size());
+    for(size_t i = 0; i < candidates.size(); i++) {
+        cities[i] = string(candidates[i].second);
+    }
+    return cities;
+}
+
+#endif // SPATIALINDEX_H_INCLUDED
@@ -0,0 +1,148 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include "SearchWorkspace.h"
+using namespace std;
+
+// statistics of route queries, kept only when the map is built with CITYMAP_STATS defined;
+// each query adds its counters, path and wall time to process-wide totals and a latency histogram, which CityMap::Stats() reads
+
+const size_t LATENCY_BUCKETS = 32; // bucket 0 counts queries under 1 microsecond, bucket i queries under 2^i microseconds and the last one the rest
+
+// work and time of one route query
+struct QueryStats {
+    QueryStats() : pathCities(0), distance(0), seconds(0) {}
+    SearchCounters counters; // every search and label scan of the query added up, both sides of two-sided ones included
+    size_t pathCities; // cities on the path, 0 if the path was not asked for
+    double distance;
+    double seconds; // wall time of the search
+};
+
+// route queries of every map of the process since it started
+struct CityMapStats {
+    bool enabled; // whether the map was built with CITYMAP_STATS defined; everything else stays zero if not
+    size_t queries;
+    SearchCounters totals;
+    size_t pathCities;
+    double seconds;
+    size_t latencies[LATENCY_BUCKETS]; // queries by wall time
+    QueryStats lastQuery; // last query run on the calling thread
+};
+
+// process-wide totals which the queries of all threads add to with relaxed atomics, so recording never waits
+class QueryStatistics
+{
+    public:
+        static QueryStatistics &Process();
+        void Record(const QueryStats &query);
+        CityMapStats Snapshot() const;
+    private:
+        QueryStatistics();
+        static QueryStats &LastQuery(); // of the calling thread
+        atomic<size_t> queries;
+        atomic<size_t> pushed;
+        atomic<size_t> popped;
+        atomic<size_t> settled;
+        atomic<size_t> decreased;
+        atomic<size_t> relaxed;
+        atomic<size_t> scanned;
+        atomic<size_t> pathCities;
+        atomic<unsigned long long> nanoseconds;
+        atomic<size_t> latencies[LATENCY_BUCKETS];
+};
+
+inline QueryStatistics::QueryStatistics() : queries(0), pushed(0), popped(0), settled(0), decreased(0), relaxed(0), scanned(0), pathCities(0), nanoseconds(0)
+{
+    for(size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        latencies[bucket].store(0, memory_order_relaxed);
+    }
+}
+
+inline QueryStatistics &QueryStatistics::Process()
+{
+    static QueryStatistics statistics;
+    return statistics;
+}
+
+inline QueryStats &QueryStatistics::LastQuery()
+{
+    static thread_local QueryStats last;
+    return last;
+}
+
+// takes the statistics of a finished query and adds them to the totals
+inline void QueryStatistics::Record(const QueryStats &query)
+{
+    queries.fetch_add(1, memory_order_relaxed);
+    pushed.fetch_add(query.counters.pushed, memory_order_relaxed);
+    popped.fetch_add(query.counters.popped, memory_order_relaxed);
+    settled.fetch_add(query.counters.settled, memory_order_relaxed);
+    decreased.fetch_add(query.counters.decreased, memory_order_relaxed);
+    relaxed.fetch_add(query.counters.relaxed, memory_order_relaxed);
+    scanned.fetch_add(query.counters.scanned, memory_order_relaxed);
+    pathCities.fetch_add(query.pathCities, memory_order_relaxed);
+    nanoseconds.fetch_add((unsigned long long)(query.seconds * 1e9), memory_order_relaxed);
+    size_t bucket = 0;
+    for(unsigned long long microseconds = (unsigned long long)(query.seconds * 1e6); microseconds > 0 && bucket + 1 < LATENCY_BUCKETS; microseconds >>= 1) {
+        bucket++;
+    }
+    latencies[bucket].fetch_add(1, memory_order_relaxed);
+    LastQuery() = query;
+}
+
+// gets the totals; while queries run, the fields may each include a slightly different set of them
+inline CityMapStats QueryStatistics::Snapshot() const
+{
+    CityMapStats stats = CityMapStats();
+    stats.enabled = true;
+    stats.queries = queries.load(memory_order_relaxed);
+    stats.totals.pushed = pushed.load(memory_order_relaxed);
+    stats.totals.popped = popped.load(memory_order_relaxed);
+    stats.totals.settled = settled.load(memory_order_relaxed);
+    stats.totals.decreased = decreased.load(memory_order_relaxed);
+    stats.totals.relaxed = relaxed.load(memory_order_relaxed);
+    stats.totals.scanned = scanned.load(memory_order_relaxed);
+    stats.pathCities = pathCities.load(memory_order_relaxed);
+    stats.seconds = nanoseconds.load(memory_order_relaxed) / 1e9;
+    for(size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        stats.latencies[bucket] = latencies[bucket].load(memory_order_relaxed);
+    }
+    stats.lastQuery = LastQuery();
+    return stats;
+}
+
+// watches the searches of one query on the calling thread from its start: the work the thread's workspace counted since,
+// in every search space and label scan, is the work of the query
+template <typename T>
+class QueryProbe
+{
+    public:
+        QueryProbe();
+        void Finish(size_t pathCities, T distance); // record the query
+    private:
+        const SearchWorkspace<T> &workspace;
+        SearchCounters started; // the workspace's counters when the query started
+        chrono::steady_clock::time_point start;
+};
+
+template <typename T>
+QueryProbe<T>::QueryProbe() : workspace(SearchWorkspace<T>::ForThisThread()), started(workspace.Counters()), start(chrono::steady_clock::now())
+{
+}
+
+template <typename T>
+void QueryProbe<T>::Finish(size_t pathCities, T distance)
+{
+    QueryStats query;
+    query.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    query.counters = workspace.Counters();
+    query.counters -= started;
+    query.pathCities = pathCities;
+    query.distance = double(distance);
+    QueryStatistics::Process().Record(query);
+}
+
+#endif // STATS_H_INCLUDED
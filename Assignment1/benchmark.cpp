@@ -0,0 +1,550 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include <math.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "CityMap.h"
+#include "QueryService.h"
+
+using namespace std;
+
+// benchmark of building and querying maps of up to millions of cities, from generated graphs of three kinds:
+//     grid       square grid of streets 100 apart
+//     geometric  cities scattered uniformly, each connected to all cities within a radius giving about 6 roads per city
+//     road       road-like planar network: a jittered grid with a tenth of the streets missing, a few diagonal streets,
+//                and arterial roads every 16 blocks skipping 4 junctions at a time
+// usage: benchmark [--generators grid,geometric,road] [--sizes 1000,10000,100000] [--queries 1000]
+//                  [--mode astar|ch|bidirectional|overlay|labels|compressed] [--seed 1] [--workers 1,2,4] [--output results.jsonl]
+// with --workers, the distance queries are also answered as one batch by a query service of each number of workers, whose records
+// give the wall time of the batch, so mean_us is the inverse of the throughput, and the latency of each query from the submission
+// records say which layout the snapshots have: hilbert, or name when built with -DCITYGRAPH_NAME_ORDER, so two builds compare the layouts;
+// on Linux, where perf events are allowed, query records also give the hardware cache misses of a call
+// with --mode labels, a HubLabels line after the build gives the memory of the labels against their mean query time,
+// and with --mode compressed, a CompressedRoads line gives the bytes a road takes compressed and in the snapshot, and the resident
+// memory of the whole process a road comes to once the version keeps only its cities and compressed roads and the maps are emptied
+// every measurement is written as one JSON object per line, to the output file or the standard output, so runs can be appended and compared;
+// latencies are in microseconds, and peak RSS is that of the whole process so far, so sizes are best run one per process to compare memory
+
+// cities and roads of a generated graph, cities numbered from 0 and named "c" and their number
+struct GeneratedGraph {
+    vector<double> xs;
+    vector<double> ys;
+    vector<pair<uint32_t, uint32_t> > roads;
+};
+
+// takes a number of cities and makes a square grid of about that many
+void generateGrid(size_t cityCount, mt19937_64 &, GeneratedGraph &graph)
+{
+    size_t side = size_t(ceil(sqrt(double(cityCount))));
+    for(size_t city = 0; city < cityCount; city++) {
+        graph.xs.push_back(double(city % side) * 100);
+        graph.ys.push_back(double(city / side) * 100);
+        if (city % side + 1 < side && city + 1 < cityCount) {
+            graph.roads.push_back(make_pair(uint32_t(city), uint32_t(city + 1)));
+        }
+        if (city + side < cityCount) {
+            graph.roads.push_back(make_pair(uint32_t(city), uint32_t(city + side)));
+        }
+    }
+}
+
+// takes a number of cities and scatters them over a square with one city per 100 by 100 on average,
+// connecting the pairs closer than the radius; pairs are found through a grid of cells as wide as the radius
+void generateGeometric(size_t cityCount, mt19937_64 &random, GeneratedGraph &graph)
+{
+    double size = sqrt(double(cityCount)) * 100;
+    double radius = 100 * sqrt(6 / 3.141592653589793);
+    uniform_real_distribution<double> position(0, size);
+    size_t cellsPerSide = max(size_t(1), size_t(size / radius));
+    double cellSize = size / cellsPerSide;
+    vector<vector<uint32_t> > cells(cellsPerSide * cellsPerSide);
+    for(size_t city = 0; city < cityCount; city++) {
+        double x = position(random);
+        double y = position(random);
+        graph.xs.push_back(x);
+        graph.ys.push_back(y);
+        size_t column = min(cellsPerSide - 1, size_t(x / cellSize));
+        size_t row = min(cellsPerSide - 1, size_t(y / cellSize));
+        cells[row * cellsPerSide + column].push_back(uint32_t(city));
+    }
+    for(size_t row = 0; row < cellsPerSide; row++) {
+        for(size_t column = 0; column < cellsPerSide; column++) {
+            const vector<uint32_t> &cell = cells[row * cellsPerSide + column];
+            // each pair of cells is looked at once, from the cell below or left of the other
+            for(size_t otherRow = row; otherRow <= row + 1 && otherRow < cellsPerSide; otherRow++) {
+                for(size_t otherColumn = (otherRow == row ? column : (column == 0 ? 0 : column - 1)); otherColumn <= column + 1 && otherColumn < cellsPerSide; otherColumn++) {
+                    const vector<uint32_t> &other = cells[otherRow * cellsPerSide + otherColumn];
+                    bool same = &other == &cell;
+                    for(size_t i = 0; i < cell.size(); i++) {
+                        for(size_t j = same ? i + 1 : 0; j < other.size(); j++) {
+                            double deltaX = graph.xs[cell[i]] - graph.xs[other[j]];
+                            double deltaY = graph.ys[cell[i]] - graph.ys[other[j]];
+                            if (deltaX * deltaX + deltaY * deltaY <= radius * radius) {
+                                graph.roads.push_back(make_pair(cell[i], other[j]));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// takes a number of cities and makes a road-like planar network of about that many
+void generateRoadLike(size_t cityCount, mt19937_64 &random, GeneratedGraph &graph)
+{
+    size_t side = size_t(ceil(sqrt(double(cityCount))));
+    uniform_real_distribution<double> jitter(-30, 30);
+    uniform_real_distribution<double> chance(0, 1);
+    for(size_t city = 0; city < cityCount; city++) {
+        graph.xs.push_back(double(city % side) * 100 + jitter(random));
+        graph.ys.push_back(double(city / side) * 100 + jitter(random));
+    }
+    for(size_t city = 0; city < cityCount; city++) {
+        size_t column = city % side;
+        size_t row = city / side;
+        if (column + 1 < side && city + 1 < cityCount && chance(random) < 0.9) {
+            graph.roads.push_back(make_pair(uint32_t(city), uint32_t(city + 1)));
+        }
+        if (city + side < cityCount && chance(random) < 0.9) {
+            graph.roads.push_back(make_pair(uint32_t(city), uint32_t(city + side)));
+        }
+        if (column + 1 < side && city + side + 1 < cityCount && chance(random) < 0.1) {
+            graph.roads.push_back(make_pair(uint32_t(city), uint32_t(city + side + 1)));
+        }
+        if (row % 16 == 0 && column % 4 == 0 && column + 4 < side && city + 4 < cityCount) {
+            graph.roads.push_back(make_pair(uint32_t(city), uint32_t(city + 4)));
+        }
+        if (column % 16 == 0 && row % 4 == 0 && city + 4 * side < cityCount) {
+            graph.roads.push_back(make_pair(uint32_t(city), uint32_t(city + 4 * side)));
+        }
+    }
+}
+
+string cityName(size_t city)
+{
+    ostringstream name;
+    name << "c" << city;
+    return name.str();
+}
+
+// peak resident set of the process in kilobytes, 0 where it is not known
+long peakRssKb()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return usage.ru_maxrss;
+    }
+#endif
+    return 0;
+}
+
+// resident set of the process in kilobytes now, 0 where it is not known; memory freed before is handed back to the system first
+// where the allocator allows it, so it is what the process holds rather than what it once did
+long currentRssKb()
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+#ifdef __linux__
+    ifstream statm("/proc/self/statm");
+    long pages = 0;
+    long residentPages = 0;
+    if (statm >> pages >> residentPages) {
+        return residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+#endif
+    return 0;
+}
+
+double percentile(const vector<double> &sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[size_t(fraction * (sorted.size() - 1) + 0.5)];
+}
+
+#ifdef CITYGRAPH_NAME_ORDER
+const char *const CITY_LAYOUT = "name";
+#else
+const char *const CITY_LAYOUT = "hilbert";
+#endif
+
+// counter of the hardware cache misses of this thread, through perf events; counts nothing where they are not available
+class CacheMissCounter
+{
+    public:
+        CacheMissCounter();
+        ~CacheMissCounter();
+        bool Counting() const { return descriptor >= 0; }
+        long long Read() const; // misses so far, 0 when not counting
+    private:
+        int descriptor;
+};
+
+CacheMissCounter::CacheMissCounter() : descriptor(-1)
+{
+#ifdef __linux__
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.size = sizeof(attributes);
+    attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+    // user space only, which unprivileged processes are usually allowed to count
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    descriptor = int(syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0));
+#endif
+}
+
+CacheMissCounter::~CacheMissCounter()
+{
+#ifdef __linux__
+    if (descriptor >= 0) {
+        close(descriptor);
+    }
+#endif
+}
+
+long long CacheMissCounter::Read() const
+{
+    long long misses = 0;
+#ifdef __linux__
+    if (descriptor >= 0 && read(descriptor, &misses, sizeof(misses)) != sizeof(misses)) {
+        misses = 0;
+    }
+#endif
+    return misses;
+}
+
+// measurements of one operation on one graph, written as a line of JSON
+struct Record {
+    string generator;
+    size_t cities;
+    size_t roads;
+    string mode;
+    string operation;
+    double seconds; // all calls together
+    vector<double> latencies; // microseconds of each call
+    vector<double> settled; // cities settled by each query, empty for edits
+    unsigned int workers; // of the query service, 0 for calls made directly
+    double cacheMisses; // hardware cache misses of all calls, negative where they were not counted
+};
+
+void writeRecord(ostream &output, Record &record)
+{
+    sort(record.latencies.begin(), record.latencies.end());
+    sort(record.settled.begin(), record.settled.end());
+    double settledTotal = 0;
+    for(vector<double>::iterator it = record.settled.begin(); it != record.settled.end(); it++) {
+        settledTotal += *it;
+    }
+    output << "{\"generator\":\"" << record.generator << "\",\"cities\":" << record.cities << ",\"roads\":" << record.roads
+           << ",\"layout\":\"" << CITY_LAYOUT << "\",\"mode\":\"" << record.mode << "\",\"operation\":\"" << record.operation
+           << "\",\"calls\":" << record.latencies.size();
+    if (record.workers > 0) {
+        output << ",\"workers\":" << record.workers;
+    }
+    output << ",\"seconds\":" << record.seconds
+           << ",\"mean_us\":" << (record.latencies.empty() ? 0 : record.seconds * 1e6 / record.latencies.size())
+           << ",\"p50_us\":" << percentile(record.latencies, 0.5) << ",\"p90_us\":" << percentile(record.latencies, 0.9)
+           << ",\"p99_us\":" << percentile(record.latencies, 0.99) << ",\"max_us\":" << percentile(record.latencies, 1);
+    if (!record.settled.empty()) {
+        output << ",\"settled_mean\":" << settledTotal / record.settled.size() << ",\"settled_p50\":" << percentile(record.settled, 0.5)
+               << ",\"settled_p99\":" << percentile(record.settled, 0.99);
+    }
+    if (record.cacheMisses >= 0 && !record.latencies.empty()) {
+        output << ",\"cache_misses_per_call\":" << record.cacheMisses / record.latencies.size();
+    }
+    output << ",\"peak_rss_kb\":" << peakRssKb() << "}" << endl;
+}
+
+// takes the record of a build and the report of the hub labels it made and writes the report as a line of JSON
+void writeLabelReport(ostream &output, const Record &build, const HubLabelReport &report)
+{
+    output << "{\"generator\":\"" << build.generator << "\",\"cities\":" << build.cities << ",\"roads\":" << build.roads
+           << ",\"layout\":\"" << CITY_LAYOUT << "\",\"mode\":\"" << build.mode << "\",\"operation\":\"HubLabels\",\"hubs\":" << report.hubs
+           << ",\"mean_label\":" << (report.cities == 0 ? 0 : double(report.hubs) / report.cities) << ",\"largest_label\":" << report.largestLabel
+           << ",\"bytes\":" << report.bytes << ",\"plain_bytes\":" << report.plainBytes
+           << ",\"bytes_per_city\":" << (report.cities == 0 ? 0 : double(report.bytes) / report.cities)
+           << ",\"build_seconds\":" << report.buildSeconds << ",\"query_us\":" << report.queryMicroseconds
+           << ",\"peak_rss_kb\":" << peakRssKb() << "}" << endl;
+}
+
+// takes the record of a build and the version it published in the compressed mode and writes the size of its roads
+// as a line of JSON, next to that the compressed sparse rows of the snapshot would take, and the resident memory of the whole
+// process per road, which also counts the cities, the heuristic and the generated graph the benchmark keeps
+void writeRoadReport(ostream &output, const Record &build, const CityMap<double>::Version &version)
+{
+    const CompressedRoads<double, EuclideanHeuristic<double>::DistanceMetric, CityMap<double>::Graph::LengthType> &roads = *version.compressed;
+    double snapshotBytes = double(roads.Size() + 1) * sizeof(RoadId) + double(roads.RoadCount()) * (sizeof(CityId) + sizeof(CityMap<double>::Graph::LengthType));
+    long rssKb = currentRssKb();
+    output << "{\"generator\":\"" << build.generator << "\",\"cities\":" << build.cities << ",\"roads\":" << build.roads
+           << ",\"layout\":\"" << CITY_LAYOUT << "\",\"mode\":\"" << build.mode << "\",\"operation\":\"CompressedRoads\",\"bytes\":" << roads.Bytes()
+           << ",\"bytes_per_road\":" << roads.BytesPerRoad()
+           << ",\"snapshot_bytes_per_road\":" << (roads.RoadCount() == 0 ? 0 : snapshotBytes / roads.RoadCount())
+           << ",\"rss_kb\":" << rssKb << ",\"process_bytes_per_road\":" << (roads.RoadCount() == 0 ? 0 : double(rssKb) * 1024 / roads.RoadCount())
+           << ",\"peak_rss_kb\":" << peakRssKb() << "}" << endl;
+}
+
+// takes a function and a record, runs the function, and adds its latency to the record
+template <typename Function>
+void timeCall(Record &record, Function function)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    function();
+    double microseconds = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    record.latencies.push_back(microseconds);
+    record.seconds += microseconds / 1e6;
+}
+
+// cities settled by the searches the last query started on this thread
+template <typename T>
+struct SettledCounter {
+    SettledCounter() : workspace(SearchWorkspace<T>::ForThisThread()), forward(workspace.forward.Generation()), backward(workspace.backward.Generation()) {}
+    size_t Settled() const
+    {
+        return (workspace.forward.Generation() != forward ? workspace.forward.SettledCount() : 0)
+            + (workspace.backward.Generation() != backward ? workspace.backward.SettledCount() : 0);
+    }
+    SearchWorkspace<T> &workspace;
+    unsigned int forward;
+    unsigned int backward;
+};
+
+// takes a generated graph and builds a map of it edit by edit, then publishes it and runs the queries, writing a record per operation
+void benchmark(const string &generatorName, const GeneratedGraph &generated, SearchMode mode, const string &modeName, size_t queryCount,
+               const vector<unsigned int> &workerCounts, mt19937_64 &random, ostream &output)
+{
+    ostream nowhere(0); // unreachable pairs are reported as errors, which are not wanted here
+    CityMap<double> citymap(nowhere, nowhere);
+    citymap.SetSearchMode(mode);
+    size_t cityCount = generated.xs.size();
+    Record base = { generatorName, cityCount, generated.roads.size(), modeName, "", 0, vector<double>(), vector<double>(), 0, -1 };
+    CacheMissCounter cacheMisses;
+
+    Record addCity = base;
+    addCity.operation = "AddCity";
+    addCity.latencies.reserve(cityCount);
+    for(size_t city = 0; city < cityCount; city++) {
+        string name = cityName(city);
+        timeCall(addCity, [&]() { citymap.AddCity(name, generated.xs[city], generated.ys[city]); });
+    }
+    writeRecord(output, addCity);
+
+    Record addRoad = base;
+    addRoad.operation = "AddRoad";
+    addRoad.latencies.reserve(generated.roads.size());
+    for(vector<pair<uint32_t, uint32_t> >::const_iterator it = generated.roads.begin(); it != generated.roads.end(); it++) {
+        string first = cityName(it->first);
+        string second = cityName(it->second);
+        timeCall(addRoad, [&]() { citymap.AddRoad(first, second); });
+    }
+    writeRecord(output, addRoad);
+
+    // the snapshot, heuristic and the hierarchy, overlay, labels or compressed roads of the mode
+    Record build = base;
+    build.operation = "Build";
+    timeCall(build, [&]() { citymap.Freeze(); });
+    writeRecord(output, build);
+    if (mode == SearchMode::HubLabels) {
+        writeLabelReport(output, build, citymap.GetHubLabelReport());
+    }
+    if (mode == SearchMode::Compressed) {
+        writeRoadReport(output, build, *citymap.CurrentVersion());
+    }
+
+    uniform_int_distribution<size_t> pick(0, cityCount - 1);
+    vector<pair<string, string> > pairs;
+    for(size_t query = 0; query < queryCount; query++) {
+        pairs.push_back(make_pair(cityName(pick(random)), cityName(pick(random))));
+    }
+    Record findDistance = base;
+    findDistance.operation = "FindDistance";
+    long long missesBefore = cacheMisses.Read();
+    for(vector<pair<string, string> >::iterator it = pairs.begin(); it != pairs.end(); it++) {
+        SettledCounter<double> counter;
+        timeCall(findDistance, [&]() { citymap.FindDistance(it->first, it->second); });
+        findDistance.settled.push_back(double(counter.Settled()));
+    }
+    if (cacheMisses.Counting()) {
+        findDistance.cacheMisses = double(cacheMisses.Read() - missesBefore);
+    }
+    writeRecord(output, findDistance);
+
+    Record shortestPath = base;
+    shortestPath.operation = "ShortestPath";
+    missesBefore = cacheMisses.Read();
+    for(vector<pair<string, string> >::iterator it = pairs.begin(); it != pairs.end(); it++) {
+        SettledCounter<double> counter;
+        timeCall(shortestPath, [&]() { citymap.ShortestPath(it->first, it->second); });
+        shortestPath.settled.push_back(double(counter.Settled()));
+    }
+    if (cacheMisses.Counting()) {
+        shortestPath.cacheMisses = double(cacheMisses.Read() - missesBefore);
+    }
+    writeRecord(output, shortestPath);
+
+    // a road taken out and put back as one version, which the hierarchy is built again for and the overlay customized again for
+    Record changeRoad = base;
+    changeRoad.operation = "ChangeRoad";
+    uniform_int_distribution<size_t> pickRoad(0, generated.roads.size() - 1);
+    for(size_t change = 0; change < 10 && !generated.roads.empty(); change++) {
+        const pair<uint32_t, uint32_t> &road = generated.roads[pickRoad(random)];
+        string first = cityName(road.first);
+        string second = cityName(road.second);
+        timeCall(changeRoad, [&]() {
+            citymap.BeginBatch();
+            citymap.RemoveRoad(first, second);
+            citymap.AddRoad(first, second);
+            citymap.EndBatch();
+        });
+    }
+    writeRecord(output, changeRoad);
+
+    for(vector<unsigned int>::const_iterator workers = workerCounts.begin(); workers != workerCounts.end(); workers++) {
+        QueryService<double> service(citymap, *workers);
+        Record served = base;
+        served.operation = "ServiceFindDistance";
+        served.workers = *workers;
+        served.latencies.reserve(pairs.size());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<future<double> > distances = service.FindDistances(pairs);
+        for(vector<future<double> >::iterator it = distances.begin(); it != distances.end(); it++) {
+            it->wait();
+            served.latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        }
+        served.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        writeRecord(output, served);
+    }
+}
+
+// takes a comma separated list and gets its items
+vector<string> splitList(const string &list)
+{
+    vector<string> items;
+    istringstream input(list);
+    string item;
+    while (getline(input, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+int main(int argc, char **argv)
+{
+    vector<string> generators = splitList("grid,geometric,road");
+    vector<string> sizes = splitList("1000,10000,100000");
+    size_t queryCount = 1000;
+    string modeName = "astar";
+    unsigned long seed = 1;
+    vector<unsigned int> workerCounts;
+    string outputPath;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        string value = argv[i + 1];
+        if (option == "--generators") {
+            generators = splitList(value);
+        }
+        else if (option == "--sizes") {
+            sizes = splitList(value);
+        }
+        else if (option == "--queries") {
+            queryCount = strtoul(value.c_str(), 0, 10);
+        }
+        else if (option == "--mode") {
+            modeName = value;
+        }
+        else if (option == "--seed") {
+            seed = strtoul(value.c_str(), 0, 10);
+        }
+        else if (option == "--workers") {
+            vector<string> counts = splitList(value);
+            for(vector<string>::iterator it = counts.begin(); it != counts.end(); it++) {
+                workerCounts.push_back((unsigned int)strtoul(it->c_str(), 0, 10));
+            }
+        }
+        else if (option == "--output") {
+            outputPath = value;
+        }
+        else {
+            cerr << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+    SearchMode mode = SearchMode::AStar;
+    if (modeName == "ch") {
+        mode = SearchMode::ContractionHierarchy;
+    }
+    else if (modeName == "bidirectional") {
+        mode = SearchMode::Bidirectional;
+    }
+    else if (modeName == "overlay") {
+        mode = SearchMode::PartitionOverlay;
+    }
+    else if (modeName == "labels") {
+        mode = SearchMode::HubLabels;
+    }
+    else if (modeName == "compressed") {
+        mode = SearchMode::Compressed;
+    }
+    else if (modeName != "astar") {
+        cerr << "Unknown mode " << modeName << endl;
+        return 1;
+    }
+    ofstream file;
+    if (!outputPath.empty()) {
+        file.open(outputPath.c_str(), ios::app);
+        if (!file) {
+            cerr << "Cannot write " << outputPath << endl;
+            return 1;
+        }
+    }
+    ostream &output = outputPath.empty() ? cout : file;
+
+    for(vector<string>::iterator size = sizes.begin(); size != sizes.end(); size++) {
+        size_t cityCount = strtoul(size->c_str(), 0, 10);
+        for(vector<string>::iterator generator = generators.begin(); generator != generators.end(); generator++) {
+            if (cityCount < 2) {
+                continue;
+            }
+            mt19937_64 random(seed);
+            GeneratedGraph graph;
+            if (*generator == "grid") {
+                generateGrid(cityCount, random, graph);
+            }
+            else if (*generator == "geometric") {
+                generateGeometric(cityCount, random, graph);
+            }
+            else if (*generator == "road") {
+                generateRoadLike(cityCount, random, graph);
+            }
+            else {
+                cerr << "Unknown generator " << *generator << endl;
+                return 1;
+            }
+            cerr << *generator << " " << cityCount << " cities, " << graph.roads.size() << " roads" << endl;
+            benchmark(*generator, graph, mode, modeName, queryCount, workerCounts, random, output);
+        }
+    }
+    return 0;
+}
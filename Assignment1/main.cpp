@@ -1,7 +1,18 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/resource.h>
+#endif
+#define CITYMAP_STATS // the tests check the query statistics too
 #include "CityMap.h"
+#include "QueryService.h"
 
 
 using namespace std;
@@ -261,8 +272,134 @@ bool acceptanceTest() {
     return true;
 }
 
-CityMap<double> genRandom(int nCities, int maxRoadsPerCity) {
-    CityMap<double> m;
+bool snapshotTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> citymap = CityMap<double>(out, err);
+    citymap.AddCity("C", 0, 10);
+    citymap.AddCity("A", 0, 0);
+    citymap.AddCity("B", 10, 0);
+    citymap.AddRoad("A", "B");
+    citymap.AddRoad("A", "C");
+    const CityGraph<double> &graph = citymap.Snapshot();
+    // ids follow the Hilbert curve from the corner at A, up to C and round to B
+    bool idsOnCurve = graph.Size() == 3 && graph.Find("A") == 0 && graph.Find("C") == 1 && graph.Find("B") == 2 && graph.Find("D") == NO_CITY
+        && graph.ByName(0) == 0 && graph.ByName(1) == 2 && graph.ByName(2) == 1;
+    bool roadsBuilt = graph.RoadCount() == 4 && graph.LastRoad(0) - graph.FirstRoad(0) == 2 && graph.Length(graph.FindRoad(1, 0)) == 10;
+    citymap.RemoveRoad("A", "C");
+    bool roadRemoved = citymap.Snapshot().RoadCount() == 2 && citymap.ShortestPath("A", "C").empty();
+    citymap.RemoveCity("B");
+    bool cityRemoved = citymap.Snapshot().Size() == 2 && citymap.Snapshot().RoadCount() == 0;
+    return idsOnCurve && roadsBuilt && roadRemoved && cityRemoved;
+}
+
+// edits roads of a map in rounds, keeping a copy of its cities and roads in maps of its own, and checks that every snapshot is
+// the one built from those maps, array for array; rounds which only change roads must patch the snapshot before, sharing its cities,
+// and rounds which also add or remove a city build it again
+bool patchedSnapshotTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double, MetricHeuristic<double, ExplicitLengths<double> > > m(out, err);
+    map<string, Pos<double> > cities;
+    map<string, map<string, double> > roads;
+    srand(101);
+    for(int city=0; city<200; city++) {
+        string name = "City " + to_string(city);
+        cities[name] = Pos<double>(rand() % 100, rand() % 100);
+        roads[name];
+        m.AddCity(name, cities[name].x, cities[name].y);
+    }
+    shared_ptr<const CityMap<double, MetricHeuristic<double, ExplicitLengths<double> > >::Version> previous = m.CurrentVersion();
+    for(int round=0; round<30; round++) {
+        bool cityEdited = round % 5 == 4;
+        if (cityEdited) {
+            string name = "Round " + to_string(round);
+            cities[name] = Pos<double>(rand() % 100, rand() % 100);
+            roads[name];
+            m.AddCity(name, cities[name].x, cities[name].y);
+        }
+        for(int edit=0; edit<1 + round % 7; edit++) {
+            map<string, Pos<double> >::iterator first = cities.begin();
+            map<string, Pos<double> >::iterator second = cities.begin();
+            advance(first, rand() % cities.size());
+            advance(second, rand() % cities.size());
+            if (first == second) {
+                continue;
+            }
+            if (roads[first->first].count(second->first)) {
+                m.RemoveRoad(first->first, second->first);
+                roads[first->first].erase(second->first);
+                roads[second->first].erase(first->first);
+            }
+            if (rand() % 3 != 0) {
+                double length = rand() % 1000 / 8.0;
+                m.AddRoad(first->first, second->first, length);
+                roads[first->first][second->first] = length;
+                roads[second->first][first->first] = length;
+            }
+        }
+        shared_ptr<const CityMap<double, MetricHeuristic<double, ExplicitLengths<double> > >::Version> version = m.CurrentVersion();
+        const CityGraph<double> &graph = *version->graph;
+        CityGraph<double> rebuilt(cities, roads);
+        if (graph.Size() != rebuilt.Size() || graph.RoadCount() != rebuilt.RoadCount() || (graph.Xs() == previous->graph->Xs()) == cityEdited) {
+            return false;
+        }
+        for(CityId city=0; city<graph.Size(); city++) {
+            if (graph.Name(city) != rebuilt.Name(city) || graph.FirstRoad(city) != rebuilt.FirstRoad(city) || graph.LastRoad(city) != rebuilt.LastRoad(city)) {
+                return false;
+            }
+            for(RoadId road=graph.FirstRoad(city); road!=graph.LastRoad(city); road++) {
+                if (graph.Target(road) != rebuilt.Target(road) || graph.Length(road) != rebuilt.Length(road)) {
+                    return false;
+                }
+            }
+        }
+        previous = version;
+    }
+    return true;
+}
+
+// builds a grid whose names are shuffled over it and checks that every name is still found, that ids in name order give the
+// names in order, and that the ids of the two ends of a road are mostly close, which name order would scatter over the whole grid
+bool cityLayoutTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    srand(89);
+    const int side = 32;
+    vector<int> names;
+    for(int city=0; city<side*side; city++) {
+        names.push_back(city);
+    }
+    for(int city=side*side-1; city>0; city--) {
+        swap(names[city], names[rand() % (city + 1)]);
+    }
+    for(int city=0; city<side*side; city++) {
+        m.AddCity("City " + to_string(names[city]), city % side, city / side);
+    }
+    for(int city=0; city<side*side; city++) {
+        if (city % side + 1 < side) {
+            m.AddRoad("City " + to_string(names[city]), "City " + to_string(names[city + 1]));
+        }
+        if (city + side < side*side) {
+            m.AddRoad("City " + to_string(names[city]), "City " + to_string(names[city + side]));
+        }
+    }
+    const CityGraph<double> &graph = m.Snapshot();
+    double gaps = 0;
+    for(CityId city=0; city<graph.Size(); city++) {
+        if (graph.Find(graph.Name(city)) != city || (city > 0 && !(graph.NameView(graph.ByName(city - 1)) < graph.NameView(graph.ByName(city))))) {
+            return false;
+        }
+        for(RoadId road=graph.FirstRoad(city); road!=graph.LastRoad(city); road++) {
+            gaps += fabs(double(graph.Target(road)) - double(city));
+        }
+    }
+    return gaps / graph.RoadCount() < side;
+}
+
+template <typename CityMapType>
+void addRandom(CityMapType &m, int nCities, int maxRoadsPerCity) {
     int mapSize = nCities;
     for(int i=0; i<nCities; i++) {
         double x = rand() % mapSize;
@@ -292,9 +429,1312 @@ CityMap<double> genRandom(int nCities, int maxRoadsPerCity) {
             m.AddRoad("City "+rFromCity.str(), "City "+rToCity.str());
         }
     }
+}
+
+CityMap<double> genRandom(int nCities, int maxRoadsPerCity) {
+    CityMap<double> m;
+    addRandom(m, nCities, maxRoadsPerCity);
     return m;
 }
 
+// compares A* with distances from Floyd-Warshall over the snapshot
+bool exhaustiveDistanceTest() {
+    srand(7);
+    CityMap<double> m = genRandom(40, 4);
+    const CityGraph<double> &graph = m.Snapshot();
+    CityId n = graph.Size();
+    const double unreachable = 1e300;
+    vector<double> dist(n * n, unreachable);
+    for(CityId i=0; i<n; i++) {
+        dist[i*n+i] = 0;
+        for(RoadId road = graph.FirstRoad(i); road != graph.LastRoad(i); road++) {
+            dist[i*n+graph.Target(road)] = graph.Length(road);
+        }
+    }
+    for(CityId k=0; k<n; k++) {
+        for(CityId i=0; i<n; i++) {
+            for(CityId j=0; j<n; j++) {
+                if (dist[i*n+k] + dist[k*n+j] < dist[i*n+j]) {
+                    dist[i*n+j] = dist[i*n+k] + dist[k*n+j];
+                }
+            }
+        }
+    }
+    for(CityId i=0; i<n; i++) {
+        for(CityId j=0; j<n; j++) {
+            double found = m.FindDistance(graph.Name(i), graph.Name(j));
+            if (fabs(found - dist[i*n+j]) > 1e-9 * (1 + dist[i*n+j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// compares the contraction hierarchy with A*, and checks that its unpacked paths follow existing roads
+bool contractionHierarchyTest() {
+    srand(11);
+    CityMap<double> m = genRandom(60, 4);
+    const CityGraph<double> &graph = m.Snapshot();
+    vector<double> expected;
+    for(CityId i=0; i<graph.Size(); i++) {
+        for(CityId j=0; j<graph.Size(); j++) {
+            expected.push_back(m.FindDistance(graph.Name(i), graph.Name(j)));
+        }
+    }
+    m.SetSearchMode(SearchMode::ContractionHierarchy);
+    for(CityId i=0; i<graph.Size(); i++) {
+        for(CityId j=0; j<graph.Size(); j++) {
+            double found = m.FindDistance(graph.Name(i), graph.Name(j));
+            vector<string> path = m.ShortestPath(graph.Name(i), graph.Name(j));
+            double pathLength = 0;
+            for(size_t k=1; k<path.size(); k++) {
+                RoadId road = graph.FindRoad(graph.Find(path[k-1]), graph.Find(path[k]));
+                if (road == graph.LastRoad(graph.Find(path[k-1]))) {
+                    return false;
+                }
+                pathLength += graph.Length(road);
+            }
+            double exact = expected[i*graph.Size()+j];
+            if (fabs(found - exact) > 1e-9 * (1 + exact) || fabs(pathLength - exact) > 1e-9 * (1 + exact)
+                || path.front() != graph.Name(i) || path.back() != graph.Name(j)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// compares every distance the hub labels give with A*, before and after edits which rebuild them, including an unreachable city;
+// paths in the hub label mode come from the hierarchy, and the compressed labels must be smaller than plain pairs
+bool hubLabelTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    srand(83);
+    addRandom(m, 120, 4);
+    m.AddCity("Island", 500, 500);
+    CityMap<double> astar = m;
+    m.SetSearchMode(SearchMode::HubLabels);
+    for(int round=0; round<2; round++) {
+        HubLabelReport report = m.GetHubLabelReport();
+        const CityGraph<double> &graph = m.Snapshot();
+        if (report.cities != graph.Size() || report.hubs < report.cities || report.largestLabel == 0 || report.bytes >= report.plainBytes) {
+            return false;
+        }
+        for(CityId i=0; i<graph.Size(); i++) {
+            for(CityId j=0; j<graph.Size(); j++) {
+                double exact = astar.FindDistance(graph.Name(i), graph.Name(j));
+                if (fabs(m.FindDistance(graph.Name(i), graph.Name(j)) - exact) > 1e-9 * (1 + exact)) {
+                    return false;
+                }
+            }
+        }
+        vector<string> path = m.ShortestPath("City 0", "City 50");
+        if (path != astar.ShortestPath("City 0", "City 50")) {
+            return false;
+        }
+        CityMap<double> *maps[] = { &m, &astar };
+        for(int i=0; i<2 && round==0; i++) {
+            maps[i]->RemoveRoad("City 10", "City 11");
+            maps[i]->AddCity("Suburb", 3, 4);
+            maps[i]->AddRoad("Suburb", "City 10");
+            maps[i]->AddRoad("Suburb", "City 11");
+        }
+    }
+    return m.FindDistance("Island", "City 0") == 0 && err.str().find(DOESNT_EXIST) != string::npos;
+}
+
+// decodes every road of a compressed copy of a snapshot and compares it with the snapshot: the same targets in the same order,
+// and lengths no shorter and less than a quantum longer; gets the bytes a road takes, or -1 if a road differs
+template <typename Metric, typename Weight>
+double compressedRoadsCheck(const CityGraph<double, Weight> &graph, double quantum) {
+    CompressedRoads<double, Metric, Weight> roads(graph, quantum);
+    bool same = roads.Size() == graph.Size() && roads.RoadCount() == graph.RoadCount();
+    for(CityId city=0; city<graph.Size() && same; city++) {
+        RoadId road = graph.FirstRoad(city);
+        roads.ForEachRoad(city, [&](CityId target, double length) {
+            same = same && road != graph.LastRoad(city) && target == graph.Target(road)
+                && length >= graph.Length(road) - 1e-9 * (1 + length) && length < graph.Length(road) + quantum + 1e-9 * (1 + length);
+            road++;
+        });
+        same = same && road == graph.LastRoad(city);
+    }
+    return same ? roads.BytesPerRoad() : -1;
+}
+
+// compares A* over compressed roads with A* over the snapshot, for straight-line roads whose lengths are computed again
+// from the coordinates, and checks the roads of a map with explicit lengths come back within a quantum; in the compressed mode
+// the snapshot keeps only the cities, and saving, trees, edits and leaving the mode get the roads back from the compressed copy
+bool compressedRoadsTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    srand(97);
+    addRandom(m, 150, 4);
+    CityMap<double> plain = m;
+    m.SetSearchMode(SearchMode::Compressed);
+    if (!m.CurrentVersion()->compressed || m.Snapshot().RoadCount() != 0 || m.CurrentVersion()->compressed->RoadCount() != plain.Snapshot().RoadCount()) {
+        return false;
+    }
+    shared_ptr<const CityMap<double>::Version> plainVersion = plain.CurrentVersion(); // kept, as plain is edited below
+    const CityGraph<double> &graph = *plainVersion->graph;
+    for(int query=0; query<300; query++) {
+        string first = graph.Name(rand() % graph.Size());
+        string second = graph.Name(rand() % graph.Size());
+        if (m.FindDistance(first, second) != plain.FindDistance(first, second) || m.ShortestPath(first, second) != plain.ShortestPath(first, second)) {
+            return false;
+        }
+    }
+    double straightBytes = compressedRoadsCheck<EuclideanMetric<double> >(graph, 1e-3);
+    string source = graph.Name(0);
+    PathTree<double> tree = m.ShortestPathTree(source);
+    PathTree<double> plainTree = plain.ShortestPathTree(source);
+    string path = "compressed_test.map";
+    m.Save(path);
+    CityMap<double> saved = CityMap<double>(out, err);
+    saved.OpenMapped(path);
+    remove(path.c_str());
+    if (tree.distances != plainTree.distances || tree.parents != plainTree.parents || saved.Snapshot().RoadCount() != graph.RoadCount()
+        || compressedRoadsCheck<EuclideanMetric<double> >(saved.Snapshot(), 1e-3) < 0) {
+        return false;
+    }
+
+    // an edit fills the maps from the compressed roads again, and the version it publishes is compressed too
+    m.AddCity("Shortcut", 0, 0);
+    m.AddRoad("Shortcut", graph.Name(1));
+    m.AddRoad("Shortcut", graph.Name(2));
+    plain.AddCity("Shortcut", 0, 0);
+    plain.AddRoad("Shortcut", graph.Name(1));
+    plain.AddRoad("Shortcut", graph.Name(2));
+    const CityGraph<double> &edited = plain.Snapshot();
+    if (m.FindDistance(edited.Name(1), edited.Name(2)) != plain.FindDistance(edited.Name(1), edited.Name(2)) || m.Snapshot().RoadCount() != 0) {
+        return false;
+    }
+    m.SetSearchMode(SearchMode::AStar);
+    if (m.CurrentVersion()->compressed || m.Snapshot().RoadCount() != edited.RoadCount() || compressedRoadsCheck<EuclideanMetric<double> >(m.Snapshot(), 1e-3) < 0) {
+        return false;
+    }
+
+    // switching to the compressed mode within a batch keeps the edits of the batch, which are published when it ends
+    size_t errors = err.str().size();
+    m.BeginBatch();
+    m.AddCity("Batched", 1, 1);
+    m.AddRoad("Batched", graph.Name(3));
+    m.SetSearchMode(SearchMode::Compressed);
+    if (m.Snapshot().Find("Batched") != NO_CITY) {
+        return false;
+    }
+    m.EndBatch();
+    if (m.Snapshot().Find("Batched") == NO_CITY || !m.CurrentVersion()->compressed || m.FindDistance("Batched", graph.Name(3)) != m.FindDistance(graph.Name(3), "Batched")
+        || m.FindDistance("Batched", graph.Name(3)) == 0 || err.str().size() != errors) {
+        return false;
+    }
+
+    typedef CityMap<double, MetricHeuristic<double, ExplicitLengths<double> > > TimedMap;
+    TimedMap timed = TimedMap(out, err);
+    for(CityId city=0; city<graph.Size(); city++) {
+        timed.AddCity(graph.Name(city), graph.X(city), graph.Y(city));
+    }
+    for(CityId city=0; city<graph.Size(); city++) {
+        for(RoadId road=graph.FirstRoad(city); road!=graph.LastRoad(city); road++) {
+            if (city < graph.Target(road)) {
+                timed.AddRoad(graph.Name(city), graph.Name(graph.Target(road)), (rand() % 10000) / 7.0);
+            }
+        }
+    }
+    double timedBytes = compressedRoadsCheck<ExplicitLengths<double> >(timed.Snapshot(), 0.5);
+    return straightBytes >= 0 && straightBytes < 8 && timedBytes >= 0 && timedBytes < 8 && timed.Snapshot().RoadCount() == graph.RoadCount();
+}
+
+// builds a jittered grid of roads with lengths of their own and compares the partition overlay with Dijkstra's algorithm,
+// while congestion penalties lengthen roads one at a time; each penalty must customize again only a cell per level and end
+// of its road, and every path must follow existing roads and add up to the distance
+bool partitionOverlayTest() {
+    typedef CityMap<double, MetricHeuristic<double, ExplicitLengths<double> > > TimedMap;
+    stringstream out;
+    stringstream err;
+    TimedMap m = TimedMap(out, err);
+    srand(71);
+    const int side = 40;
+    for(int city=0; city<side*side; city++) {
+        m.AddCity("City " + to_string(city), (city % side) * 10 + rand() % 5, (city / side) * 10 + rand() % 5);
+    }
+    for(int city=0; city<side*side; city++) {
+        if (city % side + 1 < side) {
+            m.AddRoad("City " + to_string(city), "City " + to_string(city + 1), 10 + rand() % 10);
+        }
+        if (city + side < side*side) {
+            m.AddRoad("City " + to_string(city), "City " + to_string(city + side), 10 + rand() % 10);
+        }
+    }
+    TimedMap dijkstra = m;
+    m.SetSearchMode(SearchMode::PartitionOverlay);
+    if (!m.CurrentVersion()->overlay || m.CurrentVersion()->overlay->Levels() < 2) {
+        return false;
+    }
+    for(int penalty=0; penalty<4; penalty++) {
+        shared_ptr<const TimedMap::Version> version = m.CurrentVersion();
+        const CityGraph<double> &graph = *version->graph;
+        for(int query=0; query<100; query++) {
+            string first = "City " + to_string(rand() % (side*side));
+            string second = "City " + to_string(rand() % (side*side));
+            double exact = dijkstra.FindDistance(first, second);
+            double found = m.FindDistance(first, second);
+            vector<string> path = m.ShortestPath(first, second);
+            double pathLength = 0;
+            for(size_t k=1; k<path.size(); k++) {
+                RoadId road = graph.FindRoad(graph.Find(path[k-1]), graph.Find(path[k]));
+                if (road == graph.LastRoad(graph.Find(path[k-1]))) {
+                    return false;
+                }
+                pathLength += graph.Length(road);
+            }
+            if (fabs(found - exact) > 1e-9 * (1 + exact) || fabs(pathLength - exact) > 1e-9 * (1 + exact)
+                || path.front() != first || path.back() != second) {
+                return false;
+            }
+        }
+        int city = rand() % (side*side - side);
+        string first = "City " + to_string(city);
+        string second = "City " + to_string(city + side);
+        double length = graph.Length(graph.FindRoad(graph.Find(first), graph.Find(second)));
+        TimedMap *maps[] = { &m, &dijkstra };
+        for(int i=0; i<2; i++) {
+            maps[i]->BeginBatch();
+            maps[i]->RemoveRoad(first, second);
+            maps[i]->AddRoad(first, second, length * 5);
+            maps[i]->EndBatch();
+        }
+        const PartitionOverlay<double> &overlay = *m.CurrentVersion()->overlay;
+        if (overlay.CustomizedCells() > 2 * overlay.Levels()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// compares the landmark heuristic with the straight-line one while roads and cities come and go
+bool landmarkHeuristicTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> plain = CityMap<double>(out, err);
+    CityMap<double, LandmarkHeuristic<double, 4> > landmarks = CityMap<double, LandmarkHeuristic<double, 4> >(out, err);
+    srand(13);
+    addRandom(plain, 80, 3);
+    srand(13);
+    addRandom(landmarks, 80, 3);
+    for(int round=0; round<4; round++) {
+        if (landmarks.GetHeuristic().Landmarks().size() != 4) {
+            return false;
+        }
+        const CityGraph<double> &graph = plain.Snapshot();
+        for(int query=0; query<200; query++) {
+            string first = graph.Name(rand() % graph.Size());
+            string second = graph.Name(rand() % graph.Size());
+            double expected = plain.FindDistance(first, second);
+            if (fabs(landmarks.FindDistance(first, second) - expected) > 1e-9 * (1 + expected)) {
+                return false;
+            }
+        }
+        // the same changes on both maps: a road removed, a road added and a city replaced by a new one
+        string removedFirst = graph.Name(rand() % graph.Size());
+        const CityGraph<double> &landmarkGraph = landmarks.Snapshot();
+        CityId removedFirstId = landmarkGraph.Find(removedFirst);
+        if (landmarkGraph.FirstRoad(removedFirstId) != landmarkGraph.LastRoad(removedFirstId)) {
+            string removedSecond = landmarkGraph.Name(landmarkGraph.Target(landmarkGraph.FirstRoad(removedFirstId)));
+            plain.RemoveRoad(removedFirst, removedSecond);
+            landmarks.RemoveRoad(removedFirst, removedSecond);
+        }
+        string addedFirst = graph.Name(rand() % graph.Size());
+        string addedSecond = graph.Name(rand() % graph.Size());
+        plain.AddRoad(addedFirst, addedSecond);
+        landmarks.AddRoad(addedFirst, addedSecond);
+        string removedCity = graph.Name(rand() % graph.Size());
+        ostringstream newCity;
+        newCity << "New " << round;
+        double x = rand() % 80;
+        double y = rand() % 80;
+        plain.RemoveCity(removedCity);
+        landmarks.RemoveCity(removedCity);
+        plain.AddCity(newCity.str(), x, y);
+        landmarks.AddCity(newCity.str(), x, y);
+        plain.AddRoad(newCity.str(), addedFirst);
+        landmarks.AddRoad(newCity.str(), addedFirst);
+    }
+    return true;
+}
+
+// compares bidirectional A* with A* on random maps, with both heuristics, expecting the very same distances
+bool bidirectionalSearchTest() {
+    stringstream out;
+    stringstream err;
+    for(unsigned int seed=17; seed<21; seed++) {
+        srand(seed);
+        CityMap<double> m = genRandom(50, 4);
+        CityMap<double, LandmarkHeuristic<double, 4> > landmarks = CityMap<double, LandmarkHeuristic<double, 4> >(out, err);
+        srand(seed);
+        addRandom(landmarks, 50, 4);
+        const CityGraph<double> &graph = m.Snapshot();
+        vector<double> expected;
+        for(CityId i=0; i<graph.Size(); i++) {
+            for(CityId j=0; j<graph.Size(); j++) {
+                expected.push_back(m.FindDistance(graph.Name(i), graph.Name(j)));
+            }
+        }
+        m.SetSearchMode(SearchMode::Bidirectional);
+        landmarks.SetSearchMode(SearchMode::Bidirectional);
+        for(CityId i=0; i<graph.Size(); i++) {
+            for(CityId j=0; j<graph.Size(); j++) {
+                double exact = expected[i*graph.Size()+j];
+                vector<string> path = m.ShortestPath(graph.Name(i), graph.Name(j));
+                double pathLength = 0;
+                for(size_t k=1; k<path.size(); k++) {
+                    RoadId road = graph.FindRoad(graph.Find(path[k-1]), graph.Find(path[k]));
+                    if (road == graph.LastRoad(graph.Find(path[k-1]))) {
+                        return false;
+                    }
+                    pathLength += graph.Length(road);
+                }
+                if (m.FindDistance(graph.Name(i), graph.Name(j)) != exact || landmarks.FindDistance(graph.Name(i), graph.Name(j)) != exact
+                    || pathLength != exact || path.front() != graph.Name(i) || path.back() != graph.Name(j)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// runs weighted and anytime A* between random cities: every path must follow existing roads, add up to its distance and be
+// no longer than the reported bound allows, which is at most 1 + epsilon; searched to the end, the anytime mode must find the
+// shortest distance and prove it, reporting ever shorter paths on the way, and a search stopped early must say so
+bool boundedSearchTest() {
+    srand(29);
+    CityMap<double> m = genRandom(300, 4);
+    const CityGraph<double> &graph = m.Snapshot();
+    const double tolerance = 1e-9;
+    for(int query=0; query<200; query++) {
+        string first = graph.Name(rand() % graph.Size());
+        string second = graph.Name(rand() % graph.Size());
+        double exact = m.FindDistance(first, second);
+        if (exact == Unreachable<double>()) {
+            continue;
+        }
+        RouteLimits weighted;
+        weighted.epsilon = 0.5;
+        RouteLimits anytime;
+        anytime.epsilon = 2;
+        anytime.anytime = true;
+        double previous = Unreachable<double>();
+        bool improving = true;
+        BoundedRoute<double> best = m.BoundedPath(first, second, anytime, [&](const BoundedRoute<double> &route) {
+            improving = improving && route.distance < previous && route.distance <= route.bound * exact * (1 + tolerance);
+            previous = route.distance;
+        });
+        BoundedRoute<double> routes[] = { m.BoundedPath(first, second, RouteLimits()), m.BoundedPath(first, second, weighted), best };
+        for(int i=0; i<3; i++) {
+            const BoundedRoute<double> &route = routes[i];
+            double pathLength = 0;
+            for(size_t k=1; k<route.path.size(); k++) {
+                RoadId road = graph.FindRoad(graph.Find(route.path[k-1]), graph.Find(route.path[k]));
+                if (road == graph.LastRoad(graph.Find(route.path[k-1]))) {
+                    return false;
+                }
+                pathLength += graph.Length(road);
+            }
+            if (!route.finished || route.path.empty() || route.path.front() != first || route.path.back() != second
+                || fabs(pathLength - route.distance) > tolerance * (1 + exact) || route.distance < exact * (1 - tolerance)
+                || route.distance > route.bound * exact * (1 + tolerance) || route.bound < 1) {
+                return false;
+            }
+        }
+        if (routes[0].bound != 1 || routes[1].bound > 1.5 || fabs(best.distance - exact) > tolerance * (1 + exact) || best.bound != 1 || !improving) {
+            return false;
+        }
+
+        // a search stopped after a few cities either has no path yet or one with a valid bound
+        RouteLimits budget = anytime;
+        budget.settleBudget = 3;
+        BoundedRoute<double> stopped = m.BoundedPath(first, second, budget);
+        if (stopped.settled > 3 || (stopped.path.empty() && (stopped.finished || stopped.bound != numeric_limits<double>::infinity()))
+            || (!stopped.path.empty() && stopped.distance > stopped.bound * exact * (1 + tolerance))) {
+            return false;
+        }
+    }
+    RouteLimits late;
+    late.deadline = chrono::steady_clock::now() - chrono::seconds(1);
+    BoundedRoute<double> expired = m.BoundedPath(graph.Name(0), graph.Name(1), late);
+    return !expired.finished && expired.path.empty() && expired.settled == 0;
+}
+
+// takes two snapshots and gets whether they have the same cities, at the same places, with the same roads
+bool sameCities(const CityGraph<double> &first, const CityGraph<double> &second) {
+    if (first.Size() != second.Size() || first.RoadCount() != second.RoadCount()) {
+        return false;
+    }
+    for(CityId city=0; city<first.Size(); city++) {
+        CityId other = second.Find(first.Name(city));
+        if (other == NO_CITY || first.X(city) != second.X(other) || first.Y(city) != second.Y(other)
+            || first.LastRoad(city) - first.FirstRoad(city) != second.LastRoad(other) - second.FirstRoad(other)) {
+            return false;
+        }
+        for(RoadId road=first.FirstRoad(city); road!=first.LastRoad(city); road++) {
+            RoadId otherRoad = second.FindRoad(other, second.Find(first.Name(first.Target(road))));
+            if (otherRoad == second.LastRoad(other) || second.Length(otherRoad) != first.Length(road)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// records edits in a journal small enough to be compacted several times, some of them in a batch, and restores the map from it;
+// a record torn by a crash is then appended to the journal, and restoring must drop it and keep everything before it
+bool journalTest() {
+    stringstream out;
+    stringstream err;
+    const string path = "journalTest";
+    JournalOptions options;
+    options.syncBytes = 512;
+    options.compactBytes = 8192;
+    CityMap<double> recorded = CityMap<double>(out, err);
+    srand(37);
+    addRandom(recorded, 20, 3);
+    recorded.OpenJournal(path, options);
+    addRandom(recorded, 300, 3);
+    recorded.BeginBatch();
+    for(int edit=0; edit<100; edit++) {
+        const CityGraph<double> &graph = recorded.Snapshot();
+        CityId city = rand() % graph.Size();
+        if (edit % 3 == 0) {
+            recorded.RemoveCity(graph.Name(city));
+        }
+        else if (graph.FirstRoad(city) != graph.LastRoad(city)) {
+            recorded.RemoveRoad(graph.Name(city), graph.Name(graph.Target(graph.FirstRoad(city))));
+        }
+    }
+    recorded.EndBatch();
+    recorded.AddCity("Last", 1, 2);
+    recorded.AddRoad("Last", recorded.Snapshot().Name(0));
+    JournalStats written = recorded.GetJournalStats();
+    recorded.CloseJournal();
+    if (written.compactions < 3 || written.appended == 0 || written.syncs == 0) {
+        return false;
+    }
+
+    CityMap<double> restored = CityMap<double>(out, err);
+    restored.OpenJournal(path, options);
+    JournalStats reopened = restored.GetJournalStats();
+    if (!sameCities(recorded.Snapshot(), restored.Snapshot()) || reopened.replayed == 0 || reopened.discardedBytes != 0) {
+        return false;
+    }
+    restored.RemoveCity("Last");
+    string lastJournal = path + "." + to_string(restored.GetJournalStats().generation) + ".journal";
+    restored.CloseJournal();
+    ofstream(lastJournal.c_str(), ios::binary | ios::app) << string("\x20\0\0\0torn", 8);
+
+    CityMap<double> recovered = CityMap<double>(out, err);
+    recovered.OpenJournal(path, options);
+    JournalStats afterCrash = recovered.GetJournalStats();
+    bool crashRecovered = sameCities(restored.Snapshot(), recovered.Snapshot()) && recovered.Snapshot().Find("Last") == NO_CITY
+        && afterCrash.discardedBytes == 8 && err.str().find(JOURNAL_FILE) == string::npos && err.str().find(SNAPSHOT_FILE) == string::npos;
+
+    // an import replaces the map as a whole, so its snapshot is on disk as soon as Import returns; without that snapshot the
+    // edits after the import must not be replayed over an older map, and restoring reports it and leaves the map as it was
+    stringstream cityLines("Name,X,Y\nImported 0,1,1\nImported 1,2,2\n");
+    stringstream roadLines("From,To\nImported 0,Imported 1\n");
+    recovered.Import(cityLines, roadLines);
+    string importedSnapshot = path + "." + to_string(recovered.GetJournalStats().generation) + ".map";
+    bool importSaved = ifstream(importedSnapshot.c_str()).good();
+    recovered.AddCity("After import", 5, 5);
+    recovered.AddRoad("After import", "Imported 0");
+    JournalStats afterImport = recovered.GetJournalStats();
+    recovered.CloseJournal();
+    CityMap<double> reimported = CityMap<double>(out, err);
+    reimported.OpenJournal(path, options);
+    bool importRestored = sameCities(recovered.Snapshot(), reimported.Snapshot()) && reimported.Snapshot().Find("After import") != NO_CITY;
+    reimported.CloseJournal();
+    remove(importedSnapshot.c_str());
+    stringstream lostErr;
+    CityMap<double> lost = CityMap<double>(out, lostErr);
+    lost.OpenJournal(path, options);
+    bool lossReported = lostErr.str().find("Error: " + DOESNT_EXIST + "\n" + SNAPSHOT_FILE + ": " + importedSnapshot) != string::npos
+        && lost.Snapshot().Size() == 0 && lost.GetJournalStats().generation == 0;
+
+    for(uint64_t generation=0; generation<=afterImport.generation + 1; generation++) {
+        remove((path + "." + to_string(generation) + ".map").c_str());
+        remove((path + "." + to_string(generation) + ".journal").c_str());
+    }
+    return crashRecovered && importSaved && importRestored && lossReported;
+}
+
+// makes a write to the journal fail partway, by lowering the limit on file sizes, and records more edits once it is raised again;
+// the failed edit is written again with them, and the part of it the failed write left must not hide them from recovery
+bool journalWriteFailureTest() {
+#ifdef _WIN32
+    return true;
+#else
+    stringstream out;
+    stringstream err;
+    const string path = "journalWriteFailureTest";
+    JournalOptions options;
+    options.syncBytes = 0;
+    CityMap<double> recorded = CityMap<double>(out, err);
+    recorded.OpenJournal(path, options);
+    recorded.AddCity("First", 1, 1);
+    string journalPath = path + "." + to_string(recorded.GetJournalStats().generation) + ".journal";
+    ifstream journal(journalPath.c_str(), ios::binary | ios::ate);
+    rlim_t size = rlim_t(journal.tellg());
+    journal.close();
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = size + 5;
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &lowered);
+    recorded.AddCity("Failed", 2, 2);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, handler);
+    bool failureReported = err.str().find(JOURNAL_FILE) != string::npos;
+    recorded.AddCity("Second", 3, 3);
+    recorded.AddRoad("First", "Second");
+    recorded.CloseJournal();
+
+    CityMap<double> recovered = CityMap<double>(out, err);
+    recovered.OpenJournal(path, options);
+    JournalStats stats = recovered.GetJournalStats();
+    bool restored = sameCities(recorded.Snapshot(), recovered.Snapshot()) && recovered.Snapshot().Find("Second") != NO_CITY && stats.discardedBytes == 0;
+    recovered.CloseJournal();
+    for(uint64_t generation=0; generation<=stats.generation + 1; generation++) {
+        remove((path + "." + to_string(generation) + ".map").c_str());
+        remove((path + "." + to_string(generation) + ".journal").c_str());
+    }
+    return failureReported && restored;
+#endif
+}
+
+// compares distance matrices, from Dijkstra and from the contraction hierarchy, with single queries;
+// an isolated city and a city which does not exist get Unreachable entries
+bool distanceMatrixTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    srand(23);
+    addRandom(m, 70, 4);
+    m.AddCity("Island", 500, 500);
+    const CityGraph<double> &graph = m.Snapshot();
+    vector<string> sources;
+    vector<string> targets;
+    for(CityId i=0; i<graph.Size(); i++) {
+        sources.push_back(graph.Name(i));
+        if (i % 3 == 0) {
+            targets.push_back(graph.Name(i));
+        }
+    }
+    targets.push_back(targets.front());
+    sources.push_back("Nowhere");
+    vector<double> expected;
+    for(size_t i=0; i<sources.size(); i++) {
+        for(size_t j=0; j<targets.size(); j++) {
+            bool unreachable = i + 1 == sources.size() || sources[i] == "Island" || targets[j] == "Island";
+            expected.push_back(unreachable && sources[i] != targets[j] ? Unreachable<double>() : m.FindDistance(sources[i], targets[j]));
+        }
+    }
+    SearchMode modes[] = { SearchMode::AStar, SearchMode::ContractionHierarchy, SearchMode::HubLabels };
+    for(int mode=0; mode<3; mode++) {
+        m.SetSearchMode(modes[mode]);
+        vector<double> distances(sources.size() * targets.size(), -1);
+        m.DistanceMatrix(sources, targets, &distances[0]);
+        for(size_t k=0; k<distances.size(); k++) {
+            if (expected[k] == Unreachable<double>() ? distances[k] != expected[k] : fabs(distances[k] - expected[k]) > 1e-9 * (1 + expected[k])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// queries a map from several threads while another thread extends a line of stops in batches of two;
+// every version a query sees must hold whole batches, and the distance along the line to its last stop must be exact
+bool concurrentVersionsTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    m.AddCity("Stop 0", 0, 0);
+    const int batches = 200;
+    atomic<bool> writing(true);
+    atomic<bool> failed(false);
+    vector<thread> readers;
+    for(int reader=0; reader<3; reader++) {
+        readers.push_back(thread([&]() {
+            unsigned long lastNumber = 0;
+            while (writing && !failed) {
+                shared_ptr<const CityMapVersion<double, EuclideanHeuristic<double> > > version = m.CurrentVersion();
+                CityId size = version->graph->Size();
+                ostringstream lastStop;
+                lastStop << "Stop " << size - 1;
+                if (size % 2 != 1 || version->number < lastNumber || m.FindDistance("Stop 0", lastStop.str()) != size - 1) {
+                    failed = true;
+                }
+                lastNumber = version->number;
+            }
+        }));
+    }
+    for(int batch=0; batch<batches; batch++) {
+        m.BeginBatch();
+        for(int stop=2*batch+1; stop<=2*batch+2; stop++) {
+            ostringstream name;
+            ostringstream previous;
+            name << "Stop " << stop;
+            previous << "Stop " << stop - 1;
+            m.AddCity(name.str(), stop, 0);
+            m.AddRoad(previous.str(), name.str());
+        }
+        m.EndBatch();
+    }
+    writing = false;
+    for(vector<thread>::iterator it = readers.begin(); it != readers.end(); it++) {
+        it->join();
+    }
+    return !failed && m.CurrentVersion()->graph->Size() == 2 * batches + 1 && m.FindDistance("Stop 0", "Stop 400") == 400;
+}
+
+// compares a map with a small route cache against one without, while roads and cities come and go;
+// added cities and roads far from the queried cities must leave their cached routes fresh
+bool routeCacheTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> plain = CityMap<double>(out, err);
+    CityMap<double> cached = CityMap<double>(out, err);
+    cached.SetRouteCacheCapacity(40);
+    srand(29);
+    addRandom(plain, 60, 3);
+    srand(29);
+    addRandom(cached, 60, 3);
+    const CityGraph<double> &graph = plain.Snapshot();
+    vector<string> names;
+    for(CityId i=0; i<graph.Size(); i++) {
+        names.push_back(graph.Name(i));
+    }
+    for(int round=0; round<6; round++) {
+        for(int query=0; query<300; query++) {
+            // a few pairs are asked for far more often than the rest
+            string first = names[query % 2 == 0 ? rand() % 5 : rand() % names.size()];
+            string second = names[query % 2 == 0 ? 5 + rand() % 5 : rand() % names.size()];
+            if (plain.FindDistance(first, second) != cached.FindDistance(first, second)
+                || plain.ShortestPath(first, second) != cached.ShortestPath(first, second)) {
+                return false;
+            }
+        }
+        string a = names[rand() % names.size()];
+        string b = names[rand() % names.size()];
+        plain.AddRoad(a, b);
+        cached.AddRoad(a, b);
+        if (round % 2 == 1) {
+            plain.RemoveRoad(a, b);
+            cached.RemoveRoad(a, b);
+        }
+    }
+    cached.FindDistance(names[0], names[5]);
+    RouteCacheStats before = cached.GetRouteCacheStats();
+    cached.AddCity("Far 1", 100000, 100000);
+    cached.AddCity("Far 2", 100000, 100010);
+    cached.AddRoad("Far 1", "Far 2");
+    cached.FindDistance(names[0], names[5]);
+    RouteCacheStats after = cached.GetRouteCacheStats();
+    return before.hits > before.misses && before.invalidations > 0 && before.evictions > 0 && before.size <= 40
+        && after.invalidations == before.invalidations && after.hits == before.hits + 1;
+}
+
+// saves a map, opens it mapped in another map and compares them, before and after both are edited;
+// a file with a flipped byte and a file which is not a map file are refused
+bool mapFileTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> saved = CityMap<double>(out, err);
+    CityMap<double> opened = CityMap<double>(out, err);
+    srand(31);
+    addRandom(saved, 80, 4);
+    saved.Save("mapFileTest.map");
+    opened.OpenMapped("mapFileTest.map");
+    if (!opened.Snapshot().Mapped() || opened.Snapshot().Size() != saved.Snapshot().Size() || opened.Snapshot().RoadCount() != saved.Snapshot().RoadCount()) {
+        return false;
+    }
+    for(int round=0; round<2; round++) {
+        const CityGraph<double> &graph = saved.Snapshot();
+        for(int query=0; query<200; query++) {
+            string first = graph.Name(rand() % graph.Size());
+            string second = graph.Name(rand() % graph.Size());
+            if (saved.FindDistance(first, second) != opened.FindDistance(first, second) || saved.ShortestPath(first, second) != opened.ShortestPath(first, second)) {
+                return false;
+            }
+        }
+        saved.AddCity("Added", 3, 4);
+        opened.AddCity("Added", 3, 4);
+        saved.AddRoad("Added", graph.Name(0));
+        opened.AddRoad("Added", graph.Name(0));
+    }
+
+    ifstream source("mapFileTest.map", ios::binary);
+    string bytes((istreambuf_iterator<char>(source)), istreambuf_iterator<char>());
+    source.close();
+    // a flipped byte in a section is only found when the sections are verified, one in the header always is
+    bytes[bytes.size() / 2] ^= 1;
+    ofstream("mapFileTest.map", ios::binary) << bytes;
+    opened.OpenMapped("mapFileTest.map", true);
+    if (err.str().find("Error: is corrupt") == string::npos || opened.Snapshot().Find("Added") == NO_CITY) {
+        return false;
+    }
+    CityGraph<double> unverified;
+    if (unverified.OpenMapped("mapFileTest.map") != MapFileStatus::Ok) {
+        return false;
+    }
+    bytes[bytes.size() / 2] ^= 1;
+    bytes[offsetof(MapFileHeader, fileSize)] ^= 1;
+    ofstream("mapFileTest.map", ios::binary) << bytes;
+    if (unverified.OpenMapped("mapFileTest.map") != MapFileStatus::Corrupt) {
+        return false;
+    }
+    ofstream("mapFileTest.map") << "City,X,Y" << endl;
+    opened.OpenMapped("mapFileTest.map");
+    remove("mapFileTest.map");
+    return err.str().find("Error: has a different format") != string::npos && opened.Snapshot().Find("Added") != NO_CITY;
+}
+
+// imports cities as comma separated lines and roads as tab separated lines into a map which already has a city,
+// with a budget small enough for the roads to be sorted through temporary files, and compares it with the same map built by edits;
+// header lines are skipped, and duplicate cities, unknown cities, roads to the same city and malformed lines are reported;
+// if tempFilesFail, the limit on file sizes is lowered so only the shorter runs can be written, and the roads of the others must be kept in memory
+bool bulkImportTest(bool tempFilesFail) {
+#ifdef _WIN32
+    if (tempFilesFail) {
+        return true;
+    }
+#endif
+    stringstream out;
+    stringstream editErr;
+    stringstream err;
+    CityMap<double> edited = CityMap<double>(out, editErr);
+    CityMap<double> imported = CityMap<double>(out, err);
+    edited.AddCity("Seeded", 0, 0);
+    imported.AddCity("Seeded", 0, 0);
+    srand(37);
+    stringstream cityLines;
+    stringstream roadLines;
+    cityLines << "Name,X,Y\r\n";
+    roadLines << "From\tTo\n";
+    for(int i=0; i<300; i++) {
+        string cityName = "City " + to_string(i);
+        double x = rand() % 1000;
+        double y = rand() % 1000;
+        edited.AddCity(cityName, x, y);
+        cityLines << cityName << ", " << x << "," << y << "\r\n";
+    }
+    cityLines << "City 7,1,1\r\n" << "City 300,1\r\n" << "City 301,1,one";
+    for(int i=0; i<3000; i++) {
+        string first = i == 0 ? "Seeded" : "City " + to_string(rand() % 300);
+        string second = "City " + to_string(rand() % 300);
+        if (first != second) {
+            edited.AddRoad(first, second);
+            roadLines << first << "\t" << second << "\n";
+        }
+    }
+    roadLines << "City 1\tNowhere\n" << "City 2\tCity 2\n" << "City 3\n";
+#ifdef _WIN32
+    ImportReport report = imported.Import(cityLines, roadLines, 0);
+#else
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = tempFilesFail ? 6000 : limit.rlim_cur;
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &lowered);
+    ImportReport report = imported.Import(cityLines, roadLines, 0);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, handler);
+#endif
+
+    const CityGraph<double> &graph = edited.Snapshot();
+    if (imported.Snapshot().Size() != graph.Size() || imported.Snapshot().RoadCount() != graph.RoadCount()
+        || report.cities != 300 || report.roads * 2 != graph.RoadCount() || report.problemCount != 6 || report.overBudget != tempFilesFail) {
+        return false;
+    }
+    for(int query=0; query<200; query++) {
+        string first = graph.Name(rand() % graph.Size());
+        string second = graph.Name(rand() % graph.Size());
+        if (edited.FindDistance(first, second) != imported.FindDistance(first, second)) {
+            return false;
+        }
+    }
+    imported.RemoveRoad("Seeded", graph.Name(graph.Target(graph.FirstRoad(graph.Find("Seeded")))));
+    return report.problems[0].line == 303 && report.problems[0].reason == IS_MALFORMED && report.problems[2].subject == "City 7" && report.problems[2].line == 302
+        && report.problems[2].reason == ALREADY_EXISTS && report.problems[3].subject == "Nowhere" && report.problems[4].reason == MUST_BE_DIFFERENT
+        && imported.Snapshot().RoadCount() == graph.RoadCount() - 2 && err.str().empty();
+}
+
+// compares nearest, k nearest and radius queries with a scan of every city by the distance of the metric, before and after
+// rounds of cities added, removed and moved, which the index first keeps aside from its tree and then builds into a new one;
+// the cities lie on a grid over the given width and height, so many are as far from a point as each other, and the points
+// queried reach a tenth past it on every side
+template <typename Metric>
+bool spatialIndexTest(double left, double bottom, double width, double height, double maxRadius) {
+    stringstream out;
+    stringstream err;
+    CityMap<double, MetricHeuristic<double, Metric> > m(out, err);
+    CityMap<double, MetricHeuristic<double, Metric> > empty(out, err);
+    if (empty.NearestCity(1, 2) != "" || !empty.KNearest(1, 2, 3).empty() || !empty.CitiesWithin(1, 2, 3).empty()) {
+        return false;
+    }
+    srand(41);
+    for(int i=0; i<300; i++) {
+        m.AddCity("City " + to_string(i), left + width * (rand() % 50) / 50, bottom + height * (rand() % 50) / 50);
+    }
+    for(int round=0; round<6; round++) {
+        const CityGraph<double> &graph = m.Snapshot();
+        for(int query=0; query<100; query++) {
+            double x = left + width * (rand() % 120 - 10) / 100;
+            double y = bottom + height * (rand() % 120 - 10) / 100;
+            double radius = maxRadius * (rand() % 100) / 100;
+            size_t k = rand() % 10;
+            // cities as far as each other come in order of their names
+            vector<pair<double, string> > scanned;
+            for(CityId city = 0; city < graph.Size(); city++) {
+                scanned.push_back(make_pair(double(Metric::Length(x, y, graph.X(city), graph.Y(city))), graph.Name(city)));
+            }
+            sort(scanned.begin(), scanned.end());
+            vector<string> nearest;
+            vector<string> within;
+            for(size_t i = 0; i < scanned.size(); i++) {
+                if (i < k) {
+                    nearest.push_back(scanned[i].second);
+                }
+                if (scanned[i].first <= radius) {
+                    within.push_back(scanned[i].second);
+                }
+            }
+            if (m.NearestCity(x, y) != scanned[0].second || m.KNearest(x, y, k) != nearest || m.CitiesWithin(x, y, radius) != within) {
+                return false;
+            }
+        }
+        for(int edit=0; edit<20; edit++) {
+            string removed = graph.Name(rand() % graph.Size());
+            m.RemoveCity(removed);
+            m.AddCity("Added " + to_string(round) + " " + to_string(edit), left + width * (rand() % 50) / 50, bottom + height * (rand() % 50) / 50);
+            if (edit % 4 == 0) {
+                m.AddCity(removed, left + width * (rand() % 50) / 50, bottom + height * (rand() % 50) / 50);
+            }
+        }
+    }
+    return true;
+}
+
+bool spatialIndexTest() {
+    return spatialIndexTest<EuclideanMetric<double> >(0, 0, 1000, 1000, 200) && spatialIndexTest<ManhattanMetric<double> >(-500, 0, 1000, 1000, 300)
+        && spatialIndexTest<HaversineMetric<double> >(-150, -70, 300, 140, 3000);
+}
+
+// computes batches of every length up to a few vectors with each kernel, for double and float coordinates,
+// and checks they all give exactly the scalar distances, which are those of the straight-line heuristic
+template <typename T>
+bool distanceKernelTest(const CityGraph<T> &graph) {
+    EuclideanHeuristic<T> euclidean;
+    vector<CityId> batch;
+    vector<T> scalar(20);
+    vector<T> vectorized(20);
+    for(size_t count = 0; count < 20; count++) {
+        CityId target = rand() % graph.Size();
+        ScalarStraightDistances(graph.Xs(), graph.Ys(), batch.empty() ? 0 : &batch[0], count, graph.X(target), graph.Y(target), &scalar[0]);
+        for(size_t i = 0; i < count; i++) {
+            if (scalar[i] != euclidean.Estimate(graph, batch[i], target)) {
+                return false;
+            }
+        }
+        DistanceKernel kernels[] = { DistanceKernel::Scalar, DistanceKernel::SSE2, DistanceKernel::AVX2 };
+        for(int kernel = 0; kernel < 3; kernel++) {
+            StraightDistances(graph.Xs(), graph.Ys(), batch.empty() ? 0 : &batch[0], count, graph.X(target), graph.Y(target), &vectorized[0], kernels[kernel]);
+            if (!equal(scalar.begin(), scalar.begin() + count, vectorized.begin())) {
+                return false;
+            }
+        }
+        batch.push_back(rand() % graph.Size());
+    }
+    return true;
+}
+
+bool distanceKernelTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> doubles = CityMap<double>(out, err);
+    CityMap<float> floats = CityMap<float>(out, err);
+    srand(43);
+    for(int i=0; i<100; i++) {
+        double x = (rand() % 100000) / 7.0;
+        double y = (rand() % 100000) / 3.0;
+        doubles.AddCity("City " + to_string(i), x, y);
+        floats.AddCity("City " + to_string(i), float(x), float(y));
+    }
+    return distanceKernelTest(doubles.Snapshot()) && distanceKernelTest(floats.Snapshot());
+}
+
+// grows trees from a few cities with Dijkstra's algorithm and with delta-stepping, also on a team of threads, and checks they are the same,
+// that every parent is closer to the source by exactly the road to it, and that the distances are those of point to point queries;
+// cities share positions here, so some roads are 0 long
+template <typename T>
+bool shortestPathTreeTest(int nCities) {
+    stringstream out;
+    stringstream err;
+    CityMap<T> m = CityMap<T>(out, err);
+    srand(47);
+    addRandom(m, nCities, 4);
+    m.AddCity("Island", 5, 5);
+    const CityGraph<T> &graph = m.Snapshot();
+    for(int round=0; round<5; round++) {
+        string source = graph.Name(rand() % graph.Size());
+        PathTree<T> dijkstra = m.ShortestPathTree(source, TreeAlgorithm::Dijkstra);
+        PathTree<T> deltaStepping = m.ShortestPathTree(source, TreeAlgorithm::DeltaStepping);
+        // one bucket holding every city makes rounds big enough for a team of threads, even on a machine of one core
+        vector<T> teamDistances;
+        DeltaSteppingDistances(graph, dijkstra.source, T(graph.Size()) * 1000, teamDistances, 4);
+        if (dijkstra.distances != deltaStepping.distances || dijkstra.parents != deltaStepping.parents || dijkstra.source != graph.Find(source)
+            || teamDistances != dijkstra.distances
+            || dijkstra.distances[graph.Find("Island")] != Unreachable<T>()) {
+            return false;
+        }
+        for(CityId city = 0; city < graph.Size(); city++) {
+            CityId parent = dijkstra.parents[city];
+            if (parent != NO_CITY && dijkstra.distances[parent] + graph.Length(graph.FindRoad(parent, city)) != dijkstra.distances[city]) {
+                return false;
+            }
+            if ((parent == NO_CITY) != (city == dijkstra.source || dijkstra.distances[city] == Unreachable<T>())) {
+                return false;
+            }
+        }
+        for(int query=0; query<20; query++) {
+            CityId target = rand() % (graph.Size() - 1);
+            if (graph.Name(target) != "Island" && m.FindDistance(source, graph.Name(target)) != dijkstra.distances[target]) {
+                return false;
+            }
+        }
+    }
+    PathTree<T> missing = m.ShortestPathTree("Nowhere");
+    return missing.source == NO_CITY && missing.distances.size() == graph.Size() && err.str().find("Nowhere") != string::npos;
+}
+
+bool shortestPathTreeTest() {
+    return shortestPathTreeTest<double>(3000) && shortestPathTreeTest<int>(300);
+}
+
+// keeps a tree while roads and cities are removed and added, one at a time and in batches, and compares it with a tree grown afresh
+// after every change; a new city hung off the map only costs the repair of itself
+bool keptTreeTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    srand(53);
+    addRandom(m, 400, 4);
+    m.KeepTree("City 0");
+    for(int round=0; round<60; round++) {
+        const CityGraph<double> &graph = m.Snapshot();
+        bool batch = round % 5 == 4;
+        if (batch) {
+            m.BeginBatch();
+        }
+        for(int edit=0; edit < (batch ? 6 : 1); edit++) {
+            CityId city = rand() % graph.Size();
+            int kind = rand() % 4;
+            if (kind == 0 && graph.FirstRoad(city) != graph.LastRoad(city)) {
+                m.RemoveRoad(graph.Name(city), graph.Name(graph.Target(graph.FirstRoad(city))));
+            }
+            else if (kind == 1) {
+                m.AddRoad(graph.Name(city), graph.Name(rand() % graph.Size()));
+            }
+            else if (kind == 2 && graph.Name(city) != "City 0") {
+                string cityName = graph.Name(city);
+                m.RemoveCity(cityName);
+                m.AddCity(cityName, rand() % 400, rand() % 400);
+                m.AddRoad(cityName, graph.Name(rand() % graph.Size()));
+            }
+            else {
+                m.RemoveRoad(graph.Name(city), graph.Name(rand() % graph.Size()));
+            }
+        }
+        if (batch) {
+            m.EndBatch();
+        }
+        PathTree<double> kept = m.KeptTree("City 0");
+        PathTree<double> grown = m.ShortestPathTree("City 0", TreeAlgorithm::Dijkstra);
+        if (kept.distances != grown.distances || kept.graph != grown.graph) {
+            return false;
+        }
+        for(CityId city = 0; city < kept.graph->Size(); city++) {
+            CityId parent = kept.parents[city];
+            if (parent != NO_CITY && kept.distances[parent] + kept.graph->Length(kept.graph->FindRoad(parent, city)) != kept.distances[city]) {
+                return false;
+            }
+        }
+    }
+    m.AddCity("Hanging", 1, 1);
+    m.AddRoad("Hanging", "City 1");
+    return m.KeptTreeRepairs("City 0") == 1 && m.KeptTree("City 0").distances[m.Snapshot().Find("Hanging")] != Unreachable<double>();
+}
+
+// keeps a tree over roads of lengths of their own while batches remove roads and add them again, longer or shorter than before,
+// and compares it with a tree grown afresh; a road which comes back longer within one batch must not keep its old length in the tree
+bool keptTreeLengthTest() {
+    typedef CityMap<double, MetricHeuristic<double, ExplicitLengths<double> > > TimedMap;
+    stringstream out;
+    stringstream err;
+    TimedMap m(out, err);
+    m.AddCity("A", 0, 0);
+    m.AddCity("B", 1, 0);
+    m.AddCity("C", 2, 0);
+    m.AddRoad("A", "B", 1);
+    m.AddRoad("B", "C", 1);
+    m.AddRoad("A", "C", 10);
+    m.KeepTree("A");
+    m.BeginBatch();
+    m.RemoveRoad("A", "B");
+    m.AddRoad("A", "B", 5);
+    m.EndBatch();
+    PathTree<double> small = m.KeptTree("A");
+    if (small.distances[small.graph->Find("B")] != 5 || small.distances[small.graph->Find("C")] != 6) {
+        return false;
+    }
+
+    srand(54);
+    for(int city=0; city<300; city++) {
+        m.AddCity("City " + to_string(city), rand() % 300, rand() % 300);
+    }
+    for(int city=1; city<300; city++) {
+        m.AddRoad("City " + to_string(city), "City " + to_string(rand() % city), 1 + rand() % 20);
+        m.AddRoad("City " + to_string(city), "City " + to_string(rand() % 300), 1 + rand() % 20);
+    }
+    m.KeepTree("City 0");
+    for(int round=0; round<40; round++) {
+        const CityGraph<double> &graph = m.Snapshot();
+        m.BeginBatch();
+        for(int edit=0; edit<4; edit++) {
+            CityId city = rand() % graph.Size();
+            if (graph.FirstRoad(city) == graph.LastRoad(city)) {
+                continue;
+            }
+            string first = graph.Name(city);
+            string second = graph.Name(graph.Target(graph.FirstRoad(city) + rand() % (graph.LastRoad(city) - graph.FirstRoad(city))));
+            m.RemoveRoad(first, second);
+            m.AddRoad(first, second, 1 + rand() % 40);
+        }
+        m.EndBatch();
+        PathTree<double> kept = m.KeptTree("City 0");
+        PathTree<double> grown = m.ShortestPathTree("City 0", TreeAlgorithm::Dijkstra);
+        if (kept.distances != grown.distances) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool statsTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    srand(59);
+    addRandom(m, 300, 3);
+    CityMapStats before = m.Stats();
+    SearchMode modes[] = { SearchMode::AStar, SearchMode::Bidirectional, SearchMode::ContractionHierarchy, SearchMode::PartitionOverlay,
+                           SearchMode::Compressed };
+    for(int mode=0; mode<5; mode++) {
+        m.SetSearchMode(modes[mode]);
+        vector<string> path = m.ShortestPath("City 0", "City 299");
+        CityMapStats stats = m.Stats();
+        const QueryStats &query = stats.lastQuery;
+        if (!stats.enabled || stats.queries != before.queries + 2 * mode + 1 || query.pathCities != path.size()
+            || query.distance != m.FindDistance("City 0", "City 299") || query.counters.settled == 0
+            || query.counters.popped < query.counters.settled || query.counters.pushed < query.counters.popped
+            || query.counters.relaxed == 0 || query.counters.scanned != 0 || query.seconds < 0) {
+            return false;
+        }
+    }
+    // hub labels search nothing, they only read labels
+    m.SetSearchMode(SearchMode::HubLabels);
+    double distance = m.FindDistance("City 0", "City 299");
+    QueryStats labelQuery = m.Stats().lastQuery;
+    if (labelQuery.distance != distance || labelQuery.counters.scanned < 2 || labelQuery.counters.popped != 0) {
+        return false;
+    }
+    RouteLimits limits;
+    limits.epsilon = 0.5;
+    BoundedRoute<double> bounded = m.BoundedPath("City 0", "City 299", limits);
+    QueryStats boundedQuery = m.Stats().lastQuery;
+    if (boundedQuery.distance != bounded.distance || boundedQuery.pathCities != bounded.path.size()
+        || boundedQuery.counters.settled != bounded.settled || boundedQuery.counters.relaxed == 0) {
+        return false;
+    }
+    CityMapStats after = m.Stats();
+    size_t histogram = 0;
+    for(size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        histogram += after.latencies[bucket] - before.latencies[bucket];
+    }
+    return after.queries == before.queries + 12 && histogram == 12 && after.totals.settled > before.totals.settled
+        && after.totals.relaxed > before.totals.relaxed && after.totals.scanned > before.totals.scanned;
+}
+
+bool cityHandleTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    srand(61);
+    addRandom(m, 300, 3);
+    SearchMode modes[] = { SearchMode::AStar, SearchMode::Bidirectional, SearchMode::ContractionHierarchy };
+    vector<CityId> path;
+    for(int mode=0; mode<3; mode++) {
+        m.SetSearchMode(modes[mode]);
+        shared_ptr<const CityMap<double>::Version> version = m.CurrentVersion();
+        const CityGraph<double> &graph = *version->graph;
+        for(int query=0; query<20; query++) {
+            string firstName = "City " + to_string(rand() % 300);
+            string secondName = "City " + to_string(rand() % 300);
+            CityId first = graph.Find(string_view(firstName));
+            CityId second = graph.Find(string_view(secondName));
+            double distance = m.ShortestPath(*version, first, second, path);
+            vector<string> names = m.ShortestPath(string_view(firstName), secondName);
+            if (distance != m.FindDistance(firstName, secondName) || distance != m.FindDistance(*version, first, second)
+                || path.size() != names.size()) {
+                return false;
+            }
+            for(size_t i = 0; i < path.size(); i++) {
+                if (graph.NameView(path[i]) != names[i]) {
+                    return false;
+                }
+            }
+        }
+    }
+    shared_ptr<const CityMap<double>::Version> version = m.CurrentVersion();
+    err.str("");
+    return m.ShortestPath(*version, 0, version->graph->Size(), path) == 0 && path.empty()
+        && err.str() == "Error: " + DOESNT_EXIST + "\n" + CITY + ": " + to_string(version->graph->Size()) + "\n";
+}
+
+// builds the same random map with roads stored as double and with roads stored in the compact type of Heuristic, and compares
+// the compact distances of every search mode with Dijkstra's algorithm over the compact snapshot and with the exact distances:
+// compact roads are rounded up, so they are no shorter, and the rounding of each road stays within the step of the type
+template <typename Heuristic>
+bool compactWeightTest(double step) {
+    stringstream out;
+    stringstream err;
+    CityMap<double> exact = CityMap<double>(out, err);
+    CityMap<double, Heuristic> compact = CityMap<double, Heuristic>(out, err);
+    srand(67);
+    addRandom(exact, 200, 4);
+    srand(67);
+    addRandom(compact, 200, 4);
+    if (sizeof(typename Heuristic::Graph::LengthType) != 4) {
+        return false;
+    }
+    SearchMode modes[] = { SearchMode::AStar, SearchMode::Bidirectional, SearchMode::ContractionHierarchy };
+    vector<double> distances;
+    for(int mode=0; mode<3; mode++) {
+        compact.SetSearchMode(modes[mode]);
+        for(int query=0; query<30; query++) {
+            CityId first = rand() % 200;
+            CityId second = rand() % 200;
+            DijkstraDistances(compact.Snapshot(), first, distances);
+            string firstName = compact.Snapshot().Name(first);
+            string secondName = compact.Snapshot().Name(second);
+            double distance = compact.FindDistance(firstName, secondName);
+            double exactDistance = exact.FindDistance(firstName, secondName);
+            size_t roads = compact.ShortestPath(firstName, secondName).size();
+            if (fabs(distance - distances[second]) > 1e-9 * distance || distance < exactDistance || distance > exactDistance + step * roads) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// road lengths under each metric, roads of explicit lengths, and a map file saved with double roads refused by a map of float roads
+bool metricPolicyTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double, MetricHeuristic<double, ManhattanMetric<double> > > manhattan(out, err);
+    manhattan.AddCity("A", 0, 0);
+    manhattan.AddCity("B", 3, 4);
+    manhattan.AddRoad("A", "B");
+    CityMap<double, MetricHeuristic<double, HaversineMetric<double> > > haversine(out, err);
+    haversine.AddCity("Equator", 0, 0);
+    haversine.AddCity("North", 0, 1);
+    haversine.AddRoad("Equator", "North");
+    CityMap<double, MetricHeuristic<double, ExplicitLengths<double> > > timed(out, err);
+    timed.AddCity("A", 0, 0);
+    timed.AddCity("B", 100, 0);
+    timed.AddCity("C", 1, 0);
+    timed.AddRoad("A", "B", 10);
+    timed.AddRoad("B", "C", 1);
+    timed.AddRoad("A", "C", 50);
+    timed.AddRoad("A", "D", -1);
+    vector<string> timedPath = timed.ShortestPath("A", "C");
+    if (manhattan.FindDistance("A", "B") != 7 || fabs(haversine.FindDistance("Equator", "North") - 111.195) > 0.001
+        || timed.FindDistance("A", "C") != 11 || timedPath.size() != 3 || timedPath[1] != "B"
+        || err.str().find("Error: " + CANT_BE_NEGATIVE) == string::npos) {
+        return false;
+    }
+
+    CityMap<double> saved = CityMap<double>(out, err);
+    CityMap<double, EuclideanHeuristic<double, float> > opened(out, err);
+    saved.AddCity("A", 0, 0);
+    saved.Save("metricPolicyTest.map");
+    err.str("");
+    opened.OpenMapped("metricPolicyTest.map");
+    remove("metricPolicyTest.map");
+    return err.str().find("Error: " + WRONG_FORMAT) != string::npos
+        && compactWeightTest<EuclideanHeuristic<double, float> >(1e-4)
+        && compactWeightTest<LandmarkHeuristic<double, 8, EuclideanMetric<double>, FixedPoint<1000> > >(1e-3);
+}
+
+// answers random queries through a query service with a small queue, from two submitting threads, singly and in batches,
+// and compares the futures with the blocking answers; the service stopping must answer what was still queued first
+bool serviceTest() {
+    stringstream out;
+    stringstream err;
+    CityMap<double> m = CityMap<double>(out, err);
+    srand(67);
+    addRandom(m, 300, 3);
+    vector<pair<string, string> > pairs;
+    for(int query=0; query<400; query++) {
+        pairs.push_back(make_pair("City " + to_string(rand() % 300), "City " + to_string(rand() % 300)));
+    }
+    vector<future<double> > singles;
+    vector<future<double> > batch;
+    vector<future<vector<string> > > paths;
+    future<double> tried;
+    bool submitted = false;
+    {
+        QueryService<double> service(m, 3, 16);
+        thread submitter([&]() {
+            batch = service.FindDistances(pairs);
+        });
+        for(size_t query=0; query<100; query++) {
+            singles.push_back(service.FindDistance(pairs[query].first, pairs[query].second));
+            paths.push_back(service.ShortestPath(pairs[query].first, pairs[query].second));
+        }
+        submitter.join();
+        while (!submitted) {
+            submitted = service.TryFindDistance("City 0", "City 1", tried);
+        }
+    }
+    for(size_t query=0; query<pairs.size(); query++) {
+        double distance = m.FindDistance(pairs[query].first, pairs[query].second);
+        if (batch[query].get() != distance) {
+            return false;
+        }
+        if (query < singles.size() && (singles[query].get() != distance || paths[query].get() != m.ShortestPath(pairs[query].first, pairs[query].second))) {
+            return false;
+        }
+    }
+    return tried.get() == m.FindDistance("City 0", "City 1");
+}
+
 bool performanceTest() {
     CityMap<double> m = genRandom(10,3);
     cout << m.FindDistance("City 0", "City 9") << endl;
@@ -314,7 +1754,32 @@ int main()
         && straightLineWithDeadendBranch()
         && straightLineWithDeadendBranch2()
         && square()
+        && snapshotTest()
+        && cityLayoutTest()
+        && patchedSnapshotTest()
         && acceptanceTest()
+        && exhaustiveDistanceTest()
+        && contractionHierarchyTest()
+        && partitionOverlayTest()
+        && hubLabelTest()
+        && compressedRoadsTest()
+        && landmarkHeuristicTest()
+        && bidirectionalSearchTest()
+        && boundedSearchTest()
+        && distanceMatrixTest()
+        && concurrentVersionsTest()
+        && routeCacheTest()
+        && mapFileTest()
+        && journalTest() && journalWriteFailureTest()
+        && bulkImportTest(false) && bulkImportTest(true)
+        && spatialIndexTest()
+        && distanceKernelTest()
+        && shortestPathTreeTest()
+        && keptTreeTest() && keptTreeLengthTest()
+        && statsTest()
+        && cityHandleTest()
+        && metricPolicyTest()
+        && serviceTest()
         && performanceTest()){
         cout << "PASS" << endl;
     }